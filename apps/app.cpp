@@ -165,7 +165,7 @@ int main(int argc, char* argv []) {
     std::cout << prop_model << std::endl;
     {
         auto ref_records{ rx0.get_reflection_records().at(tx0.get_id()) };
-        prop_model.calc_all_propagation_properties(ref_records);
+        prop_model.calc_all_propagation_properties(ref_records, sig_tracer.get_palette());
 
         std::cout << "Total receiving power: " << prop_model.calc_total_receiving_power(ref_records) << " dB" << std::endl;
 
@@ -0,0 +1,779 @@
+// Acceleration structure benchmarks on a synthetic city.
+// The scene is generated procedurally, so no OpenGL context or asset is needed.
+//
+// usage: benchmark.exe [num_buildings] [num_rays] [name or group ...]
+//        benchmark.exe --list
+// Without names every benchmark runs. A group (bvh, tracing, scene, coverage) runs all of its benchmarks.
+
+#include "bvh_map.hpp"
+#include "coverage_tracer.hpp"
+#include "coverage_layers.hpp"
+#include "coverage_map.hpp"
+#include "coverage_volume.hpp"
+#include "sparse_coverage_map.hpp"
+#include "tiled_coverage_map.hpp"
+#include "footprint_grid.hpp"
+#include "heightfield.hpp"
+#include "quad.hpp"
+#include "triangle.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "ray_sorter.hpp"
+#include "interval.hpp"
+#include "intersect_record.hpp"
+#include "transmitter.hpp"
+#include "utils.hpp"
+#include "constant.hpp"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "omp.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace SignalTracer;
+
+/// @brief Append the 12 triangles of an axis aligned box.
+void add_box(std::vector<std::shared_ptr<Triangle>>& triangles, const glm::vec3& bmin, const glm::vec3& bmax) {
+    glm::vec3 p[8];
+    for (int i = 0; i < 8; ++i) {
+        p[i] = glm::vec3{ i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y, i & 4 ? bmax.z : bmin.z };
+    }
+    const int faces[6][4] = { {0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5} };
+    for (const auto& f : faces) {
+        triangles.emplace_back(std::make_shared<Triangle>(p[f[0]], p[f[1]], p[f[2]]));
+        triangles.emplace_back(std::make_shared<Triangle>(p[f[0]], p[f[2]], p[f[3]]));
+    }
+}
+
+/// @brief Square city blocks of random height on a tessellated ground plane.
+std::vector<std::shared_ptr<Triangle>> make_city(int num_buildings, unsigned seed = 7) {
+    std::mt19937 rng{ seed };
+    std::uniform_real_distribution<float> height{ 5.0f, 60.0f };
+    std::uniform_real_distribution<float> size{ 8.0f, 18.0f };
+
+    std::vector<std::shared_ptr<Triangle>> triangles{};
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(num_buildings))));
+    const float spacing = 25.0f;
+    float extent = side * spacing;
+    for (int b = 0; b < num_buildings; ++b) {
+        float x = (b % side) * spacing - extent * 0.5f;
+        float z = (b / side) * spacing - extent * 0.5f;
+        float w = size(rng);
+        float d = size(rng);
+        add_box(triangles, glm::vec3{ x, 0.0f, z }, glm::vec3{ x + w, height(rng), z + d });
+    }
+
+    // ground, one quad per city block
+    for (int i = 0; i < side; ++i) {
+        for (int j = 0; j < side; ++j) {
+            glm::vec3 a{ i * spacing - extent * 0.5f, 0.0f, j * spacing - extent * 0.5f };
+            glm::vec3 b{ a.x + spacing, 0.0f, a.z };
+            glm::vec3 c{ a.x + spacing, 0.0f, a.z + spacing };
+            glm::vec3 d{ a.x, 0.0f, a.z + spacing };
+            triangles.emplace_back(std::make_shared<Triangle>(a, c, b));
+            triangles.emplace_back(std::make_shared<Triangle>(a, d, c));
+        }
+    }
+    return triangles;
+}
+
+/// @brief Rays shot from a transmitter above the city in Fibonacci lattice directions.
+/// @param coherent sort the directions so that neighbouring rays point the same way
+std::vector<Ray> make_rays(int num_rays, const glm::vec3& tx_pos, bool coherent = false) {
+    std::vector<glm::vec3> directions{ Utils::get_fibonacci_lattice(num_rays) };
+    if (coherent) {
+        Utils::sort_directions_coherent(directions);
+    }
+    std::vector<Ray> rays{};
+    rays.reserve(num_rays);
+    for (const auto& dir : directions) {
+        rays.emplace_back(tx_pos, dir);
+    }
+    return rays;
+}
+
+/// @brief Closest hit for every ray, return million rays per second.
+double trace(const Hittable& accel, const std::vector<Ray>& rays, int& hit_count) {
+    Utils::Timer timer{};
+    int hits{ 0 };
+#pragma omp parallel for reduction(+:hits) schedule(dynamic, 1024)
+    for (int i = 0; i < static_cast<int>(rays.size()); ++i) {
+        IntersectRecord record{};
+        if (accel.is_hit(rays[i], Interval{ Constant::EPSILON, Constant::INF_POS }, record)) {
+            ++hits;
+        }
+    }
+    hit_count = hits;
+    return rays.size() / timer.elapsed() * 1e-6;
+}
+
+/// @brief Any-hit query for every ray, return million rays per second.
+double occlusion(const Hittable& accel, const std::vector<Ray>& rays, const Interval& interval, int& hit_count) {
+    Utils::Timer timer{};
+    int hits{ 0 };
+#pragma omp parallel for reduction(+:hits) schedule(dynamic, 1024)
+    for (int i = 0; i < static_cast<int>(rays.size()); ++i) {
+        if (accel.is_occluded(rays[i], interval)) {
+            ++hits;
+        }
+    }
+    hit_count = hits;
+    return rays.size() / timer.elapsed() * 1e-6;
+}
+
+/// @brief Closest hit in packets of consecutive rays, return million rays per second.
+template <typename Accel>
+double trace_packets(const Accel& accel, const std::vector<Ray>& rays, int& hit_count) {
+    Utils::Timer timer{};
+    int hits{ 0 };
+    const int num_rays = static_cast<int>(rays.size());
+#pragma omp parallel for reduction(+:hits) schedule(dynamic, 64)
+    for (int first = 0; first < num_rays; first += RayPacket::MAX_SIZE) {
+        IntersectRecord records[RayPacket::MAX_SIZE]{};
+        RayPacket packet{ &rays[first], std::min(RayPacket::MAX_SIZE, num_rays - first) };
+        hits += std::popcount(accel.is_hit(packet, Interval{ Constant::EPSILON, Constant::INF_POS }, records));
+    }
+    hit_count = hits;
+    return rays.size() / timer.elapsed() * 1e-6;
+}
+
+void bench_packets(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_rays, const glm::vec3& tx_pos) {
+    std::cout << "---- single rays vs packets of " << RayPacket::MAX_SIZE << " ----" << std::endl;
+    auto bvh = std::make_shared<BVHAccel>(triangles, 0, triangles.size());
+    std::vector<BVHInstance> instances{ BVHInstance{ bvh } };
+    TLAS tlas{ instances, 1 };
+    tlas.build();
+
+    for (bool coherent : { false, true }) {
+        std::vector<Ray> rays{ make_rays(num_rays, tx_pos, coherent) };
+        std::string order{ coherent ? "sorted" : "lattice" };
+        int hits{ 0 };
+        double mrays = trace(tlas, rays, hits);
+        std::cout << "single, " << order << " order: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+        mrays = trace_packets(tlas, rays, hits);
+        std::cout << "packet, " << order << " order: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+    }
+}
+
+/// @brief Specular bounces of all rays, one bounce at a time, with or without sorting the rays in between.
+void bench_bounce_sorting(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_rays, const glm::vec3& tx_pos, int max_bounces) {
+    std::cout << "---- " << max_bounces << " bounces, unsorted vs sorted rays ----" << std::endl;
+    auto bvh = std::make_shared<BVHAccel>(triangles, 0, triangles.size());
+    std::vector<BVHInstance> instances{ BVHInstance{ bvh } };
+    TLAS tlas{ instances, 1 };
+    tlas.build();
+
+    for (bool sort_rays : { false, true }) {
+        std::vector<Ray> rays{ make_rays(num_rays, tx_pos, true) };
+        std::vector<int> active(num_rays);
+        std::iota(active.begin(), active.end(), 0);
+        std::vector<uint8_t> alive(num_rays, 0);
+        RaySorter sorter{ tlas.bounding_box() };
+
+        double sort_time{ 0.0 }, trace_time{ 0.0 };
+        std::size_t hits{ 0 };
+        for (int depth = 0; depth < max_bounces && !active.empty(); ++depth) {
+            Utils::Timer timer{};
+            if (sort_rays && depth > 0) {
+                sorter.sort(rays, active);
+                sort_time += timer.elapsed();
+                timer.reset();
+            }
+            const int num_active = static_cast<int>(active.size());
+#pragma omp parallel for schedule(dynamic, 256)
+            for (int k = 0; k < num_active; ++k) {
+                int i = active[k];
+                IntersectRecord record{};
+                alive[i] = tlas.is_hit(rays[i], Interval{ Constant::EPSILON, Constant::INF_POS }, record);
+                if (alive[i]) {
+                    rays[i] = Ray{ record.point, glm::reflect(rays[i].get_direction(), record.normal) };
+                }
+            }
+            std::erase_if(active, [&alive](int i) { return alive[i] == 0; });
+            hits += active.size();
+            trace_time += timer.elapsed();
+        }
+        std::cout << (sort_rays ? "sorted:   " : "unsorted: ") << "trace: " << trace_time << " s, sort: " << sort_time
+            << " s, hits: " << hits << std::endl;
+    }
+}
+
+/// @brief TLAS build time and trace speed for a city of instanced buildings, one instance per building.
+void bench_tlas(int num_instances, int num_rays) {
+    std::vector<std::shared_ptr<Triangle>> building{};
+    add_box(building, glm::vec3{ 0.0f }, glm::vec3{ 12.0f, 30.0f, 12.0f });
+    auto bvh = std::make_shared<BVHAccel>(building, 0, building.size());
+
+    std::mt19937 rng{ 7 };
+    std::uniform_real_distribution<float> height{ 0.2f, 2.0f };
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(num_instances))));
+    const float spacing = 25.0f;
+    std::vector<BVHInstance> instances{};
+    instances.reserve(num_instances);
+    for (int i = 0; i < num_instances; ++i) {
+        glm::vec3 offset{ (i % side - side * 0.5f) * spacing, 0.0f, (i / side - side * 0.5f) * spacing };
+        instances.emplace_back(bvh, glm::scale(glm::translate(glm::mat4{ 1.0f }, offset), glm::vec3{ 1.0f, height(rng), 1.0f }));
+    }
+
+    TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+    std::vector<Ray> rays{ make_rays(num_rays, glm::vec3{ 0.0f, 70.0f, 0.0f }) };
+    int hits{ 0 };
+    double mrays = trace(tlas, rays, hits);
+    std::cout << std::left << std::setw(8) << num_instances << " instances, TLAS build: " << tlas.get_build_time() << " s"
+        << ", nodes: " << tlas.get_node_count() << "\ttrace: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+
+    // one shared BLAS against a copy of its triangles and nodes per instance
+    double shared_mib = (bvh->memory_usage() + instances.size() * sizeof(BVHInstance) + tlas.memory_usage()) / 1024.0 / 1024.0;
+    double flattened_mib = (static_cast<double>(bvh->memory_usage()) * num_instances + tlas.memory_usage()) / 1024.0 / 1024.0;
+    std::cout << "         memory: " << shared_mib << " MiB instanced, " << flattened_mib << " MiB flattened" << std::endl;
+}
+
+void bench_lazy(int num_buildings, int num_rays) {
+    std::cout << "---- eager vs lazy BLAS builds (" << num_buildings << " buildings) ----" << std::endl;
+    std::vector<std::shared_ptr<Triangle>> triangles{ make_city(num_buildings) };
+
+    // a street-level transmitter, most rays end in the neighbourhood
+    std::vector<Ray> rays{ make_rays(num_rays, glm::vec3{ -3.0f, 2.0f, -3.0f }) };
+    const std::size_t blas_triangles = 16 * 12; // 16 buildings per BLAS, the ground quads last
+    for (bool lazy : { false, true }) {
+        BVHBuildOptions options{};
+        options.builder = BVHBuilder::SpatialSplit;
+        options.lazy = lazy;
+        Utils::Timer timer{};
+        std::vector<std::shared_ptr<BVHAccel>> blases{};
+        std::vector<BVHInstance> instances{};
+        for (std::size_t first = 0; first < triangles.size(); first += blas_triangles) {
+            blases.emplace_back(std::make_shared<BVHAccel>(triangles, first, first + blas_triangles, static_cast<uint32_t>(blases.size()), options));
+            instances.emplace_back(blases.back());
+        }
+        TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+        tlas.build();
+        double startup = timer.elapsed();
+
+        int hits{ 0 };
+        double mrays = trace(tlas, rays, hits);
+        std::size_t built = std::count_if(blases.begin(), blases.end(), [](const auto& blas) { return blas->is_built(); });
+        std::cout << (lazy ? "lazy:  " : "eager: ") << "startup " << startup << " s, first trace: " << mrays << " Mrays/s"
+            << ", built " << built << " / " << blases.size() << " BLASes, hits: " << hits << std::endl;
+    }
+}
+
+void bench_compressed(const std::vector<std::shared_ptr<Triangle>>& triangles, const std::vector<Ray>& rays) {
+    std::cout << "---- float vs compressed BLAS (" << triangles.size() << " triangles) ----" << std::endl;
+    for (bool compressed : { false, true }) {
+        BVHBuildOptions options{};
+        options.compressed = compressed;
+        BVHAccel bvh{ triangles, 0, triangles.size(), 0, options };
+        int hits{ 0 };
+        double mrays = trace(bvh, rays, hits);
+        double bytes_per_triangle = static_cast<double>(bvh.memory_usage()) / triangles.size();
+        std::cout << (compressed ? "compressed: " : "float:      ") << bvh.memory_usage() / 1024.0 / 1024.0 << " MiB, "
+            << bytes_per_triangle << " bytes/triangle, trace: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+    }
+}
+
+void bench_layouts(int num_buildings, int num_rays) {
+    std::vector<std::shared_ptr<Triangle>> triangles{ make_city(num_buildings) };
+    std::cout << "---- wide node layouts (" << triangles.size() << " triangles) ----" << std::endl;
+    std::vector<Ray> rays{ make_rays(num_rays, glm::vec3{ 0.0f, 30.0f, 0.0f }) };
+    struct Config {
+        std::string name;
+        NodeLayout layout;
+        bool huge_pages;
+    };
+    const Config configs[] = {
+        { "depth-first", NodeLayout::DepthFirst, false },
+        { "siblings adjacent", NodeLayout::Siblings, false },
+        { "treelets", NodeLayout::Treelet, false },
+        { "siblings + huge pages", NodeLayout::Siblings, true },
+    };
+    for (const auto& [name, layout, huge_pages] : configs) {
+        Memory::set_huge_pages(huge_pages);
+        BVHBuildOptions options{};
+        options.layout = layout;
+        BVHAccel bvh{ triangles, 0, triangles.size(), 0, options };
+        int hits{ 0 };
+        double mrays = trace(bvh, rays, hits);
+        std::cout << std::left << std::setw(24) << name << "trace: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+    }
+    Memory::set_huge_pages(false);
+}
+
+void bench_paged(const std::vector<std::shared_ptr<Triangle>>& triangles, const std::vector<Ray>& rays) {
+    std::cout << "---- in-memory vs paged BLAS (" << triangles.size() << " triangles) ----" << std::endl;
+    BVHAccel bvh{ triangles, 0, triangles.size() };
+    std::size_t tree_bytes = bvh.get_wide().memory_usage() + bvh.get_blocks().memory_usage();
+    int hits{ 0 };
+    double mrays = trace(bvh, rays, hits);
+    std::cout << "in memory:   " << tree_bytes / 1024.0 / 1024.0 << " MiB, trace: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "signal_tracer_benchmark.bvh").string();
+    for (double fraction : { 1.0, 0.25, 0.05 }) {
+        BVHAccel paged{ triangles, 0, triangles.size() };
+        if (!paged.page_out(path, static_cast<std::size_t>(tree_bytes * fraction))) { return; }
+        mrays = trace(paged, rays, hits);
+        std::cout << "budget " << std::setw(4) << fraction * 100.0 << " %: trace: " << mrays << " Mrays/s, hits: " << hits
+            << "\n\t" << paged.get_paged()->get_stats();
+    }
+    std::filesystem::remove(path);
+}
+
+void bench_occlusion(const std::vector<std::shared_ptr<Triangle>>& triangles, const std::vector<Ray>& rays) {
+    std::cout << "---- closest hit vs any hit ----" << std::endl;
+    BVHAccel bvh{ triangles, 0, triangles.size() };
+    int hits{ 0 };
+    double mrays = trace(bvh, rays, hits);
+    std::cout << "is_hit:      " << mrays << " Mrays/s, hits: " << hits << std::endl;
+    mrays = occlusion(bvh, rays, Interval{ Constant::EPSILON, Constant::INF_POS }, hits);
+    std::cout << "is_occluded: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+}
+
+void bench_builders(const std::vector<std::shared_ptr<Triangle>>& triangles, const std::vector<Ray>& rays) {
+    std::cout << "---- BLAS builders (" << triangles.size() << " triangles) ----" << std::endl;
+    struct Config {
+        std::string name;
+        BVHBuilder builder;
+        uint treelet_passes;
+    };
+    const Config configs[] = {
+        { "sequential binned SAH", BVHBuilder::Sequential, 0 },
+        { "parallel binned SAH", BVHBuilder::ParallelBinned, 0 },
+        { "SBVH (spatial splits)", BVHBuilder::SpatialSplit, 0 },
+        { "LBVH", BVHBuilder::Linear, 0 },
+        { "LBVH + 2 treelet passes", BVHBuilder::Linear, 2 },
+    };
+    for (const auto& [name, builder, treelet_passes] : configs) {
+        BVHBuildOptions options{};
+        options.builder = builder;
+        options.treelet_passes = treelet_passes;
+        BVHAccel bvh{ triangles, 0, triangles.size(), 0, options };
+        int hits{ 0 };
+        double mrays = trace(bvh, rays, hits);
+        std::cout << std::left << std::setw(24) << name << bvh.get_build_stats()
+            << "\ttrace: " << mrays << " Mrays/s, hits: " << hits << std::endl;
+    }
+
+    // build time of the parallel builders against the team size, best of 3
+    const int max_threads{ omp_get_max_threads() };
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        omp_set_num_threads(num_threads);
+        std::ostringstream line{};
+        line << std::left << std::setw(4) << num_threads << "threads";
+        for (BVHBuilder builder : { BVHBuilder::ParallelBinned, BVHBuilder::Linear }) {
+            BVHBuildOptions options{};
+            options.builder = builder;
+            double best{ Constant::INF_POS };
+            for (int run = 0; run < 3; ++run) {
+                BVHAccel bvh{ triangles, 0, triangles.size(), 0, options };
+                best = std::min(best, bvh.get_build_stats().build_time);
+            }
+            line << (builder == BVHBuilder::ParallelBinned ? ", parallel binned SAH: " : ", LBVH: ") << best * 1e3 << " ms";
+        }
+        std::cout << line.str() << std::endl;
+        if (num_threads < max_threads && 2 * num_threads > max_threads) { num_threads = max_threads / 2; }
+    }
+    omp_set_num_threads(max_threads);
+}
+
+void bench_footprint(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_rays) {
+    std::cout << "---- TLAS vs footprint grid (" << triangles.size() << " triangles) ----" << std::endl;
+    std::vector<BVHInstance> instances{ BVHInstance{ std::make_shared<BVHAccel>(triangles, 0, triangles.size()) } };
+    TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+    FootprintGrid grid{};
+    if (!grid.build(instances)) { return; }
+    std::cout << "2.5D: " << (FootprintGrid::is_2_5d(instances) ? "yes" : "no") << ", " << grid.get_stats();
+    std::cout << "memory: BVH " << (instances[0].get_bvh()->memory_usage() + tlas.memory_usage()) / 1024.0 / 1024.0
+        << " MiB, grid " << grid.memory_usage() / 1024.0 / 1024.0 << " MiB" << std::endl;
+
+    // above the roofs most rays leave the city or reach the ground, in the street they end on walls nearby
+    const std::pair<const char*, glm::vec3> transmitters[] = {
+        { "rooftop", glm::vec3{ 0.0f, 70.0f, 0.0f } },
+        { "street", glm::vec3{ -3.0f, 2.0f, -3.0f } },
+    };
+    for (const auto& [name, tx_pos] : transmitters) {
+        std::vector<Ray> rays{ make_rays(num_rays, tx_pos) };
+        int tlas_hits{ 0 };
+        int grid_hits{ 0 };
+        double tlas_mrays = trace(tlas, rays, tlas_hits);
+        double grid_mrays = trace(grid, rays, grid_hits);
+        std::cout << std::left << std::setw(8) << name << "TLAS: " << tlas_mrays << " Mrays/s, grid: " << grid_mrays
+            << " Mrays/s, hits: " << tlas_hits << " / " << grid_hits << std::endl;
+        tlas_mrays = occlusion(tlas, rays, Interval{ Constant::EPSILON, 100.0f }, tlas_hits);
+        grid_mrays = occlusion(grid, rays, Interval{ Constant::EPSILON, 100.0f }, grid_hits);
+        std::cout << std::left << std::setw(8) << "" << "any hit within 100, TLAS: " << tlas_mrays << " Mrays/s, grid: " << grid_mrays
+            << " Mrays/s, hits: " << tlas_hits << " / " << grid_hits << std::endl;
+    }
+}
+
+void bench_terrain(uint32_t samples, int num_rays) {
+    // rolling hills of a few octaves on a 10 m raster
+    HeightfieldDesc desc{};
+    desc.width = samples;
+    desc.depth = samples;
+    desc.spacing = glm::vec2{ 10.0f };
+    desc.origin = glm::vec3{ -0.5f * samples * desc.spacing.x, 0.0f, -0.5f * samples * desc.spacing.y };
+    std::vector<float> heights(static_cast<std::size_t>(samples) * samples);
+    for (uint32_t z = 0; z < samples; ++z) {
+        for (uint32_t x = 0; x < samples; ++x) {
+            float h = 0.0f;
+            for (int octave = 0; octave < 4; ++octave) {
+                float f = 0.01f * static_cast<float>(1 << octave);
+                h += 40.0f / (1 << octave) * std::sin(f * x + octave) * std::cos(f * 1.3f * z - octave);
+            }
+            heights[static_cast<std::size_t>(z) * samples + x] = h;
+        }
+    }
+    auto heightfield = std::make_shared<Heightfield>(desc, std::move(heights));
+    std::cout << "---- triangle BVH vs heightfield terrain (" << samples << " x " << samples << " samples, "
+        << heightfield->get_triangle_count() << " triangles) ----" << std::endl;
+
+    std::vector<std::shared_ptr<Triangle>> triangles{};
+    triangles.reserve(heightfield->get_triangle_count());
+    for (uint32_t prim = 0; prim < heightfield->get_triangle_count(); ++prim) {
+        glm::vec3 a{}, b{}, c{};
+        heightfield->get_triangle(prim, a, b, c);
+        triangles.emplace_back(std::make_shared<Triangle>(a, b, c));
+    }
+    Utils::Timer timer{};
+    BVHAccel mesh_bvh{ triangles, 0, triangles.size() };
+    double mesh_build = timer.elapsed();
+    BVHAccel terrain_bvh{ heightfield };
+
+    // a mast above the terrain, most rays reach the ground, the rest leave the scene
+    std::vector<Ray> rays{ make_rays(num_rays, glm::vec3{ 0.0f, 80.0f, 0.0f }) };
+    int mesh_hits{ 0 };
+    int terrain_hits{ 0 };
+    double mesh_mrays = trace(mesh_bvh, rays, mesh_hits);
+    double terrain_mrays = trace(terrain_bvh, rays, terrain_hits);
+    std::cout << "triangles:   " << mesh_bvh.memory_usage() / 1024.0 / 1024.0 << " MiB, build: " << mesh_build << " s, trace: "
+        << mesh_mrays << " Mrays/s, hits: " << mesh_hits << std::endl;
+    std::cout << "heightfield: " << terrain_bvh.memory_usage() / 1024.0 / 1024.0 << " MiB, " << heightfield->get_level_count()
+        << " levels, trace: " << terrain_mrays << " Mrays/s, hits: " << terrain_hits << std::endl;
+}
+
+/// @brief Coverage map accumulation of the hits of a street level transmitter, private grids vs atomic adds, 1 to 64 threads.
+void bench_coverage_accumulation(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_rays) {
+    std::cout << "---- coverage accumulation, private grids vs atomic adds ----" << std::endl;
+    auto bvh = std::make_shared<BVHAccel>(triangles, 0, triangles.size());
+    std::vector<BVHInstance> instances{ BVHInstance{ bvh } };
+    TLAS tlas{ instances, 1 };
+    tlas.build();
+    AABB bounds{ tlas.bounding_box() };
+    Quad quad{ glm::vec3{ bounds.get_min().x, 0.0f, bounds.get_min().z }, glm::vec3{ 0.0f, 0.0f, bounds.get_max().z - bounds.get_min().z },
+        glm::vec3{ bounds.get_max().x - bounds.get_min().x, 0.0f, 0.0f } };
+
+    // hits near a street transmitter pile up in the few cells around it
+    const glm::vec3 tx_pos{ -3.0f, 2.0f, -3.0f };
+    std::vector<Ray> rays{ make_rays(num_rays, tx_pos) };
+    std::vector<glm::vec3> points(rays.size());
+    std::vector<float> strengths(rays.size(), 0.0f);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int i = 0; i < num_rays; ++i) {
+        IntersectRecord record{};
+        if (tlas.is_hit(rays[i], Interval{ Constant::EPSILON, Constant::INF_POS }, record)) {
+            points[i] = glm::vec3{ record.point.x, 0.0f, record.point.z };
+            strengths[i] = 1.0f / std::max(record.t * record.t, 1.0f);
+        }
+    }
+
+    const int passes{ 8 };  // one per bounce of a coverage run
+    const int max_threads{ omp_get_max_threads() };
+    double reference_energy{ 0.0 };
+    for (int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+        omp_set_num_threads(num_threads);
+        std::ostringstream line{};
+        line << std::left << std::setw(4) << num_threads << "threads";
+        for (CoverageAccumulation mode : { CoverageAccumulation::Atomic, CoverageAccumulation::Private }) {
+            CoverageMap cm{ quad, 1.0f };
+            Utils::Timer timer{};
+            CoverageAccumulator accumulator{ cm, mode };
+            for (int pass = 0; pass < passes; ++pass) {
+#pragma omp parallel for schedule(static)
+                for (int i = 0; i < num_rays; ++i) {
+                    if (strengths[i] > 0.0f) {
+                        accumulator.add_strength(points[i], strengths[i]);
+                    }
+                }
+            }
+            accumulator.reduce();
+            double elapsed{ timer.elapsed() };
+
+            double energy{ 0.0 };
+            for (const auto& cell : cm.get_cells()) {
+                energy += cell.strength;
+            }
+            if (reference_energy == 0.0) {
+                reference_energy = energy;
+            }
+            line << (mode == CoverageAccumulation::Atomic ? ", atomic: " : ", private: ") << elapsed << " s"
+                << " (" << accumulator.memory_usage() / 1024.0 / 1024.0 << " MiB, energy error " << std::abs(energy / reference_energy - 1.0) << ")";
+        }
+        std::cout << line.str() << std::endl;
+    }
+    omp_set_num_threads(max_threads);
+}
+
+/// @brief Ground coverage of many sites with CoverageTracer::generate_layers, sites per minute vs threads.
+void bench_multi_site(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_sites, int rays_per_site) {
+    std::cout << "---- " << num_sites << " sites in one pass, " << rays_per_site << " rays each ----" << std::endl;
+    CoverageTracer tracer{ 3, rays_per_site };
+    tracer.add_triangles(triangles);
+    AABB bounds{ tracer.get_scene_bounds() };
+
+    std::mt19937 rng{ 11 };
+    std::uniform_real_distribution<float> coord{ 0.0f, 1.0f };
+    std::vector<Transmitter> sites{};
+    for (int s = 0; s < num_sites; ++s) {
+        glm::vec3 t{ coord(rng), 0.0f, coord(rng) };
+        glm::vec3 position{ glm::vec3{ bounds.get_min().x, 65.0f, bounds.get_min().z } + t * (bounds.get_max() - bounds.get_min()) };
+        sites.emplace_back(s, position, 3.5e9f, 43.0f);
+    }
+
+    const int max_threads{ omp_get_max_threads() };
+    // 1, 2, 4, ... threads up to all cores
+    for (int num_threads = 1;; num_threads = std::min(2 * num_threads, max_threads)) {
+        omp_set_num_threads(num_threads);
+        Utils::Timer timer{};
+        CoverageLayers layers{ tracer.generate_layers(sites, 2.0f) };
+        double elapsed{ timer.elapsed() };
+        std::cout << std::left << std::setw(4) << num_threads << "threads, " << num_sites / elapsed * 60.0
+            << " sites/min, " << elapsed << " s, layers: " << layers.memory_usage() / 1024.0 / 1024.0 << " MiB" << std::endl;
+        if (num_threads >= max_threads) {
+            break;
+        }
+    }
+    omp_set_num_threads(max_threads);
+}
+
+/// @brief Coverage at several receiver heights with CoverageTracer::generate_volume, one layered trace vs one trace per height.
+void bench_coverage_heights(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_rays, const std::vector<float>& heights) {
+    std::cout << "---- " << heights.size() << " coverage heights, one pass vs one pass per height ----" << std::endl;
+    CoverageTracer tracer{ 4, num_rays };
+    tracer.add_triangles(triangles);
+    const std::vector<Transmitter> transmitters{ Transmitter{ 0, glm::vec3{ -3.0f, 2.0f, -3.0f }, 3.5e9f, 43.0f } };
+
+    Utils::Timer timer{};
+    CoverageVolume volume{ tracer.generate_volume(transmitters, 1.0f, heights) };
+    double layered_time{ timer.elapsed() };
+    std::size_t layered_bytes{ volume.memory_usage() };
+
+    double separate_time{ 0.0 };
+    std::size_t separate_bytes{ 0 };
+    for (float height : heights) {
+        timer.reset();
+        CoverageVolume plane{ tracer.generate_volume(transmitters, 1.0f, { height }) };
+        separate_time += timer.elapsed();
+        separate_bytes = std::max(separate_bytes, plane.memory_usage());
+    }
+    std::cout << "layered:  " << layered_time << " s, maps " << layered_bytes / 1024.0 / 1024.0 << " MiB" << std::endl;
+    std::cout << "separate: " << separate_time << " s, maps " << separate_bytes / 1024.0 / 1024.0 << " MiB per run, "
+        << separate_bytes * heights.size() / 1024.0 / 1024.0 << " MiB in total" << std::endl;
+}
+
+/// @brief Region-scale coverage at 1 m cells in a tiled map with a memory budget, streamed to a raw raster.
+void bench_tiled_coverage(float region, int num_sites, int rays_per_site, std::size_t memory_budget) {
+    std::cout << "---- tiled coverage, " << region / 1000.0f << " km square at 1 m, " << num_sites << " sites ----" << std::endl;
+    std::string backing{ (std::filesystem::temp_directory_path() / "bench_tiled_coverage.bin").string() };
+    TiledCoverageMap map{ glm::vec3{ 0.0f, 3.0f, 0.0f }, glm::vec2{ region }, 1.0f, memory_budget, backing };
+    if (!map.is_open()) { return; }
+    std::cout << "dense CoverageMap would take " << static_cast<double>(map.get_cells_x()) * map.get_cells_z() * sizeof(Cell) / 1024.0 / 1024.0 / 1024.0
+        << " GiB, budget " << memory_budget / 1024.0 / 1024.0 << " MiB" << std::endl;
+
+    // each site lights a disc of 2 km, every ray deposits along its ground track
+    std::mt19937 rng{ 5 };
+    std::uniform_real_distribution<float> coord{ 0.0f, region };
+    std::vector<glm::vec3> sites(num_sites);
+    for (auto& site : sites) {
+        site = glm::vec3{ coord(rng), 3.0f, coord(rng) };
+    }
+    const int steps{ 200 };
+    Utils::Timer timer{};
+#pragma omp parallel
+    {
+        TiledCoverageMap::Writer writer{ map };
+#pragma omp for schedule(dynamic, 1)
+        for (int s = 0; s < num_sites; ++s) {
+            for (int r = 0; r < rays_per_site; ++r) {
+                float angle{ static_cast<float>(2.0 * Constant::PI * (r + 0.5) / rays_per_site) };
+                glm::vec3 dir{ std::cos(angle), 0.0f, std::sin(angle) };
+                for (int k = 1; k <= steps; ++k) {
+                    float dist{ 10.0f * k };
+                    writer.add_strength(sites[s] + dist * dir, 1.0f / (dist * dist));
+                }
+            }
+        }
+    }
+    double trace_time{ timer.elapsed() };
+    std::cout << map.get_stats();
+
+    timer.reset();
+    std::string raster{ (std::filesystem::temp_directory_path() / "bench_tiled_coverage.raw").string() };
+    bool written{ map.write_raw(raster) };
+    double write_time{ timer.elapsed() };
+    std::cout << "deposits: " << static_cast<double>(num_sites) * rays_per_site * steps / trace_time * 1e-6 << " M/s"
+        << ", raster: " << (written ? std::filesystem::file_size(raster) / 1024.0 / 1024.0 : 0.0) << " MiB in " << write_time << " s" << std::endl;
+    std::filesystem::remove(raster);
+}
+
+/// @brief Street level hits on a map padded to region, dense CoverageMap vs SparseCoverageMap.
+void bench_sparse_coverage(const std::vector<std::shared_ptr<Triangle>>& triangles, int num_rays, float region, float cell_size) {
+    std::cout << "---- sparse coverage, " << region / 1000.0f << " km square at " << cell_size << " m ----" << std::endl;
+    auto bvh = std::make_shared<BVHAccel>(triangles, 0, triangles.size());
+    std::vector<BVHInstance> instances{ BVHInstance{ bvh } };
+    TLAS tlas{ instances, 1 };
+    tlas.build();
+    Quad quad{ glm::vec3{ -0.5f * region, 0.0f, -0.5f * region }, glm::vec3{ 0.0f, 0.0f, region }, glm::vec3{ region, 0.0f, 0.0f } };
+
+    // a transmitter in a street canyon, its rays reach the streets and facades around it
+    const glm::vec3 tx_pos{ -3.0f, 2.0f, -3.0f };
+    std::vector<Ray> rays{ make_rays(num_rays, tx_pos) };
+    std::vector<glm::vec3> points(rays.size());
+    std::vector<float> strengths(rays.size(), 0.0f);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int i = 0; i < num_rays; ++i) {
+        IntersectRecord record{};
+        if (tlas.is_hit(rays[i], Interval{ Constant::EPSILON, Constant::INF_POS }, record)) {
+            points[i] = glm::vec3{ record.point.x, 0.0f, record.point.z };
+            strengths[i] = 1.0f / std::max(record.t * record.t, 1.0f);
+        }
+    }
+
+    const int passes{ 8 };
+    std::ostringstream line{};
+    {
+        Utils::Timer timer{};
+        CoverageMap cm{ quad, cell_size };
+        CoverageAccumulator accumulator{ cm, CoverageAccumulation::Atomic };
+        for (int pass = 0; pass < passes; ++pass) {
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < num_rays; ++i) {
+                if (strengths[i] > 0.0f) {
+                    accumulator.add_strength(points[i], strengths[i]);
+                }
+            }
+        }
+        accumulator.reduce();
+        cm.convert_to_dB();
+        line << "dense: " << timer.elapsed() << " s, " << cm.get_num_cells() * sizeof(Cell) / 1024.0 / 1024.0 << " MiB";
+    }
+    {
+        Utils::Timer timer{};
+        SparseCoverageMap cm{ quad, cell_size };
+        SparseCoverageAccumulator accumulator{ cm };
+        for (int pass = 0; pass < passes; ++pass) {
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < num_rays; ++i) {
+                if (strengths[i] > 0.0f) {
+                    accumulator.add_strength(points[i], strengths[i]);
+                }
+            }
+        }
+        accumulator.reduce();
+        cm.convert_to_dB();
+        double elapsed{ timer.elapsed() };
+        double occupied{ static_cast<double>(cm.get_num_occupied()) / (static_cast<double>(cm.get_num_row()) * cm.get_num_col()) };
+        line << ", sparse: " << elapsed << " s, " << (cm.memory_usage() + accumulator.memory_usage()) / 1024.0 / 1024.0 << " MiB, "
+            << occupied * 100.0 << " % of cells occupied";
+    }
+    std::cout << line.str() << std::endl;
+}
+
+/// @brief Scene and rays shared by the benchmarks of one run.
+struct BenchContext {
+    int num_buildings{ 4096 };
+    int num_rays{ 1000000 };
+    std::vector<std::shared_ptr<Triangle>> triangles{};
+    std::vector<Ray> rays{};
+};
+
+struct BenchEntry {
+    const char* name;
+    const char* group;
+    std::function<void(const BenchContext&)> run;
+};
+
+const std::vector<BenchEntry>& get_benchmarks() {
+    static const std::vector<BenchEntry> benchmarks{
+        { "builders", "bvh", [](const BenchContext& ctx) { bench_builders(ctx.triangles, ctx.rays); } },
+        { "occlusion", "bvh", [](const BenchContext& ctx) { bench_occlusion(ctx.triangles, ctx.rays); } },
+        { "compressed", "bvh", [](const BenchContext& ctx) { bench_compressed(ctx.triangles, ctx.rays); } },
+        { "paged", "bvh", [](const BenchContext& ctx) { bench_paged(ctx.triangles, ctx.rays); } },
+        { "layouts", "bvh", [](const BenchContext& ctx) { bench_layouts(ctx.num_buildings * 16, ctx.num_rays); } },
+        { "packets", "tracing", [](const BenchContext& ctx) { bench_packets(ctx.triangles, ctx.num_rays, glm::vec3{ 0.0f, 30.0f, 0.0f }); } },
+        { "bounce_sorting", "tracing", [](const BenchContext& ctx) { bench_bounce_sorting(ctx.triangles, ctx.num_rays, glm::vec3{ 0.0f, 30.0f, 0.0f }, 16); } },
+        { "lazy", "scene", [](const BenchContext& ctx) { bench_lazy(ctx.num_buildings * 4, ctx.num_rays); } },
+        { "footprint", "scene", [](const BenchContext& ctx) { bench_footprint(ctx.triangles, ctx.num_rays); } },
+        { "terrain", "scene", [](const BenchContext& ctx) { bench_terrain(1024, ctx.num_rays); } },
+        { "coverage_accumulation", "coverage", [](const BenchContext& ctx) { bench_coverage_accumulation(ctx.triangles, ctx.num_rays); } },
+        { "multi_site", "coverage", [](const BenchContext& ctx) { bench_multi_site(ctx.triangles, 64, ctx.num_rays / 8); } },
+        // pedestrian, vehicle and ten building floors
+        { "coverage_heights", "coverage", [](const BenchContext& ctx) {
+            bench_coverage_heights(ctx.triangles, ctx.num_rays, { 1.5f, 2.5f, 4.5f, 7.5f, 10.5f, 13.5f, 16.5f, 19.5f, 22.5f, 25.5f, 28.5f, 31.5f });
+        } },
+        { "tiled_coverage", "coverage", [](const BenchContext&) { bench_tiled_coverage(20000.0f, 100, 20000, std::size_t{ 256 } << 20); } },
+        { "sparse_coverage", "coverage", [](const BenchContext& ctx) { bench_sparse_coverage(ctx.triangles, ctx.num_rays, 4000.0f, 0.5f); } },
+        { "tlas", "scene", [](const BenchContext& ctx) {
+            std::cout << "---- TLAS over instanced buildings ----" << std::endl;
+            for (int num_instances : { 10000, 100000, 1000000 }) {
+                bench_tlas(num_instances, ctx.num_rays);
+            }
+        } },
+    };
+    return benchmarks;
+}
+
+int main(int argc, char* argv[]) {
+    BenchContext ctx{};
+    std::vector<std::string> selected{};
+    int num_counts{ 0 };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg{ argv[i] };
+        if (arg == "--list") {
+            for (const auto& bench : get_benchmarks()) {
+                std::cout << std::left << std::setw(24) << bench.name << bench.group << std::endl;
+            }
+            return 0;
+        }
+        // the leading numbers are the building and ray counts
+        if (num_counts < 2 && selected.empty() && !arg.empty() && std::isdigit(static_cast<unsigned char>(arg[0]))) {
+            (num_counts++ == 0 ? ctx.num_buildings : ctx.num_rays) = std::atoi(arg.c_str());
+            continue;
+        }
+        selected.push_back(arg);
+    }
+
+    std::vector<const BenchEntry*> to_run{};
+    for (const auto& bench : get_benchmarks()) {
+        if (selected.empty() || std::find_if(selected.begin(), selected.end(), [&](const std::string& name) { return name == bench.name || name == bench.group; }) != selected.end()) {
+            to_run.push_back(&bench);
+        }
+    }
+    for (const auto& name : selected) {
+        if (std::none_of(get_benchmarks().begin(), get_benchmarks().end(), [&](const BenchEntry& bench) { return name == bench.name || name == bench.group; })) {
+            std::cerr << "Unknown benchmark " << name << ", see --list." << std::endl;
+            return 1;
+        }
+    }
+
+    ctx.triangles = make_city(ctx.num_buildings);
+    ctx.rays = make_rays(ctx.num_rays, glm::vec3{ 0.0f, 30.0f, 0.0f });
+    for (const BenchEntry* bench : to_run) {
+        bench->run(ctx);
+    }
+    return 0;
+}
@@ -192,15 +192,13 @@ typedef struct Material {
 /*
     IntersectRecord
 */
-struct Triangle;
-
 typedef struct IntersectRecord {
-  float pointx, pointy, pointz;               // 12 bytes
-  float normalx, normaly, normalz;            // 12 bytes
-  struct Triangle *triangle_ptr, *dummy_ptr1; // 16 bytes
-  float t;                                    // 4 bytes
-  float reserved1;                            // 4 bytes
-} IntersectRecord_t;                          // 44 bytes
+  float pointx, pointy, pointz;    // 12 bytes
+  float normalx, normaly, normalz; // 12 bytes
+  uint blas_id, prim_id;           // 8 bytes
+  float t;                         // 4 bytes
+  float reserved1;                 // 4 bytes
+} IntersectRecord_t;               // 40 bytes
 
 /*
     Triangle
@@ -263,7 +261,6 @@ bool tri_hit(const Triangle_t *tri, const Ray_t *ray,
     record->normalx = normal.x;
     record->normaly = normal.y;
     record->normalz = normal.z;
-    record->triangle_ptr = (Triangle_t *)tri;
     return true;
   }
   return false;
@@ -367,11 +364,14 @@ __kernel void ray_trace(__global IntersectRecord_t *recs,
          record->pointz);
   printf("record[%d].normal = %f, %f, %f\n", i, record->normalx,
          record->normaly, record->normalz);
-  printf("record[%d].triangle_ptr = %p\n", i, record->triangle_ptr);
+  printf("record[%d].blas_id = %u\n", i, record->blas_id);
+  printf("record[%d].prim_id = %u\n", i, record->prim_id);
   printf("record[%d].t = %f\n", i, record->t);
   printf("record[%d].reserved1 = %f\n", i, record->reserved1);
 
-  tri_hit(tri, ray, &interval, record);
+  if (tri_hit(tri, ray, &interval, record)) {
+    record->prim_id = i;
+  }
 }
 
 // __kernel void ray_trace(__global Triangle_t *triangles) {
@@ -9,6 +9,8 @@
 #include "cyGL.h"
 #include "containers.hpp"
 #include "drawable.hpp"
+#include "tiled_coverage_map.hpp"
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -19,34 +21,7 @@ namespace SignalTracer {
             : m_cells{ cells }
             , m_indices{ make_indices(num_row, num_col) } {
 
-            // find max strength in vector of cells using binary search
-            float max_strength_dB{ Constant::INF_NEG };
-            float min_strength_dB{ Constant::INF_POS };
-            for (const auto& cell : m_cells) {
-                if (cell.strength == 0.0f) {
-                    continue;
-                }
-                float strength_dB{ Utils::linear_to_dB(cell.strength) };
-                if (strength_dB > max_strength_dB) {
-                    max_strength_dB = strength_dB;
-                }
-                if (strength_dB < min_strength_dB) {
-                    min_strength_dB = strength_dB;
-                }
-            }
-
-            // normalize strength to put in color
-            for (auto& cell : m_cells) {
-                float intensity{};
-                if (cell.strength == 0.0f) {
-                    intensity = 1.0f;
-                }
-                else {
-                    float strength_dB{ Utils::linear_to_dB(cell.strength) };
-                    intensity = (max_strength_dB - strength_dB) / (max_strength_dB - min_strength_dB);
-                }
-                cell.color = glm::vec3(intensity, 1.0f - intensity, 1.0f - intensity);
-            }
+            set_colors();
 
             // // cout max and min strength
             // std::cout << "max strength: " << max_strength_dB << "\n";
@@ -72,6 +47,37 @@ namespace SignalTracer {
             setup_draw();
         }
 
+        /// @brief Map of a TiledCoverageMap, streamed with for_each_tile so the map never has to be resident.
+        /// @param stride cells along each edge of the block drawn as one vertex, the strongest cell of the block wins
+        MapDrawing(const TiledCoverageMap& map, uint32_t stride = 1) {
+            stride = std::max(stride, 1u);
+            int num_row{ static_cast<int>((map.get_cells_z() + stride - 1) / stride) };
+            int num_col{ static_cast<int>((map.get_cells_x() + stride - 1) / stride) };
+            float block_size{ map.get_cell_size() * stride };
+
+            // rows along z like CoverageMap, a vertex sits on the center of the first cell of its block
+            m_cells.resize(static_cast<std::size_t>(num_row) * num_col);
+            for (int i = 0; i < num_row; ++i) {
+                for (int j = 0; j < num_col; ++j) {
+                    m_cells[i * num_col + j].point = map.get_origin() + glm::vec3{ j * block_size, 0.0f, i * block_size };
+                }
+            }
+            map.for_each_tile([&](const TiledCoverageMap::TileView& view) {
+                for (uint32_t z = 0; z < view.depth; ++z) {
+                    const float* strengths = view.strengths + static_cast<std::size_t>(z) * TiledCoverageMap::TILE_SIZE;
+                    Cell* row = &m_cells[static_cast<std::size_t>((view.first_z + z) / stride) * num_col];
+                    for (uint32_t x = 0; x < view.width; ++x) {
+                        float& strength = row[(view.first_x + x) / stride].strength;
+                        strength = std::max(strength, strengths[x]);
+                    }
+                }
+            });
+            m_indices = make_indices(num_row, num_col);
+
+            set_colors();
+            setup_draw();
+        }
+
         // prepare indices
         std::vector<uint> make_indices(int num_row, int num_col) {
             std::vector<uint> indices((num_row - 1) * (num_col - 1) * 6, 0);
@@ -122,6 +128,38 @@ namespace SignalTracer {
 
     private:
 
+        /// @brief Color the cells from red at the strongest to white at the weakest, cells without signal are white.
+        void set_colors() {
+            // find max strength in vector of cells using binary search
+            float max_strength_dB{ Constant::INF_NEG };
+            float min_strength_dB{ Constant::INF_POS };
+            for (const auto& cell : m_cells) {
+                if (cell.strength == 0.0f) {
+                    continue;
+                }
+                float strength_dB{ Utils::linear_to_dB(cell.strength) };
+                if (strength_dB > max_strength_dB) {
+                    max_strength_dB = strength_dB;
+                }
+                if (strength_dB < min_strength_dB) {
+                    min_strength_dB = strength_dB;
+                }
+            }
+
+            // normalize strength to put in color
+            for (auto& cell : m_cells) {
+                float intensity{};
+                if (cell.strength == 0.0f) {
+                    intensity = 1.0f;
+                }
+                else {
+                    float strength_dB{ Utils::linear_to_dB(cell.strength) };
+                    intensity = (max_strength_dB - strength_dB) / (max_strength_dB - min_strength_dB);
+                }
+                cell.color = glm::vec3(intensity, 1.0f - intensity, 1.0f - intensity);
+            }
+        }
+
         // Remember to activate the program before setting uniforms!
         void setup_draw() const override {
             glGenVertexArrays(1, &m_vao);
@@ -12,6 +12,7 @@
 #include "cyGL.h"
 #include "drawable.hpp"
 #include "mesh.hpp"
+#include <cstdint>
 #include <string>
 
 namespace SignalTracer {
@@ -26,6 +27,10 @@ namespace SignalTracer {
         static void load_texture(const char* path, unsigned int& texture);
 
         const std::vector<Mesh>& get_meshes() const { return m_meshes; }
+        /// @brief Assimp node of each mesh, nodes are numbered in depth-first order
+        const std::vector<uint32_t>& get_mesh_nodes() const { return m_mesh_nodes; }
+        /// @brief Material name of each mesh, from the .mtl file of an OBJ, empty if the mesh has none
+        const std::vector<std::string>& get_mesh_materials() const { return m_mesh_materials; }
         const std::vector<Texture>& get_textures_loaded() const { return m_textures_loaded; }
         std::string get_directory() const { return m_directory; }
         void transform(const glm::mat4& model_mat);
@@ -34,6 +39,9 @@ namespace SignalTracer {
 
     private:
         std::vector<Mesh> m_meshes{};
+        std::vector<uint32_t> m_mesh_nodes{};
+        std::vector<std::string> m_mesh_materials{};
+        uint32_t m_node_count{ 0 };
         std::string m_directory{};
         std::vector<Texture> m_textures_loaded;
 
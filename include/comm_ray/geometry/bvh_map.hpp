@@ -4,15 +4,27 @@
 #define _BVH_MAP_HPP_
 
 #include "triangle.hpp"
+#include "triangle_store.hpp"
+#include "wide_bvh.hpp"
+#include "triangle_block.hpp"
+#include "compressed_bvh.hpp"
+#include "paged_bvh.hpp"
+#include "heightfield.hpp"
+#include "ray_packet.hpp"
 #include "constant.hpp"
+#include "material.hpp"
+#include "material_palette.hpp"
 #include "hittable_list.hpp"
 #include "model.hpp"
+#include "utils.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtx/string_cast.hpp"
 #include "omp.h"
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 
@@ -58,36 +70,217 @@ namespace SignalTracer {
         }
     };
 
+    /// @brief Algorithm used to build the binary BVH of a BLAS.
+    enum class BVHBuilder {
+        Sequential,         // recursive binned SAH on one thread
+        ParallelBinned,     // binned SAH, subtrees and large binning passes run as OpenMP tasks
+        SpatialSplit,       // SBVH, object and spatial splits with reference duplication
+        Linear,             // LBVH, Morton order and radix sort, for fast rebuilds of dynamic geometry
+    };
+
+    /// @brief How BaseTracer splits an imported model into BLASes.
+    enum class BLASPartition {
+        Model,              // one BLAS with every mesh of the model
+        Mesh,               // one BLAS per Assimp mesh
+        Node,               // one BLAS per Assimp node, with all of its meshes
+        Component,          // one BLAS per connected component, e.g. a building of a merged city mesh
+    };
+
+    /// @brief Scene level accelerator BaseTracer traces rays through.
+    enum class SceneAccel {
+        TLAS,               // BVH over the BLAS instances
+        FootprintGrid,      // 2D grid over the ground, for 2.5D cities of extruded building footprints
+        Auto,               // FootprintGrid if the scene is 2.5D, else TLAS
+    };
+
+    struct BVHBuildOptions {
+        BVHBuilder builder{ BVHBuilder::ParallelBinned };
+        uint num_bins{ 64 };            // SAH bins per axis, at most BVHAccel::MAX_BINS
+        uint task_threshold{ 4096 };    // nodes with more primitives are processed as parallel tasks
+        float split_budget{ 1.3f };     // SpatialSplit: references allowed, as a multiple of the triangle count
+        float split_alpha{ 1e-5f };     // SpatialSplit: try spatial splits if object children overlap more than alpha x root area
+        uint treelet_passes{ 0 };       // Linear: treelet restructuring passes after the build, 0 disables
+        BLASPartition partition{ BLASPartition::Model }; // BaseTracer: BLASes per imported model
+        SceneAccel scene_accel{ SceneAccel::TLAS };      // BaseTracer: accelerator over all BLAS instances
+        float grid_cell_size{ 0.0f };   // FootprintGrid: cell edge in scene units, 0 gives about four triangles per cell
+        bool lazy{ false };             // only the bounds are computed up front, the tree is built by the first ray that reaches it
+        bool compressed{ false };       // trace 8-bit nodes and 16-bit vertices, the float tree and triangles are freed after the build
+        NodeLayout layout{ NodeLayout::Siblings }; // memory order of the wide nodes that rays traverse
+        std::shared_ptr<MaterialPalette> palette{}; // material ids of the triangles refer to it, a BLAS without one makes its own
+    };
+
+    struct BVHBuildStats {
+        double build_time{ 0.0 };       // seconds spent in the binary build
+        double collapse_time{ 0.0 };    // seconds spent packing wide nodes and triangle blocks
+        float sah_cost{ 0.0f };
+        uint32_t node_count{ 0 };
+        uint32_t leaf_count{ 0 };
+        uint32_t reference_count{ 0 };  // primitive references in leaves, more than the triangles with SBVH
+        uint32_t max_depth{ 0 };        // of the binary tree, at most BVH_MAX_DEPTH
+        float leaf_fill{ 0.0f };        // share of the triangle block lanes holding a triangle, 1 if every block is full
+
+        friend std::ostream& operator<<(std::ostream& out, const BVHBuildStats& stats) {
+            out << "BVH build: " << stats.build_time << " s, collapse: " << stats.collapse_time << " s"
+                << ", nodes: " << stats.node_count << ", leaves: " << stats.leaf_count
+                << ", references: " << stats.reference_count << ", depth: " << stats.max_depth
+                << ", leaf fill: " << stats.leaf_fill
+                << ", SAH cost: " << stats.sah_cost << std::endl;
+            return out;
+        }
+    };
+
     class BVHAccel : public Hittable {
     public:
+        static constexpr uint MAX_BINS{ 64 };
+
         // BVHAccel(const HittableList& obj_container);
-        BVHAccel(const std::vector<shared_ptr<Triangle>>& src_objects, const std::size_t& start, const std::size_t& range);
-        BVHAccel(const Model& model);
+        BVHAccel(const std::vector<shared_ptr<Triangle>>& src_objects, const std::size_t& start, const std::size_t& range, uint32_t blas_id = 0, const BVHBuildOptions& options = {});
+        BVHAccel(const Model& model, uint32_t blas_id = 0, const BVHBuildOptions& options = {});
+
+        /// @brief BLAS over part of a model, e.g. one object found by partition_model.
+        /// @param faces triangles of the model, numbered over all meshes in order
+        BVHAccel(const Model& model, const std::vector<uint32_t>& faces, uint32_t blas_id = 0, const BVHBuildOptions& options = {});
+
+        /// @brief Terrain BLAS traced through the maximum mipmap of a heightfield, no triangles or tree are built.
+        /// @details Its primitives are the heightfield triangles, all with the material of the heightfield.
+        BVHAccel(const std::shared_ptr<const Heightfield>& heightfield, uint32_t blas_id = 0, const BVHBuildOptions& options = {});
+
+        /// @brief Independent copy, e.g. for a copied tracer. Updating one leaves the other unchanged.
+        /// @details A paged BLAS keeps tracing from the same treelet file. Not to be copied while a lazy build runs.
+        BVHAccel(const BVHAccel& other);
+        BVHAccel& operator=(const BVHAccel& other) = delete;
 
         const BVHNode& get_node(const uint node_idx) const { return m_nodes[node_idx]; }
         const BVHNode& get_root() const { return m_nodes[0]; }
 
+        uint32_t get_blas_id() const { return m_blas_id; }
+        void set_blas_id(uint32_t blas_id) { m_blas_id = blas_id; }
+        const TriangleStore& get_store() const { return m_store; }
+        std::size_t get_triangle_count() const { return m_heightfield ? m_heightfield->get_triangle_count() : m_store.size(); }
+        const WideBVH& get_wide() const { return m_wide; }
+        const TriangleBlocks& get_blocks() const { return m_blocks; }
+        const CompressedBVH& get_compressed() const { return m_compressed; }
+        bool is_compressed() const { return !m_compressed.empty(); }
+        bool is_paged() const { return m_paged != nullptr; }
+        /// @brief Treelet file the BLAS traces from after page_out, nullptr otherwise.
+        const PagedBVH* get_paged() const { return m_paged.get(); }
+        bool is_heightfield() const { return m_heightfield != nullptr; }
+        const std::shared_ptr<const Heightfield>& get_heightfield() const { return m_heightfield; }
+        const BVHBuildOptions& get_build_options() const { return m_options; }
+        const BVHBuildStats& get_build_stats() const { return m_stats; }
+
+        /// @brief False while a lazy BLAS waits for its first ray.
+        bool is_built() const { return m_built.load(std::memory_order_acquire); }
+        /// @brief True if the lazy build could not run, e.g. the triangles were freed, rays miss the BLAS until it is built again.
+        bool has_build_failed() const { return m_build_failed.load(std::memory_order_acquire); }
+
+        /// @brief Build a lazy BLAS now, once, whichever thread gets here first.
+        /// @details Threads reaching the same unbuilt BLAS wait for its build, other BLASes are not blocked.
+        /// Called from a parallel region, e.g. by the first ray of a trace, the build runs on the calling thread only.
+        /// @return false if the build failed, the failure is reported once and the queries return misses without traversing
+        bool ensure_built() const;
+
+        /// @brief Triangles taken from the model, empty if the BLAS holds the whole model.
+        const std::vector<uint32_t>& get_faces() const { return m_faces; }
+
+        /// @brief SAH cost of the binary tree, normalized by the root area.
+        /// @details Each node visit costs 1 and each leaf costs 1 per triangle block.
+        /// A compressed or paged BLAS keeps the cost measured before its binary tree was freed.
+        float calc_sah_cost() const;
+
+        /// @brief Bytes used by the triangles, the nodes and the triangle blocks.
+        std::size_t memory_usage() const;
+
+        /// @brief Material of a primitive, resolved through its compact material id.
+        const std::shared_ptr<Material>& get_material(uint32_t prim_id) const { return m_palette->get_material(get_mat_id(prim_id)); }
+        /// @brief Id of the material of a primitive in the palette.
+        uint16_t get_mat_id(uint32_t prim_id) const { return m_heightfield ? m_heightfield->get_mat_id() : m_store.get_mat_id(prim_id); }
+        const std::shared_ptr<MaterialPalette>& get_palette() const { return m_palette; }
+
         void build();
+
+        /// @brief Update the bounds after vertices moved, keeping the topology.
+        /// @details An unbuilt lazy BLAS only updates its root bounds and stays unbuilt.
+        /// A compressed or paged BLAS has no tree left to refit, it is built again from the geometry set last.
         void refit();
 
+        /// @brief Build again with another builder, e.g. Linear when the geometry changes every step.
+        /// @details The builder given at construction stays the default for build().
+        void rebuild(BVHBuilder builder);
+
+        /// @brief Replace the triangles, e.g. after vertices moved.
+        /// @details The tree is not updated, call refit() if the triangle count is unchanged, build() otherwise.
+        /// A BLAS over part of a model takes the same faces of the new model.
+        void set_geometry(const std::vector<shared_ptr<Triangle>>& triangles);
+        void set_geometry(const Model& model);
+
+        /// @brief Move the nodes and triangle blocks to a treelet file and trace from it from now on.
+        /// @details Like a compressed BLAS, the in-memory tree and the triangles are freed,
+        /// material ids and the root bounds stay. The file is written over and must outlive the BLAS.
+        /// @param memory_budget bytes of treelets kept resident, see PagedBVH
+        /// @param treelet_nodes wide nodes per treelet, 0 picks about 64 KiB
+        /// @return false if the BLAS is compressed or the file could not be written, the BLAS is then unchanged
+        bool page_out(const std::string& path, std::size_t memory_budget, uint32_t treelet_nodes = 0);
+
         bool is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const override;
         bool is_hit_(const Ray& ray, Interval interval, IntersectRecord& record) const;
+        bool is_occluded(const Ray& ray, const Interval& interval) const override;
+
+        /// @brief Closest hits of the active rays of a packet.
+        /// @details records[i].t bounds ray i like in is_hit_, records of missed rays are untouched.
+        /// @return mask of the rays that hit
+        uint32_t is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const;
 
         AABB bounding_box() const override;
 
     private:
 
-        std::vector<std::shared_ptr<Triangle>> init_triangles(const Model& model);
+        void init_store(const std::vector<shared_ptr<Triangle>>& triangles);
+        void init_store(const Model& model);
         void update_node_bounds(const uint node_idx);
-        float find_best_split_plane(const BVHNode& node, int& axis, float& split_pos, uint num_bins = 64);
+        float find_best_split_plane(const BVHNode& node, int& axis, float& split_pos, uint num_bins = 64) const;
+        float find_best_split_plane_parallel(const BVHNode& node, int& axis, float& split_pos) const;
+        uint partition(const BVHNode& node, int axis, float split_pos);
         void subdivide(uint node_idx, uint depth = 0);
-
-        std::vector<shared_ptr<Triangle>> m_prim_ptrs{};
+        void subdivide_parallel(uint node_idx, std::atomic<uint32_t>& nodes_used, uint depth = 0);
+        void collapse();
+        void start_build();
+        void defer_build();
+        void compress();
+        void release_tree();
+
+        TriangleStore m_store{};
+        std::shared_ptr<MaterialPalette> m_palette{};
+        std::vector<uint32_t> m_faces{}; // faces of the model in the store, all of them if empty
+        uint32_t m_blas_id{ 0 };
+        BVHBuildOptions m_options{};
+        BVHBuildStats m_stats{};
+        std::vector<glm::vec3> m_centroids{}; // build only, indexed by primitive id
         std::vector<uint> m_prim_indices{};
         std::vector<BVHNode> m_nodes{};
         uint32_t m_nodes_used{ 2 };
+        WideBVH m_wide{}; // traversal structure collapsed from m_nodes
+        TriangleBlocks m_blocks{}; // leaf triangles in SIMD blocks, referenced by m_wide
+        CompressedBVH m_compressed{}; // replaces m_wide, m_blocks and the store geometry when compressed
+        std::shared_ptr<const PagedBVH> m_paged{}; // replaces them after page_out, shared by copies
+        std::shared_ptr<const Heightfield> m_heightfield{}; // terrain BLAS, the store and the tree stay empty
+        std::atomic<bool> m_built{ false };
+        mutable std::atomic<bool> m_build_failed{ false }; // set by the lazy build, cleared when the build is deferred again
+        mutable std::unique_ptr<std::once_flag> m_build_once{}; // lazy build, replaced when the build is deferred again
     };
 
+    /*
+        ----------------------------------------
+        BVHInstance
+        A BLAS placed in the world by an affine transform.
+        Any number of instances share one BVHAccel.
+        Rays are moved into object space, where the direction is
+        normalized again, so distances there are scaled by the length
+        of the transformed direction. Intervals and hit distances are
+        converted with that factor, and hit points and normals are
+        brought back to world space.
+        ----------------------------------------
+    */
     class BVHInstance : public Hittable {
     public:
         BVHInstance() = default;
@@ -99,33 +292,52 @@ namespace SignalTracer {
         }
 
         bool is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const override;
+        bool is_occluded(const Ray& ray, const Interval& interval) const override;
+        uint32_t is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const;
 
         AABB bounding_box() const override;
         void set_transform(const glm::mat4& transform);
+        const glm::mat4& get_transform() const { return m_transform_point; }
+        const std::shared_ptr<BVHAccel>& get_bvh() const { return m_bvh_ptr; }
 
     private:
+        /// @brief Ray in object space, scale receives the object space length of a unit world distance.
+        Ray to_object(const Ray& ray, float& scale) const;
+        void to_world(IntersectRecord& record, float scale) const;
+
         std::shared_ptr<BVHAccel> m_bvh_ptr{ nullptr };
         glm::mat4 m_transform_point{ 1.0f };
-        glm::mat4 m_transform_vector{ 1.0f };
         glm::mat4 m_inv_transform_point{ 1.0f };
-        glm::mat4 m_inv_transform_vector{ 1.0f };
+        glm::mat3 m_inv_transform_vector{ 1.0f };   // directions, world to object
+        glm::mat3 m_transform_normal{ 1.0f };       // normals, object to world: transpose(inverse(M))
+        bool m_identity{ true };                    // rays are passed through untouched
         AABB m_box{}; // in world space
     };
 
     struct TLASNode {
         glm::vec3 aabb_min{};
-        uint32_t left_right{}; // 2x16 bits
+        uint32_t left{};        // left child, the right child is left + 1
         glm::vec3 aabb_max{};
-        uint32_t blas_idx{};
+        uint32_t blas_idx{};    // instance of a leaf
 
         // child nodes of internal nodes must be greater than 0
         // leaf nodes must be 0
-        bool is_leaf() { return left_right == 0; }
-        bool is_leaf() const { return left_right == 0; }
+        bool is_leaf() { return left == 0; }
+        bool is_leaf() const { return left == 0; }
     };
 
+    /*
+        ----------------------------------------
+        TLAS
+        Binary tree over the BVH instances, one instance per leaf,
+        built top-down with a binned SAH over the instance bounds
+        in O(n log n), then collapsed into a WideBVH for traversal.
+        ----------------------------------------
+    */
     class TLAS : public Hittable {
     public:
+        static constexpr int NUM_BINS{ 16 };
+
         TLAS() = default;
         TLAS(BVHInstance* bvh_list, uint blas_count);
         TLAS(const std::vector<BVHInstance>& bvh_list, uint blas_count);
@@ -133,18 +345,42 @@ namespace SignalTracer {
         void build();
         bool is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const override;
         bool is_hit_(const Ray& ray, Interval interval, IntersectRecord& record) const;
+        bool is_occluded(const Ray& ray, const Interval& interval) const override;
+
+        /// @brief Closest hits of a packet, e.g. neighbouring launch directions of a transmitter.
+        /// @details Records start from their t like is_hit_, see BVHAccel::is_hit for packets.
+        /// @return mask of the rays that hit
+        uint32_t is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const;
+
+        /// @brief Point the TLAS at another copy of the instances it was built over, e.g. after its owner was copied.
+        /// @details The tree is kept, so the instances must be the same. Call build() if they changed.
+        void set_instances(const std::vector<BVHInstance>& instances);
+
+        /// @brief Bytes used by the binary and the wide nodes.
+        std::size_t memory_usage() const;
+
+        /// @brief True if the straight segment between two points is blocked, e.g. the direct path between tx and rx.
+        bool is_segment_occluded(const glm::vec3& from, const glm::vec3& to) const;
 
         AABB bounding_box() const override {
             return AABB{ m_tlas_nodes[0].aabb_min, m_tlas_nodes[0].aabb_max };
         }
 
+        const WideBVH& get_wide() const { return m_wide; }
+        uint get_node_count() const { return m_nodes_used; }
+
+        /// @brief Seconds spent in the last build, including the collapse into wide nodes.
+        double get_build_time() const { return m_build_time; }
+
     private:
-        int find_best_match(int* node_idxs, int num_nodes, int node_A_idx);
+        void subdivide(std::vector<uint32_t>& instance_ids, const std::vector<glm::vec3>& box_min, const std::vector<glm::vec3>& box_max);
 
         std::vector<TLASNode> m_tlas_nodes{};
+        WideBVH m_wide{};
         const BVHInstance* m_blas{ nullptr };
         uint m_blas_count{ 0 };
         uint m_nodes_used{ 0 };
+        double m_build_time{ 0.0 };
     };
 
 }
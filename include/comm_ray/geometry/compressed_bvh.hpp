@@ -0,0 +1,119 @@
+#pragma once
+
+#ifndef COMPRESSED_BVH_HPP
+#define COMPRESSED_BVH_HPP
+
+#include "wide_bvh.hpp"
+#include "triangle_block.hpp"
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "interval.hpp"
+#include "constant.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /// @brief Value of grid point q, the single decoding rule of the compressed format.
+    inline float dequantize(float origin, float scale, uint32_t q) {
+        return origin + static_cast<float>(q) * scale;
+    }
+
+    /*
+        ----------------------------------------
+        QuantizedWideNode
+        A WideBVHNode with 8-bit child bounds.
+        The bounds are grid points of the node box: 256 steps per axis,
+        rounded outwards, so a decoded child box always contains the child.
+        ----------------------------------------
+    */
+    template <int W>
+    struct alignas(16) QuantizedWideNode {
+        float origin[3]{};
+        float scale[3]{};
+        uint8_t lo_x[W], lo_y[W], lo_z[W];
+        uint8_t hi_x[W], hi_y[W], hi_z[W];
+        uint32_t child[W];
+        uint16_t count[W];
+        uint8_t lane_mask{ 0 };
+    };
+
+    /// @brief Float bounds of the lanes of a node, decoded for the slab tests.
+    template <int W>
+    struct alignas(32) WideBounds {
+        float min_x[W], min_y[W], min_z[W];
+        float max_x[W], max_y[W], max_z[W];
+        uint32_t lane_mask{ 0 };
+    };
+
+    /*
+        ----------------------------------------
+        QuantizedTriangleBlock
+        A TriangleBlock with 16-bit vertices on the grid of the BLAS bounds.
+        Padding lanes repeat grid point 0, a degenerate triangle
+        that never reports a hit.
+        ----------------------------------------
+    */
+    template <int W>
+    struct alignas(16) QuantizedTriangleBlock {
+        uint16_t a[3][W]{};
+        uint16_t b[3][W]{};
+        uint16_t c[3][W]{};
+        uint32_t prim_id[W];
+    };
+
+    /*
+        ----------------------------------------
+        CompressedBVH
+        Memory-saving copy of a collapsed BLAS for very large models:
+        quantized wide nodes and 16-bit triangle blocks.
+        Vertices move by at most half a grid step, 1/131070 of the BLAS extent.
+        Node bounds are computed from the decoded triangles, so traversal
+        is exact for the geometry that is intersected.
+        ----------------------------------------
+    */
+    class CompressedBVH {
+    public:
+        CompressedBVH() = default;
+
+        /// @brief Quantize the nodes and triangle blocks of a collapsed BLAS.
+        /// @param store vertices of the triangles the blocks refer to
+        /// @param bounds bounds of all triangles, the vertex grid spans them
+        void build(const WideBVH& wide, const TriangleBlocks& blocks, const TriangleStore& store, const AABB& bounds);
+        void clear();
+
+        bool empty() const { return m_nodes4.empty() && m_nodes8.empty(); }
+        int get_width() const { return m_width; }
+        std::size_t memory_usage() const;
+
+        /// @brief Closest hit within the interval.
+        /// @param normal receives the geometric normal of the decoded triangle
+        bool intersect(const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id, glm::vec3& normal) const;
+
+        /// @brief True if any triangle is hit within the interval.
+        bool occluded(const Ray& ray, const Interval& interval) const;
+
+    private:
+        template <int W>
+        void build_nodes(const WideNodeArray<W>& wide_nodes, const TransformBlockArray<W>& blocks, const TriangleStore& store,
+            Memory::AlignedVector<QuantizedWideNode<W>>& nodes, Memory::AlignedVector<QuantizedTriangleBlock<W>>& quantized_blocks) const;
+
+        template <int W>
+        void decode_block(const QuantizedTriangleBlock<W>& quantized, TriangleBlock<W>& block) const;
+
+        template <int W>
+        bool intersect_leaves(const Memory::AlignedVector<QuantizedTriangleBlock<W>>& blocks, uint32_t first, uint32_t count,
+            const Ray& ray, Interval& interval, uint32_t& prim_id, glm::vec3& normal) const;
+
+        Memory::AlignedVector<QuantizedWideNode<4>> m_nodes4{};
+        Memory::AlignedVector<QuantizedWideNode<8>> m_nodes8{};
+        Memory::AlignedVector<QuantizedTriangleBlock<4>> m_blocks4{};
+        Memory::AlignedVector<QuantizedTriangleBlock<8>> m_blocks8{};
+        glm::vec3 m_origin{};   // vertex grid
+        glm::vec3 m_scale{};
+        int m_width{ 4 };
+    };
+}
+
+#endif // !COMPRESSED_BVH_HPP
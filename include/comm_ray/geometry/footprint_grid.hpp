@@ -0,0 +1,115 @@
+#pragma once
+
+#ifndef FOOTPRINT_GRID_HPP
+#define FOOTPRINT_GRID_HPP
+
+#include "hittable.hpp"
+#include "bvh_map.hpp"
+#include "triangle_store.hpp"
+#include "triangle_block.hpp"
+#include "ray_packet.hpp"
+#include "constant.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace SignalTracer {
+
+    struct FootprintGridStats {
+        double build_time{ 0.0 };
+        uint32_t cells_x{ 0 };
+        uint32_t cells_z{ 0 };
+        uint32_t filled_cells{ 0 };
+        uint32_t triangle_count{ 0 };
+        uint32_t reference_count{ 0 };  // triangles in cells, a triangle is listed in every cell its footprint overlaps
+        float cell_size{ 0.0f };
+
+        friend std::ostream& operator<<(std::ostream& out, const FootprintGridStats& stats) {
+            out << "Footprint grid: " << stats.cells_x << " x " << stats.cells_z << " cells of " << stats.cell_size
+                << ", filled: " << stats.filled_cells << ", triangles: " << stats.triangle_count
+                << ", references: " << stats.reference_count << ", build: " << stats.build_time << " s" << std::endl;
+            return out;
+        }
+    };
+
+    /*
+        ----------------------------------------
+        FootprintGrid
+        Scene accelerator for 2.5D cities: extruded building footprints
+        on a ground plane, y up. The ground is cut into square cells on
+        x and z. A cell lists every triangle whose footprint overlaps it,
+        in transform blocks, and keeps the height range of those triangles.
+        A ray walks the cells it crosses with a 2D DDA and skips a cell
+        if it passes above its roofs or below its lowest triangle, so a
+        ray over the rooftops tests almost nothing.
+        Triangles are copied to world space from the instances of the
+        TLAS, so records carry the blas_id and prim_id of the BLAS. The
+        grid is exact for any scene, it is only fast for 2.5D ones.
+        ----------------------------------------
+    */
+    class FootprintGrid : public Hittable {
+    public:
+        static constexpr float FLAT_NORMAL_Y{ 0.98f };      // |n.y| above: ground or roof
+        static constexpr float WALL_NORMAL_Y{ 0.02f };      // |n.y| below: wall
+        static constexpr float MIN_2_5D_AREA{ 0.9f };       // area of walls, roofs and ground for a scene to be 2.5D
+        static constexpr uint32_t MAX_CELLS{ 1u << 22 };
+
+        FootprintGrid() = default;
+
+        /// @brief True if nearly all of the triangle area of the instances is vertical or horizontal.
+        /// @details Instances whose BLAS has released its triangles are not counted, a heightfield makes the scene not 2.5D.
+        static bool is_2_5d(const std::vector<BVHInstance>& instances);
+
+        /// @brief Bin the world space triangles of the instances.
+        /// @param cell_size edge of a cell in scene units, 0 gives about four triangles per cell
+        /// @param width lanes of the triangle blocks, 0 selects the widest available
+        /// @return false if a BLAS has no triangles, e.g. a compressed, paged out or heightfield BLAS
+        bool build(const std::vector<BVHInstance>& instances, float cell_size = 0.0f, int width = 0);
+
+        bool is_built() const { return !m_cells.empty(); }
+        const FootprintGridStats& get_stats() const { return m_stats; }
+        std::size_t memory_usage() const;
+
+        bool is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const override;
+        bool is_occluded(const Ray& ray, const Interval& interval) const override;
+
+        /// @brief Closest hits of a packet, ray by ray, records start from their t like TLAS::is_hit.
+        /// @return mask of the rays that hit
+        uint32_t is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const;
+
+        /// @brief True if something lies between two points, the end points are not tested.
+        bool is_segment_occluded(const glm::vec3& from, const glm::vec3& to) const;
+
+        AABB bounding_box() const override { return m_bounds; }
+        glm::vec3 get_min() const override { return m_bounds.get_min(); }
+        glm::vec3 get_max() const override { return m_bounds.get_max(); }
+
+    private:
+        struct Cell {
+            uint32_t first_block{ 0 };
+            uint32_t block_count{ 0 };
+            float y_min{ Constant::INF_POS };
+            float y_max{ Constant::INF_NEG };
+        };
+
+        /// @brief Walk the cells along the ray, visit(cell, t_enter, t_exit) returns true to stop.
+        template <typename Visit>
+        void walk(const Ray& ray, const Interval& interval, Visit&& visit) const;
+
+        AABB m_bounds{};
+        glm::vec3 m_origin{ 0.0f };     // corner of cell (0, 0) on x and z
+        float m_cell_size{ 1.0f };
+        float m_inv_cell_size{ 1.0f };
+        uint32_t m_cells_x{ 0 };
+        uint32_t m_cells_z{ 0 };
+        std::vector<Cell> m_cells{};            // x * z cells, row major on z
+        TriangleBlocks m_blocks{};              // prim_id of a lane indexes m_blas_ids and m_prim_ids
+        std::vector<uint32_t> m_blas_ids{};
+        std::vector<uint32_t> m_prim_ids{};
+        std::vector<glm::vec3> m_normals{};     // world space
+        FootprintGridStats m_stats{};
+    };
+}
+
+#endif // !FOOTPRINT_GRID_HPP
@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef HEIGHTFIELD_HPP
+#define HEIGHTFIELD_HPP
+
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "interval.hpp"
+#include "constant.hpp"
+#include "material_palette.hpp"
+#include "aligned_allocator.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SignalTracer {
+
+    /// @brief Sample type of a raw DEM raster.
+    enum class HeightFormat {
+        Float32,
+        Int16,
+        UInt16,
+    };
+
+    /// @brief Layout of a raw DEM raster: rows along z, samples along x, no header.
+    struct HeightfieldDesc {
+        uint32_t width{ 0 };            // samples per row, along x
+        uint32_t depth{ 0 };            // rows, along z
+        HeightFormat format{ HeightFormat::Float32 };
+        bool big_endian{ false };
+        glm::vec3 origin{ 0.0f };       // position of sample (0, 0) with height 0
+        glm::vec2 spacing{ 1.0f };      // distance between samples on x and z
+        float height_scale{ 1.0f };     // y = origin.y + height_offset + height_scale * sample
+        float height_offset{ 0.0f };
+        uint16_t mat_id{ MaterialPalette::MEDIUM_DRY_GROUND };
+    };
+
+    /*
+        ----------------------------------------
+        Heightfield
+        Terrain from a DEM raster, y up, traced without building triangles.
+        Each cell between four samples is two triangles split along the
+        diagonal from sample (x, z) to (x + 1, z + 1), so hits match a
+        mesh of the same raster. Primitive 2 * (z * (width - 1) + x) + k
+        is triangle k of cell (x, z).
+        A maximum mipmap keeps the lowest and highest sample of every
+        2^l x 2^l block of cells. Rays descend this quadtree front to back
+        and skip every block whose height slab they miss, so only the
+        cells near the hit are tested.
+        ----------------------------------------
+    */
+    class Heightfield {
+    public:
+        /// @param heights y of the desc.width x desc.depth samples, row by row, the height fields of desc are not applied
+        Heightfield(const HeightfieldDesc& desc, std::vector<float> heights);
+
+        /// @brief Read a headerless DEM raster.
+        /// @return nullptr if the file is missing or shorter than the raster
+        static std::shared_ptr<Heightfield> load_raw(const std::string& path, const HeightfieldDesc& desc);
+
+        uint32_t get_width() const { return m_desc.width; }
+        uint32_t get_depth() const { return m_desc.depth; }
+        uint16_t get_mat_id() const { return m_desc.mat_id; }
+        const HeightfieldDesc& get_desc() const { return m_desc; }
+        std::size_t get_triangle_count() const;
+        std::size_t get_level_count() const { return m_levels.size(); }
+
+        /// @brief Height of a sample in scene units.
+        float get_height(uint32_t x, uint32_t z) const { return m_heights[static_cast<std::size_t>(z) * m_desc.width + x]; }
+
+        /// @brief Corners of a primitive, counter-clockwise seen from above.
+        void get_triangle(uint32_t prim_id, glm::vec3& a, glm::vec3& b, glm::vec3& c) const;
+        glm::vec3 get_normal(uint32_t prim_id) const;
+
+        AABB bounding_box() const { return m_bounds; }
+        std::size_t memory_usage() const;
+
+        /// @brief Closest hit within the interval.
+        bool intersect(const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id) const;
+
+        /// @brief True if the terrain is hit within the interval.
+        bool occluded(const Ray& ray, const Interval& interval) const;
+
+    private:
+        /// @brief Height ranges of the four children of a block, lane (z & 1) * 2 + (x & 1).
+        struct alignas(32) RangeQuad {
+            float lo[4]{ Constant::INF_POS, Constant::INF_POS, Constant::INF_POS, Constant::INF_POS };
+            float hi[4]{ Constant::INF_NEG, Constant::INF_NEG, Constant::INF_NEG, Constant::INF_NEG };
+        };
+
+        struct Level {
+            uint32_t width{ 0 };        // blocks along x
+            uint32_t depth{ 0 };        // blocks along z
+            Memory::AlignedVector<RangeQuad> quads{}; // indexed by block of the next level, (x / 2, z / 2)
+        };
+
+        void build_levels();
+
+        /// @brief Blocks per row of the next level, 1 above the top level.
+        uint32_t parent_width(uint32_t level) const { return level + 1 < m_levels.size() ? m_levels[level + 1].width : 1; }
+
+        /// @brief Nearest hit of the two triangles of a cell.
+        bool intersect_cell(uint32_t x, uint32_t z, const Ray& ray, float t_min, float t_max, float& t, uint32_t& prim_id) const;
+
+        /// @brief Descend the mipmap front to back, stop at the first hit if any_hit.
+        bool traverse(const Ray& ray, const Interval& interval, bool any_hit, float& t, uint32_t& prim_id) const;
+
+        HeightfieldDesc m_desc{};
+        std::vector<float> m_heights{};
+        std::vector<Level> m_levels{};  // level l covers 2^l x 2^l cells, the last one is a single block
+        AABB m_bounds{};
+    };
+}
+
+#endif // !HEIGHTFIELD_HPP
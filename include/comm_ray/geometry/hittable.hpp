@@ -13,6 +13,13 @@ namespace SignalTracer {
     class Hittable {
     public:
         virtual bool is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const = 0;
+
+        /// @brief Any-hit query: true if something blocks the ray within the interval.
+        /// Acceleration structures override it with an early-exit traversal that writes no record.
+        virtual bool is_occluded(const Ray& ray, const Interval& interval) const {
+            IntersectRecord record{};
+            return is_hit(ray, interval, record);
+        }
         virtual AABB bounding_box() const = 0;
 
         virtual std::ostream& print(std::ostream& out) const {
@@ -47,6 +47,15 @@ namespace SignalTracer {
             return is_intersect;
         };
 
+        bool is_occluded(const Ray& r, const Interval& interval) const override {
+            for (const auto& object : m_objects) {
+                if (object->is_occluded(r, interval)) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
         const std::vector<shared_ptr<Hittable>>& objects() const {
             return m_objects;
         };
@@ -6,25 +6,28 @@
 #include "ray.hpp"
 #include "constant.hpp"
 #include "glm/glm.hpp"
+#include <cstdint>
 #include <iostream>
-#include <memory>
 
 namespace SignalTracer {
-    class Material;
-    class Triangle;
-
     /*
         ----------------------------------------
         IntersectRecord
         A container to store the information of the intersection
+        The hit primitive is identified by (blas_id, prim_id),
+        which indexes the triangle store of the hit BLAS.
         ----------------------------------------
     */
     struct IntersectRecord {
         glm::vec3 point{ Constant::INF_NEG };           // 12 bytes
         glm::vec3 normal{};                             // 12 bytes
-        std::shared_ptr<Triangle> tri_ptr{ nullptr };   // 16 bytes
+        uint32_t blas_id{ Constant::INVALID_IDX };      // 4 bytes
+        uint32_t prim_id{ Constant::INVALID_IDX };      // 4 bytes
         float t{ Constant::INF_POS };                   // 4 bytes
         float reserved{ 0.0f };                         // 4 bytes
+
+        bool has_primitive() const { return prim_id != Constant::INVALID_IDX; }
+
         friend std::ostream& operator<<(std::ostream& os, const IntersectRecord& record) {
             os << "IntersectRecord: " << glm::to_string(record.point) << std::endl;
             return os;
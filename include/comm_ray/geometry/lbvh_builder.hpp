@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef LBVH_BUILDER_HPP
+#define LBVH_BUILDER_HPP
+
+#include "bvh_map.hpp"
+#include "triangle_store.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        LBVHBuilder
+        Linear BVH (Karras 2012) for fast rebuilds of dynamic geometry.
+        Centroids are quantized to 30-bit Morton codes and radix sorted.
+        Every internal node then finds its split on its own, from the
+        common prefixes of the sorted codes, so all passes run in parallel.
+        Ranges of at most leaf_size primitives become leaves.
+        Optional treelet restructuring (Karras and Aila 2013) wins back
+        part of the SAH quality lost to the Morton order.
+        ----------------------------------------
+    */
+    class LBVHBuilder {
+    public:
+        LBVHBuilder(const TriangleStore& store, const BVHBuildOptions& options, uint32_t leaf_size);
+
+        /// @brief Build the binary tree.
+        /// @param nodes receives the nodes, node 1 is left unused like the other builders
+        /// @param prim_indices receives the primitive ids in Morton order
+        /// @return the number of used nodes, including the unused node 1
+        uint32_t build(std::vector<BVHNode>& nodes, std::vector<uint>& prim_indices);
+
+    private:
+        static constexpr int TREELET_SIZE{ 7 };
+
+        void compute_morton_codes(std::vector<uint32_t>& codes, std::vector<uint>& prim_indices) const;
+        void radix_sort(std::vector<uint32_t>& codes, std::vector<uint>& prim_indices) const;
+        void find_splits(const std::vector<uint32_t>& codes, std::vector<uint32_t>& splits) const;
+        uint32_t emit(const std::vector<uint32_t>& splits, std::vector<BVHNode>& nodes) const;
+        void update_bounds(std::vector<BVHNode>& nodes, const std::vector<uint>& prim_indices, uint32_t nodes_used) const;
+        void optimize_treelets(std::vector<BVHNode>& nodes, uint32_t nodes_used) const;
+        bool restructure(std::vector<BVHNode>& nodes, std::vector<float>& costs, uint32_t root) const;
+        static uint32_t max_depth(const std::vector<BVHNode>& nodes, uint32_t nodes_used);
+        float blocks(uint32_t count) const { return static_cast<float>((count + m_leaf_size - 1) / m_leaf_size); }
+
+        const TriangleStore& m_store;
+        BVHBuildOptions m_options{};
+        uint32_t m_leaf_size{ 4 };
+    };
+}
+
+#endif // !LBVH_BUILDER_HPP
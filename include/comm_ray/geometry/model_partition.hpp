@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef MODEL_PARTITION_HPP
+#define MODEL_PARTITION_HPP
+
+#include "bvh_map.hpp"
+#include "model.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        Model partitioning
+        Splits the triangles of an imported model into objects,
+        so each object gets its own BLAS under the TLAS.
+        Faces are numbered over all meshes in order,
+        the numbering BVHAccel uses for part of a model.
+        ----------------------------------------
+    */
+
+    /// @brief Faces of each object of a model, objects without faces are dropped.
+    /// @return one group for BLASPartition::Model, one per mesh, Assimp node or connected component otherwise
+    std::vector<std::vector<uint32_t>> partition_model(const Model& model, BLASPartition partition);
+
+    /// @brief Connected components of an indexed triangle mesh.
+    /// @details Triangles are connected through shared vertices, vertices at the same position count as shared,
+    /// so a building stays whole even if its faces were exported with their own vertices.
+    /// @param positions vertex positions
+    /// @param indices three vertex indices per triangle
+    /// @param labels receives the component of each triangle, numbered in the order of their first triangle
+    /// @return number of components
+    uint32_t label_components(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, std::vector<uint32_t>& labels);
+}
+
+#endif // !MODEL_PARTITION_HPP
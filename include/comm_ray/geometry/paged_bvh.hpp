@@ -0,0 +1,138 @@
+#pragma once
+
+#ifndef PAGED_BVH_HPP
+#define PAGED_BVH_HPP
+
+#include "wide_bvh.hpp"
+#include "triangle_block.hpp"
+#include "ray.hpp"
+#include "interval.hpp"
+#include "constant.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace SignalTracer {
+
+    struct PagedBVHStats {
+        uint64_t hits{ 0 };             // treelets found resident
+        uint64_t misses{ 0 };           // treelets paged in from the file
+        uint64_t evictions{ 0 };
+        std::size_t resident_bytes{ 0 };
+        uint32_t resident_treelets{ 0 };
+        uint32_t treelet_count{ 0 };
+
+        friend std::ostream& operator<<(std::ostream& out, const PagedBVHStats& stats) {
+            uint64_t lookups = stats.hits + stats.misses;
+            out << "Paged BVH: " << stats.resident_treelets << " / " << stats.treelet_count << " treelets resident ("
+                << stats.resident_bytes / 1024.0 / 1024.0 << " MiB)"
+                << ", hits: " << stats.hits << ", misses: " << stats.misses
+                << " (" << (lookups > 0 ? 100.0 * stats.misses / lookups : 0.0) << " %)"
+                << ", evictions: " << stats.evictions << std::endl;
+            return out;
+        }
+    };
+
+    /*
+        ----------------------------------------
+        PagedBVH
+        Out-of-core copy of a collapsed BLAS for scenes larger than memory.
+        The wide nodes are cut into treelets of at most treelet_nodes nodes,
+        filled breadth-first like NodeLayout::Treelet. Each treelet is written
+        with the triangle blocks of its leaves, page aligned, to one file
+        that is memory-mapped read-only.
+        A lane that leads into another treelet is stored as a leaf lane
+        with count TREELET_LINK and the treelet id as child, so the wide
+        traversals run unchanged inside a treelet and descend through the link.
+        Treelet 0, the top of the tree, stays resident. The others are copied
+        out of the mapping on first use and evicted least recently used
+        when the resident bytes exceed the budget.
+        ----------------------------------------
+    */
+    class PagedBVH {
+    public:
+        static constexpr uint32_t TREELET_LINK{ Constant::INVALID_IDX };
+
+        /// @brief Write a collapsed BLAS as treelets.
+        /// @param treelet_nodes nodes per treelet, 0 picks about 64 KiB of nodes
+        /// @return false if the file could not be written
+        static bool write(const std::string& path, const WideBVH& wide, const TriangleBlocks& blocks, uint32_t treelet_nodes = 0);
+
+        /// @brief Map a file written by write().
+        /// @param memory_budget bytes of paged treelets kept resident, the top treelet is not counted
+        explicit PagedBVH(const std::string& path, std::size_t memory_budget);
+        ~PagedBVH();
+
+        PagedBVH(const PagedBVH&) = delete;
+        PagedBVH& operator=(const PagedBVH&) = delete;
+
+        /// @brief False if the file could not be mapped or is not a treelet file.
+        bool is_open() const { return m_data != nullptr; }
+        const std::string& get_path() const { return m_path; }
+        int get_width() const { return m_width; }
+        std::size_t get_memory_budget() const { return m_memory_budget; }
+        PagedBVHStats get_stats() const;
+
+        /// @brief Bytes of the resident treelets and the treelet table.
+        std::size_t memory_usage() const;
+
+        /// @brief Closest hit within the interval.
+        /// @param normal receives the geometric normal of the triangle
+        bool intersect(const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id, glm::vec3& normal) const;
+
+        /// @brief True if any triangle is hit within the interval.
+        bool occluded(const Ray& ray, const Interval& interval) const;
+
+    private:
+        struct Treelet {
+            WideNodeArray<4> nodes4{};
+            WideNodeArray<8> nodes8{};
+            TransformBlockArray<4> blocks4{};
+            TransformBlockArray<8> blocks8{};
+            std::size_t bytes{ 0 };
+        };
+
+        struct TreeletEntry {
+            uint64_t offset{ 0 };   // page aligned offset of the nodes in the file, the blocks follow them
+            uint32_t node_count{ 0 };
+            uint32_t block_count{ 0 };
+        };
+
+        struct Slot {
+            std::shared_ptr<const Treelet> treelet{};
+            std::list<uint32_t>::iterator lru{};
+        };
+
+        template <int W>
+        static bool write_treelets(std::ostream& out, const WideNodeArray<W>& nodes, const TransformBlockArray<W>& blocks, uint32_t treelet_nodes);
+
+        /// @brief Resident treelet, paged in and made most recently used.
+        std::shared_ptr<const Treelet> acquire(uint32_t treelet_id) const;
+        std::shared_ptr<const Treelet> load(uint32_t treelet_id) const;
+
+        template <int W>
+        bool intersect_treelet(uint32_t treelet_id, const Ray& ray, Interval& interval, uint32_t& prim_id, glm::vec3& normal) const;
+        template <int W>
+        bool occluded_treelet(uint32_t treelet_id, const Ray& ray, const Interval& interval) const;
+
+        std::string m_path{};
+        const unsigned char* m_data{ nullptr };
+        std::size_t m_size{ 0 };
+        int m_width{ 4 };
+        std::size_t m_memory_budget{ 0 };
+        std::vector<TreeletEntry> m_table{};
+        std::shared_ptr<const Treelet> m_top{};
+
+        mutable std::mutex m_mutex{}; // guards the slots, the LRU list and the counters
+        mutable std::vector<Slot> m_slots{};
+        mutable std::list<uint32_t> m_lru{}; // most recently used first
+        mutable PagedBVHStats m_stats{};
+    };
+}
+
+#endif // !PAGED_BVH_HPP
@@ -0,0 +1,92 @@
+#pragma once
+
+#ifndef SBVH_BUILDER_HPP
+#define SBVH_BUILDER_HPP
+
+#include "bvh_map.hpp"
+#include "triangle_store.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        SBVHBuilder
+        Spatial split BVH (Stich et al. 2009).
+        Besides the binned object split, every node also considers
+        splitting space: triangles that straddle the plane are clipped,
+        and each side gets a reference with a tighter box.
+        This pays off for long wall and ground triangles,
+        whose boxes overlap a lot under object splits alone.
+        References are duplicated only while the total stays within
+        split_budget x the triangle count.
+        ----------------------------------------
+    */
+    class SBVHBuilder {
+    public:
+        SBVHBuilder(const TriangleStore& store, const BVHBuildOptions& options, uint32_t block_width);
+
+        /// @brief Build the binary tree.
+        /// @param nodes receives the nodes, node 1 is left unused like the other builders
+        /// @param prim_indices receives the primitive ids of the leaves, with duplicates
+        /// @return the number of used nodes, including the unused node 1
+        uint32_t build(std::vector<BVHNode>& nodes, std::vector<uint>& prim_indices);
+
+        /// @brief Number of references after the build, at least the triangle count.
+        std::size_t get_reference_count() const { return m_ref_count; }
+
+    private:
+        struct Box {
+            glm::vec3 min{ Constant::INF_POS };
+            glm::vec3 max{ Constant::INF_NEG };
+
+            void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+            void grow(const Box& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+            Box intersect(const Box& b) const { return Box{ glm::max(min, b.min), glm::min(max, b.max) }; }
+            bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+            float area() const {
+                if (!valid()) { return 0.0f; }
+                glm::vec3 e = max - min;
+                return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+            }
+            glm::vec3 center() const { return (min + max) * 0.5f; }
+        };
+
+        struct Reference {
+            Box box{};
+            uint32_t prim{ 0 };
+        };
+
+        struct Split {
+            float cost{ Constant::INF_POS };
+            int axis{ -1 };
+            float pos{ 0.0f };
+            Box left{}, right{};
+            uint32_t left_count{ 0 }, right_count{ 0 };
+        };
+
+        void subdivide(uint32_t node_idx, std::vector<Reference>& refs, uint32_t depth);
+        Split find_object_split(const std::vector<Reference>& refs) const;
+        Split find_spatial_split(const std::vector<Reference>& refs, const Box& bounds) const;
+        void partition_object(const std::vector<Reference>& refs, const Split& split, std::vector<Reference>& left, std::vector<Reference>& right) const;
+        void partition_spatial(const std::vector<Reference>& refs, const Split& split, std::vector<Reference>& left, std::vector<Reference>& right);
+        void split_reference(const Reference& ref, int axis, float pos, Reference& left, Reference& right) const;
+        void make_leaf(uint32_t node_idx, const std::vector<Reference>& refs);
+        float blocks(uint32_t count) const { return static_cast<float>((count + m_block_width - 1) / m_block_width); }
+
+        const TriangleStore& m_store;
+        BVHBuildOptions m_options{};
+        uint32_t m_block_width{ 4 };
+        float m_min_overlap{ 0.0f };    // spatial splits are tried when object children overlap more than this
+        std::size_t m_max_refs{ 0 };
+        std::size_t m_ref_count{ 0 };
+
+        std::vector<BVHNode>* m_nodes{ nullptr };
+        std::vector<uint>* m_prim_indices{ nullptr };
+        uint32_t m_nodes_used{ 2 };
+    };
+}
+
+#endif // !SBVH_BUILDER_HPP
@@ -10,6 +10,7 @@
 #include "ray.hpp"
 #include "constant.hpp"
 #include "material.hpp"
+#include "material_palette.hpp"
 #include "glm/glm.hpp"
 #include "glm/gtx/string_cast.hpp"
 #include <memory>
@@ -21,7 +22,8 @@ namespace SignalTracer {
 
     public:
         Triangle() = default;
-        Triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, std::shared_ptr<Material> mat_ptr = std::make_shared<Concrete>());
+        // triangles without a material share one concrete instead of allocating their own
+        Triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, std::shared_ptr<Material> mat_ptr = MaterialPalette::default_material());
 
         // copy constructor
         Triangle(const Triangle& rhs);
@@ -72,8 +74,12 @@ namespace SignalTracer {
 
         bool is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const override;
 
+        /// @brief Recompute the bounding box, edges and normal after the vertices changed.
         void update() {
             m_box = AABB{ m_a, m_b, m_c };
+            m_edge_ab = m_b - m_a;
+            m_edge_ac = m_c - m_a;
+            m_normal = glm::normalize(glm::cross(m_edge_ab, m_edge_ac));
         }
 
     private:
@@ -81,6 +87,9 @@ namespace SignalTracer {
         glm::vec3 m_b{};
         glm::vec3 m_c{};
         AABB m_box{};
+        glm::vec3 m_edge_ab{};
+        glm::vec3 m_edge_ac{};
+        glm::vec3 m_normal{};
         std::shared_ptr<Material> m_mat_ptr{};
 
     };
@@ -0,0 +1,476 @@
+#pragma once
+
+#ifndef TRIANGLE_BLOCK_HPP
+#define TRIANGLE_BLOCK_HPP
+
+#include "triangle_store.hpp"
+#include "ray.hpp"
+#include "interval.hpp"
+#include "constant.hpp"
+#include "simd.hpp"
+#include "aligned_allocator.hpp"
+#include "glm/glm.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        TriangleBlock
+        W triangles as vertex and edges in structure of arrays layout,
+        intersected together by one SIMD Moller-Trumbore test.
+        Used where the triangles are rebuilt per ray, e.g. decoded from
+        a compressed BLAS, since it needs no setup beyond two subtractions.
+        Padding lanes have zero edges, so their determinant is zero
+        and they never report a hit.
+        ----------------------------------------
+    */
+    template <int W>
+    struct alignas(32) TriangleBlock {
+        float ax[W], ay[W], az[W];
+        float e1x[W], e1y[W], e1z[W];
+        float e2x[W], e2y[W], e2z[W];
+        uint32_t prim_id[W];
+
+        TriangleBlock() {
+            for (float* arr : { ax, ay, az, e1x, e1y, e1z, e2x, e2y, e2z }) {
+                std::fill_n(arr, W, 0.0f);
+            }
+            std::fill_n(prim_id, W, Constant::INVALID_IDX);
+        }
+
+        void set_lane(int lane, const TriangleStore& store, uint32_t prim) {
+            const glm::vec3& a = store.a(prim);
+            const glm::vec3& e1 = store.get_edge_ab(prim);
+            const glm::vec3& e2 = store.get_edge_ac(prim);
+            ax[lane] = a.x; ay[lane] = a.y; az[lane] = a.z;
+            e1x[lane] = e1.x; e1y[lane] = e1.y; e1z[lane] = e1.z;
+            e2x[lane] = e2.x; e2y[lane] = e2.y; e2z[lane] = e2.z;
+            prim_id[lane] = prim;
+        }
+    };
+
+    template <int W>
+    using TriangleBlockArray = Memory::AlignedVector<TriangleBlock<W>>;
+
+    /* ---- Block kernels: return the nearest hit lane or -1, t receives its distance ---- */
+
+    template <int W>
+    inline int intersect_block_scalar(const TriangleBlock<W>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+        int best_lane = -1;
+        for (int i = 0; i < W; ++i) {
+            glm::vec3 e1{ block.e1x[i], block.e1y[i], block.e1z[i] };
+            glm::vec3 e2{ block.e2x[i], block.e2y[i], block.e2z[i] };
+            glm::vec3 pvec = glm::cross(d, e2);
+            float det = glm::dot(e1, pvec);
+#if defined(CULLING)
+            if (det < Constant::EPSILON) { continue; }
+#else
+            if (std::fabs(det) < Constant::EPSILON) { continue; }
+#endif
+            float inv_det = 1.0f / det;
+            glm::vec3 tvec = o - glm::vec3{ block.ax[i], block.ay[i], block.az[i] };
+            float u = glm::dot(tvec, pvec) * inv_det;
+            if (u < 0.0f || u > 1.0f) { continue; }
+            glm::vec3 qvec = glm::cross(tvec, e1);
+            float v = glm::dot(d, qvec) * inv_det;
+            if (v < 0.0f || u + v > 1.0f) { continue; }
+            float t_hit = glm::dot(e2, qvec) * inv_det;
+            if (t_hit < t_min || t_hit > t_max) { continue; }
+            t_max = t_hit;
+            best_lane = i;
+        }
+        if (best_lane >= 0) { t = t_max; }
+        return best_lane;
+    }
+
+    /// @brief Pick the lane with the smallest distance among the lanes in mask.
+    template <int W>
+    inline int nearest_lane(uint32_t mask, const float* t_lanes, float& t) {
+        int best_lane = -1;
+        float best_t = Constant::INF_POS;
+        while (mask) {
+            int lane = std::countr_zero(mask);
+            mask &= mask - 1;
+            if (t_lanes[lane] < best_t) {
+                best_t = t_lanes[lane];
+                best_lane = lane;
+            }
+        }
+        if (best_lane >= 0) { t = best_t; }
+        return best_lane;
+    }
+
+#if defined(SIGNAL_TRACER_X86)
+    inline int intersect_block_sse(const TriangleBlock<4>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+        const __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+        const __m128 e1x = _mm_load_ps(block.e1x), e1y = _mm_load_ps(block.e1y), e1z = _mm_load_ps(block.e1z);
+        const __m128 e2x = _mm_load_ps(block.e2x), e2y = _mm_load_ps(block.e2y), e2z = _mm_load_ps(block.e2z);
+
+        // pvec = d x e2
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+#if defined(CULLING)
+        __m128 mask = _mm_cmpge_ps(det, _mm_set1_ps(Constant::EPSILON));
+#else
+        __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), det), _mm_set1_ps(Constant::EPSILON));
+#endif
+        __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        // tvec = o - a
+        __m128 tx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_load_ps(block.ax));
+        __m128 ty = _mm_sub_ps(_mm_set1_ps(o.y), _mm_load_ps(block.ay));
+        __m128 tz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_load_ps(block.az));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+        // qvec = tvec x e1
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+        __m128 t_hit = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t_hit, _mm_set1_ps(t_min)), _mm_cmple_ps(t_hit, _mm_set1_ps(t_max))));
+
+        alignas(16) float t_lanes[4];
+        _mm_store_ps(t_lanes, t_hit);
+        return nearest_lane<4>(static_cast<uint32_t>(_mm_movemask_ps(mask)), t_lanes, t);
+    }
+
+    SIGNAL_TRACER_TARGET_AVX2 inline int intersect_block_avx2(const TriangleBlock<8>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+        const __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+        const __m256 e1x = _mm256_load_ps(block.e1x), e1y = _mm256_load_ps(block.e1y), e1z = _mm256_load_ps(block.e1z);
+        const __m256 e2x = _mm256_load_ps(block.e2x), e2y = _mm256_load_ps(block.e2y), e2z = _mm256_load_ps(block.e2z);
+
+        // pvec = d x e2
+        __m256 px = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+        __m256 det = _mm256_fmadd_ps(e1x, px, _mm256_fmadd_ps(e1y, py, _mm256_mul_ps(e1z, pz)));
+#if defined(CULLING)
+        __m256 mask = _mm256_cmp_ps(det, _mm256_set1_ps(Constant::EPSILON), _CMP_GE_OQ);
+#else
+        __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), det), _mm256_set1_ps(Constant::EPSILON), _CMP_GE_OQ);
+#endif
+        __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+        // tvec = o - a
+        __m256 tx = _mm256_sub_ps(_mm256_set1_ps(o.x), _mm256_load_ps(block.ax));
+        __m256 ty = _mm256_sub_ps(_mm256_set1_ps(o.y), _mm256_load_ps(block.ay));
+        __m256 tz = _mm256_sub_ps(_mm256_set1_ps(o.z), _mm256_load_ps(block.az));
+        __m256 u = _mm256_mul_ps(_mm256_fmadd_ps(tx, px, _mm256_fmadd_ps(ty, py, _mm256_mul_ps(tz, pz))), inv_det);
+
+        // qvec = tvec x e1
+        __m256 qx = _mm256_fmsub_ps(ty, e1z, _mm256_mul_ps(tz, e1y));
+        __m256 qy = _mm256_fmsub_ps(tz, e1x, _mm256_mul_ps(tx, e1z));
+        __m256 qz = _mm256_fmsub_ps(tx, e1y, _mm256_mul_ps(ty, e1x));
+        __m256 v = _mm256_mul_ps(_mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz))), inv_det);
+        __m256 t_hit = _mm256_mul_ps(_mm256_fmadd_ps(e2x, qx, _mm256_fmadd_ps(e2y, qy, _mm256_mul_ps(e2z, qz))), inv_det);
+
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t_hit, _mm256_set1_ps(t_min), _CMP_GE_OQ), _mm256_cmp_ps(t_hit, _mm256_set1_ps(t_max), _CMP_LE_OQ)));
+
+        alignas(32) float t_lanes[8];
+        _mm256_store_ps(t_lanes, t_hit);
+        return nearest_lane<8>(static_cast<uint32_t>(_mm256_movemask_ps(mask)), t_lanes, t);
+    }
+#endif
+
+    /// @brief Nearest hit lane of one block with the widest kernel available, or -1.
+    template <int W>
+    inline int intersect_block(const TriangleBlock<W>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+#if defined(SIGNAL_TRACER_X86)
+        if constexpr (W == 8) {
+            return SIMD::has_avx2() ? intersect_block_avx2(block, o, d, t_min, t_max, t) : intersect_block_scalar<8>(block, o, d, t_min, t_max, t);
+        }
+        else {
+            return intersect_block_sse(block, o, d, t_min, t_max, t);
+        }
+#else
+        return intersect_block_scalar<W>(block, o, d, t_min, t_max, t);
+#endif
+    }
+
+    /*
+        ----------------------------------------
+        TransformBlock
+        W triangles of a BVH leaf as Baldwin-Weber affine transforms,
+        precomputed at build time in leaf order.
+        Each row maps a world point to one triangle coordinate:
+        u and v are barycentric, the plane row is the signed distance
+        scaled so that its largest normal component has magnitude 1.
+        A hit needs three dot products, one division and no cross product,
+        and the plane row doubles as the geometric normal.
+        Padding and degenerate lanes are all zero and never report a hit.
+        ----------------------------------------
+    */
+    template <int W>
+    struct alignas(32) TransformBlock {
+        float ux[W], uy[W], uz[W], uw[W];
+        float vx[W], vy[W], vz[W], vw[W];
+        float nx[W], ny[W], nz[W], nw[W];
+        uint32_t prim_id[W];
+
+        TransformBlock() {
+            for (float* arr : { ux, uy, uz, uw, vx, vy, vz, vw, nx, ny, nz, nw }) {
+                std::fill_n(arr, W, 0.0f);
+            }
+            std::fill_n(prim_id, W, Constant::INVALID_IDX);
+        }
+
+        void set_lane(int lane, const TriangleStore& store, uint32_t prim) {
+            set_lane(lane, store.a(prim), store.get_edge_ab(prim), store.get_edge_ac(prim), prim);
+        }
+
+        /// @param e1 edge from a to b, e2 edge from a to c
+        void set_lane(int lane, const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, uint32_t prim) {
+            prim_id[lane] = prim;
+            // doubles keep the rows of thin triangles far from the origin accurate
+            glm::dvec3 da{ a }, de1{ e1 }, de2{ e2 };
+            glm::dvec3 n = glm::cross(de1, de2);
+            int k = std::fabs(n.x) > std::fabs(n.y) ? (std::fabs(n.x) > std::fabs(n.z) ? 0 : 2) : (std::fabs(n.y) > std::fabs(n.z) ? 1 : 2);
+            if (n[k] == 0.0) { return; }
+            int k1 = (k + 1) % 3;
+            int k2 = (k + 2) % 3;
+
+            // u = ((p - a) x e2)[k] / n[k], v = (e1 x (p - a))[k] / n[k]
+            glm::dvec3 u{ 0.0 }, v{ 0.0 };
+            u[k1] = de2[k2] / n[k];
+            u[k2] = -de2[k1] / n[k];
+            v[k1] = -de1[k2] / n[k];
+            v[k2] = de1[k1] / n[k];
+            glm::dvec3 plane = n / std::fabs(n[k]);
+
+            ux[lane] = static_cast<float>(u.x); uy[lane] = static_cast<float>(u.y); uz[lane] = static_cast<float>(u.z);
+            uw[lane] = static_cast<float>(-glm::dot(u, da));
+            vx[lane] = static_cast<float>(v.x); vy[lane] = static_cast<float>(v.y); vz[lane] = static_cast<float>(v.z);
+            vw[lane] = static_cast<float>(-glm::dot(v, da));
+            nx[lane] = static_cast<float>(plane.x); ny[lane] = static_cast<float>(plane.y); nz[lane] = static_cast<float>(plane.z);
+            nw[lane] = static_cast<float>(-glm::dot(plane, da));
+        }
+
+        glm::vec3 get_normal(int lane) const {
+            return glm::normalize(glm::vec3{ nx[lane], ny[lane], nz[lane] });
+        }
+    };
+
+    template <int W>
+    using TransformBlockArray = Memory::AlignedVector<TransformBlock<W>>;
+
+    /*
+        The plane row gives dn = d . n / |n[k]|, so the Moller-Trumbore determinant is -dn * |n[k]|
+        and a front face has dn < 0. EPSILON on dn rejects rays within about 1e-5 rad of the plane.
+    */
+    template <int W>
+    inline int intersect_block_scalar(const TransformBlock<W>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+        int best_lane = -1;
+        for (int i = 0; i < W; ++i) {
+            float dn = block.nx[i] * d.x + block.ny[i] * d.y + block.nz[i] * d.z;
+#if defined(CULLING)
+            if (dn > -Constant::EPSILON) { continue; }
+#else
+            if (std::fabs(dn) < Constant::EPSILON) { continue; }
+#endif
+            float on = block.nx[i] * o.x + block.ny[i] * o.y + block.nz[i] * o.z + block.nw[i];
+            float t_hit = -on / dn;
+            if (t_hit < t_min || t_hit > t_max) { continue; }
+            glm::vec3 p = o + t_hit * d;
+            float u = block.ux[i] * p.x + block.uy[i] * p.y + block.uz[i] * p.z + block.uw[i];
+            float v = block.vx[i] * p.x + block.vy[i] * p.y + block.vz[i] * p.z + block.vw[i];
+            if (u < 0.0f || v < 0.0f || u + v > 1.0f) { continue; }
+            t_max = t_hit;
+            best_lane = i;
+        }
+        if (best_lane >= 0) { t = t_max; }
+        return best_lane;
+    }
+
+#if defined(SIGNAL_TRACER_X86)
+    inline int intersect_block_sse(const TransformBlock<4>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+        const __m128 ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z);
+        const __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+        const __m128 nx = _mm_load_ps(block.nx), ny = _mm_load_ps(block.ny), nz = _mm_load_ps(block.nz);
+
+        __m128 dn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz));
+#if defined(CULLING)
+        __m128 mask = _mm_cmple_ps(dn, _mm_set1_ps(-Constant::EPSILON));
+#else
+        __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), dn), _mm_set1_ps(Constant::EPSILON));
+#endif
+        __m128 on = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, ox), _mm_mul_ps(ny, oy)), _mm_add_ps(_mm_mul_ps(nz, oz), _mm_load_ps(block.nw)));
+        __m128 t_hit = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), on), dn);
+
+        // hit point p = o + t d
+        __m128 px = _mm_add_ps(ox, _mm_mul_ps(t_hit, dx));
+        __m128 py = _mm_add_ps(oy, _mm_mul_ps(t_hit, dy));
+        __m128 pz = _mm_add_ps(oz, _mm_mul_ps(t_hit, dz));
+        __m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(block.ux), px), _mm_mul_ps(_mm_load_ps(block.uy), py)),
+            _mm_add_ps(_mm_mul_ps(_mm_load_ps(block.uz), pz), _mm_load_ps(block.uw)));
+        __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(block.vx), px), _mm_mul_ps(_mm_load_ps(block.vy), py)),
+            _mm_add_ps(_mm_mul_ps(_mm_load_ps(block.vz), pz), _mm_load_ps(block.vw)));
+
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t_hit, _mm_set1_ps(t_min)), _mm_cmple_ps(t_hit, _mm_set1_ps(t_max))));
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+
+        alignas(16) float t_lanes[4];
+        _mm_store_ps(t_lanes, t_hit);
+        return nearest_lane<4>(static_cast<uint32_t>(_mm_movemask_ps(mask)), t_lanes, t);
+    }
+
+    SIGNAL_TRACER_TARGET_AVX2 inline int intersect_block_avx2(const TransformBlock<8>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+        const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+        const __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+        const __m256 nx = _mm256_load_ps(block.nx), ny = _mm256_load_ps(block.ny), nz = _mm256_load_ps(block.nz);
+
+        __m256 dn = _mm256_fmadd_ps(nx, dx, _mm256_fmadd_ps(ny, dy, _mm256_mul_ps(nz, dz)));
+#if defined(CULLING)
+        __m256 mask = _mm256_cmp_ps(dn, _mm256_set1_ps(-Constant::EPSILON), _CMP_LE_OQ);
+#else
+        __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), dn), _mm256_set1_ps(Constant::EPSILON), _CMP_GE_OQ);
+#endif
+        __m256 on = _mm256_fmadd_ps(nx, ox, _mm256_fmadd_ps(ny, oy, _mm256_fmadd_ps(nz, oz, _mm256_load_ps(block.nw))));
+        __m256 t_hit = _mm256_div_ps(_mm256_sub_ps(_mm256_setzero_ps(), on), dn);
+
+        // hit point p = o + t d
+        __m256 px = _mm256_fmadd_ps(t_hit, dx, ox);
+        __m256 py = _mm256_fmadd_ps(t_hit, dy, oy);
+        __m256 pz = _mm256_fmadd_ps(t_hit, dz, oz);
+        __m256 u = _mm256_fmadd_ps(_mm256_load_ps(block.ux), px, _mm256_fmadd_ps(_mm256_load_ps(block.uy), py,
+            _mm256_fmadd_ps(_mm256_load_ps(block.uz), pz, _mm256_load_ps(block.uw))));
+        __m256 v = _mm256_fmadd_ps(_mm256_load_ps(block.vx), px, _mm256_fmadd_ps(_mm256_load_ps(block.vy), py,
+            _mm256_fmadd_ps(_mm256_load_ps(block.vz), pz, _mm256_load_ps(block.vw))));
+
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t_hit, _mm256_set1_ps(t_min), _CMP_GE_OQ), _mm256_cmp_ps(t_hit, _mm256_set1_ps(t_max), _CMP_LE_OQ)));
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+
+        alignas(32) float t_lanes[8];
+        _mm256_store_ps(t_lanes, t_hit);
+        return nearest_lane<8>(static_cast<uint32_t>(_mm256_movemask_ps(mask)), t_lanes, t);
+    }
+#endif
+
+    /// @brief Nearest hit lane of one transform block with the widest kernel available, or -1.
+    template <int W>
+    inline int intersect_block(const TransformBlock<W>& block, const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, float& t) {
+#if defined(SIGNAL_TRACER_X86)
+        if constexpr (W == 8) {
+            return SIMD::has_avx2() ? intersect_block_avx2(block, o, d, t_min, t_max, t) : intersect_block_scalar<8>(block, o, d, t_min, t_max, t);
+        }
+        else {
+            return intersect_block_sse(block, o, d, t_min, t_max, t);
+        }
+#else
+        return intersect_block_scalar<W>(block, o, d, t_min, t_max, t);
+#endif
+    }
+
+    /*
+        ----------------------------------------
+        TriangleBlocks
+        The leaves of a BLAS packed into 4-wide (SSE) or 8-wide (AVX2) transform blocks.
+        A leaf with n triangles owns ceil(n / W) consecutive blocks.
+        ----------------------------------------
+    */
+    class TriangleBlocks {
+    public:
+        TriangleBlocks() = default;
+
+        /// @brief Drop all blocks and set the lane count, 0 selects the widest available.
+        void reset(int width = 0) {
+            m_width = width == 0 ? SIMD::default_width() : width;
+            m_blocks4.clear();
+            m_blocks8.clear();
+        }
+
+        /// @brief Pack the triangles of one leaf.
+        /// @return The index of the first block of the leaf.
+        uint32_t add_leaf(const TriangleStore& store, const uint32_t* prim_indices, uint32_t count) {
+            return m_width == 8 ? add_leaf(m_blocks8, store, prim_indices, count) : add_leaf(m_blocks4, store, prim_indices, count);
+        }
+
+        int get_width() const { return m_width; }
+        uint32_t get_block_count(uint32_t tri_count) const { return (tri_count + m_width - 1) / m_width; }
+        std::size_t size() const { return m_width == 8 ? m_blocks8.size() : m_blocks4.size(); }
+        std::size_t memory_usage() const {
+            return m_blocks4.size() * sizeof(TransformBlock<4>) + m_blocks8.size() * sizeof(TransformBlock<8>);
+        }
+
+        /// @brief Nearest hit among the blocks [first, first + count).
+        /// @param t receives the hit distance, prim_id the primitive id in the triangle store.
+        bool intersect(uint32_t first, uint32_t count, const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id) const {
+            const glm::vec3& o = ray.get_origin();
+            const glm::vec3& d = ray.get_direction();
+            float t_max = interval.max();
+            bool hit_flag = false;
+            for (uint32_t i = first; i < first + count; ++i) {
+                float t_hit{};
+                int lane{ -1 };
+                if (m_width == 8) {
+                    lane = intersect_block<8>(m_blocks8[i], o, d, interval.min(), t_max, t_hit);
+                    if (lane >= 0) { prim_id = m_blocks8[i].prim_id[lane]; }
+                }
+                else {
+                    lane = intersect_block<4>(m_blocks4[i], o, d, interval.min(), t_max, t_hit);
+                    if (lane >= 0) { prim_id = m_blocks4[i].prim_id[lane]; }
+                }
+                if (lane >= 0) {
+                    t_max = t_hit;
+                    hit_flag = true;
+                }
+            }
+            if (hit_flag) { t = t_max; }
+            return hit_flag;
+        }
+
+        /// @brief True if any triangle of the blocks [first, first + count) is hit within the interval.
+        bool occluded(uint32_t first, uint32_t count, const Ray& ray, const Interval& interval) const {
+            const glm::vec3& o = ray.get_origin();
+            const glm::vec3& d = ray.get_direction();
+            for (uint32_t i = first; i < first + count; ++i) {
+                float t_hit{};
+                int lane = m_width == 8 ? intersect_block<8>(m_blocks8[i], o, d, interval.min(), interval.max(), t_hit)
+                    : intersect_block<4>(m_blocks4[i], o, d, interval.min(), interval.max(), t_hit);
+                if (lane >= 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const TransformBlockArray<4>& get_blocks4() const { return m_blocks4; }
+        const TransformBlockArray<8>& get_blocks8() const { return m_blocks8; }
+
+    private:
+        template <int W>
+        static uint32_t add_leaf(TransformBlockArray<W>& blocks, const TriangleStore& store, const uint32_t* prim_indices, uint32_t count) {
+            uint32_t first = static_cast<uint32_t>(blocks.size());
+            for (uint32_t i = 0; i < count; i += W) {
+                TransformBlock<W>& block = blocks.emplace_back();
+                for (uint32_t lane = 0; lane < W && i + lane < count; ++lane) {
+                    block.set_lane(lane, store, prim_indices[i + lane]);
+                }
+            }
+            return first;
+        }
+
+        TransformBlockArray<4> m_blocks4{};
+        TransformBlockArray<8> m_blocks8{};
+        int m_width{ 4 };
+    };
+}
+
+#endif // !TRIANGLE_BLOCK_HPP
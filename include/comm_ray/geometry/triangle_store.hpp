@@ -0,0 +1,109 @@
+#pragma once
+
+#ifndef TRIANGLE_STORE_HPP
+#define TRIANGLE_STORE_HPP
+
+#include "aabb.hpp"
+#include "interval.hpp"
+#include "ray.hpp"
+#include "constant.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /// @brief Structure-of-arrays storage for the triangles owned by a BLAS.
+    /// @details Each attribute lives in its own contiguous array, indexed by the primitive id.
+    /// Edges and normals are precomputed once when a triangle is added, so the intersection
+    /// test touches only plain floats and never allocates.
+    /// Vertex b and c are reconstructed as a + edge_ab and a + edge_ac, which keeps the bounds
+    /// consistent with the geometry used by the intersection test.
+    class TriangleStore {
+    public:
+        TriangleStore() = default;
+
+        void reserve(std::size_t count);
+        void clear();
+
+        /// @brief Free the vertices, edges and normals, keeping the material ids.
+        /// @details For a compressed BLAS that traces its own copy of the triangles.
+        void release_geometry();
+        bool has_geometry() const { return !m_a.empty(); }
+
+        /// @brief Append a triangle to the store.
+        /// @return The primitive id of the new triangle.
+        uint32_t add(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint16_t mat_id = 0);
+
+        /// @brief Replace the vertices of an existing triangle (dynamic geometry).
+        void set(uint32_t prim_id, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+        std::size_t size() const { return m_mat_ids.size(); }
+        bool empty() const { return m_mat_ids.empty(); }
+
+        const glm::vec3& a(uint32_t prim_id) const { return m_a[prim_id]; }
+        glm::vec3 b(uint32_t prim_id) const { return m_a[prim_id] + m_edge_ab[prim_id]; }
+        glm::vec3 c(uint32_t prim_id) const { return m_a[prim_id] + m_edge_ac[prim_id]; }
+        const glm::vec3& get_edge_ab(uint32_t prim_id) const { return m_edge_ab[prim_id]; }
+        const glm::vec3& get_edge_ac(uint32_t prim_id) const { return m_edge_ac[prim_id]; }
+        const glm::vec3& get_normal(uint32_t prim_id) const { return m_normals[prim_id]; }
+        uint16_t get_mat_id(uint32_t prim_id) const { return m_mat_ids[prim_id]; }
+        void set_mat_id(uint32_t prim_id, uint16_t mat_id) { m_mat_ids[prim_id] = mat_id; }
+
+        glm::vec3 get_centroid(uint32_t prim_id) const;
+        glm::vec3 get_min(uint32_t prim_id) const;
+        glm::vec3 get_max(uint32_t prim_id) const;
+        AABB bounding_box(uint32_t prim_id) const;
+
+        /// @brief Bytes held by the arrays of the store.
+        std::size_t memory_usage() const;
+
+        /// @brief Tomas Moller and Ben Trumbore ray-triangle test on the precomputed edges.
+        /// @param t distance along the ray if the triangle is hit.
+        /// @return true if the triangle is hit inside the interval.
+        bool is_hit(uint32_t prim_id, const Ray& ray, const Interval& interval, float& t) const {
+            const glm::vec3& edge_ab = m_edge_ab[prim_id];
+            const glm::vec3& edge_ac = m_edge_ac[prim_id];
+            glm::vec3 pvec = glm::cross(ray.get_direction(), edge_ac);
+            float det = glm::dot(edge_ab, pvec);
+#if defined(CULLING)
+            if (det < Constant::EPSILON) {
+                return false;
+            }
+#else
+            if (std::fabs(det) < Constant::EPSILON) {
+                return false;
+            }
+#endif
+            float inv_det = 1.0f / det;
+
+            glm::vec3 tvec = ray.get_origin() - m_a[prim_id];
+            float u = glm::dot(tvec, pvec) * inv_det;
+            if (u < 0.0f || u > 1.0f) {
+                return false;
+            }
+
+            glm::vec3 qvec = glm::cross(tvec, edge_ab);
+            float v = glm::dot(ray.get_direction(), qvec) * inv_det;
+            if (v < 0.0f || u + v > 1.0f) {
+                return false;
+            }
+
+            float t_hit = glm::dot(edge_ac, qvec) * inv_det;
+            if (!interval.contains(t_hit)) {
+                return false;
+            }
+            t = t_hit;
+            return true;
+        }
+
+    private:
+        std::vector<glm::vec3> m_a{};
+        std::vector<glm::vec3> m_edge_ab{};
+        std::vector<glm::vec3> m_edge_ac{};
+        std::vector<glm::vec3> m_normals{};
+        std::vector<uint16_t> m_mat_ids{};
+    };
+}
+
+#endif // !TRIANGLE_STORE_HPP
@@ -0,0 +1,644 @@
+#pragma once
+
+#ifndef WIDE_BVH_HPP
+#define WIDE_BVH_HPP
+
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "interval.hpp"
+#include "constant.hpp"
+#include "simd.hpp"
+#include "aligned_allocator.hpp"
+#include "glm/glm.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /// @brief Deepest binary BVH a WideBVH collapses, every builder makes leaves at this depth.
+    /// @details A collapsed node is at most as deep as its binary node, so a traversal stack
+    /// of 64 * W entries holds the W - 1 siblings left on each level plus the W children of the last.
+    constexpr uint32_t BVH_MAX_DEPTH{ 64 };
+
+    /// @brief Order of the nodes of a WideBVH in memory, parents always come before their children.
+    enum class NodeLayout {
+        DepthFirst,     // collapse order, only the first internal child follows its parent
+        Siblings,       // depth-first, the internal children of a node are stored side by side
+        Treelet,        // breadth-first treelets of about a page each, van Emde Boas style
+    };
+
+    /*
+        ----------------------------------------
+        WideBVHNode
+        A node of a collapsed W-wide BVH.
+        The bounds of the W children are stored as structure of arrays
+        so that all W slab tests run in one SIMD instruction sequence.
+        count[i] == 0 -> child[i] is the index of an internal node
+        count[i] > 0  -> leaf, child[i] is the first item of the leaf
+                         (a primitive, a triangle block or a BVH instance)
+        Unused lanes have an inverted box and are masked out by lane_mask.
+        ----------------------------------------
+    */
+    template <int W>
+    struct alignas(32) WideBVHNode {
+        float min_x[W], min_y[W], min_z[W];
+        float max_x[W], max_y[W], max_z[W];
+        uint32_t child[W];
+        uint32_t count[W];
+        uint32_t lane_mask{ 0 };
+
+        WideBVHNode() {
+            std::fill_n(min_x, W, Constant::INF_POS);
+            std::fill_n(min_y, W, Constant::INF_POS);
+            std::fill_n(min_z, W, Constant::INF_POS);
+            std::fill_n(max_x, W, Constant::INF_NEG);
+            std::fill_n(max_y, W, Constant::INF_NEG);
+            std::fill_n(max_z, W, Constant::INF_NEG);
+            std::fill_n(child, W, Constant::INVALID_IDX);
+            std::fill_n(count, W, 0u);
+        }
+
+        void set_lane(int lane, const glm::vec3& bmin, const glm::vec3& bmax, uint32_t child_idx, uint32_t prim_count) {
+            min_x[lane] = bmin.x; min_y[lane] = bmin.y; min_z[lane] = bmin.z;
+            max_x[lane] = bmax.x; max_y[lane] = bmax.y; max_z[lane] = bmax.z;
+            child[lane] = child_idx;
+            count[lane] = prim_count;
+            lane_mask |= 1u << lane;
+        }
+    };
+
+    /* ---- Slab tests: return the mask of hit lanes and the entry distance of each lane ---- */
+
+    template <int W>
+    struct ScalarSlab {
+        ScalarSlab(const glm::vec3& origin, const glm::vec3& rdirection)
+            : o{ origin }, rd{ rdirection } {}
+
+        template <typename Node>
+        uint32_t test(const Node& node, float t_min, float t_max, float* dist) const {
+            uint32_t mask = 0;
+            for (int i = 0; i < W; ++i) {
+                float tx0 = (node.min_x[i] - o.x) * rd.x, tx1 = (node.max_x[i] - o.x) * rd.x;
+                float ty0 = (node.min_y[i] - o.y) * rd.y, ty1 = (node.max_y[i] - o.y) * rd.y;
+                float tz0 = (node.min_z[i] - o.z) * rd.z, tz1 = (node.max_z[i] - o.z) * rd.z;
+                float t_near = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), t_min));
+                float t_far = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), t_max));
+                dist[i] = t_near;
+                mask |= static_cast<uint32_t>(t_near <= t_far) << i;
+            }
+            return mask & node.lane_mask;
+        }
+
+        glm::vec3 o;
+        glm::vec3 rd;
+    };
+
+#if defined(SIGNAL_TRACER_X86)
+    struct SSESlab {
+        SSESlab(const glm::vec3& origin, const glm::vec3& rdirection)
+            : ox{ _mm_set1_ps(origin.x) }, oy{ _mm_set1_ps(origin.y) }, oz{ _mm_set1_ps(origin.z) }
+            , rdx{ _mm_set1_ps(rdirection.x) }, rdy{ _mm_set1_ps(rdirection.y) }, rdz{ _mm_set1_ps(rdirection.z) } {}
+
+        template <typename Node>
+        uint32_t test(const Node& node, float t_min, float t_max, float* dist) const {
+            __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), ox), rdx);
+            __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), ox), rdx);
+            __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), oy), rdy);
+            __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), oy), rdy);
+            __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), oz), rdz);
+            __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), oz), rdz);
+            __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_set1_ps(t_min)));
+            __m128 t_far = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(t_max)));
+            _mm_storeu_ps(dist, t_near);
+            return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) & node.lane_mask;
+        }
+
+        __m128 ox, oy, oz;
+        __m128 rdx, rdy, rdz;
+    };
+
+    struct AVX2Slab {
+        SIGNAL_TRACER_TARGET_AVX2 AVX2Slab(const glm::vec3& origin, const glm::vec3& rdirection)
+            : ox{ _mm256_set1_ps(origin.x) }, oy{ _mm256_set1_ps(origin.y) }, oz{ _mm256_set1_ps(origin.z) }
+            , rdx{ _mm256_set1_ps(rdirection.x) }, rdy{ _mm256_set1_ps(rdirection.y) }, rdz{ _mm256_set1_ps(rdirection.z) } {
+            // (b - o) * rd = b * rd - o * rd, one fused multiply-add per slab
+            ordx = _mm256_mul_ps(ox, rdx);
+            ordy = _mm256_mul_ps(oy, rdy);
+            ordz = _mm256_mul_ps(oz, rdz);
+            // on an axis the ray is parallel to, b * inf - o * inf is NaN, those slabs are tested on the origin instead
+            for (int axis = 0; axis < 3; ++axis) {
+                parallel_mask |= static_cast<uint32_t>(!std::isfinite(rdirection[axis])) << axis;
+            }
+        }
+
+        template <typename Node>
+        SIGNAL_TRACER_TARGET_AVX2 uint32_t test(const Node& node, float t_min, float t_max, float* dist) const {
+            __m256 tx0, tx1, ty0, ty1, tz0, tz1;
+            slab(_mm256_load_ps(node.min_x), _mm256_load_ps(node.max_x), ox, rdx, ordx, parallel_mask & 1u, tx0, tx1);
+            slab(_mm256_load_ps(node.min_y), _mm256_load_ps(node.max_y), oy, rdy, ordy, parallel_mask & 2u, ty0, ty1);
+            slab(_mm256_load_ps(node.min_z), _mm256_load_ps(node.max_z), oz, rdz, ordz, parallel_mask & 4u, tz0, tz1);
+            __m256 t_near = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_set1_ps(t_min)));
+            __m256 t_far = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(t_max)));
+            _mm256_storeu_ps(dist, t_near);
+            return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ))) & node.lane_mask;
+        }
+
+        /// @brief Entry and exit of one axis, (-inf, inf) or (inf, inf) on a parallel axis depending on whether the origin is inside the slab.
+        SIGNAL_TRACER_TARGET_AVX2 static void slab(__m256 lo, __m256 hi, __m256 o, __m256 rd, __m256 ord, bool parallel, __m256& t0, __m256& t1) {
+            if (parallel) [[unlikely]] {
+                __m256 inside = _mm256_and_ps(_mm256_cmp_ps(lo, o, _CMP_LE_OQ), _mm256_cmp_ps(o, hi, _CMP_LE_OQ));
+                t1 = _mm256_set1_ps(Constant::INF_POS);
+                t0 = _mm256_blendv_ps(t1, _mm256_set1_ps(Constant::INF_NEG), inside);
+                return;
+            }
+            t0 = _mm256_fmsub_ps(lo, rd, ord);
+            t1 = _mm256_fmsub_ps(hi, rd, ord);
+        }
+
+        __m256 ox, oy, oz;
+        __m256 rdx, rdy, rdz;
+        __m256 ordx, ordy, ordz;
+        uint32_t parallel_mask{ 0 };    // bit per axis
+    };
+#endif
+
+    /// @brief Closest-hit traversal of a W-wide BVH.
+    /// @details Node is WideBVHNode or any node with child, count and the bounds the slab reads.
+    /// @param leaf called as leaf(first, count, interval) for every leaf lane reached by the ray.
+    /// It returns true on a hit and shrinks interval.max() to the hit distance.
+    template <int W, typename Node, typename Slab, typename LeafFn>
+    inline bool traverse_wide(const Node* nodes, const Slab& slab, Interval& interval, LeafFn& leaf) {
+        struct Entry { uint32_t node_idx; float dist; };
+        Entry stack[64 * W];
+        uint32_t stack_ptr = 0;
+        Entry entry{ 0, interval.min() };
+
+        bool hit_flag = false;
+        while (true) {
+            if (entry.dist <= interval.max()) {
+                const Node& node = nodes[entry.node_idx];
+                alignas(32) float dist[W];
+                uint32_t mask = slab.test(node, interval.min(), interval.max(), dist);
+
+                // sort the hit lanes front to back
+                int lanes[W];
+                int hit_count = 0;
+                while (mask) {
+                    int lane = std::countr_zero(mask);
+                    mask &= mask - 1;
+                    int j = hit_count++;
+                    while (j > 0 && dist[lanes[j - 1]] > dist[lane]) {
+                        lanes[j] = lanes[j - 1];
+                        --j;
+                    }
+                    lanes[j] = lane;
+                }
+
+                // leaves are intersected right away, internal nodes are pushed far to near
+                for (int i = 0; i < hit_count; ++i) {
+                    int lane = lanes[i];
+                    if (node.count[lane] > 0 && dist[lane] <= interval.max()) {
+                        hit_flag |= leaf(node.child[lane], node.count[lane], interval);
+                    }
+                }
+                for (int i = hit_count - 1; i >= 0; --i) {
+                    int lane = lanes[i];
+                    if (node.count[lane] == 0 && dist[lane] <= interval.max()) {
+                        stack[stack_ptr++] = Entry{ node.child[lane], dist[lane] };
+                    }
+                }
+            }
+            if (stack_ptr == 0) { break; }
+            entry = stack[--stack_ptr];
+            // the node below on the stack is fetched while this one is traversed
+            if (stack_ptr > 0) { Memory::prefetch(&nodes[stack[stack_ptr - 1].node_idx]); }
+        }
+        return hit_flag;
+    }
+
+    /// @brief Any-hit traversal of a W-wide BVH, for shadow and visibility rays.
+    /// @details Children are visited in memory order and the traversal stops at the first hit.
+    /// @param leaf called as leaf(first, count, interval), returns true if anything in the leaf blocks the ray.
+    template <int W, typename Node, typename Slab, typename LeafFn>
+    inline bool occluded_wide(const Node* nodes, const Slab& slab, const Interval& interval, LeafFn& leaf) {
+        uint32_t stack[64 * W];
+        uint32_t stack_ptr = 0;
+        uint32_t node_idx = 0;
+        while (true) {
+            const Node& node = nodes[node_idx];
+            alignas(32) float dist[W];
+            uint32_t mask = slab.test(node, interval.min(), interval.max(), dist);
+            while (mask) {
+                int lane = std::countr_zero(mask);
+                mask &= mask - 1;
+                if (node.count[lane] == 0) {
+                    stack[stack_ptr++] = node.child[lane];
+                }
+                else if (leaf(node.child[lane], node.count[lane], interval)) {
+                    return true;
+                }
+            }
+            if (stack_ptr == 0) { break; }
+            node_idx = stack[--stack_ptr];
+            if (stack_ptr > 0) { Memory::prefetch(&nodes[stack[stack_ptr - 1]]); }
+        }
+        return false;
+    }
+
+    /*
+        ----------------------------------------
+        PacketSlab
+        Conservative slab test of a whole ray packet against W boxes.
+        With a shared origin o, each ray enters the slab of an axis at
+        (b_near - o) * rd and leaves it at (b_far - o) * rd. Both are linear
+        in rd, so over [rd_min, rd_max] their bounds lie at the end points.
+        A lane is culled only when the earliest entry of any ray is beyond
+        the latest exit of any ray, so no ray of the packet can reach it.
+        Axes where the packet has no sign (see RayPacket::get_sign) are
+        not tested. dist receives the earliest entry.
+        ----------------------------------------
+    */
+    template <int W>
+    struct PacketSlab {
+        explicit PacketSlab(const RayPacket& packet) : o{ packet.get_origin() } {
+            for (int axis = 0; axis < 3; ++axis) {
+                sign[axis] = packet.get_sign(axis);
+                r0[axis] = packet.get_rd_min()[axis];
+                r1[axis] = packet.get_rd_max()[axis];
+            }
+        }
+
+        uint32_t test(const WideBVHNode<W>& node, float t_min, float t_max, float* dist) const {
+            const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+            const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+            float t_near[W], t_far[W];
+            std::fill_n(t_near, W, t_min);
+            std::fill_n(t_far, W, t_max);
+            for (int axis = 0; axis < 3; ++axis) {
+                if (sign[axis] == 0) { continue; }
+                const float* b_near = sign[axis] > 0 ? lo[axis] : hi[axis];
+                const float* b_far = sign[axis] > 0 ? hi[axis] : lo[axis];
+                for (int i = 0; i < W; ++i) {
+                    float n = b_near[i] - o[axis];
+                    float f = b_far[i] - o[axis];
+                    t_near[i] = std::max(t_near[i], std::min(n * r0[axis], n * r1[axis]));
+                    t_far[i] = std::min(t_far[i], std::max(f * r0[axis], f * r1[axis]));
+                }
+            }
+            uint32_t mask = 0;
+            for (int i = 0; i < W; ++i) {
+                dist[i] = t_near[i];
+                mask |= static_cast<uint32_t>(t_near[i] <= t_far[i]) << i;
+            }
+            return mask & node.lane_mask;
+        }
+
+        glm::vec3 o;
+        float r0[3], r1[3];
+        int sign[3];
+    };
+
+    /// @brief Slab test of one ray against one lane of a node.
+    template <int W>
+    inline bool ray_box_lane(const WideBVHNode<W>& node, int lane, const glm::vec3& o, const glm::vec3& rd, float t_min, float t_max) {
+        float tx0 = (node.min_x[lane] - o.x) * rd.x, tx1 = (node.max_x[lane] - o.x) * rd.x;
+        float ty0 = (node.min_y[lane] - o.y) * rd.y, ty1 = (node.max_y[lane] - o.y) * rd.y;
+        float tz0 = (node.min_z[lane] - o.z) * rd.z, tz1 = (node.max_z[lane] - o.z) * rd.z;
+        float t_near = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), t_min));
+        float t_far = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), t_max));
+        return t_near <= t_far;
+    }
+
+    /// @brief Closest-hit traversal of a W-wide BVH for a packet of rays with a shared origin.
+    /// @details Internal nodes are culled for the whole packet by PacketSlab and visited front to back.
+    /// At leaves every active ray is tested against the leaf box on its own,
+    /// so leaf only sees the rays that reach it.
+    /// @param t_max per ray upper bound, indexed like the packet
+    /// @param leaf called as leaf(first, count, ray_mask), it shrinks t_max of the rays it hits.
+    template <int W, typename LeafFn>
+    inline void traverse_packet(const WideBVHNode<W>* nodes, const RayPacket& packet, float t_min, float* t_max, LeafFn& leaf) {
+        struct Entry { uint32_t node_idx; float dist; };
+        Entry stack[64 * W];
+        uint32_t stack_ptr = 0;
+        Entry entry{ 0, t_min };
+        PacketSlab<W> slab{ packet };
+
+        auto packet_max = [&]() {
+            float t = Constant::INF_NEG;
+            for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+                t = std::max(t, t_max[std::countr_zero(rays)]);
+            }
+            return t;
+        };
+
+        float t_far = packet_max();
+        while (true) {
+            if (entry.dist <= t_far) {
+                const WideBVHNode<W>& node = nodes[entry.node_idx];
+                alignas(32) float dist[W];
+                uint32_t mask = slab.test(node, t_min, t_far, dist);
+
+                // sort the hit lanes front to back
+                int lanes[W];
+                int hit_count = 0;
+                while (mask) {
+                    int lane = std::countr_zero(mask);
+                    mask &= mask - 1;
+                    int j = hit_count++;
+                    while (j > 0 && dist[lanes[j - 1]] > dist[lane]) {
+                        lanes[j] = lanes[j - 1];
+                        --j;
+                    }
+                    lanes[j] = lane;
+                }
+
+                for (int i = 0; i < hit_count; ++i) {
+                    int lane = lanes[i];
+                    if (node.count[lane] == 0 || dist[lane] > t_far) { continue; }
+                    uint32_t ray_mask = 0;
+                    for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+                        int r = std::countr_zero(rays);
+                        const Ray& ray = packet[r];
+                        if (ray_box_lane(node, lane, ray.get_origin(), ray.get_rdirection(), t_min, t_max[r])) {
+                            ray_mask |= 1u << r;
+                        }
+                    }
+                    if (ray_mask) {
+                        leaf(node.child[lane], node.count[lane], ray_mask);
+                        t_far = packet_max();
+                    }
+                }
+                for (int i = hit_count - 1; i >= 0; --i) {
+                    int lane = lanes[i];
+                    if (node.count[lane] == 0 && dist[lane] <= t_far) {
+                        stack[stack_ptr++] = Entry{ node.child[lane], dist[lane] };
+                    }
+                }
+            }
+            if (stack_ptr == 0) { break; }
+            entry = stack[--stack_ptr];
+            if (stack_ptr > 0) { Memory::prefetch(&nodes[stack[stack_ptr - 1].node_idx]); }
+        }
+    }
+
+#if defined(SIGNAL_TRACER_X86)
+    template <typename LeafFn>
+    SIGNAL_TRACER_TARGET_AVX2 bool occluded_wide_avx2(const WideBVHNode<8>* nodes, const Ray& ray, const Interval& interval, LeafFn& leaf) {
+        AVX2Slab slab{ ray.get_origin(), ray.get_rdirection() };
+        return occluded_wide<8>(nodes, slab, interval, leaf);
+    }
+
+    template <typename LeafFn>
+    SIGNAL_TRACER_TARGET_AVX2 void traverse_packet_avx2(const WideBVHNode<8>* nodes, const RayPacket& packet, float t_min, float* t_max, LeafFn& leaf) {
+        traverse_packet<8>(nodes, packet, t_min, t_max, leaf);
+    }
+
+    template <typename LeafFn>
+    SIGNAL_TRACER_TARGET_AVX2 bool traverse_wide_avx2(const WideBVHNode<8>* nodes, const Ray& ray, Interval& interval, LeafFn& leaf) {
+        AVX2Slab slab{ ray.get_origin(), ray.get_rdirection() };
+        return traverse_wide<8>(nodes, slab, interval, leaf);
+    }
+#endif
+
+    /*
+        ----------------------------------------
+        WideBVH
+        Collapses a binary BVH into 4-wide nodes (SSE)
+        or 8-wide nodes (AVX2), selected at runtime.
+        The binary tree is read through a source with:
+            is_leaf(i), left(i), right(i), first(i), count(i), bmin(i), bmax(i)
+        The node arrays start on a cache line and are reordered
+        after the collapse, see NodeLayout.
+        ----------------------------------------
+    */
+    template <int W>
+    using WideNodeArray = Memory::AlignedVector<WideBVHNode<W>>;
+
+    class WideBVH {
+    public:
+        WideBVH() = default;
+
+        /// @brief Collapse a binary BVH rooted at root.
+        /// @param width 4 or 8, 0 selects 8 when AVX2 is available.
+        template <typename Source>
+        void build(const Source& src, uint32_t root, int width = 0, NodeLayout layout = NodeLayout::Siblings) {
+            m_width = width == 0 ? SIMD::default_width() : width;
+            m_nodes4.clear();
+            m_nodes8.clear();
+            if (m_width == 8) {
+                collapse(m_nodes8, src, root);
+                reorder(m_nodes8, layout);
+            }
+            else {
+                collapse(m_nodes4, src, root);
+                reorder(m_nodes4, layout);
+            }
+        }
+
+        void clear() {
+            m_nodes4.clear();
+            m_nodes8.clear();
+        }
+
+        int get_width() const { return m_width; }
+        bool empty() const { return m_nodes4.empty() && m_nodes8.empty(); }
+        const WideNodeArray<4>& get_nodes4() const { return m_nodes4; }
+        const WideNodeArray<8>& get_nodes8() const { return m_nodes8; }
+        std::size_t get_node_count() const { return m_width == 8 ? m_nodes8.size() : m_nodes4.size(); }
+        std::size_t memory_usage() const {
+            return m_nodes4.size() * sizeof(WideBVHNode<4>) + m_nodes8.size() * sizeof(WideBVHNode<8>);
+        }
+
+        template <typename LeafFn>
+        bool traverse(const Ray& ray, Interval& interval, LeafFn&& leaf) const {
+            if (empty()) { return false; }
+            if (m_width == 8) {
+#if defined(SIGNAL_TRACER_X86)
+                if (SIMD::has_avx2()) {
+                    return traverse_wide_avx2(m_nodes8.data(), ray, interval, leaf);
+                }
+#endif
+                ScalarSlab<8> slab{ ray.get_origin(), ray.get_rdirection() };
+                return traverse_wide<8>(m_nodes8.data(), slab, interval, leaf);
+            }
+#if defined(SIGNAL_TRACER_X86)
+            SSESlab slab{ ray.get_origin(), ray.get_rdirection() };
+#else
+            ScalarSlab<4> slab{ ray.get_origin(), ray.get_rdirection() };
+#endif
+            return traverse_wide<4>(m_nodes4.data(), slab, interval, leaf);
+        }
+
+        /// @brief Any-hit traversal, see occluded_wide.
+        template <typename LeafFn>
+        bool occluded(const Ray& ray, const Interval& interval, LeafFn&& leaf) const {
+            if (empty()) { return false; }
+            if (m_width == 8) {
+#if defined(SIGNAL_TRACER_X86)
+                if (SIMD::has_avx2()) {
+                    return occluded_wide_avx2(m_nodes8.data(), ray, interval, leaf);
+                }
+#endif
+                ScalarSlab<8> slab{ ray.get_origin(), ray.get_rdirection() };
+                return occluded_wide<8>(m_nodes8.data(), slab, interval, leaf);
+            }
+#if defined(SIGNAL_TRACER_X86)
+            SSESlab slab{ ray.get_origin(), ray.get_rdirection() };
+#else
+            ScalarSlab<4> slab{ ray.get_origin(), ray.get_rdirection() };
+#endif
+            return occluded_wide<4>(m_nodes4.data(), slab, interval, leaf);
+        }
+
+        /// @brief Closest-hit traversal of a ray packet, see traverse_packet.
+        template <typename LeafFn>
+        void traverse(const RayPacket& packet, float t_min, float* t_max, LeafFn&& leaf) const {
+            if (empty() || packet.get_active() == 0) { return; }
+            if (m_width == 8) {
+#if defined(SIGNAL_TRACER_X86)
+                if (SIMD::has_avx2()) {
+                    traverse_packet_avx2(m_nodes8.data(), packet, t_min, t_max, leaf);
+                    return;
+                }
+#endif
+                traverse_packet<8>(m_nodes8.data(), packet, t_min, t_max, leaf);
+                return;
+            }
+            traverse_packet<4>(m_nodes4.data(), packet, t_min, t_max, leaf);
+        }
+
+    private:
+        template <int W, typename Source>
+        static void collapse(WideNodeArray<W>& nodes, const Source& src, uint32_t root) {
+            nodes.emplace_back();
+            if (src.is_leaf(root)) {
+                nodes[0].set_lane(0, src.bmin(root), src.bmax(root), src.first(root), src.count(root));
+                return;
+            }
+            collapse_node(nodes, src, root, 0, 0);
+        }
+
+        template <int W, typename Source>
+        static void collapse_node(WideNodeArray<W>& nodes, const Source& src, uint32_t binary_idx, uint32_t wide_idx, uint32_t depth) {
+            // the traversal stacks are sized for BVH_MAX_DEPTH, see there
+            assert(depth < BVH_MAX_DEPTH && "binary BVH deeper than BVH_MAX_DEPTH");
+            // open the internal child with the largest surface area until W children are gathered
+            uint32_t children[W];
+            int child_count = 2;
+            children[0] = src.left(binary_idx);
+            children[1] = src.right(binary_idx);
+            while (child_count < W) {
+                int best = -1;
+                float best_area = -1.0f;
+                for (int i = 0; i < child_count; ++i) {
+                    if (src.is_leaf(children[i])) { continue; }
+                    glm::vec3 e = src.bmax(children[i]) - src.bmin(children[i]);
+                    float area = e.x * e.y + e.y * e.z + e.z * e.x;
+                    if (area > best_area) {
+                        best_area = area;
+                        best = i;
+                    }
+                }
+                if (best < 0) { break; }
+                uint32_t opened = children[best];
+                children[best] = src.left(opened);
+                children[child_count++] = src.right(opened);
+            }
+
+            for (int i = 0; i < child_count; ++i) {
+                uint32_t c = children[i];
+                if (src.is_leaf(c)) {
+                    nodes[wide_idx].set_lane(i, src.bmin(c), src.bmax(c), src.first(c), src.count(c));
+                }
+                else {
+                    uint32_t child_idx = static_cast<uint32_t>(nodes.size());
+                    nodes.emplace_back();
+                    nodes[wide_idx].set_lane(i, src.bmin(c), src.bmax(c), child_idx, 0);
+                    collapse_node(nodes, src, c, child_idx, depth + 1);
+                }
+            }
+        }
+
+        /// @brief Move the nodes into the given layout and renumber the child links.
+        template <int W>
+        static void reorder(WideNodeArray<W>& nodes, NodeLayout layout) {
+            if (layout == NodeLayout::DepthFirst || nodes.size() < 3) { return; }
+            std::vector<uint32_t> order{};
+            order.reserve(nodes.size());
+            if (layout == NodeLayout::Siblings) {
+                order.push_back(0);
+                order_siblings(nodes, 0, order);
+            }
+            else {
+                order_treelets(nodes, order);
+            }
+
+            std::vector<uint32_t> new_idx(nodes.size());
+            for (uint32_t i = 0; i < order.size(); ++i) {
+                new_idx[order[i]] = i;
+            }
+            WideNodeArray<W> reordered(nodes.size());
+            for (uint32_t i = 0; i < order.size(); ++i) {
+                WideBVHNode<W>& node = reordered[i];
+                node = nodes[order[i]];
+                for (int lane = 0; lane < W; ++lane) {
+                    if ((node.lane_mask >> lane & 1u) && node.count[lane] == 0) {
+                        node.child[lane] = new_idx[node.child[lane]];
+                    }
+                }
+            }
+            nodes.swap(reordered);
+        }
+
+        template <int W>
+        static void order_siblings(const WideNodeArray<W>& nodes, uint32_t node_idx, std::vector<uint32_t>& order) {
+            const WideBVHNode<W>& node = nodes[node_idx];
+            for (int lane = 0; lane < W; ++lane) {
+                if ((node.lane_mask >> lane & 1u) && node.count[lane] == 0) { order.push_back(node.child[lane]); }
+            }
+            for (int lane = 0; lane < W; ++lane) {
+                if ((node.lane_mask >> lane & 1u) && node.count[lane] == 0) { order_siblings(nodes, node.child[lane], order); }
+            }
+        }
+
+        template <int W>
+        static void order_treelets(const WideNodeArray<W>& nodes, std::vector<uint32_t>& order) {
+            // a treelet is filled breadth-first from its root until it spans a page,
+            // the nodes below it become the roots of the next treelets, visited depth-first
+            const std::size_t treelet_size = std::max<std::size_t>(4096 / sizeof(WideBVHNode<W>), 2);
+            std::vector<uint32_t> roots{ 0 };
+            std::vector<uint32_t> frontier{};
+            while (!roots.empty()) {
+                uint32_t root = roots.back();
+                roots.pop_back();
+                order.push_back(root);
+                frontier.assign(1, root);
+                std::size_t taken = 1;
+                for (std::size_t head = 0; head < frontier.size(); ++head) {
+                    const WideBVHNode<W>& node = nodes[frontier[head]];
+                    for (int lane = 0; lane < W; ++lane) {
+                        if (!(node.lane_mask >> lane & 1u) || node.count[lane] != 0) { continue; }
+                        if (taken < treelet_size) {
+                            order.push_back(node.child[lane]);
+                            frontier.push_back(node.child[lane]);
+                            ++taken;
+                        }
+                        else {
+                            roots.push_back(node.child[lane]);
+                        }
+                    }
+                }
+            }
+        }
+
+        WideNodeArray<4> m_nodes4{};
+        WideNodeArray<8> m_nodes8{};
+        int m_width{ 4 };
+    };
+}
+
+#endif // !WIDE_BVH_HPP
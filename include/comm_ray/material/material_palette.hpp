@@ -0,0 +1,179 @@
+#pragma once
+
+#ifndef MATERIAL_PALETTE_HPP
+#define MATERIAL_PALETTE_HPP
+
+#include "material.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        MaterialPalette
+        Scene-level table of materials, a triangle refers to its material by
+        a 16-bit id instead of owning a shared pointer.
+        It starts with the ITU-R P.2040 materials of material.hpp, in the
+        order of the ITU ids below. OBJ .mtl material names are mapped to
+        them through a keyword table, e.g. "itu_brick" or "Brick_wall" to BRICK.
+        Ids never change once given out. Materials are added while BLASes
+        are built, lookups while tracing are not synchronized with adds.
+        ----------------------------------------
+    */
+    class MaterialPalette {
+    public:
+        static constexpr uint16_t CONCRETE{ 0 };
+        static constexpr uint16_t AIR{ 1 };
+        static constexpr uint16_t BRICK{ 2 };
+        static constexpr uint16_t PLASTERBOARD{ 3 };
+        static constexpr uint16_t WOOD{ 4 };
+        static constexpr uint16_t GLASS{ 5 };
+        static constexpr uint16_t CEILING_BOARD{ 6 };
+        static constexpr uint16_t CHIPBOARD{ 7 };
+        static constexpr uint16_t FLOORBOARD{ 8 };
+        static constexpr uint16_t METAL{ 9 };
+        static constexpr uint16_t VERY_DRY_GROUND{ 10 };
+        static constexpr uint16_t MEDIUM_DRY_GROUND{ 11 };
+        static constexpr uint16_t WET_GROUND{ 12 };
+        static constexpr uint16_t DEFAULT_ID{ CONCRETE }; // unnamed and unknown materials
+
+        MaterialPalette() {
+            add("concrete", default_material());
+            add("air", std::make_shared<Air>());
+            add("brick", std::make_shared<Brick>());
+            add("plasterboard", std::make_shared<Plasterboard>());
+            add("wood", std::make_shared<Wood>());
+            add("glass", std::make_shared<Glass>());
+            add("ceiling_board", std::make_shared<CeilingBoard>());
+            add("chipboard", std::make_shared<Chipboard>());
+            add("floorboard", std::make_shared<Floorboard>());
+            add("metal", std::make_shared<Metal>());
+            add("very_dry_ground", std::make_shared<VeryDryGround>());
+            add("medium_dry_ground", std::make_shared<MediumDryGround>());
+            add("wet_ground", std::make_shared<WetGround>());
+
+            // first match wins, so longer keywords come before the ones they contain
+            m_keywords = {
+                { "very_dry_ground", VERY_DRY_GROUND }, { "medium_dry_ground", MEDIUM_DRY_GROUND }, { "wet_ground", WET_GROUND },
+                { "ceiling", CEILING_BOARD }, { "chipboard", CHIPBOARD }, { "floor", FLOORBOARD },
+                { "plasterboard", PLASTERBOARD }, { "drywall", PLASTERBOARD }, { "gypsum", PLASTERBOARD },
+                { "concrete", CONCRETE }, { "brick", BRICK }, { "wood", WOOD }, { "timber", WOOD },
+                { "glass", GLASS }, { "window", GLASS }, { "metal", METAL }, { "steel", METAL }, { "alumin", METAL },
+                { "ground", MEDIUM_DRY_GROUND }, { "terrain", MEDIUM_DRY_GROUND }, { "soil", MEDIUM_DRY_GROUND },
+            };
+        }
+
+        MaterialPalette(const MaterialPalette&) = delete;
+        MaterialPalette& operator=(const MaterialPalette&) = delete;
+
+        /// @brief The concrete every triangle gets unless it is given a material, shared by all of them.
+        static const std::shared_ptr<Material>& default_material() {
+            static const std::shared_ptr<Material> concrete{ std::make_shared<Concrete>() };
+            return concrete;
+        }
+
+        /// @brief Append a material under a name.
+        /// @return The id of the new material, DEFAULT_ID once all 16-bit ids are used.
+        uint16_t add(const std::string& name, const std::shared_ptr<Material>& material) {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            return add_locked(name, material);
+        }
+
+        /// @brief Id of a material with the same type and parameters, the material is added if there is none.
+        uint16_t find_or_add(const std::shared_ptr<Material>& material) {
+            if (!material) { return DEFAULT_ID; }
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            auto it = m_ids.find(make_key(*material));
+            if (it != m_ids.end()) {
+                return it->second;
+            }
+            return add_locked("", material);
+        }
+
+        /// @brief Id for an OBJ .mtl material name, matched case-insensitively.
+        /// @return The material of that name, else the first one whose keyword is part of the name, else DEFAULT_ID.
+        uint16_t find_name(const std::string& mtl_name) const {
+            std::string name{ to_lower(mtl_name) };
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            auto named = std::find(m_names.begin(), m_names.end(), name);
+            if (!name.empty() && named != m_names.end()) {
+                return static_cast<uint16_t>(named - m_names.begin());
+            }
+            for (const auto& [keyword, id] : m_keywords) {
+                if (name.find(keyword) != std::string::npos) {
+                    return id;
+                }
+            }
+            return DEFAULT_ID;
+        }
+
+        /// @brief Map .mtl names containing a keyword to a material, ahead of the built-in keywords.
+        void map_name(const std::string& keyword, uint16_t id) {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (id >= m_materials.size()) {
+                std::cerr << "MaterialPalette: no material " << id << " for keyword " << keyword << std::endl;
+                return;
+            }
+            m_keywords.emplace(m_keywords.begin(), to_lower(keyword), id);
+        }
+
+        std::size_t size() const { return m_materials.size(); }
+        const std::shared_ptr<Material>& get_material(uint16_t id) const { return m_materials[id]; }
+        const std::string& get_name(uint16_t id) const { return m_names[id]; }
+
+        /// @brief Real relative permittivity of every material at one frequency, indexed by id.
+        /// @param frequency Hz
+        std::vector<float> get_permittivities(float frequency) const {
+            std::vector<float> permittivities(m_materials.size());
+            for (std::size_t i = 0; i < m_materials.size(); ++i) {
+                permittivities[i] = m_materials[i]->calc_real_relative_permittivity(frequency);
+            }
+            return permittivities;
+        }
+
+    private:
+        using MaterialKey = std::tuple<std::type_index, float, float, float, float>;
+
+        static MaterialKey make_key(const Material& material) {
+            return MaterialKey{ std::type_index(typeid(material)), material.get_real_relative_permittivity_a(), material.get_real_relative_permittivity_b(),
+                material.get_conductivity_c(), material.get_conductivity_d() };
+        }
+
+        static std::string to_lower(std::string text) {
+            std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            return text;
+        }
+
+        uint16_t add_locked(const std::string& name, const std::shared_ptr<Material>& material) {
+            if (m_materials.size() > std::numeric_limits<uint16_t>::max()) {
+                std::cerr << "MaterialPalette: too many materials, using material " << DEFAULT_ID << "." << std::endl;
+                return DEFAULT_ID;
+            }
+            uint16_t id = static_cast<uint16_t>(m_materials.size());
+            m_materials.emplace_back(material);
+            m_names.emplace_back(to_lower(name));
+            m_ids.emplace(make_key(*material), id);
+            return id;
+        }
+
+        mutable std::mutex m_mutex{}; // guards adds and the keyword table
+        std::vector<std::shared_ptr<Material>> m_materials{};
+        std::vector<std::string> m_names{};
+        std::map<MaterialKey, uint16_t> m_ids{};    // first id of each distinct material
+        std::vector<std::pair<std::string, uint16_t>> m_keywords{};
+    };
+}
+
+#endif // !MATERIAL_PALETTE_HPP
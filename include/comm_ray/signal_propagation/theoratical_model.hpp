@@ -7,6 +7,7 @@
 #include "path_record.hpp"
 #include "propagation_params.hpp"
 #include "material.hpp"
+#include "material_palette.hpp"
 #include "glm/glm.hpp"
 #include <cmath>
 #include <iostream>
@@ -182,10 +183,13 @@ namespace SignalTracer {
             return 2 * M_PI * time_delay * frequency;
         }
 
-        void calc_all_propagation_properties(std::vector<PathRecord>& ref_records) {
+        /// @param palette materials the ids of the records refer to, e.g. tracer.get_palette()
+        void calc_all_propagation_properties(std::vector<PathRecord>& ref_records, const MaterialPalette& palette) {
+            // one permittivity per material instead of one per reflection
+            const std::vector<float> palette_permittivities{ palette.get_permittivities(m_frequency) };
             for (auto& ref_record : ref_records) {
 
-                std::vector<float> material_permittivities{ setup_permittivity(m_frequency, ref_record.get_mat_ptrs()) };
+                std::vector<float> material_permittivities{ setup_permittivity(palette_permittivities, ref_record.get_mat_ids()) };
 
                 ref_record.set_signal_loss(calc_reflection_loss(m_frequency, ref_record.get_points(), material_permittivities, m_tx_permittivity, m_polarization));
                 ref_record.set_signal_strength(m_tx_power + m_tx_gain + m_rx_gain - ref_record.get_signal_loss());
@@ -225,10 +229,11 @@ namespace SignalTracer {
         }
 
     private:
-        std::vector<float> setup_permittivity(const float& frequency, const std::vector<std::shared_ptr<Material>>& ref_material_ptrs) {
+        std::vector<float> setup_permittivity(const std::vector<float>& palette_permittivities, const std::vector<uint16_t>& ref_mat_ids) {
             std::vector<float> relative_permittivity{};
-            for (const auto& material_ptr : ref_material_ptrs) {
-                relative_permittivity.emplace_back(material_ptr->calc_real_relative_permittivity(frequency));
+            relative_permittivity.reserve(ref_mat_ids.size());
+            for (uint16_t mat_id : ref_mat_ids) {
+                relative_permittivity.emplace_back(palette_permittivities[mat_id]);
             }
             return relative_permittivity;
         }
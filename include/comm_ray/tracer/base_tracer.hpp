@@ -5,10 +5,41 @@
 
 #include "glm/glm.hpp"
 #include "bvh_map.hpp"
+#include "triangle.hpp"
+#include "footprint_grid.hpp"
+#include "model_partition.hpp"
 #include "tracer_interface.hpp"
 
 namespace SignalTracer {
 
+    /// @brief How a BLAS is brought up to date after its geometry changed.
+    enum class BLASUpdate {
+        Auto,       // refit, or a Linear rebuild once refitting has degraded the SAH cost too much
+        Refit,      // same topology, new bounds, only if the triangle count is unchanged
+        Linear,     // LBVH rebuild
+        Full,       // rebuild with the builder chosen at construction
+    };
+
+    /// @brief Memory of the acceleration structures, shared BLASes are counted once.
+    struct AccelMemory {
+        std::size_t blas_bytes{ 0 };
+        std::size_t tlas_bytes{ 0 };
+        std::size_t grid_bytes{ 0 };            // footprint grid, if the scene has one
+        std::size_t instance_bytes{ 0 };
+        std::size_t instance_count{ 0 };
+        std::size_t stored_triangles{ 0 };      // triangles kept in the BLASes
+        std::size_t instanced_triangles{ 0 };   // triangles seen by the rays, after instancing
+
+        friend std::ostream& operator<<(std::ostream& os, const AccelMemory& memory) {
+            os << "BLAS: " << memory.blas_bytes / 1024.0 / 1024.0 << " MiB, "
+                << "TLAS: " << memory.tlas_bytes / 1024.0 / 1024.0 << " MiB, "
+                << "grid: " << memory.grid_bytes / 1024.0 / 1024.0 << " MiB, "
+                << "instances: " << memory.instance_count << " (" << memory.instance_bytes / 1024.0 / 1024.0 << " MiB), "
+                << "triangles: " << memory.stored_triangles << " stored, " << memory.instanced_triangles << " instanced" << std::endl;
+            return os;
+        }
+    };
+
     class BaseTracer : public TracerInterface {
     public:
         BaseTracer() = default;
@@ -16,41 +47,163 @@ namespace SignalTracer {
 
         /// @brief Initialize TLAS and BLAS (BVH) struture
         /// @param models Imported ASSIMP models that contains meshes
-        BaseTracer(const std::vector<Model>& models);
+        /// @param options BLAS builder (binned SAH, parallel binned SAH or SBVH) and its parameters,
+        /// options.partition gives one BLAS per model, mesh, Assimp node or connected component,
+        /// options.scene_accel traces the scene through the TLAS or a footprint grid
+        BaseTracer(const std::vector<Model>& models, const BVHBuildOptions& options = {});
 
         /// @brief Initialize TLAS and BLAS (BVH) struture
         /// @param models Imported ASSIMP models that contains meshes
-        BaseTracer(const std::vector<std::reference_wrapper<Model>>& models);
+        /// @param options BLAS builder (binned SAH, parallel binned SAH or SBVH) and its parameters,
+        /// options.partition gives one BLAS per model, mesh, Assimp node or connected component,
+        /// options.scene_accel traces the scene through the TLAS or a footprint grid
+        BaseTracer(const std::vector<std::reference_wrapper<Model>>& models, const BVHBuildOptions& options = {});
 
         virtual ~BaseTracer() = default;
 
+        // the TLAS points into m_bvhs, so it is pointed at the copied or moved instances
+
         //copy constructor
         BaseTracer(const BaseTracer& other)
-            : m_bvhs{ other.m_bvhs }
-            , m_tlas{ other.m_tlas } {}
+            : m_palette{ other.m_palette }
+            , m_grid{ other.m_grid }
+            , m_grid_cell_size{ other.m_grid_cell_size } {
+            copy_blases(other);
+        }
 
         //copy assignment
         BaseTracer& operator=(const BaseTracer& other) {
-            m_bvhs = other.m_bvhs;
-            m_tlas = other.m_tlas;
+            if (this == &other) {
+                return *this;
+            }
+            m_palette = other.m_palette;
+            m_grid = other.m_grid;
+            m_grid_cell_size = other.m_grid_cell_size;
+            copy_blases(other);
             return *this;
         }
 
         // move constructor
-        BaseTracer(BaseTracer&& other)
-            : m_bvhs{ other.m_bvhs }
-            , m_tlas{ other.m_tlas } {}
+        BaseTracer(BaseTracer&& other) noexcept
+            : m_palette{ std::move(other.m_palette) }
+            , m_blases{ std::move(other.m_blases) }
+            , m_bvhs{ std::move(other.m_bvhs) }
+            , m_tlas{ std::move(other.m_tlas) }
+            , m_grid{ std::move(other.m_grid) }
+            , m_grid_cell_size{ other.m_grid_cell_size } {
+            m_tlas.set_instances(m_bvhs);
+        }
 
         // move assignment
         BaseTracer& operator=(BaseTracer&& other) noexcept {
-            m_bvhs = other.m_bvhs;
-            m_tlas = other.m_tlas;
+            m_palette = std::move(other.m_palette);
+            m_blases = std::move(other.m_blases);
+            m_bvhs = std::move(other.m_bvhs);
+            m_tlas = std::move(other.m_tlas);
+            m_grid = std::move(other.m_grid);
+            m_grid_cell_size = other.m_grid_cell_size;
+            m_tlas.set_instances(m_bvhs);
             return *this;
         }
 
+        /// @brief Material of the primitive stored in an intersection record.
+        const std::shared_ptr<Material>& get_material(const IntersectRecord& record) const {
+            return m_blases[record.blas_id]->get_material(record.prim_id);
+        }
+
+        /// @brief Palette id of the material of the primitive stored in an intersection record.
+        uint16_t get_mat_id(const IntersectRecord& record) const {
+            return m_blases[record.blas_id]->get_mat_id(record.prim_id);
+        }
+
+        /// @brief Materials of the scene, shared by all BLASes of this tracer.
+        const MaterialPalette& get_palette() const { return *m_palette; }
+
+        /// @brief True if nothing blocks the direct path between two points, e.g. a transmitter and a receiver.
+        bool is_line_of_sight(const glm::vec3& from, const glm::vec3& to) const {
+            return m_grid ? !m_grid->is_segment_occluded(from, to) : !m_tlas.is_segment_occluded(from, to);
+        }
+
+        /// @brief Closest hit in the scene, through the footprint grid if the tracer has one, else the TLAS.
+        bool intersect_scene(const Ray& ray, const Interval& interval, IntersectRecord& record) const {
+            return m_grid ? m_grid->is_hit(ray, interval, record) : m_tlas.is_hit(ray, interval, record);
+        }
+
+        /// @brief Closest hits of a packet, records start from their t.
+        /// @return mask of the rays that hit
+        uint32_t intersect_scene(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const {
+            return m_grid ? m_grid->is_hit(packet, interval, records) : m_tlas.is_hit(packet, interval, records);
+        }
+
+        /// @brief Bounds of every instance in world space.
+        AABB get_scene_bounds() const {
+            return m_grid ? m_grid->bounding_box() : m_tlas.bounding_box();
+        }
+
+        /// @brief True if rays are traced through a footprint grid instead of the TLAS.
+        bool has_footprint_grid() const { return m_grid != nullptr; }
+
+        /// @brief Update a BLAS after its model changed, e.g. a moving vehicle or an opening door.
+        /// @details The instances of the BLAS and the TLAS are updated as well.
+        /// @param blas_id index of the BLAS, the index of its model if models are not partitioned
+        /// @param model the changed model, a BLAS over one object of it takes its own faces
+        /// @param mode refit, LBVH rebuild or full rebuild
+        void update_blas(uint32_t blas_id, const Model& model, BLASUpdate mode = BLASUpdate::Auto);
+
+        /// @brief Place another copy of a BLAS in the scene, e.g. repeated buildings, street furniture or vehicles.
+        /// @details The instance shares the BVH of the BLAS, only its transform is stored. The TLAS is rebuilt.
+        /// @param blas_id index of the BLAS
+        /// @param transform object to world transform, any invertible affine matrix
+        /// @return index of the new instance, INVALID_IDX if the BLAS does not exist
+        uint32_t add_instance(uint32_t blas_id, const glm::mat4& transform);
+
+        /// @brief Add terrain as a BLAS of its own, traced through its maximum mipmap and placed once.
+        /// @details The TLAS is rebuilt. The terrain has the material of the heightfield, an id of the palette of this tracer.
+        /// @param transform object to world transform of the heightfield
+        /// @return blas_id of the terrain, INVALID_IDX if the heightfield is empty
+        uint32_t add_terrain(const std::shared_ptr<const Heightfield>& heightfield, const glm::mat4& transform = glm::mat4{ 1.0f });
+
+        /// @brief Add triangles that come from no model as a BLAS of its own, e.g. a generated scene, placed once.
+        /// @details The TLAS is rebuilt. The materials of the triangles are added to the palette of this tracer.
+        /// @return blas_id of the triangles, INVALID_IDX if there are none
+        uint32_t add_triangles(const std::vector<std::shared_ptr<Triangle>>& triangles, const glm::mat4& transform = glm::mat4{ 1.0f });
+
+        /// @brief Place many copies of a BLAS with a single TLAS rebuild.
+        /// @return index of the first new instance, INVALID_IDX if the BLAS does not exist
+        uint32_t add_instances(uint32_t blas_id, const std::vector<glm::mat4>& transforms);
+
+        std::size_t get_instance_count() const { return m_bvhs.size(); }
+        std::size_t get_blas_count() const { return m_blases.size(); }
+
+        /// @brief Bytes used by the BLASes, the instances and the TLAS.
+        AccelMemory get_memory_usage() const;
+
+        /// @brief Auto refits until the SAH cost grows past this factor of the cost at the last build.
+        static constexpr float REFIT_SAH_LIMIT{ 1.5f };
+
     protected:
+        /// @brief Build the BLASes of a model, one or one per object, each placed once.
+        /// @details The first palette given in the options becomes the palette of the tracer,
+        /// a different one given later is ignored since the BLASes built so far use the ids of the first.
+        void add_model(const Model& model, const BVHBuildOptions& options);
+
+        /// @brief Copy every BLAS of another tracer and place the copies like its instances.
+        /// @details The BLASes are copied, not shared, so update_blas on one tracer leaves the other unchanged.
+        /// The palette and the footprint grid are read-only once built and stay shared.
+        void copy_blases(const BaseTracer& other);
+
+        /// @brief Build the footprint grid if options.scene_accel asks for it, after the TLAS is built.
+        void init_scene_accel(const BVHBuildOptions& options);
+
+        /// @brief Bin the instances into a new footprint grid, the TLAS is used if it cannot be built.
+        void build_footprint_grid();
+
+        std::shared_ptr<MaterialPalette> m_palette{ std::make_shared<MaterialPalette>() }; // options.palette if one is given
+        std::vector<std::shared_ptr<BVHAccel>> m_blases{}; // indexed by blas_id
         std::vector<BVHInstance> m_bvhs{};
         TLAS m_tlas{};
+        std::shared_ptr<const FootprintGrid> m_grid{}; // rays go through it instead of the TLAS if it is set
+        float m_grid_cell_size{ 0.0f };
     };
 
 }
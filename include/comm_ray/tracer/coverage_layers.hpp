@@ -0,0 +1,142 @@
+#pragma once
+
+#ifndef COVERAGE_LAYERS_HPP
+#define COVERAGE_LAYERS_HPP
+
+#include "coverage_map.hpp"
+#include "quad.hpp"
+#include "glm/glm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        CoverageLayers
+        Coverage of many transmitters over the same grid of cells: one
+        layer of linear received power per transmitter, stored layer after
+        layer, and the layers derived from all of them:
+        - best server: index of the strongest transmitter of a cell, -1 if none reaches it
+        - best server RSRP: power of that transmitter in dB
+        - SINR: best power over the sum of the others plus noise, in dB
+        ----------------------------------------
+    */
+    class CoverageLayers {
+    public:
+        static constexpr float NO_COVERAGE_DB{ -200.0f };  // dB of a cell without power, as CoverageMap::convert_to_dB
+        static constexpr std::size_t DERIVE_BLOCK{ 1024 };  // cells reduced together, their running maxima and sums stay in L1
+
+        CoverageLayers() = default;
+
+        CoverageLayers(const Quad& quad, float cell_size, std::size_t num_layers)
+            : m_grid{ quad, cell_size }
+            , m_quad{ quad }
+            , m_cell_size{ cell_size }
+            , m_num_layers{ num_layers }
+            , m_strengths(num_layers * m_grid.get_num_cells(), 0.0f) {}
+
+        std::size_t get_num_layers() const { return m_num_layers; }
+        std::size_t get_num_cells() const { return m_grid.get_num_cells(); }
+        int get_num_row() const { return m_grid.get_num_row(); }
+        int get_num_col() const { return m_grid.get_num_col(); }
+        std::size_t memory_usage() const {
+            return m_strengths.capacity() * sizeof(float) + m_best_server.capacity() * sizeof(int32_t)
+                + (m_best_rsrp.capacity() + m_sinr.capacity()) * sizeof(float);
+        }
+
+        /// @brief Cell of a point, -1 outside of the grid.
+        int find_cell_index(const glm::vec3& point) const {
+            int cell_index{ m_grid.find_cell_index(point) };
+            return cell_index >= 0 && static_cast<std::size_t>(cell_index) < get_num_cells() ? cell_index : -1;
+        }
+
+        /// @brief Linear power of a transmitter in every cell.
+        const float* get_layer(std::size_t layer) const { return m_strengths.data() + layer * get_num_cells(); }
+        float* get_layer(std::size_t layer) { return m_strengths.data() + layer * get_num_cells(); }
+
+        /// @brief Add power to a cell of a layer, safe when several threads write to the same layer.
+        void add_strength_atomic(std::size_t layer, int cell_index, float strength) {
+            std::atomic_ref<float>{ get_layer(layer)[cell_index] }.fetch_add(strength, std::memory_order_relaxed);
+        }
+
+        /// @brief Fill the best server, RSRP and SINR layers from the power layers.
+        /// @param noise_power linear, in the unit of the power layers
+        void derive(float noise_power) {
+            const std::size_t num_cells{ get_num_cells() };
+            m_best_server.assign(num_cells, -1);
+            m_best_rsrp.assign(num_cells, NO_COVERAGE_DB);
+            m_sinr.assign(num_cells, NO_COVERAGE_DB);
+            const int num_blocks{ static_cast<int>((num_cells + DERIVE_BLOCK - 1) / DERIVE_BLOCK) };
+
+#pragma omp parallel for schedule(static)
+            for (int b = 0; b < num_blocks; ++b) {
+                const std::size_t first{ b * DERIVE_BLOCK };
+                const int count{ static_cast<int>(std::min(DERIVE_BLOCK, num_cells - first)) };
+                float best[DERIVE_BLOCK];
+                float total[DERIVE_BLOCK];
+                int32_t server[DERIVE_BLOCK];
+                std::fill(best, best + count, 0.0f);
+                std::fill(total, total + count, 0.0f);
+                std::fill(server, server + count, -1);
+
+                // layer after layer, so the inner loop reads contiguous cells and vectorises
+                for (std::size_t layer = 0; layer < m_num_layers; ++layer) {
+                    const float* strengths{ get_layer(layer) + first };
+                    const int32_t id{ static_cast<int32_t>(layer) };
+#pragma omp simd
+                    for (int c = 0; c < count; ++c) {
+                        float strength{ strengths[c] };
+                        server[c] = strength > best[c] ? id : server[c];
+                        best[c] = std::max(best[c], strength);
+                        total[c] += strength;
+                    }
+                }
+
+                for (int c = 0; c < count; ++c) {
+                    if (server[c] < 0) {
+                        continue;
+                    }
+                    float interference{ std::max(total[c] - best[c], 0.0f) };
+                    m_best_server[first + c] = server[c];
+                    m_best_rsrp[first + c] = 10.0f * std::log10(best[c]);
+                    m_sinr[first + c] = 10.0f * std::log10(best[c] / (interference + noise_power));
+                }
+            }
+        }
+
+        /// @brief Derived layers, empty until derive() is called.
+        const std::vector<int32_t>& get_best_server() const { return m_best_server; }
+        const std::vector<float>& get_best_rsrp() const { return m_best_rsrp; }
+        const std::vector<float>& get_sinr() const { return m_sinr; }
+
+        /// @brief Coverage map of the linear power of the best server, e.g. for MapDrawing after convert_to_dB.
+        CoverageMap make_best_server_map() const {
+            const std::size_t num_cells{ get_num_cells() };
+            std::vector<float> strengths(num_cells, 0.0f);
+            for (std::size_t layer = 0; layer < m_num_layers; ++layer) {
+                const float* layer_strengths{ get_layer(layer) };
+                for (std::size_t c = 0; c < num_cells; ++c) {
+                    strengths[c] = std::max(strengths[c], layer_strengths[c]);
+                }
+            }
+            return CoverageMap{ m_quad, strengths, m_cell_size };
+        }
+
+    private:
+        CoverageMap m_grid{};               // cell geometry, its strengths are unused
+        Quad m_quad{};
+        float m_cell_size{ 2.0f };
+        std::size_t m_num_layers{ 0 };
+        std::vector<float> m_strengths{};   // layer l, cell c at l * num_cells + c
+        std::vector<int32_t> m_best_server{};
+        std::vector<float> m_best_rsrp{};
+        std::vector<float> m_sinr{};
+    };
+}
+
+#endif // !COVERAGE_LAYERS_HPP
@@ -6,7 +6,12 @@
 #include "glm/glm.hpp"
 #include "quad.hpp"
 #include "containers.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
+#include <memory>
 #include <vector>
 
 namespace SignalTracer {
@@ -16,6 +21,17 @@ namespace SignalTracer {
         std::vector<float> strengths{};
     };
 
+    /// @brief Row and column of the cell center nearest to a point, rows along the u side of the map.
+    /// @details The dense, sparse and tiled coverage maps all bin with it, so a point lands in the same cell of each.
+    /// @return false outside of the num_row x num_col cells
+    inline bool find_nearest_cell(const glm::vec3& point, const glm::vec3& corner, const glm::vec3& unit_u, const glm::vec3& unit_v,
+        float cell_size, int num_row, int num_col, int& row, int& col) {
+        glm::vec3 to_point_vec{ point - corner };
+        row = int(std::floor(glm::dot(to_point_vec, unit_u) / cell_size + 0.5f));
+        col = int(std::floor(glm::dot(to_point_vec, unit_v) / cell_size + 0.5f));
+        return row >= 0 && row < num_row && col >= 0 && col < num_col;
+    }
+
     /// @brief This is a container that stores the coverage map of a transmitter.
     /// @details The coverage map is a 2D map that stores the signal strength of a transmitter at each cell.
     /// The cell is defined by the center of the cell and the size of the cell.
@@ -83,48 +99,53 @@ namespace SignalTracer {
         std::vector<Cell> get_cells() const {
             return m_cells;
         }
+        std::size_t get_num_cells() const {
+            return m_cells.size();
+        }
 
         void set_strength(const glm::vec3 point, float strength) {
             int cell_index = find_cell_index(point);
-            m_cells[cell_index].strength = strength;
+            if (cell_index >= 0) {
+                m_cells[cell_index].strength = strength;
+            }
         }
 
         /// @brief Get the signal strength at a point.
         /// @param point The point to get the signal strength.
-        /// @return The signal strength at the point.
+        /// @return The signal strength at the point, 0 outside of the map.
         float get_strength(const glm::vec3 point) {
             int cell_index = find_cell_index(point);
-            return m_cells[cell_index].strength;
+            return cell_index >= 0 ? m_cells[cell_index].strength : 0.0f;
         }
 
-        /// @brief adding signal strength to a cell center.
+        /// @brief adding signal strength to a cell center, points outside of the map are dropped.
         /// @param point position of the ray-coverage_map intersection point.
         /// @param strength signal strength at the intersection point in dB.
         void add_strength(const glm::vec3 point, float strength) {
             int cell_index = find_cell_index(point);
-            m_cells[cell_index].strength += strength;
+            if (cell_index >= 0) {
+                m_cells[cell_index].strength += strength;
+            }
         }
 
-        int find_cell_index(const glm::vec3& point) {
-            glm::vec3 u_vec = m_cm.get_unit_u();
-            glm::vec3 v_vec = m_cm.get_unit_v();
+        /// @brief adding signal strength to a cell, cell_index must be valid.
+        void add_strength(int cell_index, float strength) {
+            m_cells[cell_index].strength += strength;
+        }
 
-            // project point into vector u and v
-            glm::vec3 to_point_vec = point - m_cm.get_corner_point();
-            float mag_u = glm::dot(to_point_vec, u_vec);
-            float mag_v = glm::dot(to_point_vec, v_vec);
+        /// @brief adding signal strength to a cell from several threads at once, cell_index must be valid.
+        void add_strength_atomic(int cell_index, float strength) {
+            std::atomic_ref<float>{ m_cells[cell_index].strength }.fetch_add(strength, std::memory_order_relaxed);
+        }
 
-            // calculate the cell index
-            if (mag_u / m_cell_size > m_num_row || mag_v / m_cell_size > m_num_col) {
-                std::cerr << "Point is out of range." << std::endl;
+        /// @brief Index of the cell with the nearest center, -1 outside of the map.
+        int find_cell_index(const glm::vec3& point) const {
+            int row{};
+            int col{};
+            if (!find_nearest_cell(point, m_cm.get_corner_point(), m_cm.get_unit_u(), m_cm.get_unit_v(), m_cell_size, m_num_row, m_num_col, row, col)) {
                 return -1;
             }
-
-            int row{ int(std::floor(mag_u / m_cell_size + 0.5f)) };
-            int col{ int(std::floor(mag_v / m_cell_size + 0.5f)) };
-            int cell_index = row * m_num_col + col;
-
-            return cell_index;
+            return row * m_num_col + col;
         }
 
         void convert_to_dB() {
@@ -145,6 +166,101 @@ namespace SignalTracer {
         int m_num_col{};
         std::vector<Cell> m_cells{};
     };
+
+    /// @brief How a CoverageAccumulator sums the strengths of concurrent rays.
+    enum class CoverageAccumulation {
+        Private,    // one grid per thread, summed by reduce()
+        Atomic,     // atomic adds on the coverage map
+        Auto,       // Private if the grids fit in the memory budget, Atomic otherwise
+    };
+
+    /*
+        ----------------------------------------
+        CoverageAccumulator
+        Collects the strengths that the threads of a parallel loop add to
+        a coverage map. Every thread adds into a private copy of the grid,
+        so hot cells near the transmitter are not shared, and reduce()
+        sums the copies into the map in thread order, one band of cells
+        per thread. With a static schedule the map is the same on every
+        run with the same thread count. When the copies would not fit in
+        the memory budget, strengths go straight to the map with atomic
+        adds instead.
+        ----------------------------------------
+    */
+    class CoverageAccumulator {
+    public:
+        static constexpr std::size_t DEFAULT_MEMORY_BUDGET{ std::size_t{ 1 } << 30 };
+        static constexpr std::size_t PADDING{ 16 };    // floats, keeps two grids off the same cache line
+
+        /// @param memory_budget bytes the private grids may take with CoverageAccumulation::Auto
+        CoverageAccumulator(CoverageMap& cm, CoverageAccumulation mode = CoverageAccumulation::Auto, std::size_t memory_budget = DEFAULT_MEMORY_BUDGET)
+            : m_cm{ cm }
+            , m_num_cells{ cm.get_num_cells() }
+            , m_stride{ (cm.get_num_cells() + PADDING - 1) / PADDING * PADDING }
+            , m_num_threads{ omp_get_max_threads() } {
+            std::size_t grid_bytes{ m_stride * static_cast<std::size_t>(m_num_threads) * sizeof(float) };
+            bool use_private{ mode == CoverageAccumulation::Private || (mode == CoverageAccumulation::Auto && grid_bytes <= memory_budget) };
+            if (!use_private) {
+                return;
+            }
+            m_grids.reset(new float[m_stride * m_num_threads]);
+            // every thread clears its own grid, so first touch places its pages on the thread's NUMA node
+#pragma omp parallel num_threads(m_num_threads)
+            {
+                float* grid{ m_grids.get() + m_stride * omp_get_thread_num() };
+                std::fill(grid, grid + m_stride, 0.0f);
+            }
+        }
+
+        CoverageAccumulator(const CoverageAccumulator&) = delete;
+        CoverageAccumulator& operator=(const CoverageAccumulator&) = delete;
+
+        bool is_private() const { return m_grids != nullptr; }
+        std::size_t memory_usage() const { return is_private() ? m_stride * m_num_threads * sizeof(float) : 0; }
+
+        /// @brief Add the strength of a ray to the cell of a point, safe inside a parallel region.
+        /// @details Points outside the map are dropped.
+        void add_strength(const glm::vec3& point, float strength) {
+            int cell_index{ m_cm.find_cell_index(point) };
+            if (cell_index < 0 || static_cast<std::size_t>(cell_index) >= m_num_cells) {
+                return;
+            }
+            int thread{ omp_get_thread_num() };
+            if (is_private() && thread < m_num_threads) {
+                m_grids[m_stride * thread + cell_index] += strength;
+            }
+            else {
+                m_cm.add_strength_atomic(cell_index, strength);
+            }
+        }
+
+        /// @brief Sum the private grids into the coverage map and clear them, call outside of the parallel region.
+        void reduce() {
+            if (!is_private()) {
+                return;
+            }
+            const int num_cells{ static_cast<int>(m_num_cells) };
+#pragma omp parallel for schedule(static)
+            for (int c = 0; c < num_cells; ++c) {
+                float sum{ 0.0f };
+                for (int t = 0; t < m_num_threads; ++t) {
+                    float& strength{ m_grids[m_stride * t + c] };
+                    sum += strength;
+                    strength = 0.0f;
+                }
+                if (sum != 0.0f) {
+                    m_cm.add_strength(c, sum);
+                }
+            }
+        }
+
+    private:
+        CoverageMap& m_cm;
+        std::size_t m_num_cells{ 0 };
+        std::size_t m_stride{ 0 };          // floats from one thread's grid to the next
+        int m_num_threads{ 1 };
+        std::unique_ptr<float[]> m_grids{}; // empty with atomic adds
+    };
 }
 
 #endif // !COVERAGE_MAP_HPP
\ No newline at end of file
@@ -8,9 +8,15 @@
 #include "bvh_map.hpp"
 #include "cl_utils.hpp"
 #include "constant.hpp"
+#include "coverage_layers.hpp"
 #include "coverage_map.hpp"
+#include "coverage_volume.hpp"
+#include "tiled_coverage_map.hpp"
 #include "intersect_record.hpp"
 #include "path_record.hpp"
+#include "ray_packet.hpp"
+#include "ray_sorter.hpp"
+#include "sparse_coverage_map.hpp"
 #include "triangle.hpp"
 #include "quad.hpp"
 #include "utils.hpp"
@@ -22,12 +28,14 @@
 #include "glm/glm.hpp"
 #include "glm/gtx/transform.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <execution>
 #include <filesystem>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <vector>
 #include <thread>
@@ -36,6 +44,26 @@
 
 namespace SignalTracer {
 
+    /// @brief Time spent on one bounce by CoverageTracer::generate_wavefront.
+    struct BounceStats {
+        int depth{ 0 };
+        std::size_t ray_count{ 0 };     // active rays at the start of the bounce
+        double sort_time{ 0.0 };        // seconds spent ordering the rays
+        double trace_time{ 0.0 };       // seconds spent on intersection and signal strength
+
+        friend std::ostream& operator<<(std::ostream& out, const BounceStats& stats) {
+            out << "bounce " << stats.depth << ": " << stats.ray_count << " rays"
+                << ", sort: " << stats.sort_time << " s, trace: " << stats.trace_time << " s" << std::endl;
+            return out;
+        }
+    };
+
+    /// @brief Storage of the cells generate() fills.
+    enum class CoverageBackend {
+        Dense,      // CoverageMap, every cell of the domain
+        Sparse,     // SparseCoverageMap, only the cells rays reach, made dense on return
+    };
+
     class CoverageTracer : public BaseTracer {
     public:
         CoverageTracer() = default;
@@ -43,24 +71,41 @@ namespace SignalTracer {
         // CoverageTracer(const std::vector<Model>& models, int max_reflection = 2)
         //     : BaseTracer{ models } {}
 
-        CoverageTracer(std::vector<std::reference_wrapper<Model>>& models, int max_reflection = 2, int num_rays = int(6e6))
-            : BaseTracer{ models }
+        CoverageTracer(std::vector<std::reference_wrapper<Model>>& models, int max_reflection = 2, int num_rays = int(6e6), const BVHBuildOptions& options = {})
+            : BaseTracer{ models, options }
             , m_max_reflection{ max_reflection }
             , m_num_rays{ num_rays } {}
 
+        /// @brief Tracer without models, the scene is added with add_triangles, add_terrain or add_instance.
+        CoverageTracer(int max_reflection, int num_rays)
+            : m_max_reflection{ max_reflection }
+            , m_num_rays{ num_rays } {}
+
         ~CoverageTracer() override = default;
 
         // copy constructor
         CoverageTracer(const CoverageTracer& other)
             : BaseTracer{ other }
             , m_max_reflection{ other.m_max_reflection }
-            , m_num_rays{ other.m_num_rays } {}
+            , m_num_rays{ other.m_num_rays }
+            , m_bounce_sync{ other.m_bounce_sync }
+            , m_sort_rays{ other.m_sort_rays }
+            , m_accumulation{ other.m_accumulation }
+            , m_accumulation_budget{ other.m_accumulation_budget }
+            , m_noise_power{ other.m_noise_power }
+            , m_backend{ other.m_backend } {}
 
         // copy assignment
         CoverageTracer& operator=(const CoverageTracer& other) {
             BaseTracer::operator=(other);
             m_max_reflection = other.m_max_reflection;
             m_num_rays = other.m_num_rays;
+            m_bounce_sync = other.m_bounce_sync;
+            m_sort_rays = other.m_sort_rays;
+            m_accumulation = other.m_accumulation;
+            m_accumulation_budget = other.m_accumulation_budget;
+            m_noise_power = other.m_noise_power;
+            m_backend = other.m_backend;
             return *this;
         }
 
@@ -68,13 +113,25 @@ namespace SignalTracer {
         CoverageTracer(CoverageTracer&& other)
             : BaseTracer{ std::move(other) }
             , m_max_reflection{ other.m_max_reflection }
-            , m_num_rays{ other.m_num_rays } {}
+            , m_num_rays{ other.m_num_rays }
+            , m_bounce_sync{ other.m_bounce_sync }
+            , m_sort_rays{ other.m_sort_rays }
+            , m_accumulation{ other.m_accumulation }
+            , m_accumulation_budget{ other.m_accumulation_budget }
+            , m_noise_power{ other.m_noise_power }
+            , m_backend{ other.m_backend } {}
 
         // move assignment
         CoverageTracer& operator=(CoverageTracer&& other) noexcept {
             BaseTracer::operator=(std::move(other));
             m_max_reflection = other.m_max_reflection;
             m_num_rays = other.m_num_rays;
+            m_bounce_sync = other.m_bounce_sync;
+            m_sort_rays = other.m_sort_rays;
+            m_accumulation = other.m_accumulation;
+            m_accumulation_budget = other.m_accumulation_budget;
+            m_noise_power = other.m_noise_power;
+            m_backend = other.m_backend;
             return *this;
         }
 
@@ -92,7 +149,29 @@ namespace SignalTracer {
         /// change the direction to the reflection direction
         /// and repeat step 3
         /// - The final coverage map is a 2D array of cells, each cell contains a list of ray-quad intersections and the energy of signal at the intersections
+        /// With several transmitters the map holds the power of the best server of each cell, see generate_layers.
+        /// That pass keeps no path records and has neither a bounce-synchronous nor a sparse variant,
+        /// so those options are rejected there and an empty map is returned.
+        /// The bounce-synchronous pass has no sparse variant either, so bounce sync with the sparse backend
+        /// is rejected for any number of transmitters.
         CoverageMap generate(const std::vector<Transmitter>& transmitters, float cell_size, std::vector<SignalTracer::PathRecord>* path_recs = nullptr, const std::string& method = "friss") {
+            if (m_bounce_sync && m_backend == CoverageBackend::Sparse) {
+                std::cerr << "CoverageTracer: bounce sync does not support the sparse backend." << std::endl;
+                return CoverageMap{};
+            }
+            if (transmitters.size() > 1 && method == "friss") {
+                if (path_recs != nullptr || m_bounce_sync || m_backend != CoverageBackend::Dense) {
+                    std::cerr << "CoverageTracer: several transmitters support neither path records, bounce sync nor the sparse backend." << std::endl;
+                    return CoverageMap{};
+                }
+                return generate_layers(transmitters, cell_size).make_best_server_map();
+            }
+            if (m_bounce_sync) {
+                return generate_wavefront(transmitters, cell_size, path_recs, method);
+            }
+            if (m_backend == CoverageBackend::Sparse) {
+                return generate_sparse(transmitters, cell_size, path_recs, method).to_dense();
+            }
             // CoverageMap cm{ generate_seq(transmitters,cell_size, path_recs, method) };
             CoverageMap cm{ generate_par(transmitters,cell_size, path_recs, method) };
             // CoverageMap cm{ generate_opencl(transmitters,cell_size, path_recs, method) };
@@ -100,6 +179,30 @@ namespace SignalTracer {
 
         }
 
+        /// @brief Let generate() advance all rays one bounce at a time, see generate_wavefront.
+        /// @param sort_rays reorder the rays before every bounce after the first
+        /// generate() rejects it together with the sparse backend.
+        void set_bounce_sync(bool enable, bool sort_rays = true) {
+            m_bounce_sync = enable;
+            m_sort_rays = sort_rays;
+        }
+
+        /// @brief How the threads of generate_par and generate_wavefront add strengths to the map, see CoverageAccumulator.
+        /// @param memory_budget bytes the per-thread grids may take with CoverageAccumulation::Auto
+        void set_accumulation(CoverageAccumulation mode, std::size_t memory_budget = CoverageAccumulator::DEFAULT_MEMORY_BUDGET) {
+            m_accumulation = mode;
+            m_accumulation_budget = memory_budget;
+        }
+
+        /// @brief Cell storage of generate(), see CoverageBackend. generate() rejects the sparse backend together with bounce sync.
+        void set_backend(CoverageBackend backend) { m_backend = backend; }
+
+        /// @brief Noise power of the SINR layer of generate_layers, dBm.
+        void set_noise_power(float noise_power) { m_noise_power = noise_power; }
+
+        /// @brief Per bounce timings of the last generate_wavefront call.
+        const std::vector<BounceStats>& get_bounce_stats() const { return m_bounce_stats; }
+
         CoverageMap generate_opencl(const std::vector<Transmitter>& transmitters, float cell_size, std::vector<SignalTracer::PathRecord>* path_recs = nullptr, const std::string& method = "friss") {
             // for (std::size_t i = 0; i < transmitters.size(); i++) {
             // }
@@ -111,7 +214,7 @@ namespace SignalTracer {
             std::clog << "tx position: " << glm::to_string(tx_pos) << std::endl;
 
             // initialize the coverage map
-            Quad cm_quad{ make_coverage_quad(m_tlas.bounding_box(), 3.0f) };
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
             CoverageMap cm{ cm_quad, cell_size };
 
             // generate rays from the transmitters to the screen
@@ -125,6 +228,7 @@ namespace SignalTracer {
             std::vector<SignalTracer::PathRecord> tmp_path_recs(m_num_rays);
             float tx_power{ tx.get_power() };
             float tx_freq{ tx.get_frequency() };
+            const std::vector<float> permittivities{ m_palette->get_permittivities(tx_freq) }; // indexed by material id
             float tx_gain{ Utils::dB_to_linear(tx.get_gain()) };
             std::string polar = "TM";
 
@@ -197,7 +301,7 @@ namespace SignalTracer {
                     bool is_quad_hit{ cm_quad.is_hit(rays[i], interval, cm_isect_record) };
 
                     // TODO: do the ray tracing in opencl
-                    bool is_scene_hit{ m_tlas.is_hit(rays[i], interval, scene_isect_record) };
+                    bool is_scene_hit{ intersect_scene(rays[i], interval, scene_isect_record) };
 
                     glm::vec3 start_pos{ tmp_path_recs[i].get_last_point() };
                     float start_strength{ tmp_path_recs[i].get_signal_strength() };
@@ -215,11 +319,11 @@ namespace SignalTracer {
 
                     // if the ray hits the scene, record the hit point
                     if (is_scene_hit) {
-                        tmp_path_recs[i].add_record(scene_isect_record.point, scene_isect_record.tri_ptr->get_mat_ptr(), scene_isect_record.tri_ptr);
+                        tmp_path_recs[i].add_record(scene_isect_record.point, get_mat_id(scene_isect_record), scene_isect_record.blas_id, scene_isect_record.prim_id);
 
                         Ray scattered_ray{};
                         glm::vec3 attenuation{};
-                        if (scene_isect_record.tri_ptr->get_mat_ptr()->is_scattering(rays[i], scene_isect_record, attenuation, scattered_ray)) {
+                        if (get_material(scene_isect_record)->is_scattering(rays[i], scene_isect_record, attenuation, scattered_ray)) {
 
                             // TODO: Now: calc signal strength using Friss -> should use EM wave propagation model
                             if (method == "friss") {
@@ -229,7 +333,7 @@ namespace SignalTracer {
 
                                 float cos_2theta1 = glm::dot(incident_dir, reflected_dir);
                                 float incident_angle = std::acos(cos_2theta1) / 2;
-                                float ref_coef{ calc_reflection_coefficient(incident_angle, 1.0f, scene_isect_record.tri_ptr->get_mat_ptr()->calc_real_relative_permittivity(tx_freq), polar) };
+                                float ref_coef{ calc_reflection_coefficient(incident_angle, 1.0f, permittivities[get_mat_id(scene_isect_record)], polar) };
 
                                 float added_strength{ calc_friss_strength(start_pos, scene_isect_record.point, tx_freq, start_strength, start_gain, end_gain, ref_coef) };
 
@@ -282,7 +386,7 @@ namespace SignalTracer {
             std::clog << "tx position: " << glm::to_string(tx_pos) << std::endl;
 
             // initialize the coverage map
-            Quad cm_quad{ make_coverage_quad(m_tlas.bounding_box(), 3.0f) };
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
             CoverageMap cm{ cm_quad, cell_size };
 
             // generate rays from the transmitters to the screen
@@ -296,6 +400,7 @@ namespace SignalTracer {
             std::vector<SignalTracer::PathRecord> tmp_path_recs(m_num_rays);
             float tx_power{ tx.get_power() };
             float tx_freq{ tx.get_frequency() };
+            const std::vector<float> permittivities{ m_palette->get_permittivities(tx_freq) }; // indexed by material id
             float tx_gain{ Utils::dB_to_linear(tx.get_gain()) };
             std::string polar = "TM";
 
@@ -309,7 +414,7 @@ namespace SignalTracer {
                     IntersectRecord cm_isect_record{};
                     IntersectRecord scene_isect_record{};
                     bool is_quad_hit{ cm_quad.is_hit(rays[i], interval, cm_isect_record) };
-                    bool is_scene_hit{ m_tlas.is_hit(rays[i], interval, scene_isect_record) };
+                    bool is_scene_hit{ intersect_scene(rays[i], interval, scene_isect_record) };
 
                     glm::vec3 start_pos{ tmp_path_recs[i].get_last_point() };
                     float start_strength{ tmp_path_recs[i].get_signal_strength() };
@@ -328,11 +433,11 @@ namespace SignalTracer {
 
                     // if the ray hits the scene, record the hit point
                     if (is_scene_hit) {
-                        tmp_path_recs[i].add_record(scene_isect_record.point, scene_isect_record.tri_ptr->get_mat_ptr(), scene_isect_record.tri_ptr);
+                        tmp_path_recs[i].add_record(scene_isect_record.point, get_mat_id(scene_isect_record), scene_isect_record.blas_id, scene_isect_record.prim_id);
 
                         Ray scattered_ray{};
                         glm::vec3 attenuation{};
-                        if (scene_isect_record.tri_ptr->get_mat_ptr()->is_scattering(rays[i], scene_isect_record, attenuation, scattered_ray)) {
+                        if (get_material(scene_isect_record)->is_scattering(rays[i], scene_isect_record, attenuation, scattered_ray)) {
 
                             // TODO: Now: calc signal strength using Friss -> should use EM wave propagation model
                             if (method == "friss") {
@@ -342,7 +447,7 @@ namespace SignalTracer {
 
                                 float cos_2theta1 = glm::dot(-incident_dir, reflected_dir);
                                 float incident_angle = std::acos(cos_2theta1) / 2;
-                                float ref_coef{ calc_reflection_coefficient(incident_angle, 1.0f, scene_isect_record.tri_ptr->get_mat_ptr()->calc_real_relative_permittivity(tx_freq), polar) };
+                                float ref_coef{ calc_reflection_coefficient(incident_angle, 1.0f, permittivities[get_mat_id(scene_isect_record)], polar) };
 
                                 float added_strength{ calc_friss_strength(start_pos, scene_isect_record.point, tx_freq, start_strength, start_gain, end_gain, ref_coef) };
 
@@ -388,116 +493,353 @@ namespace SignalTracer {
             // for (std::size_t i = 0; i < transmitters.size(); i++) {
             // }
 
+            // testing for only one transmitter
+            // initialize the coverage map
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
+            CoverageMap cm{ cm_quad, cell_size };
+            CoverageAccumulator accumulator{ cm, m_accumulation, m_accumulation_budget };
+            trace_par(transmitters[0], cm_quad, accumulator, path_recs, method);
+
+            std::clog << "Coverage map is generated" << std::endl;
+            return cm;
+        }
+
+        /// @brief generate_par into a SparseCoverageMap, only the cells that rays reach are stored.
+        SparseCoverageMap generate_sparse(const std::vector<Transmitter>& transmitters, float cell_size, std::vector<SignalTracer::PathRecord>* path_recs = nullptr, const std::string& method = "friss") {
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
+            SparseCoverageMap cm{ cm_quad, cell_size };
+            SparseCoverageAccumulator accumulator{ cm };
+            trace_par(transmitters[0], cm_quad, accumulator, path_recs, method);
+
+            std::clog << "Sparse coverage map is generated: " << cm.get_num_occupied() << " of "
+                << static_cast<std::size_t>(cm.get_num_row()) * cm.get_num_col() << " cells, " << cm.memory_usage() / 1024.0 / 1024.0 << " MiB" << std::endl;
+            return cm;
+        }
+
+        /// @brief Bounce-synchronous variant of generate_par for many reflections.
+        /// @details After the first reflection the rays of neighbouring launch directions are scattered
+        /// over the scene, so each thread of generate_par walks unrelated parts of the BVH.
+        /// Here all active rays advance one bounce at a time. Before each bounce after the first,
+        /// the active rays are sorted by RaySorter, so that neighbouring iterations of the parallel loop
+        /// start close to each other and head the same way. Rays that stop are compacted out.
+        /// Sort and trace times of every bounce are kept in get_bounce_stats().
+        CoverageMap generate_wavefront(const std::vector<Transmitter>& transmitters, float cell_size, std::vector<SignalTracer::PathRecord>* path_recs = nullptr, const std::string& method = "friss") {
             // testing for only one transmitter
             auto tx{ transmitters[0] };
             glm::vec3 tx_pos{ tx.get_position() };
-            std::clog << "Running in sequential testing mode" << std::endl;
+            std::clog << "Running in bounce-synchronous mode" << std::endl;
             std::clog << "tx position: " << glm::to_string(tx_pos) << std::endl;
 
             // initialize the coverage map
-            Quad cm_quad{ make_coverage_quad(m_tlas.bounding_box(), 3.0f) };
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
             CoverageMap cm{ cm_quad, cell_size };
+            CoverageAccumulator accumulator{ cm, m_accumulation, m_accumulation_budget };
 
             // generate rays from the transmitters to the screen
             Utils::Timer timer{};
             std::vector<Ray> rays(m_num_rays);
             {
                 std::vector <glm::vec3> directions{ Utils::get_fibonacci_lattice(m_num_rays) };
+                Utils::sort_directions_coherent(directions);
                 std::transform(std::execution::par_unseq, directions.begin(), directions.end(), rays.begin(), [&tx_pos](const glm::vec3& dir) {return Ray{ tx_pos, dir };});
             }
 
             std::vector<SignalTracer::PathRecord> tmp_path_recs(m_num_rays);
-            float tx_power{ tx.get_power() };
-            float tx_freq{ tx.get_frequency() };
-            float tx_gain{ Utils::dB_to_linear(tx.get_gain()) };
-            std::string polar = "TM";
-#pragma omp parallel for
-            for (int i = 0; i < m_num_rays; i++) {
-                tmp_path_recs[i].add_point(tx_pos);
-                tmp_path_recs[i].set_signal_strength(Utils::dB_to_linear(tx_power));
-                Interval interval{ Constant::EPSILON, Constant::INF_POS };
+            const BounceSource source{ make_bounce_source(tx) };
+            const bool friss{ method == "friss" };
+            const Interval interval{ Constant::EPSILON, Constant::INF_POS };
+            auto deposit = [&](const Ray& ray, float t_max, auto&& strength_at) {
+                IntersectRecord cm_isect_record{};
+                if (cm_quad.is_hit(ray, interval, cm_isect_record) && cm_isect_record.t < t_max) {
+                    accumulator.add_strength(cm_isect_record.point, strength_at(cm_isect_record.point));
+                }
+            };
 
-                for (int depth = 0; depth < m_max_reflection; depth++) {
-                    // if the ray hits the coverage map plane, record the hit point
-                    IntersectRecord cm_isect_record{};
-                    IntersectRecord scene_isect_record{};
-                    bool is_quad_hit{ cm_quad.is_hit(rays[i], interval, cm_isect_record) };
-                    bool is_scene_hit{ m_tlas.is_hit(rays[i], interval, scene_isect_record) };
+            // one bounce of ray i, its start point and strength live in its path record between bounces
+            auto bounce = [&](int i, int depth, const IntersectRecord& scene_isect_record, bool is_scene_hit) {
+                BounceRay state{ rays[i], tmp_path_recs[i].get_last_point(), tmp_path_recs[i].get_signal_strength() };
+                if (is_scene_hit) {
+                    tmp_path_recs[i].add_record(scene_isect_record.point, get_mat_id(scene_isect_record), scene_isect_record.blas_id, scene_isect_record.prim_id);
+                }
+                else if (path_recs == nullptr) {
+                    tmp_path_recs[i].clear();
+                }
+                else if (depth != 0) {
+                    tmp_path_recs[i].add_record(rays[i].point_at(1000.0f));
+                }
+                if (!trace_bounce(state, scene_isect_record, is_scene_hit, source, friss, deposit)) {
+                    return false;
+                }
+                tmp_path_recs[i].set_signal_strength(state.strength);
+                rays[i] = std::move(state.ray);
+                return true;
+            };
+
+            std::vector<int> active(m_num_rays);
+            std::iota(active.begin(), active.end(), 0);
+            std::vector<uint8_t> alive(m_num_rays, 0);
+            RaySorter sorter{ get_scene_bounds() };
+            m_bounce_stats.clear();
+
+            for (int depth = 0; depth < m_max_reflection && !active.empty(); depth++) {
+                BounceStats stats{};
+                stats.depth = depth;
+                stats.ray_count = active.size();
+                const int num_active{ static_cast<int>(active.size()) };
+
+                Utils::Timer bounce_timer{};
+                if (depth == 0) {
+                    // all rays start at the transmitter, in launch order they form coherent packets
+#pragma omp parallel for schedule(dynamic, 64)
+                    for (int first = 0; first < num_active; first += RayPacket::MAX_SIZE) {
+                        const int count{ std::min(RayPacket::MAX_SIZE, num_active - first) };
+                        IntersectRecord first_hits[RayPacket::MAX_SIZE]{};
+                        uint32_t hit_mask{ intersect_scene(RayPacket{ &rays[first], count }, interval, first_hits) };
+                        for (int j = 0; j < count; j++) {
+                            int i{ first + j };
+                            tmp_path_recs[i].add_point(tx_pos);
+                            tmp_path_recs[i].set_signal_strength(source.power);
+                            alive[i] = bounce(i, depth, first_hits[j], ((hit_mask >> j) & 1u) != 0);
+                        }
+                    }
+                }
+                else {
+                    if (m_sort_rays) {
+                        sorter.sort(rays, active);
+                        stats.sort_time = bounce_timer.elapsed();
+                        bounce_timer.reset();
+                    }
+#pragma omp parallel for schedule(dynamic, 256)
+                    for (int k = 0; k < num_active; k++) {
+                        int i{ active[k] };
+                        IntersectRecord scene_isect_record{};
+                        bool is_scene_hit{ intersect_scene(rays[i], interval, scene_isect_record) };
+                        alive[i] = bounce(i, depth, scene_isect_record, is_scene_hit);
+                    }
+                }
+                std::erase_if(active, [&alive](int i) { return alive[i] == 0; });
+                stats.trace_time = bounce_timer.elapsed();
+                std::clog << stats;
+                m_bounce_stats.emplace_back(stats);
+            }
+            accumulator.reduce();
+            timer.execution_time();
 
-                    glm::vec3 start_pos{ tmp_path_recs[i].get_last_point() };
-                    float start_strength{ tmp_path_recs[i].get_signal_strength() };
-                    float start_gain{ tx_gain };
-                    float end_gain{ 1.0f };
+            if (path_recs != nullptr) {
+                for (int i = 0; i < m_num_rays; i++) {
+                    if (!tmp_path_recs[i].is_empty()) {
+                        (*path_recs).emplace_back(tmp_path_recs[i]);
+                    }
+                }
+            }
 
-                    if (is_quad_hit && cm_isect_record.t < scene_isect_record.t) {
+            std::clog << "Coverage map is generated" << std::endl;
+            return cm;
+        }
 
-                        // TODO: Now: calc signal strength using Friss -> should use EM wave propagation model
-                        if (method == "friss") {
-                            float added_strength{ calc_friss_strength(start_pos, cm_isect_record.point, tx_freq, start_strength, start_gain, end_gain) };
-                            cm.add_strength(cm_isect_record.point, added_strength);
-                        }
+        /// @brief Coverage of the first transmitter for regions too large for a dense CoverageMap.
+        /// @details Same rays and bounces as generate_par, the strengths go to a TiledCoverageMap at 3 m
+        /// that keeps memory_budget bytes of tiles and spills the rest to backing_path.
+        /// Read the result with TiledCoverageMap::for_each_tile or write_raw. Path records are not kept.
+        /// @return nullptr if the backing file could not be mapped
+        std::unique_ptr<TiledCoverageMap> generate_tiled(const std::vector<Transmitter>& transmitters, float cell_size, std::size_t memory_budget,
+            const std::string& backing_path, const std::string& method = "friss") {
+            auto tx{ transmitters[0] };
+            glm::vec3 tx_pos{ tx.get_position() };
+            std::clog << "tx position: " << glm::to_string(tx_pos) << std::endl;
 
-                    }
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
+            AABB scene_box{ get_scene_bounds() };
+            glm::vec2 extent{ scene_box.get_max().x - scene_box.get_min().x, scene_box.get_max().z - scene_box.get_min().z };
+            auto tiled = std::make_unique<TiledCoverageMap>(cm_quad.get_corner_point(), extent, cell_size, memory_budget, backing_path);
+            if (!tiled->is_open()) {
+                return nullptr;
+            }
 
-                    // if the ray hits the scene, record the hit point
-                    if (is_scene_hit) {
-                        tmp_path_recs[i].add_record(scene_isect_record.point, scene_isect_record.tri_ptr->get_mat_ptr(), scene_isect_record.tri_ptr);
+            Utils::Timer timer{};
+            std::vector<Ray> rays(m_num_rays);
+            {
+                std::vector <glm::vec3> directions{ Utils::get_fibonacci_lattice(m_num_rays) };
+                Utils::sort_directions_coherent(directions);
+                std::transform(std::execution::par_unseq, directions.begin(), directions.end(), rays.begin(), [&tx_pos](const glm::vec3& dir) {return Ray{ tx_pos, dir };});
+            }
 
-                        Ray scattered_ray{};
-                        glm::vec3 attenuation{};
-                        if (scene_isect_record.tri_ptr->get_mat_ptr()->is_scattering(rays[i], scene_isect_record, attenuation, scattered_ray)) {
+            const BounceSource source{ make_bounce_source(tx) };
+            const bool friss{ method == "friss" };
+            const Interval interval{ Constant::EPSILON, Constant::INF_POS };
+#pragma omp parallel
+            {
+                // each thread keeps the tiles it writes to pinned, neighbouring rays mostly land on the same tiles
+                TiledCoverageMap::Writer writer{ *tiled };
+                auto deposit = [&](const Ray& ray, float t_max, auto&& strength_at) {
+                    IntersectRecord cm_isect_record{};
+                    if (cm_quad.is_hit(ray, interval, cm_isect_record) && cm_isect_record.t < t_max) {
+                        writer.add_strength(cm_isect_record.point, strength_at(cm_isect_record.point));
+                    }
+                };
+#pragma omp for schedule(dynamic, 64)
+                for (int first = 0; first < m_num_rays; first += RayPacket::MAX_SIZE) {
+                    const int count{ std::min(RayPacket::MAX_SIZE, m_num_rays - first) };
+                    IntersectRecord first_hits[RayPacket::MAX_SIZE]{};
+                    uint32_t hit_mask{ intersect_scene(RayPacket{ &rays[first], count }, interval, first_hits) };
+
+                    for (int j = 0; j < count; j++) {
+                        BounceRay state{ rays[first + j], tx_pos, source.power };
+                        IntersectRecord scene_isect_record{ first_hits[j] };
+                        bool is_scene_hit{ ((hit_mask >> j) & 1u) != 0 };
+                        for (int depth = 0; depth < m_max_reflection; depth++) {
+                            if (depth > 0) {
+                                scene_isect_record = IntersectRecord{};
+                                is_scene_hit = intersect_scene(state.ray, interval, scene_isect_record);
+                            }
+                            if (!trace_bounce(state, scene_isect_record, is_scene_hit, source, friss, deposit)) {
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            timer.execution_time();
 
-                            // TODO: Now: calc signal strength using Friss -> should use EM wave propagation model
-                            if (method == "friss") {
-                                glm::vec3 normal{ scene_isect_record.normal };
-                                glm::vec3 incident_dir{ glm::normalize(rays[i].get_direction()) };
-                                glm::vec3 reflected_dir{ glm::normalize(glm::reflect(incident_dir, normal)) };
+            std::clog << tiled->get_stats();
+            return tiled;
+        }
 
-                                float cos_2theta1 = glm::dot(incident_dir, reflected_dir);
-                                float incident_angle = std::acos(cos_2theta1) / 2;
-                                float ref_coef{ calc_reflection_coefficient(incident_angle, 1.0f, scene_isect_record.tri_ptr->get_mat_ptr()->calc_real_relative_permittivity(tx_freq), polar) };
+        /// @brief Coverage of the first transmitter at several receiver heights in one trace.
+        /// @details Same rays and bounces as generate_par, but every segment deposits into each layer
+        /// of the volume it crosses before the scene hit, instead of into a single quad at 3 m.
+        /// Layer l matches a generate_par run with its coverage quad at heights[l]. Path records are not kept.
+        CoverageVolume generate_volume(const std::vector<Transmitter>& transmitters, float cell_size, const std::vector<float>& heights, const std::string& method = "friss") {
+            auto tx{ transmitters[0] };
+            glm::vec3 tx_pos{ tx.get_position() };
+            std::clog << "tx position: " << glm::to_string(tx_pos) << ", " << heights.size() << " coverage heights" << std::endl;
 
-                                float added_strength{ calc_friss_strength(start_pos, scene_isect_record.point, tx_freq, start_strength, start_gain, end_gain, ref_coef) };
+            CoverageVolume volume{ get_scene_bounds(), heights, cell_size };
+            std::vector<std::unique_ptr<CoverageAccumulator>> accumulators{ volume.make_accumulators(m_accumulation, m_accumulation_budget) };
 
-                                tmp_path_recs[i].set_signal_strength(added_strength);
-                            }
+            Utils::Timer timer{};
+            std::vector<Ray> rays(m_num_rays);
+            {
+                std::vector <glm::vec3> directions{ Utils::get_fibonacci_lattice(m_num_rays) };
+                Utils::sort_directions_coherent(directions);
+                std::transform(std::execution::par_unseq, directions.begin(), directions.end(), rays.begin(), [&tx_pos](const glm::vec3& dir) {return Ray{ tx_pos, dir };});
+            }
 
-                            rays[i] = std::move(scattered_ray);
-                            continue;
-                        }
-                        else {
-                            break;
-                        }
+            std::vector<IntersectRecord> first_hits(m_num_rays);
+#pragma omp parallel for schedule(dynamic, 64)
+            for (int first = 0; first < m_num_rays; first += RayPacket::MAX_SIZE) {
+                const int count{ std::min(RayPacket::MAX_SIZE, m_num_rays - first) };
+                intersect_scene(RayPacket{ &rays[first], count }, Interval{ Constant::EPSILON, Constant::INF_POS }, &first_hits[first]);
+            }
+
+            const BounceSource source{ make_bounce_source(tx) };
+            const bool friss{ method == "friss" };
+            const Interval interval{ Constant::EPSILON, Constant::INF_POS };
+            // every layer the segment crosses before the scene hit
+            auto deposit = [&](const Ray& ray, float t_max, auto&& strength_at) {
+                volume.for_each_crossing(ray, interval.min(), t_max, [&](std::size_t layer, const glm::vec3& point) {
+                    accumulators[layer]->add_strength(point, strength_at(point));
+                });
+            };
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < m_num_rays; i++) {
+                BounceRay state{ rays[i], tx_pos, source.power };
+                for (int depth = 0; depth < m_max_reflection; depth++) {
+                    IntersectRecord scene_isect_record{};
+                    bool is_scene_hit{};
+                    if (depth == 0) {
+                        scene_isect_record = first_hits[i];
+                        is_scene_hit = scene_isect_record.has_primitive();
                     }
                     else {
-                        if (path_recs != nullptr) {
-                            if (depth != 0) {
-                                auto reflected_point = rays[i].point_at(1000.0f);
-                                tmp_path_recs[i].add_record(reflected_point);
-                            }
-                        }
-                        else {
-                            tmp_path_recs[i].clear();
-                        }
+                        is_scene_hit = intersect_scene(state.ray, interval, scene_isect_record);
+                    }
+                    if (!trace_bounce(state, scene_isect_record, is_scene_hit, source, friss, deposit)) {
                         break;
                     }
                 }
             }
+            for (auto& accumulator : accumulators) {
+                accumulator->reduce();
+            }
             timer.execution_time();
 
-#pragma omp critical
-            {
-                if (path_recs != nullptr) {
-                    for (int i = 0; i < m_num_rays; i++) {
-                        if (!tmp_path_recs[i].is_empty()) {
-                            (*path_recs).emplace_back(tmp_path_recs[i]);
+            std::clog << "Coverage volume is generated, " << volume.memory_usage() / 1024.0 / 1024.0 << " MiB" << std::endl;
+            return volume;
+        }
+
+        /// @brief Coverage of all transmitters in one pass, with the best server, RSRP and SINR layers.
+        /// @details All sites share the scene and the thread pool. A work item is a block of rays of one
+        /// transmitter, and consecutive items belong to different transmitters, so threads running at
+        /// the same time mostly add to different layers. Their adds are atomic for the rare case of two
+        /// threads on one site. With as many sites as threads every core is busy from the first item
+        /// to the last, so sites per minute grow with the cores. Path records are not kept.
+        CoverageLayers generate_layers(const std::vector<Transmitter>& transmitters, float cell_size) {
+            std::vector<BounceSource> sites{};
+            sites.reserve(transmitters.size());
+            for (const auto& tx : transmitters) {
+                sites.emplace_back(make_bounce_source(tx));
+            }
+            std::clog << "Tracing " << sites.size() << " transmitters in one pass" << std::endl;
+
+            Quad cm_quad{ make_coverage_quad(get_scene_bounds(), 3.0f) };
+            CoverageLayers layers{ cm_quad, cell_size, sites.size() };
+
+            // the launch directions are shared by all sites
+            Utils::Timer timer{};
+            std::vector<glm::vec3> directions{ Utils::get_fibonacci_lattice(m_num_rays) };
+            Utils::sort_directions_coherent(directions);
+
+            const int block_size{ 16 * RayPacket::MAX_SIZE };
+            const int num_blocks{ (m_num_rays + block_size - 1) / block_size };
+            const long long num_items{ static_cast<long long>(num_blocks) * static_cast<long long>(sites.size()) };
+            const Interval interval{ Constant::EPSILON, Constant::INF_POS };
+
+#pragma omp parallel for schedule(dynamic, 1)
+            for (long long item = 0; item < num_items; item++) {
+                const std::size_t s{ static_cast<std::size_t>(item % static_cast<long long>(sites.size())) };
+                const int first_ray{ static_cast<int>(item / static_cast<long long>(sites.size())) * block_size };
+                const BounceSource& site{ sites[s] };
+                auto deposit = [&](const Ray& ray, float t_max, auto&& strength_at) {
+                    IntersectRecord cm_isect_record{};
+                    if (cm_quad.is_hit(ray, interval, cm_isect_record) && cm_isect_record.t < t_max) {
+                        int cell_index{ layers.find_cell_index(cm_isect_record.point) };
+                        if (cell_index >= 0) {
+                            layers.add_strength_atomic(s, cell_index, strength_at(cm_isect_record.point));
+                        }
+                    }
+                };
+
+                for (int first = first_ray; first < std::min(first_ray + block_size, m_num_rays); first += RayPacket::MAX_SIZE) {
+                    const int count{ std::min(RayPacket::MAX_SIZE, m_num_rays - first) };
+                    Ray rays[RayPacket::MAX_SIZE]{};
+                    for (int j = 0; j < count; j++) {
+                        rays[j] = Ray{ site.position, directions[first + j] };
+                    }
+                    IntersectRecord first_hits[RayPacket::MAX_SIZE]{};
+                    uint32_t hit_mask{ intersect_scene(RayPacket{ rays, count }, interval, first_hits) };
+
+                    for (int j = 0; j < count; j++) {
+                        BounceRay state{ rays[j], site.position, site.power };
+                        IntersectRecord scene_isect_record{ first_hits[j] };
+                        bool is_scene_hit{ ((hit_mask >> j) & 1u) != 0 };
+                        for (int depth = 0; depth < m_max_reflection; depth++) {
+                            if (depth > 0) {
+                                scene_isect_record = IntersectRecord{};
+                                is_scene_hit = intersect_scene(state.ray, interval, scene_isect_record);
+                            }
+                            if (!trace_bounce(state, scene_isect_record, is_scene_hit, site, true, deposit)) {
+                                break;
+                            }
                         }
                     }
                 }
             }
 
-            std::clog << "Coverage map is generated" << std::endl;
-            return cm;
+            layers.derive(Utils::dB_to_linear(m_noise_power));
+            double elapsed{ timer.elapsed() };
+            std::clog << "Coverage layers are generated: " << elapsed << " s, " << sites.size() / elapsed * 60.0 << " sites per minute" << std::endl;
+            return layers;
         }
 
         float calc_friss_strength(const glm::vec3& start_pos, const glm::vec3& end_pos, float freq, float tx_power, float tx_gain, float rx_gain, float ref_coef = 1.0f) {
@@ -553,17 +895,153 @@ namespace SignalTracer {
 
     private:
 
+        /// @brief Transmitter constants of trace_bounce.
+        struct BounceSource {
+            glm::vec3 position{};
+            float power{};                          // linear
+            float frequency{};
+            float gain{};                           // linear
+            std::vector<float> permittivities{};    // indexed by material id
+            std::string polar{ "TM" };
+        };
+
+        /// @brief A coverage ray between two bounces.
+        struct BounceRay {
+            Ray ray{};
+            glm::vec3 start_pos{};  // the transmitter or the last reflection point
+            float strength{};       // linear power leaving start_pos
+        };
+
+        BounceSource make_bounce_source(const Transmitter& tx) const {
+            return BounceSource{ tx.get_position(), Utils::dB_to_linear(tx.get_power()), tx.get_frequency(),
+                Utils::dB_to_linear(tx.get_gain()), m_palette->get_permittivities(tx.get_frequency()) };
+        }
+
+        /// @brief One bounce of a coverage ray, the body shared by every generate variant.
+        /// @details With friss, deposit(ray, t_max, strength_at) adds the segment in front of the scene hit
+        /// (t_max is INF_POS on a miss) to the map, strength_at(point) gives the Friis power at a point of it.
+        /// The ray is then reflected at the scene hit and its strength scaled by the reflection coefficient.
+        /// Without friss nothing is deposited and the strength is kept.
+        /// @return true if the ray was reflected and goes on
+        template <typename Deposit>
+        bool trace_bounce(BounceRay& state, const IntersectRecord& scene_record, bool is_scene_hit, const BounceSource& source, bool friss, Deposit&& deposit) {
+            if (friss) {
+                auto strength_at = [&](const glm::vec3& point) {
+                    return calc_friss_strength(state.start_pos, point, source.frequency, state.strength, source.gain, 1.0f);
+                };
+                deposit(static_cast<const Ray&>(state.ray), scene_record.t, strength_at);
+            }
+            if (!is_scene_hit) {
+                return false;
+            }
+
+            Ray scattered_ray{};
+            glm::vec3 attenuation{};
+            if (!get_material(scene_record)->is_scattering(state.ray, scene_record, attenuation, scattered_ray)) {
+                return false;
+            }
+            if (friss) {
+                glm::vec3 incident_dir{ glm::normalize(state.ray.get_direction()) };
+                glm::vec3 reflected_dir{ glm::normalize(glm::reflect(incident_dir, scene_record.normal)) };
+                float incident_angle = std::acos(glm::dot(incident_dir, reflected_dir)) / 2;
+                float ref_coef{ calc_reflection_coefficient(incident_angle, 1.0f, source.permittivities[get_mat_id(scene_record)], source.polar) };
+                state.strength = calc_friss_strength(state.start_pos, scene_record.point, source.frequency, state.strength, source.gain, 1.0f, ref_coef);
+            }
+            state.start_pos = scene_record.point;
+            state.ray = std::move(scattered_ray);
+            return true;
+        }
+
+        /// @brief Body of generate_par and generate_sparse, the rays of tx deposit into the coverage quad through the accumulator.
+        template <typename Accumulator>
+        void trace_par(const Transmitter& tx, const Quad& cm_quad, Accumulator& accumulator, std::vector<SignalTracer::PathRecord>* path_recs, const std::string& method) {
+            glm::vec3 tx_pos{ tx.get_position() };
+            std::clog << "tx position: " << glm::to_string(tx_pos) << std::endl;
+
+            // generate rays from the transmitters to the screen
+            Utils::Timer timer{};
+            std::vector<Ray> rays(m_num_rays);
+            {
+                std::vector <glm::vec3> directions{ Utils::get_fibonacci_lattice(m_num_rays) };
+                Utils::sort_directions_coherent(directions);
+                std::transform(std::execution::par_unseq, directions.begin(), directions.end(), rays.begin(), [&tx_pos](const glm::vec3& dir) {return Ray{ tx_pos, dir };});
+            }
+
+            // the first bounce of all rays starts at the transmitter, trace it in packets of neighbouring directions
+            std::vector<IntersectRecord> first_hits(m_num_rays);
+#pragma omp parallel for schedule(dynamic, 64)
+            for (int first = 0; first < m_num_rays; first += RayPacket::MAX_SIZE) {
+                const int count{ std::min(RayPacket::MAX_SIZE, m_num_rays - first) };
+                intersect_scene(RayPacket{ &rays[first], count }, Interval{ Constant::EPSILON, Constant::INF_POS }, &first_hits[first]);
+            }
+
+            std::vector<SignalTracer::PathRecord> tmp_path_recs(m_num_rays);
+            const BounceSource source{ make_bounce_source(tx) };
+            const bool friss{ method == "friss" };
+            const Interval interval{ Constant::EPSILON, Constant::INF_POS };
+            auto deposit = [&](const Ray& ray, float t_max, auto&& strength_at) {
+                IntersectRecord cm_isect_record{};
+                if (cm_quad.is_hit(ray, interval, cm_isect_record) && cm_isect_record.t < t_max) {
+                    accumulator.add_strength(cm_isect_record.point, strength_at(cm_isect_record.point));
+                }
+            };
+            // static schedule, so that each thread sums the same rays on every run
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < m_num_rays; i++) {
+                BounceRay state{ rays[i], tx_pos, source.power };
+                tmp_path_recs[i].add_point(tx_pos);
+                tmp_path_recs[i].set_signal_strength(source.power);
+
+                for (int depth = 0; depth < m_max_reflection; depth++) {
+                    IntersectRecord scene_isect_record{};
+                    bool is_scene_hit{};
+                    if (depth == 0) {
+                        scene_isect_record = first_hits[i];
+                        is_scene_hit = scene_isect_record.has_primitive();
+                    }
+                    else {
+                        is_scene_hit = intersect_scene(state.ray, interval, scene_isect_record);
+                    }
+
+                    // the path records the scene hit even where the ray stops
+                    if (is_scene_hit) {
+                        tmp_path_recs[i].add_record(scene_isect_record.point, get_mat_id(scene_isect_record), scene_isect_record.blas_id, scene_isect_record.prim_id);
+                    }
+                    else if (path_recs == nullptr) {
+                        tmp_path_recs[i].clear();
+                    }
+                    else if (depth != 0) {
+                        tmp_path_recs[i].add_record(state.ray.point_at(1000.0f));
+                    }
+                    if (!trace_bounce(state, scene_isect_record, is_scene_hit, source, friss, deposit)) {
+                        break;
+                    }
+                    tmp_path_recs[i].set_signal_strength(state.strength);
+                }
+            }
+            accumulator.reduce();
+            timer.execution_time();
+
+            if (path_recs != nullptr) {
+                for (int i = 0; i < m_num_rays; i++) {
+                    if (!tmp_path_recs[i].is_empty()) {
+                        (*path_recs).emplace_back(tmp_path_recs[i]);
+                    }
+                }
+            }
+        }
+
         void trace_ray(const Ray& ray, int depth, PathRecord& path_rec) const {
             Ray cur_ray{ ray };
             IntersectRecord isect_rec{};
             Interval interval{ Constant::EPSILON, Constant::INF_POS };
 
             for (int i = 0; i < depth; i++) {
-                if (m_tlas.is_hit(cur_ray, interval, isect_rec)) {
-                    path_rec.add_record(isect_rec.point, isect_rec.tri_ptr->get_mat_ptr(), isect_rec.tri_ptr);
+                if (intersect_scene(cur_ray, interval, isect_rec)) {
+                    path_rec.add_record(isect_rec.point, get_mat_id(isect_rec), isect_rec.blas_id, isect_rec.prim_id);
                     Ray scattered_ray{};
                     glm::vec3 attenuation{};
-                    if (isect_rec.tri_ptr->get_mat_ptr()->is_scattering(cur_ray, isect_rec, attenuation, scattered_ray)) {
+                    if (get_material(isect_rec)->is_scattering(cur_ray, isect_rec, attenuation, scattered_ray)) {
                         cur_ray = scattered_ray;
                         continue;
                     }
@@ -580,6 +1058,13 @@ namespace SignalTracer {
 
         int m_max_reflection{ 2 };
         int m_num_rays{ static_cast<int>(6e6) };
+        bool m_bounce_sync{ false };    // generate() runs generate_wavefront
+        bool m_sort_rays{ true };       // generate_wavefront sorts the rays between bounces
+        CoverageAccumulation m_accumulation{ CoverageAccumulation::Auto };
+        std::size_t m_accumulation_budget{ CoverageAccumulator::DEFAULT_MEMORY_BUDGET };
+        float m_noise_power{ -101.0f }; // dBm, thermal noise over 20 MHz
+        CoverageBackend m_backend{ CoverageBackend::Dense };
+        std::vector<BounceStats> m_bounce_stats{};
     };
 
 }
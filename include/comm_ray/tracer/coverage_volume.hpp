@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef COVERAGE_VOLUME_HPP
+#define COVERAGE_VOLUME_HPP
+
+#include "aabb.hpp"
+#include "coverage_map.hpp"
+#include "quad.hpp"
+#include "ray.hpp"
+#include "glm/glm.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        CoverageVolume
+        Coverage at several receiver heights in one trace: a stack of
+        horizontal coverage maps over the same cells, e.g. pedestrian,
+        vehicle and one per building floor. A ray segment is walked
+        along y through the sorted layer heights, so it visits every
+        layer it crosses in order, and each layer gets the same
+        deposits a single plane run at its height would get.
+        ----------------------------------------
+    */
+    class CoverageVolume {
+    public:
+        CoverageVolume() = default;
+
+        /// @param heights y of the layers, in any order
+        CoverageVolume(const AABB& scene_box, std::vector<float> heights, float cell_size)
+            : m_heights{ std::move(heights) } {
+            std::sort(m_heights.begin(), m_heights.end());
+            m_heights.erase(std::unique(m_heights.begin(), m_heights.end()), m_heights.end());
+            glm::vec3 box_min{ scene_box.get_min() };
+            glm::vec3 box_max{ scene_box.get_max() };
+            m_layers.reserve(m_heights.size());
+            for (float height : m_heights) {
+                Quad quad{ glm::vec3{ box_min.x, height, box_min.z }, glm::vec3{ 0.0f, 0.0f, box_max.z - box_min.z }, glm::vec3{ box_max.x - box_min.x, 0.0f, 0.0f } };
+                m_layers.emplace_back(quad, cell_size);
+            }
+            m_min_x = box_min.x;
+            m_max_x = box_max.x;
+            m_min_z = box_min.z;
+            m_max_z = box_max.z;
+        }
+
+        std::size_t get_num_layers() const { return m_layers.size(); }
+        const std::vector<float>& get_heights() const { return m_heights; }
+        CoverageMap& get_layer(std::size_t layer) { return m_layers[layer]; }
+        const CoverageMap& get_layer(std::size_t layer) const { return m_layers[layer]; }
+        std::vector<CoverageMap>& get_layers() { return m_layers; }
+        std::size_t memory_usage() const {
+            std::size_t bytes{ 0 };
+            for (const auto& layer : m_layers) {
+                bytes += layer.get_num_cells() * sizeof(Cell);
+            }
+            return bytes;
+        }
+
+        /// @brief One accumulator per layer for a parallel trace, the budget is shared by the layers.
+        std::vector<std::unique_ptr<CoverageAccumulator>> make_accumulators(CoverageAccumulation mode = CoverageAccumulation::Auto,
+            std::size_t memory_budget = CoverageAccumulator::DEFAULT_MEMORY_BUDGET) {
+            std::vector<std::unique_ptr<CoverageAccumulator>> accumulators{};
+            for (auto& layer : m_layers) {
+                accumulators.emplace_back(std::make_unique<CoverageAccumulator>(layer, mode, memory_budget / std::max<std::size_t>(m_layers.size(), 1)));
+            }
+            return accumulators;
+        }
+
+        /// @brief Visit the layers a ray crosses within (t_min, t_max), nearest first, as visit(layer, point).
+        /// @details A ray parallel to the layers crosses none, like a single coverage quad.
+        template <typename Visit>
+        void for_each_crossing(const Ray& ray, float t_min, float t_max, Visit&& visit) const {
+            const glm::vec3& origin{ ray.get_origin() };
+            const glm::vec3& direction{ ray.get_direction() };
+            if (direction.y == 0.0f || m_heights.empty()) {
+                return;
+            }
+            const float inv_dy{ 1.0f / direction.y };
+            auto cross = [&](std::size_t layer) {
+                float t{ (m_heights[layer] - origin.y) * inv_dy };
+                if (t <= t_min) {
+                    return true;
+                }
+                if (t >= t_max) {
+                    return false;
+                }
+                glm::vec3 point{ origin + t * direction };
+                if (point.x >= m_min_x && point.x <= m_max_x && point.z >= m_min_z && point.z <= m_max_z) {
+                    visit(layer, point);
+                }
+                return true;
+            };
+
+            // first layer beyond the origin in the direction of the ray
+            auto above = std::upper_bound(m_heights.begin(), m_heights.end(), origin.y);
+            if (direction.y > 0.0f) {
+                for (std::size_t layer = static_cast<std::size_t>(above - m_heights.begin()); layer < m_heights.size(); ++layer) {
+                    if (!cross(layer)) { break; }
+                }
+            }
+            else {
+                for (std::size_t layer = static_cast<std::size_t>(above - m_heights.begin()); layer-- > 0;) {
+                    if (!cross(layer)) { break; }
+                }
+            }
+        }
+
+    private:
+        std::vector<float> m_heights{};         // ascending
+        std::vector<CoverageMap> m_layers{};    // one per height
+        float m_min_x{ 0.0f };
+        float m_max_x{ 0.0f };
+        float m_min_z{ 0.0f };
+        float m_max_z{ 0.0f };
+    };
+}
+
+#endif // !COVERAGE_VOLUME_HPP
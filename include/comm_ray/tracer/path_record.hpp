@@ -3,11 +3,11 @@
 #ifndef PATH_RECORD_HPP
 #define PATH_RECORD_HPP
 
-#include "triangle.hpp"
 #include "material.hpp"
 #include <glm/gtx/string_cast.hpp>
 #include "glm/glm.hpp"
 #include <iostream>
+#include <cstdint>
 #include <memory>
 
 namespace SignalTracer {
@@ -16,10 +16,11 @@ namespace SignalTracer {
     public:
 
         PathRecord() = default;
-        PathRecord(const int& reflection_count, const std::vector<glm::vec3>& ref_points, const std::vector<std::shared_ptr<Material>>& ref_material_ptrs)
+        /// @param ref_mat_ids palette ids of the materials at the reflection points
+        PathRecord(const int& reflection_count, const std::vector<glm::vec3>& ref_points, const std::vector<uint16_t>& ref_mat_ids)
             : m_ref_count{ reflection_count }
             , m_points{ ref_points }
-            , m_mat_ptrs{ ref_material_ptrs } {}
+            , m_mat_ids{ ref_mat_ids } {}
 
         friend std::ostream& operator<<(std::ostream& os, const PathRecord& record) {
             os << "ReflectionRecord: " << std::endl;
@@ -28,23 +29,13 @@ namespace SignalTracer {
             for (const auto& point : record.m_points) {
                 os << "\t" << glm::to_string(point) << std::endl;
             }
-            os << "Trace materials: " << std::endl;
-            for (const auto& material_ptr : record.m_mat_ptrs) {
-                if (material_ptr == nullptr) {
-                    os << "\t" << "nullptr" << std::endl;
-                }
-                else {
-                    os << "\t" << *material_ptr;
-                }
+            os << "Trace materials (palette ids): " << std::endl;
+            for (const auto& mat_id : record.m_mat_ids) {
+                os << "\t" << mat_id << std::endl;
             }
-            os << "Trace Triangles: " << std::endl;
-            for (const auto& triangle_ptr : record.m_tri_ptrs) {
-                if (triangle_ptr == nullptr) {
-                    os << "\t" << "nullptr" << std::endl;
-                }
-                else {
-                    os << "\t" << *triangle_ptr;
-                }
+            os << "Trace primitives (blas, prim): " << std::endl;
+            for (std::size_t i = 0; i < record.m_prim_ids.size(); ++i) {
+                os << "\t" << record.m_blas_ids[i] << ", " << record.m_prim_ids[i] << std::endl;
             }
             os << "Signal loss: " << "\t" << record.m_loss << " dB" << std::endl;
             os << "Signal strength: " << "\t" << record.m_strength << " dBm" << std::endl;
@@ -57,8 +48,9 @@ namespace SignalTracer {
         void clear() {
             m_ref_count = 0;
             m_points.clear();
-            m_mat_ptrs.clear();
-            m_tri_ptrs.clear();
+            m_mat_ids.clear();
+            m_blas_ids.clear();
+            m_prim_ids.clear();
             m_loss = 0.0f;
             m_strength = 0.0f;
             m_delay = 0.0f;
@@ -82,7 +74,9 @@ namespace SignalTracer {
 
         int get_reflection_count() const { return m_ref_count; }
         std::vector<glm::vec3> get_points() const { return m_points; }
-        std::vector<std::shared_ptr<Material>> get_mat_ptrs() const { return m_mat_ptrs; }
+        const std::vector<uint16_t>& get_mat_ids() const { return m_mat_ids; }
+        std::vector<uint32_t> get_blas_ids() const { return m_blas_ids; }
+        std::vector<uint32_t> get_prim_ids() const { return m_prim_ids; }
         float get_signal_loss() const { return m_loss; }
         float get_signal_strength() const { return m_strength; }
         float get_signal_delay() const { return m_delay; }
@@ -96,12 +90,13 @@ namespace SignalTracer {
             m_points.emplace_back(point);
         }
 
-        void add_material_ptr(const std::shared_ptr<Material>& material_ptr) {
-            m_mat_ptrs.emplace_back(material_ptr);
+        void add_mat_id(uint16_t mat_id) {
+            m_mat_ids.emplace_back(mat_id);
         }
 
-        void add_triangle_ptr(const std::shared_ptr<Triangle>& triangle_ptr) {
-            m_tri_ptrs.emplace_back(triangle_ptr);
+        void add_primitive(const uint32_t& blas_id, const uint32_t& prim_id) {
+            m_blas_ids.emplace_back(blas_id);
+            m_prim_ids.emplace_back(prim_id);
         }
 
         // Add starting point or ending point
@@ -110,17 +105,17 @@ namespace SignalTracer {
         }
 
         // Add intermediate point
-        void add_record(const glm::vec3& point, const std::shared_ptr<Material>& material_ptr) {
+        void add_record(const glm::vec3& point, uint16_t mat_id) {
             add_reflection_count();
             add_point(point);
-            add_material_ptr(material_ptr);
+            add_mat_id(mat_id);
         }
 
-        void add_record(const glm::vec3& point, const std::shared_ptr<Material>& material_ptr, const std::shared_ptr<Triangle>& triangle_ptr) {
+        void add_record(const glm::vec3& point, uint16_t mat_id, const uint32_t& blas_id, const uint32_t& prim_id) {
             add_reflection_count();
             add_point(point);
-            add_material_ptr(material_ptr);
-            add_triangle_ptr(triangle_ptr);
+            add_mat_id(mat_id);
+            add_primitive(blas_id, prim_id);
         }
 
         bool is_empty() const {
@@ -130,8 +125,9 @@ namespace SignalTracer {
     private:
         int m_ref_count{ 0 };
         std::vector<glm::vec3> m_points{};
-        std::vector<std::shared_ptr<Material>> m_mat_ptrs{};
-        std::vector<std::shared_ptr<Triangle>> m_tri_ptrs;
+        std::vector<uint16_t> m_mat_ids{}; // into the palette of the tracer
+        std::vector<uint32_t> m_blas_ids{};
+        std::vector<uint32_t> m_prim_ids{};
         float m_loss{};
         float m_strength{};
         float m_delay{};
@@ -9,6 +9,7 @@
 #include "constant.hpp"
 #include "intersect_record.hpp"
 #include "path_record.hpp"
+#include "ray_packet.hpp"
 #include "triangle.hpp"
 #include "utils.hpp"
 #include "material.hpp"
@@ -17,6 +18,7 @@
 #include "glm/glm.hpp"
 #include "glm/gtx/transform.hpp"
 
+#include <algorithm>
 #include <functional>
 #include <cmath>
 #include <iostream>
@@ -32,16 +34,16 @@ namespace SignalTracer {
     public:
         RayCastingTracer() = default;
 
-        RayCastingTracer(const std::vector<Model>& models, int max_reflection = 2)
-            : BaseTracer{ models }
+        RayCastingTracer(const std::vector<Model>& models, int max_reflection = 2, const BVHBuildOptions& options = {})
+            : BaseTracer{ models, options }
             , m_max_reflection{ max_reflection } {}
 
-        RayCastingTracer(const std::vector<std::reference_wrapper<Model>>& models, int max_reflection = 2)
-            : BaseTracer{ models }
+        RayCastingTracer(const std::vector<std::reference_wrapper<Model>>& models, int max_reflection = 2, const BVHBuildOptions& options = {})
+            : BaseTracer{ models, options }
             , m_max_reflection{ max_reflection } {}
 
-        RayCastingTracer(std::vector<std::reference_wrapper<Model>>& models, int max_reflection = 2, int num_rays = int(6e6))
-            : BaseTracer{ models }
+        RayCastingTracer(std::vector<std::reference_wrapper<Model>>& models, int max_reflection = 2, int num_rays = int(6e6), const BVHBuildOptions& options = {})
+            : BaseTracer{ models, options }
             , m_max_reflection{ max_reflection }
             , m_num_rays{ num_rays } {}
 
@@ -122,6 +124,8 @@ namespace SignalTracer {
 
             Utils::Timer timer{};
             std::vector <glm::vec3> directions{ Utils::get_fibonacci_lattice(m_num_rays) };
+            // each thread then traces packets of neighbouring directions
+            Utils::sort_directions_coherent(directions);
             timer.execution_time();
 
             timer.reset();
@@ -161,12 +165,20 @@ namespace SignalTracer {
         };
 
         void trace_fibonacci_rays(const glm::vec3& tx_pos, const glm::vec3& rx_pos, std::vector<PathRecord>& ref_records, const std::vector<Ray>& ray) {
-            for (const auto& r : ray) {
-                PathRecord path_rec{};
-                path_rec.add_point(tx_pos);
-                trace_ray(r, rx_pos, m_rx_radius, m_max_reflection, path_rec);
-                if (!path_rec.is_empty()) {
-                    ref_records.emplace_back(path_rec);
+            // the first bounce is traced in packets, all rays share the tx position
+            const int num_rays{ static_cast<int>(ray.size()) };
+            for (int first = 0; first < num_rays; first += RayPacket::MAX_SIZE) {
+                const int count{ std::min(RayPacket::MAX_SIZE, num_rays - first) };
+                IntersectRecord first_hits[RayPacket::MAX_SIZE]{};
+                intersect_scene(RayPacket{ &ray[first], count }, Interval{ Constant::EPSILON, Constant::INF_POS }, first_hits);
+
+                for (int i = 0; i < count; i++) {
+                    PathRecord path_rec{};
+                    path_rec.add_point(tx_pos);
+                    trace_ray(ray[first + i], rx_pos, m_rx_radius, m_max_reflection, path_rec, &first_hits[i]);
+                    if (!path_rec.is_empty()) {
+                        ref_records.emplace_back(path_rec);
+                    }
                 }
             }
         }
@@ -176,12 +188,13 @@ namespace SignalTracer {
             trace_ray(ray, rx_pos, m_rx_radius, m_max_reflection, path_rec);
         }
 
-        void trace_ray(const Ray& ray, const glm::vec3& rx_pos, const float& rx_radius, int depth, PathRecord& path_rec) {
+        /// @param first_hit closest hit of the ray when it was already traced in a packet
+        void trace_ray(const Ray& ray, const glm::vec3& rx_pos, const float& rx_radius, int depth, PathRecord& path_rec, const IntersectRecord* first_hit = nullptr) {
             if (depth < 0) {
                 path_rec.clear();
                 return;
             }
-            IntersectRecord record{};
+            IntersectRecord record{ first_hit != nullptr ? *first_hit : IntersectRecord{} };
             Interval interval{ Constant::EPSILON, Constant::INF_POS };
             glm::vec3 projection_point{};
 
@@ -191,7 +204,7 @@ namespace SignalTracer {
             float t0 = glm::dot(ray.get_direction(), rx_pos - ray.get_origin());
 
             // save new IntersectionRecord to record
-            bool b_is_hit{ m_tlas.is_hit(ray, interval, record) };
+            bool b_is_hit{ first_hit != nullptr ? record.has_primitive() : intersect_scene(ray, interval, record) };
 
             if (t0 >= 0 && t0 <= record.t) {
                 // if (t0 >= 0 && t0 <= record.get_t()) {
@@ -205,10 +218,10 @@ namespace SignalTracer {
             }
 
             if (b_is_hit) {
-                path_rec.add_record(record.point, record.tri_ptr->get_mat_ptr(), record.tri_ptr);
+                path_rec.add_record(record.point, get_mat_id(record), record.blas_id, record.prim_id);
                 Ray scattered_ray{};
                 glm::vec3 attenuation{};
-                if (record.tri_ptr->get_mat_ptr()->is_scattering(ray, record, attenuation, scattered_ray)) {
+                if (get_material(record)->is_scattering(ray, record, attenuation, scattered_ray)) {
                     trace_ray(scattered_ray, rx_pos, rx_radius, depth - 1, path_rec);
                     return;
                 }
@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef RAY_PACKET_HPP
+#define RAY_PACKET_HPP
+
+#include "ray.hpp"
+#include "constant.hpp"
+#include "glm/glm.hpp"
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        RayPacket
+        Up to MAX_SIZE rays traced together through a BVH.
+        When all rays share an origin, e.g. neighbouring launch directions
+        of a transmitter, a node can be culled for the whole packet
+        with interval arithmetic on the reciprocal directions:
+        on every axis where the rays agree in sign,
+        rd_min and rd_max bound the reciprocal direction of each ray.
+        Packets with different origins, directions spread wider than
+        MIN_COS or less than two bounded axes are traced ray by ray,
+        their bounds would not cull.
+        ----------------------------------------
+    */
+    struct RayPacket {
+        static constexpr int MAX_SIZE{ 16 };
+        static constexpr float MIN_COS{ 0.99f }; // every direction within ~8 degrees of the first one
+
+        /// @param rays the first ray of the packet, the rays are not copied
+        /// @param size number of rays, at most MAX_SIZE
+        /// @param active mask of the rays to trace, all of them by default
+        RayPacket(const Ray* rays, int size, uint32_t active = Constant::INVALID_IDX)
+            : m_rays{ rays }
+            , m_size{ size }
+            , m_active{ active & ((1u << size) - 1u) } {
+            if (m_active == 0) { return; }
+            m_origin = m_rays[std::countr_zero(m_active)].get_origin();
+            const glm::vec3& first_direction = m_rays[std::countr_zero(m_active)].get_direction();
+
+            glm::vec3 rd_min{ Constant::INF_POS };
+            glm::vec3 rd_max{ Constant::INF_NEG };
+            m_coherent = true;
+            for (uint32_t mask = m_active; mask; mask &= mask - 1) {
+                const Ray& ray = m_rays[std::countr_zero(mask)];
+                m_coherent &= ray.get_origin() == m_origin && glm::dot(ray.get_direction(), first_direction) >= MIN_COS;
+                rd_min = glm::min(rd_min, ray.get_rdirection());
+                rd_max = glm::max(rd_max, ray.get_rdirection());
+            }
+
+            // axes with mixed signs or axis-parallel rays give no bound,
+            // a single bounded axis is a slab that culls next to nothing
+            int bounded_axes = 0;
+            for (int axis = 0; axis < 3; ++axis) {
+                bool finite = std::isfinite(rd_min[axis]) && std::isfinite(rd_max[axis]);
+                if (finite && rd_min[axis] > 0.0f) { m_sign[axis] = 1; }
+                else if (finite && rd_max[axis] < 0.0f) { m_sign[axis] = -1; }
+                bounded_axes += m_sign[axis] != 0;
+            }
+            m_coherent &= bounded_axes >= 2;
+            m_rd_min = rd_min;
+            m_rd_max = rd_max;
+        }
+
+        const Ray& operator[](int i) const { return m_rays[i]; }
+        const Ray* get_rays() const { return m_rays; }
+        int size() const { return m_size; }
+        uint32_t get_active() const { return m_active; }
+
+        /// @brief True if the rays share an origin and point roughly the same way, only such packets are culled as a whole.
+        bool is_coherent() const { return m_coherent; }
+
+        const glm::vec3& get_origin() const { return m_origin; }
+        const glm::vec3& get_rd_min() const { return m_rd_min; }
+        const glm::vec3& get_rd_max() const { return m_rd_max; }
+
+        /// @brief 1 or -1 if all reciprocal directions on the axis are finite with that sign, 0 otherwise.
+        int get_sign(int axis) const { return m_sign[axis]; }
+
+    private:
+        const Ray* m_rays{ nullptr };
+        int m_size{ 0 };
+        uint32_t m_active{ 0 };
+        bool m_coherent{ false };
+        glm::vec3 m_origin{};
+        glm::vec3 m_rd_min{};
+        glm::vec3 m_rd_max{};
+        int m_sign[3]{ 0, 0, 0 };
+    };
+}
+
+#endif // !RAY_PACKET_HPP
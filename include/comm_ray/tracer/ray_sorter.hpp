@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef RAY_SORTER_HPP
+#define RAY_SORTER_HPP
+
+#include "ray.hpp"
+#include "aabb.hpp"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /*
+        ----------------------------------------
+        RaySorter
+        Orders the rays of a bounce for coherent traversal.
+        After a reflection, neighbouring rays of a launch
+        start on different walls and head different ways, so threads
+        walking them in index order touch unrelated parts of the BVH.
+        The key is a coarse direction cell (Utils::octahedral_code,
+        8x8 cells) above the 30-bit Morton code of the origin in the
+        scene box: rays heading the same way from nearby points
+        become neighbours.
+        Keys are sorted with an 11-bit LSD radix sort, four passes.
+        ----------------------------------------
+    */
+    class RaySorter {
+    public:
+        RaySorter() = default;
+        explicit RaySorter(const AABB& scene_box);
+
+        /// @brief Sort ray ids by the key of rays[id].
+        void sort(const std::vector<Ray>& rays, std::vector<int>& ray_ids);
+
+        uint64_t calc_key(const Ray& ray) const;
+
+    private:
+        static constexpr int DIRECTION_BITS{ 3 };   // per axis of the octahedral map
+        static constexpr int KEY_BITS{ 30 + 2 * DIRECTION_BITS };
+        static constexpr int RADIX_BITS{ 11 };
+
+        glm::vec3 m_min{ 0.0f };
+        glm::vec3 m_inv_extent{ 1.0f };
+
+        // reused between bounces
+        std::vector<uint64_t> m_keys{};
+        std::vector<uint64_t> m_tmp_keys{};
+        std::vector<int> m_tmp_ids{};
+    };
+}
+
+#endif // !RAY_SORTER_HPP
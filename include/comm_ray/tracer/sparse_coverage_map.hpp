@@ -0,0 +1,280 @@
+#pragma once
+
+#ifndef SPARSE_COVERAGE_MAP_HPP
+#define SPARSE_COVERAGE_MAP_HPP
+
+#include "coverage_map.hpp"
+#include "quad.hpp"
+#include "glm/glm.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace SignalTracer {
+
+    /// @brief Open addressing hash of cell strengths keyed by (row, col), linear probing, at most half full.
+    class SparseCellTable {
+    public:
+        static constexpr uint64_t EMPTY{ UINT64_MAX };
+
+        static uint64_t make_key(int row, int col) { return (static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32) | static_cast<uint32_t>(col); }
+        static int key_row(uint64_t key) { return static_cast<int>(key >> 32); }
+        static int key_col(uint64_t key) { return static_cast<int>(key & 0xffffffffu); }
+
+        std::size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        std::size_t memory_usage() const { return m_keys.capacity() * sizeof(uint64_t) + m_values.capacity() * sizeof(float); }
+
+        void add(uint64_t key, float value) {
+            if (2 * (m_size + 1) > m_keys.size()) {
+                rehash(std::max<std::size_t>(2 * m_keys.size(), 64));
+            }
+            std::size_t slot{ find_slot(key) };
+            if (m_keys[slot] == EMPTY) {
+                m_keys[slot] = key;
+                m_values[slot] = 0.0f;
+                m_size++;
+            }
+            m_values[slot] += value;
+        }
+
+        void set(uint64_t key, float value) {
+            add(key, 0.0f);
+            m_values[find_slot(key)] = value;
+        }
+
+        /// @return nullptr if the cell was never added to
+        const float* find(uint64_t key) const {
+            if (m_keys.empty()) {
+                return nullptr;
+            }
+            std::size_t slot{ find_slot(key) };
+            return m_keys[slot] == EMPTY ? nullptr : &m_values[slot];
+        }
+
+        /// @brief Visit the occupied cells as visit(key, value), in slot order.
+        template <typename Visit>
+        void for_each(Visit&& visit) const {
+            for (std::size_t slot = 0; slot < m_keys.size(); ++slot) {
+                if (m_keys[slot] != EMPTY) {
+                    visit(m_keys[slot], m_values[slot]);
+                }
+            }
+        }
+
+        /// @brief Apply f to every value in place.
+        template <typename F>
+        void transform(F&& f) {
+            for (std::size_t slot = 0; slot < m_keys.size(); ++slot) {
+                if (m_keys[slot] != EMPTY) {
+                    m_values[slot] = f(m_values[slot]);
+                }
+            }
+        }
+
+        void clear() {
+            std::fill(m_keys.begin(), m_keys.end(), EMPTY);
+            m_size = 0;
+        }
+
+    private:
+        static uint64_t hash(uint64_t key) {
+            // splitmix64 finalizer, neighbouring cells land far apart
+            key ^= key >> 30;
+            key *= 0xbf58476d1ce4e5b9ull;
+            key ^= key >> 27;
+            key *= 0x94d049bb133111ebull;
+            return key ^ (key >> 31);
+        }
+
+        std::size_t find_slot(uint64_t key) const {
+            const std::size_t mask{ m_keys.size() - 1 };
+            std::size_t slot{ static_cast<std::size_t>(hash(key)) & mask };
+            while (m_keys[slot] != EMPTY && m_keys[slot] != key) {
+                slot = (slot + 1) & mask;
+            }
+            return slot;
+        }
+
+        void rehash(std::size_t capacity) {
+            std::vector<uint64_t> keys(capacity, EMPTY);
+            std::vector<float> values(capacity, 0.0f);
+            keys.swap(m_keys);
+            values.swap(m_values);
+            for (std::size_t slot = 0; slot < keys.size(); ++slot) {
+                if (keys[slot] != EMPTY) {
+                    std::size_t new_slot{ find_slot(keys[slot]) };
+                    m_keys[new_slot] = keys[slot];
+                    m_values[new_slot] = values[slot];
+                }
+            }
+        }
+
+        std::vector<uint64_t> m_keys{};     // power of two slots
+        std::vector<float> m_values{};
+        std::size_t m_size{ 0 };
+    };
+
+    /*
+        ----------------------------------------
+        SparseCoverageMap
+        CoverageMap backend for large domains where rays reach few cells,
+        such as the streets of an urban canyon. Only cells that received
+        strength are stored, in a SparseCellTable, the rest read as 0, or
+        -200 after convert_to_dB(). Cells are laid out exactly like the
+        CoverageMap of the same quad and cell size, and to_dense() builds
+        that map on export.
+        ----------------------------------------
+    */
+    class SparseCoverageMap {
+    public:
+        SparseCoverageMap() = default;
+
+        SparseCoverageMap(const Quad& quad, const float cell_size = 2.0f)
+            : m_cm{ quad }
+            , m_corner{ quad.get_corner_point() }
+            , m_unit_u{ quad.get_unit_u() }
+            , m_unit_v{ quad.get_unit_v() }
+            , m_cell_size{ cell_size }
+            , m_num_row{ int(quad.get_height() / cell_size) + 1 }
+            , m_num_col{ int(quad.get_width() / cell_size) + 1 } {}
+
+        int get_num_row() const { return m_num_row; }
+        int get_num_col() const { return m_num_col; }
+        std::size_t get_num_occupied() const { return m_cells.size(); }
+        std::size_t memory_usage() const { return m_cells.memory_usage(); }
+        const SparseCellTable& get_table() const { return m_cells; }
+
+        void set_strength(const glm::vec3 point, float strength) {
+            int row{};
+            int col{};
+            if (find_cell(point, row, col)) {
+                m_cells.set(SparseCellTable::make_key(row, col), strength);
+            }
+        }
+
+        /// @brief Get the signal strength at a point, the background for cells without strength.
+        float get_strength(const glm::vec3 point) const {
+            int row{};
+            int col{};
+            if (!find_cell(point, row, col)) {
+                return background();
+            }
+            const float* strength{ m_cells.find(SparseCellTable::make_key(row, col)) };
+            return strength ? *strength : background();
+        }
+
+        /// @brief adding signal strength to a cell center, not thread safe, see SparseCoverageAccumulator.
+        void add_strength(const glm::vec3 point, float strength) {
+            int row{};
+            int col{};
+            if (find_cell(point, row, col)) {
+                m_cells.add(SparseCellTable::make_key(row, col), strength);
+            }
+        }
+
+        /// @brief Add the cells of a table, e.g. the buffer of a thread.
+        void merge(const SparseCellTable& table) {
+            table.for_each([this](uint64_t key, float strength) { m_cells.add(key, strength); });
+        }
+
+        /// @brief Row and column of the nearest cell center, false outside of the map.
+        bool find_cell(const glm::vec3& point, int& row, int& col) const {
+            return find_nearest_cell(point, m_corner, m_unit_u, m_unit_v, m_cell_size, m_num_row, m_num_col, row, col);
+        }
+
+        void convert_to_dB() {
+            m_cells.transform([](float strength) { return strength == 0.0f ? -200.0f : 10.0f * std::log10(strength); });
+            m_in_dB = true;
+        }
+
+        /// @brief The dense CoverageMap of the same cells, for drawing and export.
+        CoverageMap to_dense() const {
+            std::vector<float> strengths(static_cast<std::size_t>(m_num_row) * m_num_col, background());
+            m_cells.for_each([&](uint64_t key, float strength) {
+                strengths[static_cast<std::size_t>(SparseCellTable::key_row(key)) * m_num_col + SparseCellTable::key_col(key)] = strength;
+            });
+            return CoverageMap{ m_cm, strengths, m_cell_size };
+        }
+
+    private:
+        float background() const { return m_in_dB ? -200.0f : 0.0f; }
+
+        Quad m_cm{};
+        glm::vec3 m_corner{ 0.0f };
+        glm::vec3 m_unit_u{ 0.0f };     // normalized sides of the quad, rows along u
+        glm::vec3 m_unit_v{ 0.0f };
+        float m_cell_size{ 2.0f };
+        int m_num_row{};
+        int m_num_col{};
+        bool m_in_dB{ false };
+        SparseCellTable m_cells{};
+    };
+
+    /*
+        ----------------------------------------
+        SparseCoverageAccumulator
+        Counterpart of CoverageAccumulator for a SparseCoverageMap: each
+        thread inserts into its own SparseCellTable, and reduce() merges
+        the buffers into the map in thread order.
+        ----------------------------------------
+    */
+    class SparseCoverageAccumulator {
+    public:
+        explicit SparseCoverageAccumulator(SparseCoverageMap& cm)
+            : m_cm{ cm }
+            , m_buffers(static_cast<std::size_t>(omp_get_max_threads())) {}
+
+        SparseCoverageAccumulator(const SparseCoverageAccumulator&) = delete;
+        SparseCoverageAccumulator& operator=(const SparseCoverageAccumulator&) = delete;
+
+        std::size_t memory_usage() const {
+            std::size_t bytes{ 0 };
+            for (const auto& buffer : m_buffers) {
+                bytes += buffer.table.memory_usage();
+            }
+            return bytes;
+        }
+
+        /// @brief Add the strength of a ray to the cell of a point, safe inside a parallel region.
+        void add_strength(const glm::vec3& point, float strength) {
+            int row{};
+            int col{};
+            if (!m_cm.find_cell(point, row, col)) {
+                return;
+            }
+            std::size_t thread{ static_cast<std::size_t>(omp_get_thread_num()) };
+            if (thread < m_buffers.size()) {
+                m_buffers[thread].table.add(SparseCellTable::make_key(row, col), strength);
+            }
+            else {
+#pragma omp critical(sparse_coverage_overflow)
+                m_overflow.add(SparseCellTable::make_key(row, col), strength);
+            }
+        }
+
+        /// @brief Merge the buffers into the map and clear them, call outside of the parallel region.
+        void reduce() {
+            for (auto& buffer : m_buffers) {
+                m_cm.merge(buffer.table);
+                buffer.table.clear();
+            }
+            m_cm.merge(m_overflow);
+            m_overflow.clear();
+        }
+
+    private:
+        struct alignas(64) Buffer {     // one cache line apart, the tables of two threads do not share one
+            SparseCellTable table{};
+        };
+
+        SparseCoverageMap& m_cm;
+        std::vector<Buffer> m_buffers{};
+        SparseCellTable m_overflow{};   // threads beyond omp_get_max_threads
+    };
+}
+
+#endif // !SPARSE_COVERAGE_MAP_HPP
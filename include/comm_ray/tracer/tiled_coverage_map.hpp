@@ -0,0 +1,160 @@
+#pragma once
+
+#ifndef TILED_COVERAGE_MAP_HPP
+#define TILED_COVERAGE_MAP_HPP
+
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace SignalTracer {
+
+    struct TiledCoverageStats {
+        uint64_t hits{ 0 };             // tiles found resident by a writer miss
+        uint64_t allocations{ 0 };      // tiles touched for the first time
+        uint64_t loads{ 0 };            // tiles read back from the file
+        uint64_t evictions{ 0 };
+        std::size_t resident_bytes{ 0 };
+        std::size_t peak_bytes{ 0 };
+        uint32_t resident_tiles{ 0 };
+        uint32_t touched_tiles{ 0 };
+        uint32_t tile_count{ 0 };
+
+        friend std::ostream& operator<<(std::ostream& out, const TiledCoverageStats& stats) {
+            out << "Tiled coverage: " << stats.touched_tiles << " / " << stats.tile_count << " tiles touched, "
+                << stats.resident_tiles << " resident (" << stats.resident_bytes / 1024.0 / 1024.0 << " MiB, peak "
+                << stats.peak_bytes / 1024.0 / 1024.0 << " MiB), loads: " << stats.loads << ", evictions: " << stats.evictions << std::endl;
+            return out;
+        }
+    };
+
+    /*
+        ----------------------------------------
+        TiledCoverageMap
+        Coverage map for regions too large for a dense CoverageMap. The
+        cells keep only their strength, in square tiles of TILE_SIZE
+        cells that are allocated when a ray first lands on them. Tiles
+        live on the heap up to the memory budget, beyond it the least
+        recently used one is written to its slot of a sparse backing
+        file, memory-mapped shared, and read back when touched again.
+        Threads add through a Writer, which keeps the last tiles it used
+        pinned, so most adds take no lock, only a relaxed atomic add.
+        for_each_tile() streams the tiles to renderers and exporters
+        without bringing them all into memory.
+        Cell (x, z) is centred at origin + (x, z) * cell_size and takes the
+        points nearest to its centre, the cells of a CoverageMap over the
+        same quad with rows along z.
+        ----------------------------------------
+    */
+    class TiledCoverageMap {
+    public:
+        static constexpr uint32_t TILE_SIZE{ 256 };     // cells along each edge of a tile
+        static constexpr std::size_t TILE_CELLS{ static_cast<std::size_t>(TILE_SIZE) * TILE_SIZE };
+        static constexpr std::size_t TILE_BYTES{ TILE_CELLS * sizeof(float) };
+
+        /// @brief Part of the map handed to for_each_tile, row z of the tile starts at strengths + z * TILE_SIZE.
+        struct TileView {
+            uint32_t first_x{ 0 };      // first cell of the tile
+            uint32_t first_z{ 0 };
+            uint32_t width{ 0 };        // cells of the tile inside the map
+            uint32_t depth{ 0 };
+            const float* strengths{ nullptr };
+        };
+
+        /// @brief Adds of one thread, keeps its recent tiles pinned, destroy it before reading the map.
+        class Writer {
+        public:
+            static constexpr uint32_t CACHE_SIZE{ 8 };
+
+            explicit Writer(TiledCoverageMap& map) : m_map{ map } {}
+
+            /// @brief Add to the cell of a point, points outside of the map are dropped.
+            void add_strength(const glm::vec3& point, float strength);
+
+        private:
+            struct Entry {
+                uint32_t tile_id{ UINT32_MAX };
+                std::shared_ptr<float[]> strengths{};
+            };
+
+            TiledCoverageMap& m_map;
+            Entry m_cache[CACHE_SIZE]{};    // direct mapped on the tile id
+        };
+
+        /// @param origin corner of cell (0, 0), its y is the height of the map
+        /// @param extent size of the map on x and z
+        /// @param memory_budget bytes of tiles kept on the heap, tiles pinned by writers may exceed it
+        /// @param backing_path scratch file the evicted tiles go to, created and unlinked once mapped
+        TiledCoverageMap(const glm::vec3& origin, const glm::vec2& extent, float cell_size, std::size_t memory_budget, const std::string& backing_path);
+        ~TiledCoverageMap();
+
+        TiledCoverageMap(const TiledCoverageMap&) = delete;
+        TiledCoverageMap& operator=(const TiledCoverageMap&) = delete;
+
+        /// @brief False if the backing file could not be created or mapped.
+        bool is_open() const { return m_file != nullptr; }
+        uint32_t get_cells_x() const { return m_cells_x; }
+        uint32_t get_cells_z() const { return m_cells_z; }
+        float get_cell_size() const { return m_cell_size; }
+        const glm::vec3& get_origin() const { return m_origin; }
+        TiledCoverageStats get_stats() const;
+
+        /// @brief Add to the cell of a point, thread safe but takes the lock, prefer a Writer in loops.
+        void add_strength(const glm::vec3& point, float strength);
+
+        /// @brief Strength of the cell of a point, 0 outside of the map or in an untouched tile.
+        float get_strength(const glm::vec3& point) const;
+
+        /// @brief Visit every touched tile row by row, evicted tiles are read from the mapping without being cached.
+        /// @details The lock is only held to list the tiles, so the visitor may call get_strength and add_strength.
+        /// A resident tile stays pinned until its visit returns, tiles added to meanwhile may or may not show the adds.
+        void for_each_tile(const std::function<void(const TileView&)>& visit) const;
+
+        /// @brief Write the map as a headerless float32 raster in host byte order, rows along z, like a Heightfield DEM.
+        /// @param in_dB convert like CoverageMap::convert_to_dB, untouched cells become -200
+        /// @return false if the file could not be written
+        bool write_raw(const std::string& path, bool in_dB = true) const;
+
+    private:
+        struct Slot {
+            std::shared_ptr<float[]> strengths{};   // empty if not resident
+            std::list<uint32_t>::iterator lru{};
+            bool on_file{ false };
+        };
+
+        /// @brief Cell index of a point inside its tile, false outside of the map.
+        bool locate(const glm::vec3& point, uint32_t& tile_id, uint32_t& cell) const;
+
+        /// @brief Resident tile, allocated or read back and made most recently used.
+        std::shared_ptr<float[]> acquire(uint32_t tile_id);
+
+        /// @brief Write least recently used tiles to the file until the resident ones fit the budget, call under the lock.
+        void evict();
+
+        float* file_tile(uint32_t tile_id) const { return m_file + static_cast<std::size_t>(tile_id) * TILE_CELLS; }
+
+        glm::vec3 m_origin{ 0.0f };
+        float m_cell_size{ 1.0f };
+        uint32_t m_cells_x{ 0 };
+        uint32_t m_cells_z{ 0 };
+        uint32_t m_tiles_x{ 0 };
+        uint32_t m_tiles_z{ 0 };
+        std::size_t m_memory_budget{ 0 };
+        std::string m_path{};
+        float* m_file{ nullptr };   // every tile has its slot in the mapping
+        std::size_t m_file_size{ 0 };
+
+        mutable std::mutex m_mutex{};   // guards the slots, the LRU list and the counters
+        std::vector<Slot> m_slots{};
+        std::list<uint32_t> m_lru{};    // most recently used first
+        TiledCoverageStats m_stats{};
+    };
+}
+
+#endif // !TILED_COVERAGE_MAP_HPP
@@ -5,6 +5,7 @@
 
 #include <glm/glm.hpp>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 
 namespace Constant {
@@ -21,6 +22,9 @@ namespace Constant {
 
     const float EPSILON = 1e-5;
 
+    // marks an unset primitive / BLAS / node index
+    const inline uint32_t INVALID_IDX = std::numeric_limits<uint32_t>::max();
+
     const inline glm::vec3 NEG_INF_VEC = glm::vec3(INF_NEG);
     const inline glm::vec3 MIN_BOUND = glm::vec3(INF_POS);
     const inline glm::vec3 MAX_BOUND = glm::vec3(INF_NEG);
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIGNAL_TRACER_X86 1
+#define SIGNAL_TRACER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace SIMD {
+    /// @brief Check once at runtime if the CPU can run the AVX2 code path.
+    inline bool has_avx2() {
+#if defined(SIGNAL_TRACER_X86)
+        static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    /// @brief Lane count of the widest code path available: 8 with AVX2, otherwise 4.
+    inline int default_width() {
+        return has_avx2() ? 8 : 4;
+    }
+}
+
+#endif // !SIMD_HPP
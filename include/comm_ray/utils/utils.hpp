@@ -4,7 +4,9 @@
 #define UTILS_HPP
 
 #include "constant.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -12,6 +14,8 @@
 #include <iostream>
 #include <string>
 #include <iomanip>
+#include <utility>
+#include <vector>
 
 // Unused macro
 #define UTILS_UNUSED __attribute__((unused))
@@ -191,6 +195,62 @@ namespace Utils {
         return points;
     }
 
+    /// @brief Insert two zero bits between each of the lower 10 bits of v.
+    inline uint32_t expand_bits(uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    /// @brief 30-bit Morton code of a point in the unit cube, 10 bits per axis.
+    inline uint32_t morton_code(const glm::vec3& p) {
+        const float scale = 1024.0f;
+        glm::vec3 q = glm::clamp(p * scale, glm::vec3{ 0.0f }, glm::vec3{ scale - 1.0f });
+        return (expand_bits(static_cast<uint32_t>(q.x)) << 2)
+            | (expand_bits(static_cast<uint32_t>(q.y)) << 1)
+            | expand_bits(static_cast<uint32_t>(q.z));
+    }
+
+    /// @brief Morton code of a unit direction on a 2^bits x 2^bits grid, at most 16 bits.
+    /// @details The direction is mapped onto the octahedron and the lower half is unfolded
+    /// around the upper one, so nearby codes mean nearby directions.
+    inline uint32_t octahedral_code(const glm::vec3& dir, int bits = 16) {
+        auto spread_bits = [](uint32_t x) {
+            x &= 0x0000ffff;
+            x = (x | (x << 8)) & 0x00ff00ff;
+            x = (x | (x << 4)) & 0x0f0f0f0f;
+            x = (x | (x << 2)) & 0x33333333;
+            x = (x | (x << 1)) & 0x55555555;
+            return x;
+        };
+        glm::vec3 p = dir / (std::fabs(dir.x) + std::fabs(dir.y) + std::fabs(dir.z));
+        float u = p.x, v = p.z;
+        if (p.y < 0.0f) {
+            u = (1.0f - std::fabs(p.z)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+            v = (1.0f - std::fabs(p.x)) * (p.z >= 0.0f ? 1.0f : -1.0f);
+        }
+        const float scale = static_cast<float>((1u << bits) - 1u);
+        uint32_t x = static_cast<uint32_t>(std::clamp((u + 1.0f) * 0.5f, 0.0f, 1.0f) * scale);
+        uint32_t y = static_cast<uint32_t>(std::clamp((v + 1.0f) * 0.5f, 0.0f, 1.0f) * scale);
+        return spread_bits(x) | (spread_bits(y) << 1);
+    }
+
+    /// @brief Reorder unit directions so that neighbours in the vector point to neighbouring directions.
+    /// @details Consecutive Fibonacci lattice points are a golden angle apart, so a packet of them spans the sphere.
+    /// Sorted by octahedral_code, every aligned run of 4^k directions covers a compact patch of the sphere.
+    inline void sort_directions_coherent(std::vector<glm::vec3>& directions) {
+        std::vector<std::pair<uint32_t, glm::vec3>> keyed(directions.size());
+        for (std::size_t i = 0; i < directions.size(); ++i) {
+            keyed[i] = { octahedral_code(directions[i]), directions[i] };
+        }
+        std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (std::size_t i = 0; i < directions.size(); ++i) {
+            directions[i] = keyed[i].second;
+        }
+    }
+
     inline double degrees_to_radians(double degrees) {
         return degrees * Constant::PI / 180.0;
     }
@@ -35,10 +35,19 @@ namespace SignalTracer {
     }
 
     void Model::process_node(aiNode* node, const aiScene* scene) {
+        uint32_t node_id = m_node_count++;
         for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            m_mesh_nodes.push_back(node_id);
+            // meshes without a usemtl get Assimp's default material, which is not always at index 0
+            std::string material_name{};
+            if (mesh->mMaterialIndex < scene->mNumMaterials) {
+                material_name = scene->mMaterials[mesh->mMaterialIndex]->GetName().C_Str();
+            }
+            m_mesh_materials.push_back(material_name == AI_DEFAULT_MATERIAL_NAME ? "" : material_name);
             m_meshes.push_back(
                 process_mesh(
-                    scene->mMeshes[node->mMeshes[i]],
+                    mesh,
                     scene
                 )
             );
@@ -1,67 +1,429 @@
 #include "bvh_map.hpp"
+#include "sbvh_builder.hpp"
+#include "lbvh_builder.hpp"
+#include <deque>
+#include <optional>
 
 namespace SignalTracer {
 
-    BVHAccel::BVHAccel(const std::vector<shared_ptr<Triangle>>& src_objects, const std::size_t& start, const std::size_t& range)
-        : m_prim_ptrs{ std::vector<shared_ptr<Triangle>>(&src_objects[start],&src_objects[range]) }
-        , m_prim_indices{ std::vector<uint>(m_prim_ptrs.size()) }
-        , m_nodes{ std::vector<BVHNode>(2 * m_prim_ptrs.size()) } {
-        build();
+    namespace {
+        // binary BLAS nodes as seen by WideBVH::build, leaves point to their triangle blocks
+        struct BVHNodeSource {
+            const BVHNode* nodes;
+            const uint32_t* leaf_first_block;
+            const TriangleBlocks* blocks;
+            bool is_leaf(uint32_t i) const { return nodes[i].tri_count > 0; }
+            uint32_t left(uint32_t i) const { return nodes[i].left_first; }
+            uint32_t right(uint32_t i) const { return nodes[i].left_first + 1; }
+            uint32_t first(uint32_t i) const { return leaf_first_block[i]; }
+            uint32_t count(uint32_t i) const { return blocks->get_block_count(nodes[i].tri_count); }
+            const glm::vec3& bmin(uint32_t i) const { return nodes[i].aabb_min; }
+            const glm::vec3& bmax(uint32_t i) const { return nodes[i].aabb_max; }
+        };
+
+        // centroid bounds and bins of the three axes over one chunk of a node
+        struct ChunkBins {
+            glm::vec3 centroid_min{ Constant::INF_POS };
+            glm::vec3 centroid_max{ Constant::INF_NEG };
+            Bin bins[3][BVHAccel::MAX_BINS];
+        };
+
+        // chunks of the parallel split search, at most this many per node
+        constexpr uint MAX_SPLIT_CHUNKS{ 64 };
+
+        // Scratch of a parallel split search, reused by the next searches of the same thread.
+        // A search waiting at taskwait may run the search of a descendant node on its thread,
+        // tied tasks nest last in first out, so each nesting level takes its own buffer.
+        class SplitScratch {
+        public:
+            explicit SplitScratch(uint num_chunks) {
+                if (t_depth == t_pool.size()) { t_pool.emplace_back(); }
+                m_chunks = &t_pool[t_depth++];
+                m_chunks->resize(num_chunks);
+            }
+            ~SplitScratch() { --t_depth; }
+            SplitScratch(const SplitScratch&) = delete;
+            SplitScratch& operator=(const SplitScratch&) = delete;
+
+            ChunkBins& operator[](uint c) { return (*m_chunks)[c]; }
+
+        private:
+            static thread_local std::deque<std::vector<ChunkBins>> t_pool;  // a deque keeps the buffers of outer levels in place
+            static thread_local std::size_t t_depth;
+            std::vector<ChunkBins>* m_chunks{ nullptr };
+        };
+        thread_local std::deque<std::vector<ChunkBins>> SplitScratch::t_pool{};
+        thread_local std::size_t SplitScratch::t_depth{ 0 };
+
+        // binary TLAS nodes, a leaf holds exactly one BVH instance
+        struct TLASNodeSource {
+            const TLASNode* nodes;
+            bool is_leaf(uint32_t i) const { return nodes[i].is_leaf(); }
+            uint32_t left(uint32_t i) const { return nodes[i].left; }
+            uint32_t right(uint32_t i) const { return nodes[i].left + 1; }
+            uint32_t first(uint32_t i) const { return nodes[i].blas_idx; }
+            uint32_t count(uint32_t) const { return 1; }
+            const glm::vec3& bmin(uint32_t i) const { return nodes[i].aabb_min; }
+            const glm::vec3& bmax(uint32_t i) const { return nodes[i].aabb_max; }
+        };
+    }
+
+    BVHAccel::BVHAccel(const std::vector<shared_ptr<Triangle>>& src_objects, const std::size_t& start, const std::size_t& range, uint32_t blas_id, const BVHBuildOptions& options)
+        : m_blas_id{ blas_id }
+        , m_options{ options } {
+        std::size_t last = std::min(range, src_objects.size());
+        std::size_t first = std::min(start, last);
+        init_store(std::vector<shared_ptr<Triangle>>(src_objects.begin() + first, src_objects.begin() + last));
+        start_build();
     }
 
-    BVHAccel::BVHAccel(const Model& model)
-        : m_prim_ptrs{ init_triangles(model) }
-        , m_prim_indices{ std::vector<uint>(m_prim_ptrs.size()) }
-        , m_nodes{ std::vector<BVHNode>(2 * m_prim_ptrs.size()) } {
+    BVHAccel::BVHAccel(const Model& model, uint32_t blas_id, const BVHBuildOptions& options)
+        : m_blas_id{ blas_id }
+        , m_options{ options } {
+        init_store(model);
+        start_build();
+    }
+
+    BVHAccel::BVHAccel(const Model& model, const std::vector<uint32_t>& faces, uint32_t blas_id, const BVHBuildOptions& options)
+        : m_faces{ faces }
+        , m_blas_id{ blas_id }
+        , m_options{ options } {
+        init_store(model);
+        start_build();
+    }
+
+    BVHAccel::BVHAccel(const std::shared_ptr<const Heightfield>& heightfield, uint32_t blas_id, const BVHBuildOptions& options)
+        : m_palette{ options.palette ? options.palette : std::make_shared<MaterialPalette>() }
+        , m_blas_id{ blas_id }
+        , m_options{ options }
+        , m_heightfield{ heightfield } {
+        // the root bounds are all the TLAS needs, rays go to the mipmap of the heightfield
+        AABB bounds{ m_heightfield->bounding_box() };
+        m_nodes.assign(1, BVHNode{});
+        m_nodes[0].aabb_min = bounds.get_min();
+        m_nodes[0].aabb_max = bounds.get_max();
+        m_nodes_used = 1;
+        m_built.store(true, std::memory_order_release);
+    }
+
+    BVHAccel::BVHAccel(const BVHAccel& other)
+        : Hittable{ other }
+        , m_store{ other.m_store }
+        , m_palette{ other.m_palette }
+        , m_faces{ other.m_faces }
+        , m_blas_id{ other.m_blas_id }
+        , m_options{ other.m_options }
+        , m_stats{ other.m_stats }
+        , m_prim_indices{ other.m_prim_indices }
+        , m_nodes{ other.m_nodes }
+        , m_nodes_used{ other.m_nodes_used }
+        , m_wide{ other.m_wide }
+        , m_blocks{ other.m_blocks }
+        , m_compressed{ other.m_compressed }
+        , m_paged{ other.m_paged }
+        , m_heightfield{ other.m_heightfield }
+        , m_built{ other.is_built() } {
+        // an unbuilt copy builds on its own first ray
+        if (!is_built()) {
+            m_build_once = std::make_unique<std::once_flag>();
+        }
+    }
+
+    void BVHAccel::start_build() {
+        if (m_options.lazy) {
+            defer_build();
+            return;
+        }
+        m_prim_indices = std::vector<uint>(m_store.size());
+        m_nodes = std::vector<BVHNode>(std::max<std::size_t>(2 * m_store.size(), 2));
         build();
     }
 
-    void BVHAccel::build() {
-        for (std::size_t i = 0; i < m_prim_ptrs.size(); ++i) {
-            m_prim_indices[i] = i;
+    void BVHAccel::defer_build() {
+        // until the first ray arrives only the root bounds are kept, e.g. for the instance boxes of the TLAS
+        m_stats = BVHBuildStats{};
+        m_nodes.assign(2, BVHNode{});
+        m_nodes_used = 2;
+        BVHNode& root = m_nodes[0];
+        root.tri_count = static_cast<uint32_t>(m_store.size());
+        root.aabb_min = glm::vec3{ Constant::INF_POS };
+        root.aabb_max = glm::vec3{ Constant::INF_NEG };
+        for (uint32_t i = 0; i < m_store.size(); ++i) {
+            root.aabb_min = glm::min(root.aabb_min, m_store.get_min(i));
+            root.aabb_max = glm::max(root.aabb_max, m_store.get_max(i));
         }
+        m_prim_indices.clear();
+        m_wide.clear();
+        m_blocks.reset();
+        m_compressed.clear();
+        m_paged.reset();
+        m_build_once = std::make_unique<std::once_flag>();
+        m_built.store(false, std::memory_order_release);
+        m_build_failed.store(false, std::memory_order_release);
+    }
+
+    bool BVHAccel::ensure_built() const {
+        if (m_built.load(std::memory_order_acquire)) {
+            return true;
+        }
+        // the BLAS is owned non-const, the lazy build is the only write behind a const query
+        std::call_once(*m_build_once, [this] {
+            BVHAccel* self = const_cast<BVHAccel*>(this);
+            if (!omp_in_parallel()) {
+                self->build();
+            }
+            else {
+                // the first ray is traced by one thread of a team, the build runs on that thread alone:
+                // nested regions of the builders get a one-thread team and the task builder is replaced
+                // by the sequential one, which gives the same tree
+                int max_threads = omp_get_max_threads();
+                omp_set_num_threads(1);
+                if (m_options.builder == BVHBuilder::ParallelBinned) {
+                    self->rebuild(BVHBuilder::Sequential);
+                }
+                else {
+                    self->build();
+                }
+                omp_set_num_threads(max_threads);
+            }
+            if (!m_built.load(std::memory_order_acquire)) {
+                m_build_failed.store(true, std::memory_order_release);
+                std::cerr << "BVHAccel: the lazy build of BLAS " << m_blas_id << " failed, its rays miss until it is built again." << std::endl;
+            }
+        });
+        return m_built.load(std::memory_order_acquire);
+    }
 
-        if (m_prim_ptrs.empty() || m_prim_ptrs.size() == 0) {
+    void BVHAccel::build() {
+        if (m_heightfield) {
+            return;
+        }
+        if (!m_store.empty() && !m_store.has_geometry()) {
+            std::cerr << "BVHAccel: the triangles of a compressed or paged BLAS were freed, set_geometry before building again." << std::endl;
+            return;
+        }
+        m_stats = BVHBuildStats{};
+        m_compressed.clear();
+        m_paged.reset();
+        if (m_store.empty()) {
             std::cerr << "No objects in BVH constructor." << std::endl;
+            m_built.store(true, std::memory_order_release);
             return;
         }
 
-        auto& root = m_nodes[0];
-        root.left_first = 0;
-        root.tri_count = m_prim_ptrs.size();
+        Utils::Timer timer{};
+        const int prim_count = static_cast<int>(m_store.size());
+        m_prim_indices.resize(prim_count);
+        m_nodes.resize(std::max<std::size_t>(2 * m_store.size(), m_nodes.size()));
+
+        // the SAH cost counts triangle blocks, so the lane count is fixed before the build
+        m_blocks.reset();
+        m_nodes_used = 2;
+
+        if (m_options.builder == BVHBuilder::SpatialSplit) {
+            SBVHBuilder sbvh{ m_store, m_options, static_cast<uint32_t>(m_blocks.get_width()) };
+            m_nodes_used = sbvh.build(m_nodes, m_prim_indices);
+        }
+        else if (m_options.builder == BVHBuilder::Linear) {
+            LBVHBuilder lbvh{ m_store, m_options, static_cast<uint32_t>(m_blocks.get_width()) };
+            m_nodes_used = lbvh.build(m_nodes, m_prim_indices);
+        }
+        else {
+            m_centroids.resize(prim_count);
+#pragma omp parallel for if(prim_count > static_cast<int>(m_options.task_threshold))
+            for (int i = 0; i < prim_count; ++i) {
+                m_prim_indices[i] = i;
+                m_centroids[i] = m_store.get_centroid(i);
+            }
+
+            auto& root = m_nodes[0];
+            root.left_first = 0;
+            root.tri_count = m_store.size();
+            update_node_bounds(0);
+
+            if (m_options.builder == BVHBuilder::ParallelBinned) {
+                std::atomic<uint32_t> nodes_used{ 2 };
+#pragma omp parallel
+                {
+#pragma omp single
+                    subdivide_parallel(0, nodes_used);
+                }
+                m_nodes_used = nodes_used;
+            }
+            else {
+                subdivide(0);
+            }
+        }
+        m_centroids.clear();
+        m_centroids.shrink_to_fit();
+        m_stats.build_time = timer.elapsed();
+
+        timer.reset();
+        collapse();
+        m_stats.collapse_time = timer.elapsed();
+
+        m_stats.sah_cost = calc_sah_cost();
+        m_stats.node_count = m_nodes_used - 1;
+        m_stats.reference_count = static_cast<uint32_t>(m_prim_indices.size());
+        // every builder stores children after their parent
+        std::vector<uint32_t> depths(m_nodes_used, 0);
+        std::size_t block_count{ 0 };
+        for (uint32_t i = 0; i < m_nodes_used; ++i) {
+            if (i == 1) { continue; }
+            m_stats.max_depth = std::max(m_stats.max_depth, depths[i]);
+            if (m_nodes[i].tri_count > 0) {
+                m_stats.leaf_count++;
+                block_count += m_blocks.get_block_count(m_nodes[i].tri_count);
+            }
+            else {
+                depths[m_nodes[i].left_first] = depths[m_nodes[i].left_first + 1] = depths[i] + 1;
+            }
+        }
+        if (block_count > 0) {
+            m_stats.leaf_fill = static_cast<float>(static_cast<double>(m_stats.reference_count) / (static_cast<double>(block_count) * m_blocks.get_width()));
+        }
+        if (m_options.compressed) {
+            timer.reset();
+            compress();
+            m_stats.collapse_time += timer.elapsed();
+        }
+        m_built.store(true, std::memory_order_release);
+        m_build_failed.store(false, std::memory_order_release);
+    }
+
+    float BVHAccel::calc_sah_cost() const {
+        if (m_store.empty()) {
+            return 0.0f;
+        }
+        if (!m_compressed.empty() || m_paged) {
+            return m_stats.sah_cost;
+        }
+        float root_area = AABB{ m_nodes[0].aabb_min, m_nodes[0].aabb_max }.calc_surface_area();
+        if (root_area <= 0.0f) {
+            return static_cast<float>(m_blocks.get_block_count(m_store.size()));
+        }
+        double cost = 0.0;
+        for (uint32_t i = 0; i < m_nodes_used; ++i) {
+            if (i == 1) { continue; }
+            const BVHNode& node = m_nodes[i];
+            float area = AABB{ node.aabb_min, node.aabb_max }.calc_surface_area();
+            cost += area * (node.tri_count > 0 ? m_blocks.get_block_count(node.tri_count) : 1.0f);
+        }
+        return static_cast<float>(cost / root_area);
+    }
 
-        update_node_bounds(0);
-        subdivide(0);
+    void BVHAccel::compress() {
+        // the vertex grid spans the root box, traversal and leaves only read the compressed copy from here on
+        m_compressed.build(m_wide, m_blocks, m_store, bounding_box());
+        if (!m_compressed.empty()) {
+            release_tree();
+        }
+    }
+
+    bool BVHAccel::page_out(const std::string& path, std::size_t memory_budget, uint32_t treelet_nodes) {
+        if (!ensure_built()) {
+            return false;
+        }
+        if (!m_compressed.empty() || m_paged || m_heightfield) {
+            std::cerr << "BVHAccel: only an in-memory, uncompressed BLAS can be paged out." << std::endl;
+            return false;
+        }
+        if (!PagedBVH::write(path, m_wide, m_blocks, treelet_nodes)) {
+            return false;
+        }
+        auto paged = std::make_unique<PagedBVH>(path, memory_budget);
+        if (!paged->is_open()) {
+            return false;
+        }
+        m_paged = std::move(paged);
+        release_tree();
+        return true;
+    }
+
+    void BVHAccel::release_tree() {
+        // only the root bounds and the material ids are left, e.g. for the TLAS and get_material
+        m_wide = WideBVH{};
+        m_blocks = TriangleBlocks{};
+        m_nodes.resize(1);
+        m_nodes.shrink_to_fit();
+        m_nodes_used = 1;
+        m_prim_indices = {};
+        m_store.release_geometry();
+    }
+
+    void BVHAccel::collapse() {
+        if (m_store.empty()) {
+            m_wide.clear();
+            return;
+        }
+
+        // pack every leaf into SIMD triangle blocks
+        m_blocks.reset(m_blocks.get_width());
+        std::vector<uint32_t> leaf_first_block(m_nodes_used, Constant::INVALID_IDX);
+        for (uint32_t i = 0; i < m_nodes_used; ++i) {
+            const BVHNode& node = m_nodes[i];
+            if (i == 1 || node.tri_count == 0) { continue; }
+            leaf_first_block[i] = m_blocks.add_leaf(m_store, &m_prim_indices[node.left_first], node.tri_count);
+        }
+        m_wide.build(BVHNodeSource{ m_nodes.data(), leaf_first_block.data(), &m_blocks }, 0, m_blocks.get_width(), m_options.layout);
     }
 
     void BVHAccel::subdivide(uint node_idx, uint depth) {
 
         BVHNode& node = m_nodes[node_idx];
 
-        // 0. terminate if reaches leaf node
-        if (node.tri_count <= 2) {
+        // 0. terminate if reaches leaf node, traversal stacks are sized for BVH_MAX_DEPTH
+        // a single triangle block costs one box test, as much as the inner node a split adds
+        if (m_blocks.get_block_count(node.tri_count) <= 1 || depth >= BVH_MAX_DEPTH) {
             return;
         }
 
         // 1. Find best split plane
         int axis{};
         float split_pos{};
-        float split_cost = find_best_split_plane(node, axis, split_pos);
+        float split_cost = find_best_split_plane(node, axis, split_pos, m_options.num_bins);
 
-        AABB parent_box = AABB{ node.aabb_min, node.aabb_max };
-        float parent_cost = parent_box.calc_surface_area() * node.tri_count;
-        if (parent_cost < split_cost) {
+        // an inner node costs one box test, the same unit as a triangle block (see calc_sah_cost)
+        float parent_area = AABB{ node.aabb_min, node.aabb_max }.calc_surface_area();
+        float leaf_cost = parent_area * m_blocks.get_block_count(node.tri_count);
+        if (leaf_cost <= parent_area + split_cost) {
             // splitting does not improve the cost --> make a leaf node
             return;
         }
 
         // 2. Split into 2 halves
+        uint i = partition(node, axis, split_pos);
+
+        uint left_count = i - node.left_first;
+        if (left_count == 0 || left_count == node.tri_count) {
+            // No split occured --> leaf node
+            return;
+        }
+
+        // 3. Create child ndoes for each half
+        uint left_child_idx = m_nodes_used++;
+        uint right_child_idx = m_nodes_used++;
+        m_nodes[left_child_idx].left_first = node.left_first;
+        m_nodes[left_child_idx].tri_count = left_count;
+        m_nodes[right_child_idx].left_first = i;
+        m_nodes[right_child_idx].tri_count = node.tri_count - left_count;
+
+        // Update bounds
+        update_node_bounds(left_child_idx);
+        update_node_bounds(right_child_idx);
+        node.left_first = left_child_idx;
+        node.tri_count = 0;
+
+        // 4. Recursively subdivide
+        subdivide(left_child_idx, depth + 1);
+        subdivide(right_child_idx, depth + 1);
+    }
+
+    uint BVHAccel::partition(const BVHNode& node, int axis, float split_pos) {
         int i = node.left_first;
         int j = node.left_first + node.tri_count - 1;
         while (i <= j) {
-            const auto& prim = m_prim_ptrs[m_prim_indices[i]];
-            glm::vec3 centroid = prim->get_centroid();
-            if (centroid[axis] < split_pos) {
+            if (m_centroids[m_prim_indices[i]][axis] < split_pos) {
                 ++i;
             }
             else {
@@ -69,33 +431,67 @@ namespace SignalTracer {
                 --j;
             }
         }
+        return static_cast<uint>(i);
+    }
+
+    void BVHAccel::subdivide_parallel(uint node_idx, std::atomic<uint32_t>& nodes_used, uint depth) {
+        BVHNode& node = m_nodes[node_idx];
+        if (m_blocks.get_block_count(node.tri_count) <= 1 || depth >= BVH_MAX_DEPTH) {
+            return;
+        }
+
+        int axis{};
+        float split_pos{};
+        float split_cost = find_best_split_plane_parallel(node, axis, split_pos);
+
+        // same leaf test as subdivide
+        float parent_area = AABB{ node.aabb_min, node.aabb_max }.calc_surface_area();
+        float leaf_cost = parent_area * m_blocks.get_block_count(node.tri_count);
+        if (leaf_cost <= parent_area + split_cost) {
+            return;
+        }
 
+        uint i = partition(node, axis, split_pos);
         uint left_count = i - node.left_first;
         if (left_count == 0 || left_count == node.tri_count) {
-            // No split occured --> leaf node
             return;
         }
 
-        // 3. Create child ndoes for each half
-        uint left_child_idx = m_nodes_used++;
-        uint right_child_idx = m_nodes_used++;
+        // sibling nodes stay adjacent, the pair is reserved at once
+        uint left_child_idx = nodes_used.fetch_add(2);
+        uint right_child_idx = left_child_idx + 1;
         m_nodes[left_child_idx].left_first = node.left_first;
         m_nodes[left_child_idx].tri_count = left_count;
         m_nodes[right_child_idx].left_first = i;
         m_nodes[right_child_idx].tri_count = node.tri_count - left_count;
-
-        // Update bounds
         update_node_bounds(left_child_idx);
         update_node_bounds(right_child_idx);
         node.left_first = left_child_idx;
         node.tri_count = 0;
 
-        // 4. Recursively subdivide
-        subdivide(left_child_idx, depth + 1);
-        subdivide(right_child_idx, depth + 1);
+        // each subtree owns a disjoint range of m_prim_indices, so they are built independently
+        if (left_count > m_options.task_threshold) {
+#pragma omp task default(none) firstprivate(left_child_idx, depth) shared(nodes_used)
+            subdivide_parallel(left_child_idx, nodes_used, depth + 1);
+        }
+        else {
+            subdivide_parallel(left_child_idx, nodes_used, depth + 1);
+        }
+        subdivide_parallel(right_child_idx, nodes_used, depth + 1);
     }
 
     void BVHAccel::refit() {
+        if (m_heightfield) {
+            return;
+        }
+        if (!is_built()) {
+            defer_build();
+            return;
+        }
+        if (!m_compressed.empty() || m_paged) {
+            if (m_store.has_geometry()) { build(); }
+            return;
+        }
         for (int i = m_nodes_used - 1; i >= 0; i--) if (i != 1) {
             BVHNode& node = m_nodes[i];
             if (node.tri_count > 0) {
@@ -109,96 +505,259 @@ namespace SignalTracer {
             node.aabb_min = glm::min(left_child.aabb_min, right_child.aabb_min);
             node.aabb_max = glm::max(left_child.aabb_max, right_child.aabb_max);
         }
+        // the wide nodes copy the child bounds, so collapse again
+        collapse();
+    }
+
+    void BVHAccel::rebuild(BVHBuilder builder) {
+        BVHBuilder default_builder = m_options.builder;
+        m_options.builder = builder;
+        build();
+        m_options.builder = default_builder;
+    }
+
+    void BVHAccel::set_geometry(const std::vector<shared_ptr<Triangle>>& triangles) {
+        if (m_heightfield) {
+            std::cerr << "BVHAccel: the geometry of a heightfield BLAS cannot be replaced." << std::endl;
+            return;
+        }
+        init_store(triangles);
+    }
+
+    void BVHAccel::set_geometry(const Model& model) {
+        if (m_heightfield) {
+            std::cerr << "BVHAccel: the geometry of a heightfield BLAS cannot be replaced." << std::endl;
+            return;
+        }
+        init_store(model);
     }
 
     AABB BVHAccel::bounding_box() const {
         return AABB{ m_nodes[0].aabb_min, m_nodes[0].aabb_max };
     }
 
+    std::size_t BVHAccel::memory_usage() const {
+        return m_store.memory_usage() + m_blocks.memory_usage() + m_wide.memory_usage() + m_compressed.memory_usage()
+            + (m_paged ? m_paged->memory_usage() : 0) + (m_heightfield ? m_heightfield->memory_usage() : 0)
+            + m_nodes.size() * sizeof(BVHNode) + m_prim_indices.size() * sizeof(uint);
+    }
+
     bool BVHAccel::is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const {
         return is_hit_(ray, interval, record);
     }
 
     bool BVHAccel::is_hit_(const Ray& ray, Interval interval, IntersectRecord& record) const {
+        if (m_heightfield) {
+            float t{};
+            uint32_t prim_idx{};
+            interval.max(std::min(interval.max(), record.t));
+            if (!m_heightfield->intersect(ray, interval, t, prim_idx)) {
+                return false;
+            }
+            record.t = t;
+            record.point = ray.point_at(t);
+            record.normal = m_heightfield->get_normal(prim_idx);
+            record.blas_id = m_blas_id;
+            record.prim_id = prim_idx;
+            return true;
+        }
+        if (m_store.empty()) {
+            return false;
+        }
+        if (!ensure_built()) {
+            return false;
+        }
+        if (!m_compressed.empty() || m_paged) {
+            float t{};
+            uint32_t prim_idx{};
+            glm::vec3 normal{};
+            interval.max(std::min(interval.max(), record.t));
+            bool hit = m_paged ? m_paged->intersect(ray, interval, t, prim_idx, normal)
+                : m_compressed.intersect(ray, interval, t, prim_idx, normal);
+            if (!hit) {
+                return false;
+            }
+            record.t = t;
+            record.point = ray.point_at(t);
+            record.normal = normal;
+            record.blas_id = m_blas_id;
+            record.prim_id = prim_idx;
+            return true;
+        }
 
-        const BVHNode* node = &m_nodes[0], * stack[128];
-        uint stack_ptr = 0;
-
-        bool hit_flag = false;
-        while (true) {
-            if (node->tri_count > 0) {
-                // leaf node
-                for (uint i = 0; i < node->tri_count; ++i) {
-                    const uint prim_idx = m_prim_indices[node->left_first + i];
-                    const auto& prim_ptr = m_prim_ptrs[prim_idx];
-
-                    IntersectRecord tmp_record{};
-                    if (prim_ptr->is_hit(ray, interval, tmp_record)) {
-                        if (tmp_record.t < record.t) {
-                            record = tmp_record;
-                            record.tri_ptr = prim_ptr;
-                            interval.max(record.t);
-                            hit_flag = true;
-                        }
-                    }
-                }
-                if (stack_ptr == 0) { break; }
-                else { node = stack[--stack_ptr]; }
+        // only the nearest primitive is tracked during traversal,
+        // the record is filled once at the end
+        uint32_t hit_prim = Constant::INVALID_IDX;
+        float hit_t = record.t;
+        interval.max(std::min(interval.max(), hit_t));
+        auto intersect_leaf = [&](uint32_t first_block, uint32_t block_count, Interval& leaf_interval) {
+            float t{};
+            uint32_t prim_idx{};
+            if (m_blocks.intersect(first_block, block_count, ray, leaf_interval, t, prim_idx) && t < hit_t) {
+                hit_t = t;
+                hit_prim = prim_idx;
+                leaf_interval.max(t);
+                return true;
             }
-            else {
-                const BVHNode* child1 = &m_nodes[node->left_first];
-                const BVHNode* child2 = &m_nodes[node->left_first + 1];
-                AABB left_box{ child1->aabb_min, child1->aabb_max };
-                AABB right_box{ child2->aabb_min, child2->aabb_max };
+            return false;
+        };
+        m_wide.traverse(ray, interval, intersect_leaf);
 
-                float dist1 = left_box.hit(ray, interval);
-                float dist2 = right_box.hit(ray, interval);
+        if (hit_prim == Constant::INVALID_IDX) {
+            return false;
+        }
+        record.t = hit_t;
+        record.point = ray.point_at(hit_t);
+        record.normal = m_store.get_normal(hit_prim);
+        record.blas_id = m_blas_id;
+        record.prim_id = hit_prim;
+        return true;
+    }
 
-                if (dist1 > dist2) {
-                    std::swap(child1, child2);
-                    std::swap(dist1, dist2);
-                }
-                if (dist1 == Constant::INF_POS) {
-                    // no hit for both child nodes
-                    if (stack_ptr == 0) break;
-                    else node = stack[--stack_ptr];
-                }
-                else {
-                    node = child1;
-                    if (dist2 != Constant::INF_POS) {
-                        stack[stack_ptr++] = child2;
-                    }
+    uint32_t BVHAccel::is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const {
+        if (m_store.empty() && !m_heightfield) {
+            return 0;
+        }
+        if (!ensure_built()) {
+            return 0;
+        }
+        uint32_t hit_mask = 0;
+        if (!packet.is_coherent() || !m_compressed.empty() || m_paged || m_heightfield) {
+            for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+                int i = std::countr_zero(rays);
+                hit_mask |= static_cast<uint32_t>(is_hit_(packet[i], interval, records[i])) << i;
+            }
+            return hit_mask;
+        }
+
+        float hit_t[RayPacket::MAX_SIZE];
+        uint32_t hit_prim[RayPacket::MAX_SIZE];
+        for (int i = 0; i < packet.size(); ++i) {
+            hit_t[i] = std::min(interval.max(), records[i].t);
+            hit_prim[i] = Constant::INVALID_IDX;
+        }
+        auto intersect_leaf = [&](uint32_t first_block, uint32_t block_count, uint32_t ray_mask) {
+            for (; ray_mask; ray_mask &= ray_mask - 1) {
+                int i = std::countr_zero(ray_mask);
+                float t{};
+                uint32_t prim_idx{};
+                Interval leaf_interval{ interval.min(), hit_t[i] };
+                if (m_blocks.intersect(first_block, block_count, packet[i], leaf_interval, t, prim_idx) && t < hit_t[i]) {
+                    hit_t[i] = t;
+                    hit_prim[i] = prim_idx;
                 }
             }
+        };
+        m_wide.traverse(packet, interval.min(), hit_t, intersect_leaf);
+
+        for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+            int i = std::countr_zero(rays);
+            if (hit_prim[i] == Constant::INVALID_IDX) { continue; }
+            IntersectRecord& record = records[i];
+            record.t = hit_t[i];
+            record.point = packet[i].point_at(hit_t[i]);
+            record.normal = m_store.get_normal(hit_prim[i]);
+            record.blas_id = m_blas_id;
+            record.prim_id = hit_prim[i];
+            hit_mask |= 1u << i;
         }
-        return hit_flag;
+        return hit_mask;
     }
 
-    std::vector<std::shared_ptr<Triangle>> BVHAccel::init_triangles(const Model& model) {
-        std::vector<std::shared_ptr<Triangle>> triangles{};
-        std::vector<Vertex> vertex_buffer;
-        vertex_buffer.reserve(3);
-        int triangle_count{ 0 };
-        int vertex_count{ 0 };
-        for (const auto& mesh : model.get_meshes()) {
-            for (const auto& idx : mesh.get_indices()) {
-                vertex_count++;
-                vertex_buffer.push_back(mesh.get_vertices()[idx]);
-                triangle_count++;
-                if (triangle_count == 3) {
-                    triangles.emplace_back(std::make_shared<Triangle>(
-                        vertex_buffer[0].position,
-                        vertex_buffer[1].position,
-                        vertex_buffer[2].position)
-                    );
-                    vertex_buffer.clear();
-                    triangle_count = 0;
+    bool BVHAccel::is_occluded(const Ray& ray, const Interval& interval) const {
+        if (m_heightfield) {
+            return m_heightfield->occluded(ray, interval);
+        }
+        if (m_store.empty()) {
+            return false;
+        }
+        if (!ensure_built()) {
+            return false;
+        }
+        if (m_paged) {
+            return m_paged->occluded(ray, interval);
+        }
+        if (!m_compressed.empty()) {
+            return m_compressed.occluded(ray, interval);
+        }
+        auto occluded_leaf = [&](uint32_t first_block, uint32_t block_count, const Interval& leaf_interval) {
+            return m_blocks.occluded(first_block, block_count, ray, leaf_interval);
+        };
+        return m_wide.occluded(ray, interval, occluded_leaf);
+    }
+
+    void BVHAccel::init_store(const std::vector<shared_ptr<Triangle>>& triangles) {
+        if (!m_palette) {
+            m_palette = m_options.palette ? m_options.palette : std::make_shared<MaterialPalette>();
+        }
+        m_store.clear();
+        m_store.reserve(triangles.size());
+
+        // equal materials (same type and parameters) share one palette id, whether or not they share a pointer
+        for (const auto& tri : triangles) {
+            m_store.add(tri->a(), tri->b(), tri->c(), m_palette->find_or_add(tri->get_mat_ptr()));
+        }
+    }
+
+    void BVHAccel::init_store(const Model& model) {
+        if (!m_palette) {
+            m_palette = m_options.palette ? m_options.palette : std::make_shared<MaterialPalette>();
+        }
+        m_store.clear();
+
+        // material of each mesh from its .mtl name
+        const auto& mesh_materials = model.get_mesh_materials();
+        std::vector<uint16_t> mesh_mat_ids(model.get_meshes().size(), MaterialPalette::DEFAULT_ID);
+        for (std::size_t i = 0; i < mesh_mat_ids.size() && i < mesh_materials.size(); ++i) {
+            mesh_mat_ids[i] = m_palette->find_name(mesh_materials[i]);
+        }
+
+        if (!m_faces.empty()) {
+            // first face of each mesh, a face is found by its mesh and its offset in the mesh
+            const auto& meshes = model.get_meshes();
+            std::vector<uint32_t> first_faces{ 0 };
+            for (const auto& mesh : meshes) {
+                first_faces.emplace_back(first_faces.back() + static_cast<uint32_t>(mesh.get_indices().size() / 3));
+            }
+            m_store.reserve(m_faces.size());
+            for (uint32_t face : m_faces) {
+                if (face >= first_faces.back()) {
+                    std::cerr << "Face " << face << " is not in the model." << std::endl;
+                    continue;
                 }
+                std::size_t mesh_idx = std::upper_bound(first_faces.begin(), first_faces.end(), face) - first_faces.begin() - 1;
+                const auto& vertices = meshes[mesh_idx].get_vertices();
+                const auto& indices = meshes[mesh_idx].get_indices();
+                std::size_t i = 3 * static_cast<std::size_t>(face - first_faces[mesh_idx]);
+                m_store.add(
+                    vertices[indices[i]].position,
+                    vertices[indices[i + 1]].position,
+                    vertices[indices[i + 2]].position,
+                    mesh_mat_ids[mesh_idx]);
             }
+            return;
         }
-        std::cout << "Triangle count: " << triangles.size() << std::endl;
-        std::cout << "Vertex count: " << vertex_count << std::endl;
-        return triangles;
+
+        std::size_t index_count{ 0 };
+        for (const auto& mesh : model.get_meshes()) {
+            index_count += mesh.get_indices().size();
+        }
+        m_store.reserve(index_count / 3);
+
+        const auto& meshes = model.get_meshes();
+        for (std::size_t mesh_idx = 0; mesh_idx < meshes.size(); ++mesh_idx) {
+            const auto& vertices = meshes[mesh_idx].get_vertices();
+            const auto& indices = meshes[mesh_idx].get_indices();
+            for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+                m_store.add(
+                    vertices[indices[i]].position,
+                    vertices[indices[i + 1]].position,
+                    vertices[indices[i + 2]].position,
+                    mesh_mat_ids[mesh_idx]);
+            }
+        }
+        std::cout << "Triangle count: " << m_store.size() << std::endl;
+        std::cout << "Vertex count: " << index_count << std::endl;
     };
 
     void BVHAccel::update_node_bounds(const uint node_idx) {
@@ -207,41 +766,38 @@ namespace SignalTracer {
         node.aabb_max = glm::vec3{ Constant::INF_NEG };
         for (uint i = node.left_first; i < node.left_first + node.tri_count; ++i) {
             uint prim_idx = m_prim_indices[i];
-            const auto& prim = m_prim_ptrs[prim_idx];
-
-            node.aabb_min = glm::min(node.aabb_min, prim->get_min());
-            node.aabb_max = glm::max(node.aabb_max, prim->get_max());
+            node.aabb_min = glm::min(node.aabb_min, m_store.get_min(prim_idx));
+            node.aabb_max = glm::max(node.aabb_max, m_store.get_max(prim_idx));
         }
     }
 
-    float BVHAccel::find_best_split_plane(const BVHNode& node, int& axis, float& split_pos, uint num_bins) {
+    float BVHAccel::find_best_split_plane(const BVHNode& node, int& axis, float& split_pos, uint num_bins) const {
+        num_bins = std::clamp(num_bins, 2u, MAX_BINS);
         float best_cost = Constant::INF_POS;
         glm::vec3 bound_min{ 1e30f }, bound_max{ -1e30f };
         for (uint i = 0; i < node.tri_count; i++) {
-            uint prim_idx = m_prim_indices[node.left_first + i];
-            const auto& prim_ptr = m_prim_ptrs[prim_idx];
-            bound_min = glm::min(bound_min, prim_ptr->get_centroid());
-            bound_max = glm::max(bound_max, prim_ptr->get_centroid());
+            const glm::vec3& centroid = m_centroids[m_prim_indices[node.left_first + i]];
+            bound_min = glm::min(bound_min, centroid);
+            bound_max = glm::max(bound_max, centroid);
         }
 
         for (int a = 0; a < 3; a++) {
             if (bound_min[a] == bound_max[a]) { continue; }
 
             // Populate bins
-            Bin bins[num_bins];
+            Bin bins[MAX_BINS];
             float scale = static_cast<float>(num_bins) / (bound_max[a] - bound_min[a]);
             for (uint i = 0; i < node.tri_count; i++) {
                 uint prim_idx = m_prim_indices[node.left_first + i];
-                const auto& prim_ptr = m_prim_ptrs[prim_idx];
-                glm::vec3 centroid = prim_ptr->get_centroid();
+                const glm::vec3& centroid = m_centroids[prim_idx];
                 uint bin_idx = std::min(num_bins - 1, static_cast<uint>((centroid[a] - bound_min[a]) * scale));
-                bins[bin_idx].box.expand(prim_ptr->bounding_box());
+                bins[bin_idx].box.expand(m_store.bounding_box(prim_idx));
                 bins[bin_idx].tri_count++;
             }
 
             // gather data for "num_bins-1" planes between bins
-            float left_area[num_bins - 1], right_area[num_bins - 1];
-            int left_count[num_bins - 1], right_count[num_bins - 1];
+            float left_area[MAX_BINS - 1], right_area[MAX_BINS - 1];
+            int left_count[MAX_BINS - 1], right_count[MAX_BINS - 1];
             AABB left_box{}, right_box{};
             int left_sum{ 0 }, right_sum{ 0 };
 
@@ -259,7 +815,8 @@ namespace SignalTracer {
             // Calc SAH cost for num_bins-1 planes
             scale = (bound_max[a] - bound_min[a]) / static_cast<float>(num_bins);
             for (uint i = 0; i < num_bins - 1; i++) {
-                float cost = (left_area[i] * left_count[i] + right_area[i] * right_count[i]);
+                // leaves are intersected one SIMD block at a time
+                float cost = left_area[i] * m_blocks.get_block_count(left_count[i]) + right_area[i] * m_blocks.get_block_count(right_count[i]);
                 if (cost < best_cost) {
                     split_pos = bound_min[a] + scale * (i + 1);
                     best_cost = cost;
@@ -270,6 +827,110 @@ namespace SignalTracer {
         return best_cost;
     }
 
+    float BVHAccel::find_best_split_plane_parallel(const BVHNode& node, int& axis, float& split_pos) const {
+        const uint num_bins = std::clamp(m_options.num_bins, 2u, MAX_BINS);
+        const uint first = node.left_first;
+        const uint count = node.tri_count;
+        const uint chunk_size = std::max({ m_options.task_threshold, 1u, (count + MAX_SPLIT_CHUNKS - 1) / MAX_SPLIT_CHUNKS });
+        const uint num_chunks = (count + chunk_size - 1) / chunk_size;
+        // the many small nodes near the leaves have a single chunk, binned on the stack without tasks
+        ChunkBins stack_bins{};
+        std::optional<SplitScratch> scratch{};
+        if (num_chunks > 1) {
+            scratch.emplace(num_chunks);
+        }
+        auto chunk_bins = [&](uint c) -> ChunkBins& { return scratch ? (*scratch)[c] : stack_bins; };
+
+        // 1. centroid bounds, one task per chunk of primitives
+        auto bound_chunk = [&](uint c) {
+            ChunkBins& local = chunk_bins(c);
+            local = ChunkBins{};
+            uint end = std::min(count, (c + 1) * chunk_size);
+            for (uint i = c * chunk_size; i < end; ++i) {
+                const glm::vec3& centroid = m_centroids[m_prim_indices[first + i]];
+                local.centroid_min = glm::min(local.centroid_min, centroid);
+                local.centroid_max = glm::max(local.centroid_max, centroid);
+            }
+        };
+        for (uint c = 0; c < num_chunks; ++c) {
+#pragma omp task default(none) firstprivate(c) shared(bound_chunk) if(num_chunks > 1)
+            bound_chunk(c);
+        }
+#pragma omp taskwait
+        glm::vec3 bound_min{ Constant::INF_POS }, bound_max{ Constant::INF_NEG };
+        for (uint c = 0; c < num_chunks; ++c) {
+            bound_min = glm::min(bound_min, chunk_bins(c).centroid_min);
+            bound_max = glm::max(bound_max, chunk_bins(c).centroid_max);
+        }
+
+        // 2. bin all three axes in one pass over the primitives, with private bins per chunk
+        glm::vec3 scale{ 0.0f };
+        for (int a = 0; a < 3; ++a) {
+            if (bound_max[a] > bound_min[a]) {
+                scale[a] = static_cast<float>(num_bins) / (bound_max[a] - bound_min[a]);
+            }
+        }
+        auto bin_chunk = [&](uint c) {
+            ChunkBins& local = chunk_bins(c);
+            uint end = std::min(count, (c + 1) * chunk_size);
+            for (uint i = c * chunk_size; i < end; ++i) {
+                uint prim_idx = m_prim_indices[first + i];
+                const glm::vec3& centroid = m_centroids[prim_idx];
+                AABB box = m_store.bounding_box(prim_idx);
+                for (int a = 0; a < 3; ++a) {
+                    uint bin_idx = std::min(num_bins - 1, static_cast<uint>((centroid[a] - bound_min[a]) * scale[a]));
+                    local.bins[a][bin_idx].box.expand(box);
+                    local.bins[a][bin_idx].tri_count++;
+                }
+            }
+        };
+        for (uint c = 0; c < num_chunks; ++c) {
+#pragma omp task default(none) firstprivate(c) shared(bin_chunk) if(num_chunks > 1)
+            bin_chunk(c);
+        }
+#pragma omp taskwait
+        for (uint c = 1; c < num_chunks; ++c) {
+            for (int a = 0; a < 3; ++a) {
+                for (uint b = 0; b < num_bins; ++b) {
+                    chunk_bins(0).bins[a][b].box.expand(chunk_bins(c).bins[a][b].box);
+                    chunk_bins(0).bins[a][b].tri_count += chunk_bins(c).bins[a][b].tri_count;
+                }
+            }
+        }
+
+        // 3. sweep the num_bins - 1 planes of every axis
+        float best_cost = Constant::INF_POS;
+        for (int a = 0; a < 3; ++a) {
+            if (bound_min[a] == bound_max[a]) { continue; }
+            const Bin* bins = chunk_bins(0).bins[a];
+            float right_area[MAX_BINS - 1];
+            uint right_count[MAX_BINS - 1];
+            AABB right_box{};
+            uint right_sum{ 0 };
+            for (uint i = num_bins - 1; i > 0; --i) {
+                right_sum += bins[i].tri_count;
+                right_box.expand(bins[i].box);
+                right_count[i - 1] = right_sum;
+                right_area[i - 1] = right_box.calc_surface_area();
+            }
+            AABB left_box{};
+            uint left_sum{ 0 };
+            float plane_scale = (bound_max[a] - bound_min[a]) / static_cast<float>(num_bins);
+            for (uint i = 0; i < num_bins - 1; ++i) {
+                left_sum += bins[i].tri_count;
+                left_box.expand(bins[i].box);
+                if (left_sum == 0 || right_count[i] == 0) { continue; }
+                float cost = left_box.calc_surface_area() * m_blocks.get_block_count(left_sum) + right_area[i] * m_blocks.get_block_count(right_count[i]);
+                if (cost < best_cost) {
+                    split_pos = bound_min[a] + plane_scale * (i + 1);
+                    best_cost = cost;
+                    axis = a;
+                }
+            }
+        }
+        return best_cost;
+    }
+
     /*
     -----------------------------
     BVHInstance
@@ -279,8 +940,9 @@ namespace SignalTracer {
     void BVHInstance::set_transform(const glm::mat4& transform) {
         m_transform_point = transform;
         m_inv_transform_point = glm::inverse(transform);
-        m_transform_vector = glm::mat3(glm::transpose(glm::inverse(transform)));
-        m_inv_transform_vector = glm::inverse(m_transform_vector);
+        m_inv_transform_vector = glm::mat3(m_inv_transform_point);
+        m_transform_normal = glm::transpose(m_inv_transform_vector);
+        m_identity = transform == glm::mat4{ 1.0f };
         glm::vec3 bmin{ m_bvh_ptr->get_root().aabb_min };
         glm::vec3 bmax{ m_bvh_ptr->get_root().aabb_max };
         m_box = AABB{};
@@ -291,21 +953,81 @@ namespace SignalTracer {
         }
     }
 
+    Ray BVHInstance::to_object(const Ray& ray, float& scale) const {
+        glm::vec3 direction{ m_inv_transform_vector * ray.get_direction() };
+        scale = glm::length(direction);
+        return Ray{ glm::vec3(m_inv_transform_point * glm::vec4(ray.get_origin(), 1.0f)), direction };
+    }
+
+    void BVHInstance::to_world(IntersectRecord& record, float scale) const {
+        record.t /= scale;
+        record.point = glm::vec3(m_transform_point * glm::vec4(record.point, 1.0f));
+        record.normal = glm::normalize(m_transform_normal * record.normal);
+    }
+
     bool BVHInstance::is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const {
-        // transformed ray if BVH structure moves.
-        // This is similar to the inverse transformation of the ray in the world space.
-        Ray transformed_ray = ray;
-        transformed_ray.set_origin(glm::vec3(m_inv_transform_point * glm::vec4(ray.get_origin(), 1.0f)));
-        transformed_ray.set_direction(glm::vec3(m_inv_transform_vector * glm::vec4(ray.get_direction(), 0.0f)));
+        if (m_identity) {
+            return m_bvh_ptr->is_hit_(ray, interval, record);
+        }
+        float scale{};
+        Ray object_ray{ to_object(ray, scale) };
+        IntersectRecord object_record{ record };
+        object_record.t = record.t * scale;
+        if (!m_bvh_ptr->is_hit_(object_ray, Interval{ interval.min() * scale, interval.max() * scale }, object_record)) {
+            return false;
+        }
+        to_world(object_record, scale);
+        record = object_record;
+        return true;
+    }
+
+    bool BVHInstance::is_occluded(const Ray& ray, const Interval& interval) const {
+        if (m_identity) {
+            return m_bvh_ptr->is_occluded(ray, interval);
+        }
+        float scale{};
+        Ray object_ray{ to_object(ray, scale) };
+        return m_bvh_ptr->is_occluded(object_ray, Interval{ interval.min() * scale, interval.max() * scale });
+    }
+
+    uint32_t BVHInstance::is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const {
+        if (m_identity) {
+            return m_bvh_ptr->is_hit(packet, interval, records);
+        }
+
+        // each record bounds its own ray, the shared interval needs one scale for all rays,
+        // which only uniform scales give
+        Ray object_rays[RayPacket::MAX_SIZE];
+        float scales[RayPacket::MAX_SIZE];
+        IntersectRecord object_records[RayPacket::MAX_SIZE];
+        float min_scale{ Constant::INF_POS }, max_scale{ 0.0f };
+        for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+            int i = std::countr_zero(rays);
+            object_rays[i] = to_object(packet[i], scales[i]);
+            object_records[i] = records[i];
+            object_records[i].t = std::min(records[i].t, interval.max()) * scales[i];
+            min_scale = std::min(min_scale, scales[i]);
+            max_scale = std::max(max_scale, scales[i]);
+        }
+
+        if (max_scale - min_scale > Constant::EPSILON * max_scale) {
+            uint32_t hit_mask = 0;
+            for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+                int i = std::countr_zero(rays);
+                hit_mask |= static_cast<uint32_t>(is_hit(packet[i], interval, records[i])) << i;
+            }
+            return hit_mask;
+        }
 
-        bool hit_flag = false;
-        if (m_bvh_ptr->is_hit_(transformed_ray, interval, record)) {
-            hit_flag = true;
-            // transform back to world space
-            glm::vec3 point{ glm::vec3(m_transform_point * glm::vec4(record.point, 1.0f)) };
-            record.point = point;
+        RayPacket object_packet{ object_rays, packet.size(), packet.get_active() };
+        Interval object_interval{ interval.min() * min_scale, interval.max() * max_scale };
+        uint32_t hit_mask = m_bvh_ptr->is_hit(object_packet, object_interval, object_records);
+        for (uint32_t rays = hit_mask; rays; rays &= rays - 1) {
+            int i = std::countr_zero(rays);
+            to_world(object_records[i], scales[i]);
+            records[i] = object_records[i];
         }
-        return hit_flag;
+        return hit_mask;
     }
 
     AABB BVHInstance::bounding_box() const {
@@ -318,74 +1040,154 @@ namespace SignalTracer {
     -----------------------------
     */
     TLAS::TLAS(BVHInstance* bvh_list, uint num_bvh)
-        : m_blas{ bvh_list }, m_blas_count{ num_bvh }, m_nodes_used{ 2 } {
-        // m_tlas_nodes = (TLASNode*) aligned_alloc(sizeof(TLASNode) * 2 * num_bvh, 64);
-        m_tlas_nodes.reserve(2 * num_bvh);
-    }
+        : m_blas{ bvh_list }, m_blas_count{ num_bvh }, m_nodes_used{ 2 } {}
 
     TLAS::TLAS(const std::vector<BVHInstance>& bvh_list, uint num_bvhs)
         : m_blas{ bvh_list.data() }
         , m_blas_count{ num_bvhs }
-        , m_nodes_used{ 2 } {
-        std::cout << "TLAS constructor" << std::endl;
-        m_tlas_nodes.reserve(2 * num_bvhs);
-    }
+        , m_nodes_used{ 2 } {}
 
     void TLAS::build() {
+        Utils::Timer timer{};
+        std::vector<glm::vec3> box_min(m_blas_count);
+        std::vector<glm::vec3> box_max(m_blas_count);
+#pragma omp parallel for
+        for (int i = 0; i < static_cast<int>(m_blas_count); ++i) {
+            AABB box{ m_blas[i].bounding_box() };
+            box_min[i] = box.get_min();
+            box_max[i] = box.get_max();
+        }
+        // an empty or degenerate BLAS has inverted or non-finite bounds, it can never be hit
+        // and its centroid would poison the bins, so it is left out of the tree
+        std::vector<uint32_t> instance_ids{};
+        instance_ids.reserve(m_blas_count);
+        for (uint32_t i = 0; i < m_blas_count; ++i) {
+            bool valid = true;
+            for (int axis = 0; axis < 3; ++axis) {
+                valid = valid && std::isfinite(box_min[i][axis]) && std::isfinite(box_max[i][axis]) && box_min[i][axis] <= box_max[i][axis];
+            }
+            if (valid) {
+                instance_ids.push_back(i);
+            }
+        }
 
-        omp_set_nested(1);  // need nested parallel calls
-        omp_set_dynamic(0); // want team size set by calls to set_num_threads
-        omp_set_num_threads(omp_get_max_threads());
-
-#pragma omp parallel
-        {
-#pragma omp single
-            std::cout << "OPENMP: num_threads=" << omp_get_num_threads() << ", nested=" << omp_get_nested() << ", dynamic=" << omp_get_dynamic() << std::endl;
+        // n leaves and n - 1 internal nodes, node 1 stays unused so that siblings are pairs
+        m_tlas_nodes.assign(std::max<std::size_t>(2 * instance_ids.size(), 2), TLASNode{});
+        m_nodes_used = 2;
+        if (instance_ids.empty()) {
+            m_tlas_nodes[0].aabb_min = glm::vec3{ Constant::INF_POS };
+            m_tlas_nodes[0].aabb_max = glm::vec3{ Constant::INF_NEG };
+            m_wide.clear();
+            m_build_time = timer.elapsed();
+            return;
         }
+        subdivide(instance_ids, box_min, box_max);
+        m_wide.build(TLASNodeSource{ m_tlas_nodes.data() }, 0);
+        m_build_time = timer.elapsed();
+    }
 
-        // assign a TLAS leaf node to each BLAS
-        int node_idxs[256];
-        // remaining_nodes = number of nodes that are not yet assigned to a TLAS node
-        int remaining_nodes = static_cast<int>(m_blas_count);
-        m_nodes_used = 1;
-        for (std::size_t i = 0; i < m_blas_count; ++i) {
-            node_idxs[i] = m_nodes_used;
-            m_tlas_nodes[m_nodes_used].aabb_min = m_blas[i].bounding_box().get_min();
-            m_tlas_nodes[m_nodes_used].aabb_max = m_blas[i].bounding_box().get_max();
-            m_tlas_nodes[m_nodes_used].blas_idx = i;
-            m_tlas_nodes[m_nodes_used++].left_right = 0; // leaf node since this is a BVH
-        }
-
-        // use agglomerative clustering to build the TLAS
-        int pos_idx_A = 0;
-        int pos_idx_B = find_best_match(node_idxs, remaining_nodes, pos_idx_A);
-        while (remaining_nodes > 1) {
-            int pos_idx_C = find_best_match(node_idxs, remaining_nodes, pos_idx_B);
-
-            if (pos_idx_A == pos_idx_C) {
-                int node_idx_A = node_idxs[pos_idx_A];
-                int node_idx_B = node_idxs[pos_idx_B];
-                TLASNode& node_A = m_tlas_nodes[node_idx_A];
-                TLASNode& node_B = m_tlas_nodes[node_idx_B];
-                TLASNode& new_node = m_tlas_nodes[m_nodes_used];
-                new_node.left_right = node_idx_A + (node_idx_B << 16);
-                new_node.aabb_min = glm::min(node_A.aabb_min, node_B.aabb_min);
-                new_node.aabb_max = glm::max(node_A.aabb_max, node_B.aabb_max);
-
-                // remove node A & B from the list = remove pos_idx of A and B from the node_idxs array
-                // replace pos_idx of A with the new node
-                // replace pos_idx of B with the last node in the list
-                // remaining_nodes--;
-                node_idxs[pos_idx_A] = m_nodes_used++;
-                node_idxs[pos_idx_B] = node_idxs[remaining_nodes - 1];
-                pos_idx_B = find_best_match(node_idxs, --remaining_nodes, pos_idx_A);
+    void TLAS::subdivide(std::vector<uint32_t>& instance_ids, const std::vector<glm::vec3>& box_min, const std::vector<glm::vec3>& box_max) {
+        struct Task { uint32_t node_idx, first, count, depth; };
+        struct TLASBin {
+            glm::vec3 bmin{ Constant::INF_POS };
+            glm::vec3 bmax{ Constant::INF_NEG };
+            uint32_t count{ 0 };
+        };
+        auto area = [](const glm::vec3& bmin, const glm::vec3& bmax) {
+            glm::vec3 e = glm::max(bmax - bmin, glm::vec3{ 0.0f });
+            return e.x * e.y + e.y * e.z + e.z * e.x;
+        };
+        auto centroid = [&](uint32_t id) { return (box_min[id] + box_max[id]) * 0.5f; };
+
+        // explicit stack, unbalanced instance layouts could recurse very deep
+        std::vector<Task> tasks{ Task{ 0, 0, static_cast<uint32_t>(instance_ids.size()), 0 } };
+        while (!tasks.empty()) {
+            Task task = tasks.back();
+            tasks.pop_back();
+            TLASNode& node = m_tlas_nodes[task.node_idx];
+            const uint32_t last = task.first + task.count;
+
+            glm::vec3 bmin{ Constant::INF_POS }, bmax{ Constant::INF_NEG };
+            glm::vec3 cmin{ Constant::INF_POS }, cmax{ Constant::INF_NEG };
+            for (uint32_t i = task.first; i < last; ++i) {
+                uint32_t id = instance_ids[i];
+                bmin = glm::min(bmin, box_min[id]);
+                bmax = glm::max(bmax, box_max[id]);
+                cmin = glm::min(cmin, centroid(id));
+                cmax = glm::max(cmax, centroid(id));
+            }
+            node.aabb_min = bmin;
+            node.aabb_max = bmax;
+            if (task.count == 1) {
+                node.left = 0;
+                node.blas_idx = instance_ids[task.first];
+                continue;
+            }
+
+            // binned SAH over the instance centroids, unless the remaining instances
+            // only fit below BVH_MAX_DEPTH when halved (a leaf holds a single instance)
+            int best_axis = -1;
+            int best_split = 0;
+            float best_cost = Constant::INF_POS;
+            glm::vec3 extent = cmax - cmin;
+            const bool median_only = task.depth + std::bit_width(task.count - 1) >= BVH_MAX_DEPTH;
+            for (int axis = 0; axis < 3 && !median_only; ++axis) {
+                if (extent[axis] <= 0.0f) { continue; }
+                TLASBin bins[NUM_BINS]{};
+                float scale = NUM_BINS / extent[axis];
+                for (uint32_t i = task.first; i < last; ++i) {
+                    uint32_t id = instance_ids[i];
+                    int b = std::min(NUM_BINS - 1, static_cast<int>((centroid(id)[axis] - cmin[axis]) * scale));
+                    bins[b].bmin = glm::min(bins[b].bmin, box_min[id]);
+                    bins[b].bmax = glm::max(bins[b].bmax, box_max[id]);
+                    ++bins[b].count;
+                }
+                float right_area[NUM_BINS - 1];
+                uint32_t right_count[NUM_BINS - 1];
+                glm::vec3 rmin{ Constant::INF_POS }, rmax{ Constant::INF_NEG };
+                uint32_t r_count = 0;
+                for (int b = NUM_BINS - 1; b > 0; --b) {
+                    rmin = glm::min(rmin, bins[b].bmin);
+                    rmax = glm::max(rmax, bins[b].bmax);
+                    r_count += bins[b].count;
+                    right_area[b - 1] = area(rmin, rmax);
+                    right_count[b - 1] = r_count;
+                }
+                glm::vec3 lmin{ Constant::INF_POS }, lmax{ Constant::INF_NEG };
+                uint32_t l_count = 0;
+                for (int b = 0; b < NUM_BINS - 1; ++b) {
+                    lmin = glm::min(lmin, bins[b].bmin);
+                    lmax = glm::max(lmax, bins[b].bmax);
+                    l_count += bins[b].count;
+                    if (l_count == 0 || right_count[b] == 0) { continue; }
+                    float cost = l_count * area(lmin, lmax) + right_count[b] * right_area[b];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = b;
+                    }
+                }
+            }
+
+            uint32_t mid{};
+            if (best_axis >= 0) {
+                int axis = best_axis;
+                float scale = NUM_BINS / extent[axis];
+                auto is_left = [&](uint32_t id) {
+                    return std::min(NUM_BINS - 1, static_cast<int>((centroid(id)[axis] - cmin[axis]) * scale)) <= best_split;
+                };
+                mid = static_cast<uint32_t>(std::partition(instance_ids.begin() + task.first, instance_ids.begin() + last, is_left) - instance_ids.begin());
             }
             else {
-                pos_idx_A = pos_idx_B;
-                pos_idx_B = pos_idx_C;
+                // all centroids coincide or the tree is too deep, split the range in half
+                mid = task.first + task.count / 2;
             }
+
+            node.left = m_nodes_used;
+            m_nodes_used += 2;
+            tasks.emplace_back(Task{ node.left, task.first, mid - task.first, task.depth + 1 });
+            tasks.emplace_back(Task{ node.left + 1, mid, last - mid, task.depth + 1 });
         }
-        m_tlas_nodes[0] = m_tlas_nodes[node_idxs[pos_idx_A]];
     }
 
     bool TLAS::is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const {
@@ -393,73 +1195,75 @@ namespace SignalTracer {
     }
 
     bool TLAS::is_hit_(const Ray& ray, Interval interval, IntersectRecord& record) const {
-        // trace transformed ray
-        const TLASNode* node = &m_tlas_nodes[0];
-        const TLASNode* stack[128];
-        uint stack_ptr = 0;
-
-        bool hit_flag = false;
-        while (true) {
-            if (node->is_leaf()) {
-                // tlas leaf node
-                IntersectRecord tmp_record{};
-                if (m_blas[node->blas_idx].is_hit(ray, interval, tmp_record)) {
-                    if (tmp_record.t < record.t) {
-                        record = tmp_record;
-                        interval.max(record.t);
-                        hit_flag = true;
-                    }
-                }
-                if (stack_ptr == 0) { break; }
-                else { node = stack[--stack_ptr]; }
-                continue;
+        auto intersect_instance = [&](uint32_t blas_idx, uint32_t, Interval& leaf_interval) {
+            IntersectRecord tmp_record{};
+            if (m_blas[blas_idx].is_hit(ray, leaf_interval, tmp_record) && tmp_record.t < record.t) {
+                record = tmp_record;
+                leaf_interval.max(record.t);
+                return true;
             }
-            uint child_idx_1 = node->left_right & 0xffff;
-            uint child_idx_2 = node->left_right >> 16;
-            const TLASNode* child1 = &m_tlas_nodes[child_idx_1];
-            const TLASNode* child2 = &m_tlas_nodes[child_idx_2];
-            AABB left_box{ child1->aabb_min, child1->aabb_max };
-            AABB right_box{ child2->aabb_min, child2->aabb_max };
-            float dist1 = left_box.hit(ray, interval);
-            float dist2 = right_box.hit(ray, interval);
+            return false;
+        };
+        return m_wide.traverse(ray, interval, intersect_instance);
+    }
 
-            if (dist1 > dist2) {
-                std::swap(child1, child2);
-                std::swap(dist1, dist2);
-            }
-            if (dist1 == Constant::INF_POS) {
-                // no hit for both child nodes
-                if (stack_ptr == 0) break;
-                else node = stack[--stack_ptr];
-            }
-            else {
-                node = child1;
-                if (dist2 != Constant::INF_POS) {
-                    stack[stack_ptr++] = child2;
-                }
+    bool TLAS::is_occluded(const Ray& ray, const Interval& interval) const {
+        auto occluded_instance = [&](uint32_t blas_idx, uint32_t, const Interval& leaf_interval) {
+            return m_blas[blas_idx].is_occluded(ray, leaf_interval);
+        };
+        return m_wide.occluded(ray, interval, occluded_instance);
+    }
+
+    void TLAS::set_instances(const std::vector<BVHInstance>& instances) {
+        m_blas = instances.data();
+        m_blas_count = static_cast<uint>(instances.size());
+    }
+
+    std::size_t TLAS::memory_usage() const {
+        return m_tlas_nodes.size() * sizeof(TLASNode) + m_wide.memory_usage();
+    }
+
+    uint32_t TLAS::is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const {
+        uint32_t hit_mask = 0;
+        if (!packet.is_coherent()) {
+            for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+                int i = std::countr_zero(rays);
+                hit_mask |= static_cast<uint32_t>(is_hit_(packet[i], interval, records[i])) << i;
             }
+            return hit_mask;
         }
-        return hit_flag;
-    }
-
-    int TLAS::find_best_match(int* node_idxs, int num_nodes, int pos_idx_A) {
-        // return the index position of node B in the node_idxs array
-        // int node_idx_B = node_idxs[pos_B];
-        // TLASNode& node_B = m_tlas_nodes[node_idx_B];
-        float smallest_surface_area = Constant::INF_POS;
-        int best_pos_idx_B = -1;
-        for (int pos_idx_B = 0; pos_idx_B < num_nodes; pos_idx_B++) {
-            if (pos_idx_B != pos_idx_A) {
-                glm::vec3 bmax = glm::max(m_tlas_nodes[node_idxs[pos_idx_A]].aabb_max, m_tlas_nodes[node_idxs[pos_idx_B]].aabb_max);
-                glm::vec3 bmin = glm::min(m_tlas_nodes[node_idxs[pos_idx_A]].aabb_min, m_tlas_nodes[node_idxs[pos_idx_B]].aabb_min);
-                AABB box{ bmin, bmax };
-                float surface_area = box.calc_surface_area();
-                if (surface_area < smallest_surface_area) {
-                    smallest_surface_area = surface_area;
-                    best_pos_idx_B = pos_idx_B;
-                }
+
+        float hit_t[RayPacket::MAX_SIZE];
+        for (int i = 0; i < packet.size(); ++i) {
+            hit_t[i] = std::min(interval.max(), records[i].t);
+        }
+        auto intersect_instance = [&](uint32_t blas_idx, uint32_t, uint32_t ray_mask) {
+            IntersectRecord tmp_records[RayPacket::MAX_SIZE];
+            for (uint32_t rays = ray_mask; rays; rays &= rays - 1) {
+                int i = std::countr_zero(rays);
+                tmp_records[i].t = hit_t[i];
+            }
+            RayPacket sub_packet{ packet.get_rays(), packet.size(), ray_mask };
+            uint32_t instance_mask = m_blas[blas_idx].is_hit(sub_packet, interval, tmp_records);
+            for (; instance_mask; instance_mask &= instance_mask - 1) {
+                int i = std::countr_zero(instance_mask);
+                records[i] = tmp_records[i];
+                hit_t[i] = tmp_records[i].t;
+                hit_mask |= 1u << i;
             }
+        };
+        m_wide.traverse(packet, interval.min(), hit_t, intersect_instance);
+        return hit_mask;
+    }
+
+    bool TLAS::is_segment_occluded(const glm::vec3& from, const glm::vec3& to) const {
+        glm::vec3 segment = to - from;
+        float length = glm::length(segment);
+        if (length <= Constant::EPSILON) {
+            return false;
         }
-        return best_pos_idx_B;
+        // the end points usually lie on a surface, keep them out of the test
+        Ray ray{ from, segment / length };
+        return is_occluded(ray, Interval{ Constant::EPSILON, length - Constant::EPSILON });
     }
 }
@@ -0,0 +1,332 @@
+#include "compressed_bvh.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace SignalTracer {
+
+    namespace {
+        constexpr uint32_t NODE_STEPS{ 255 };
+        constexpr uint32_t VERTEX_STEPS{ 65535 };
+
+        // the traversal may decode with fused multiply-adds, a few ulps of margin keep the boxes conservative
+        constexpr float BOUNDS_MARGIN{ 1e-6f };
+
+        /// @brief Grid step so that grid point `steps` lies at or beyond hi.
+        float grid_scale(float lo, float hi, uint32_t steps) {
+            if (!(hi > lo)) { return 0.0f; }
+            float scale = (hi - lo) / static_cast<float>(steps);
+            while (dequantize(lo, scale, steps) < hi) {
+                scale = std::nextafter(scale, Constant::INF_POS);
+            }
+            return scale;
+        }
+
+        /// @brief Largest grid point at or below value.
+        uint32_t quantize_down(float origin, float scale, float value, uint32_t steps) {
+            if (scale == 0.0f) { return 0; }
+            float q = std::floor((value - origin) / scale);
+            uint32_t qi = static_cast<uint32_t>(std::clamp(q, 0.0f, static_cast<float>(steps)));
+            while (qi > 0 && dequantize(origin, scale, qi) > value) { --qi; }
+            return qi;
+        }
+
+        /// @brief Smallest grid point at or above value.
+        uint32_t quantize_up(float origin, float scale, float value, uint32_t steps) {
+            if (scale == 0.0f) { return 0; }
+            float q = std::ceil((value - origin) / scale);
+            uint32_t qi = static_cast<uint32_t>(std::clamp(q, 0.0f, static_cast<float>(steps)));
+            while (qi < steps && dequantize(origin, scale, qi) < value) { ++qi; }
+            return qi;
+        }
+
+        uint16_t quantize_nearest(float origin, float scale, float value) {
+            if (scale == 0.0f) { return 0; }
+            float q = std::round((value - origin) / scale);
+            return static_cast<uint16_t>(std::clamp(q, 0.0f, static_cast<float>(VERTEX_STEPS)));
+        }
+
+        template <int W>
+        void decode_node(const QuantizedWideNode<W>& node, WideBounds<W>& bounds) {
+            for (int i = 0; i < W; ++i) {
+                bounds.min_x[i] = dequantize(node.origin[0], node.scale[0], node.lo_x[i]);
+                bounds.min_y[i] = dequantize(node.origin[1], node.scale[1], node.lo_y[i]);
+                bounds.min_z[i] = dequantize(node.origin[2], node.scale[2], node.lo_z[i]);
+                bounds.max_x[i] = dequantize(node.origin[0], node.scale[0], node.hi_x[i]);
+                bounds.max_y[i] = dequantize(node.origin[1], node.scale[1], node.hi_y[i]);
+                bounds.max_z[i] = dequantize(node.origin[2], node.scale[2], node.hi_z[i]);
+            }
+            bounds.lane_mask = node.lane_mask;
+        }
+
+        /// @brief Slab test on quantized nodes, decodes the child bounds and runs the float test.
+        template <int W, typename Slab>
+        struct QuantizedSlab {
+            const Slab& slab;
+
+            uint32_t test(const QuantizedWideNode<W>& node, float t_min, float t_max, float* dist) const {
+                WideBounds<W> bounds;
+                decode_node(node, bounds);
+                return slab.test(bounds, t_min, t_max, dist);
+            }
+        };
+
+#if defined(SIGNAL_TRACER_X86)
+        template <typename LeafFn>
+        SIGNAL_TRACER_TARGET_AVX2 bool traverse_quantized_avx2(const QuantizedWideNode<8>* nodes, const Ray& ray, Interval& interval, LeafFn& leaf) {
+            AVX2Slab slab{ ray.get_origin(), ray.get_rdirection() };
+            return traverse_wide<8>(nodes, QuantizedSlab<8, AVX2Slab>{ slab }, interval, leaf);
+        }
+
+        template <typename LeafFn>
+        SIGNAL_TRACER_TARGET_AVX2 bool occluded_quantized_avx2(const QuantizedWideNode<8>* nodes, const Ray& ray, const Interval& interval, LeafFn& leaf) {
+            AVX2Slab slab{ ray.get_origin(), ray.get_rdirection() };
+            return occluded_wide<8>(nodes, QuantizedSlab<8, AVX2Slab>{ slab }, interval, leaf);
+        }
+#endif
+    }
+
+    void CompressedBVH::build(const WideBVH& wide, const TriangleBlocks& blocks, const TriangleStore& store, const AABB& bounds) {
+        clear();
+        if (wide.empty()) {
+            return;
+        }
+        if (wide.get_width() != blocks.get_width()) {
+            std::cerr << "CompressedBVH: node width " << wide.get_width() << " does not match block width "
+                << blocks.get_width() << std::endl;
+            return;
+        }
+        m_width = wide.get_width();
+        m_origin = bounds.get_min();
+        glm::vec3 bmax = bounds.get_max();
+        for (int axis = 0; axis < 3; ++axis) {
+            m_scale[axis] = grid_scale(m_origin[axis], bmax[axis], VERTEX_STEPS);
+        }
+        if (m_width == 8) {
+            build_nodes(wide.get_nodes8(), blocks.get_blocks8(), store, m_nodes8, m_blocks8);
+        }
+        else {
+            build_nodes(wide.get_nodes4(), blocks.get_blocks4(), store, m_nodes4, m_blocks4);
+        }
+    }
+
+    void CompressedBVH::clear() {
+        m_nodes4 = {};
+        m_nodes8 = {};
+        m_blocks4 = {};
+        m_blocks8 = {};
+    }
+
+    std::size_t CompressedBVH::memory_usage() const {
+        return m_nodes4.size() * sizeof(QuantizedWideNode<4>) + m_nodes8.size() * sizeof(QuantizedWideNode<8>)
+            + m_blocks4.size() * sizeof(QuantizedTriangleBlock<4>) + m_blocks8.size() * sizeof(QuantizedTriangleBlock<8>);
+    }
+
+    template <int W>
+    void CompressedBVH::build_nodes(const WideNodeArray<W>& wide_nodes, const TransformBlockArray<W>& blocks, const TriangleStore& store,
+        Memory::AlignedVector<QuantizedWideNode<W>>& nodes, Memory::AlignedVector<QuantizedTriangleBlock<W>>& quantized_blocks) const {
+        /* ---- Triangle blocks on the 16-bit vertex grid ---- */
+        quantized_blocks.resize(blocks.size());
+        for (std::size_t i = 0; i < blocks.size(); ++i) {
+            const TransformBlock<W>& block = blocks[i];
+            QuantizedTriangleBlock<W>& quantized = quantized_blocks[i];
+            for (int lane = 0; lane < W; ++lane) {
+                quantized.prim_id[lane] = block.prim_id[lane];
+                if (block.prim_id[lane] == Constant::INVALID_IDX) {
+                    for (int axis = 0; axis < 3; ++axis) {
+                        quantized.a[axis][lane] = quantized.b[axis][lane] = quantized.c[axis][lane] = 0;
+                    }
+                    continue;
+                }
+                uint32_t prim = block.prim_id[lane];
+                glm::vec3 a = store.a(prim);
+                glm::vec3 b = store.b(prim);
+                glm::vec3 c = store.c(prim);
+                for (int axis = 0; axis < 3; ++axis) {
+                    quantized.a[axis][lane] = quantize_nearest(m_origin[axis], m_scale[axis], a[axis]);
+                    quantized.b[axis][lane] = quantize_nearest(m_origin[axis], m_scale[axis], b[axis]);
+                    quantized.c[axis][lane] = quantize_nearest(m_origin[axis], m_scale[axis], c[axis]);
+                }
+            }
+        }
+
+        /* ---- Nodes, children before parents so every lane box is known ---- */
+        float margin = BOUNDS_MARGIN * std::max({ std::fabs(m_origin.x), std::fabs(m_origin.y), std::fabs(m_origin.z),
+            m_scale.x * VERTEX_STEPS, m_scale.y * VERTEX_STEPS, m_scale.z * VERTEX_STEPS, 1.0f });
+        std::vector<glm::vec3> node_min(wide_nodes.size());
+        std::vector<glm::vec3> node_max(wide_nodes.size());
+        nodes.resize(wide_nodes.size());
+        TriangleBlock<W> decoded{};
+        for (std::size_t n = wide_nodes.size(); n-- > 0;) {
+            const WideBVHNode<W>& wide_node = wide_nodes[n];
+            glm::vec3 lane_min[W];
+            glm::vec3 lane_max[W];
+            glm::vec3 box_min{ Constant::INF_POS };
+            glm::vec3 box_max{ Constant::INF_NEG };
+            for (int lane = 0; lane < W; ++lane) {
+                if (!(wide_node.lane_mask >> lane & 1u)) { continue; }
+                if (wide_node.count[lane] == 0) {
+                    lane_min[lane] = node_min[wide_node.child[lane]];
+                    lane_max[lane] = node_max[wide_node.child[lane]];
+                }
+                else {
+                    // bounds of the decoded triangles, not of the original ones
+                    lane_min[lane] = glm::vec3{ Constant::INF_POS };
+                    lane_max[lane] = glm::vec3{ Constant::INF_NEG };
+                    for (uint32_t i = wide_node.child[lane]; i < wide_node.child[lane] + wide_node.count[lane]; ++i) {
+                        decode_block(quantized_blocks[i], decoded);
+                        for (int tri = 0; tri < W; ++tri) {
+                            if (decoded.prim_id[tri] == Constant::INVALID_IDX) { continue; }
+                            glm::vec3 a{ decoded.ax[tri], decoded.ay[tri], decoded.az[tri] };
+                            glm::vec3 b = a + glm::vec3{ decoded.e1x[tri], decoded.e1y[tri], decoded.e1z[tri] };
+                            glm::vec3 c = a + glm::vec3{ decoded.e2x[tri], decoded.e2y[tri], decoded.e2z[tri] };
+                            lane_min[lane] = glm::min(lane_min[lane], glm::min(a, glm::min(b, c)));
+                            lane_max[lane] = glm::max(lane_max[lane], glm::max(a, glm::max(b, c)));
+                        }
+                    }
+                    lane_min[lane] -= glm::vec3{ margin };
+                    lane_max[lane] += glm::vec3{ margin };
+                }
+                box_min = glm::min(box_min, lane_min[lane]);
+                box_max = glm::max(box_max, lane_max[lane]);
+            }
+            node_min[n] = box_min;
+            node_max[n] = box_max;
+
+            QuantizedWideNode<W>& node = nodes[n];
+            for (int axis = 0; axis < 3; ++axis) {
+                node.origin[axis] = box_min[axis];
+                node.scale[axis] = grid_scale(box_min[axis], box_max[axis], NODE_STEPS);
+            }
+            node.lane_mask = static_cast<uint8_t>(wide_node.lane_mask);
+            uint8_t* lo[3] = { node.lo_x, node.lo_y, node.lo_z };
+            uint8_t* hi[3] = { node.hi_x, node.hi_y, node.hi_z };
+            for (int lane = 0; lane < W; ++lane) {
+                bool used = wide_node.lane_mask >> lane & 1u;
+                node.child[lane] = wide_node.child[lane];
+                node.count[lane] = static_cast<uint16_t>(wide_node.count[lane]);
+                for (int axis = 0; axis < 3; ++axis) {
+                    // unused lanes get an inverted box
+                    lo[axis][lane] = static_cast<uint8_t>(used ? quantize_down(node.origin[axis], node.scale[axis], lane_min[lane][axis], NODE_STEPS) : NODE_STEPS);
+                    hi[axis][lane] = static_cast<uint8_t>(used ? quantize_up(node.origin[axis], node.scale[axis], lane_max[lane][axis], NODE_STEPS) : 0);
+                }
+            }
+        }
+    }
+
+    template <int W>
+    void CompressedBVH::decode_block(const QuantizedTriangleBlock<W>& quantized, TriangleBlock<W>& block) const {
+        for (int lane = 0; lane < W; ++lane) {
+            glm::vec3 a{}, b{}, c{};
+            for (int axis = 0; axis < 3; ++axis) {
+                a[axis] = dequantize(m_origin[axis], m_scale[axis], quantized.a[axis][lane]);
+                b[axis] = dequantize(m_origin[axis], m_scale[axis], quantized.b[axis][lane]);
+                c[axis] = dequantize(m_origin[axis], m_scale[axis], quantized.c[axis][lane]);
+            }
+            block.ax[lane] = a.x; block.ay[lane] = a.y; block.az[lane] = a.z;
+            block.e1x[lane] = b.x - a.x; block.e1y[lane] = b.y - a.y; block.e1z[lane] = b.z - a.z;
+            block.e2x[lane] = c.x - a.x; block.e2y[lane] = c.y - a.y; block.e2z[lane] = c.z - a.z;
+            block.prim_id[lane] = quantized.prim_id[lane];
+        }
+    }
+
+    template <int W>
+    bool CompressedBVH::intersect_leaves(const Memory::AlignedVector<QuantizedTriangleBlock<W>>& blocks, uint32_t first, uint32_t count,
+        const Ray& ray, Interval& interval, uint32_t& prim_id, glm::vec3& normal) const {
+        TriangleBlock<W> block{};
+        bool hit = false;
+        for (uint32_t i = first; i < first + count; ++i) {
+            decode_block(blocks[i], block);
+            float t{};
+            int lane = intersect_block<W>(block, ray.get_origin(), ray.get_direction(), interval.min(), interval.max(), t);
+            if (lane < 0) { continue; }
+            glm::vec3 e1{ block.e1x[lane], block.e1y[lane], block.e1z[lane] };
+            glm::vec3 e2{ block.e2x[lane], block.e2y[lane], block.e2z[lane] };
+            interval.max(t);
+            prim_id = block.prim_id[lane];
+            normal = glm::normalize(glm::cross(e1, e2));
+            hit = true;
+        }
+        return hit;
+    }
+
+    bool CompressedBVH::intersect(const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id, glm::vec3& normal) const {
+        if (empty()) { return false; }
+        Interval ray_interval{ interval };
+        bool hit{ false };
+        if (m_width == 8) {
+            auto leaf = [&](uint32_t first, uint32_t count, Interval& leaf_interval) {
+                return intersect_leaves(m_blocks8, first, count, ray, leaf_interval, prim_id, normal);
+            };
+#if defined(SIGNAL_TRACER_X86)
+            if (SIMD::has_avx2()) {
+                hit = traverse_quantized_avx2(m_nodes8.data(), ray, ray_interval, leaf);
+            }
+            else
+#endif
+            {
+                ScalarSlab<8> slab{ ray.get_origin(), ray.get_rdirection() };
+                hit = traverse_wide<8>(m_nodes8.data(), QuantizedSlab<8, ScalarSlab<8>>{ slab }, ray_interval, leaf);
+            }
+        }
+        else {
+            auto leaf = [&](uint32_t first, uint32_t count, Interval& leaf_interval) {
+                return intersect_leaves(m_blocks4, first, count, ray, leaf_interval, prim_id, normal);
+            };
+#if defined(SIGNAL_TRACER_X86)
+            SSESlab slab{ ray.get_origin(), ray.get_rdirection() };
+            hit = traverse_wide<4>(m_nodes4.data(), QuantizedSlab<4, SSESlab>{ slab }, ray_interval, leaf);
+#else
+            ScalarSlab<4> slab{ ray.get_origin(), ray.get_rdirection() };
+            hit = traverse_wide<4>(m_nodes4.data(), QuantizedSlab<4, ScalarSlab<4>>{ slab }, ray_interval, leaf);
+#endif
+        }
+        if (hit) {
+            t = ray_interval.max();
+        }
+        return hit;
+    }
+
+    bool CompressedBVH::occluded(const Ray& ray, const Interval& interval) const {
+        if (empty()) { return false; }
+        if (m_width == 8) {
+            auto leaf = [&](uint32_t first, uint32_t count, const Interval& leaf_interval) {
+                TriangleBlock<8> block{};
+                for (uint32_t i = first; i < first + count; ++i) {
+                    decode_block(m_blocks8[i], block);
+                    float t{};
+                    if (intersect_block<8>(block, ray.get_origin(), ray.get_direction(), leaf_interval.min(), leaf_interval.max(), t) >= 0) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+#if defined(SIGNAL_TRACER_X86)
+            if (SIMD::has_avx2()) {
+                return occluded_quantized_avx2(m_nodes8.data(), ray, interval, leaf);
+            }
+#endif
+            ScalarSlab<8> slab{ ray.get_origin(), ray.get_rdirection() };
+            return occluded_wide<8>(m_nodes8.data(), QuantizedSlab<8, ScalarSlab<8>>{ slab }, interval, leaf);
+        }
+        auto leaf = [&](uint32_t first, uint32_t count, const Interval& leaf_interval) {
+            TriangleBlock<4> block{};
+            for (uint32_t i = first; i < first + count; ++i) {
+                decode_block(m_blocks4[i], block);
+                float t{};
+                if (intersect_block<4>(block, ray.get_origin(), ray.get_direction(), leaf_interval.min(), leaf_interval.max(), t) >= 0) {
+                    return true;
+                }
+            }
+            return false;
+        };
+#if defined(SIGNAL_TRACER_X86)
+        SSESlab slab{ ray.get_origin(), ray.get_rdirection() };
+        return occluded_wide<4>(m_nodes4.data(), QuantizedSlab<4, SSESlab>{ slab }, interval, leaf);
+#else
+        ScalarSlab<4> slab{ ray.get_origin(), ray.get_rdirection() };
+        return occluded_wide<4>(m_nodes4.data(), QuantizedSlab<4, ScalarSlab<4>>{ slab }, interval, leaf);
+#endif
+    }
+}
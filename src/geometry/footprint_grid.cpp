@@ -0,0 +1,339 @@
+#include "footprint_grid.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+namespace SignalTracer {
+
+    namespace {
+        glm::vec3 transform_point(const glm::mat4& transform, const glm::vec3& p) {
+            return glm::vec3{ transform * glm::vec4{ p, 1.0f } };
+        }
+
+        /// @brief Separating axis test of the x-z footprint of a triangle against a cell rectangle.
+        /// @details A wall projects to a segment, its edges then share one normal, which is still a valid axis.
+        bool overlaps_rect(const glm::vec2 tri[3], const glm::vec2& rect_min, const glm::vec2& rect_max) {
+            for (int i = 0; i < 3; ++i) {
+                glm::vec2 edge{ tri[(i + 1) % 3] - tri[i] };
+                glm::vec2 axis{ -edge.y, edge.x };
+                float tri_min{ Constant::INF_POS };
+                float tri_max{ Constant::INF_NEG };
+                for (int j = 0; j < 3; ++j) {
+                    float d = glm::dot(axis, tri[j]);
+                    tri_min = std::min(tri_min, d);
+                    tri_max = std::max(tri_max, d);
+                }
+                // the corner of the rectangle furthest along and against the axis
+                glm::vec2 near_corner{ axis.x >= 0.0f ? rect_min.x : rect_max.x, axis.y >= 0.0f ? rect_min.y : rect_max.y };
+                glm::vec2 far_corner{ axis.x >= 0.0f ? rect_max.x : rect_min.x, axis.y >= 0.0f ? rect_max.y : rect_min.y };
+                if (glm::dot(axis, far_corner) < tri_min || glm::dot(axis, near_corner) > tri_max) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    bool FootprintGrid::is_2_5d(const std::vector<BVHInstance>& instances) {
+        double flat_area{ 0.0 };
+        double total_area{ 0.0 };
+        for (const auto& bvh_inst : instances) {
+            // terrain is not binned into the grid
+            if (bvh_inst.get_bvh()->is_heightfield()) {
+                return false;
+            }
+            const TriangleStore& store = bvh_inst.get_bvh()->get_store();
+            if (!store.has_geometry()) {
+                continue;
+            }
+            const glm::mat4& transform = bvh_inst.get_transform();
+            for (uint32_t prim = 0; prim < store.size(); ++prim) {
+                glm::vec3 a{ transform_point(transform, store.a(prim)) };
+                glm::vec3 cross{ glm::cross(transform_point(transform, store.b(prim)) - a, transform_point(transform, store.c(prim)) - a) };
+                float area = glm::length(cross);
+                if (area <= 0.0f) {
+                    continue;
+                }
+                float normal_y = std::fabs(cross.y) / area;
+                total_area += area;
+                if (normal_y < WALL_NORMAL_Y || normal_y > FLAT_NORMAL_Y) {
+                    flat_area += area;
+                }
+            }
+        }
+        return total_area > 0.0 && flat_area >= MIN_2_5D_AREA * total_area;
+    }
+
+    bool FootprintGrid::build(const std::vector<BVHInstance>& instances, float cell_size, int width) {
+        Utils::Timer timer{};
+        m_cells.clear();
+        m_blas_ids.clear();
+        m_prim_ids.clear();
+        m_normals.clear();
+        m_bounds = AABB{};
+        m_stats = FootprintGridStats{};
+
+        /* ---- World space triangles ---- */
+        TriangleStore world{};
+        for (const auto& bvh_inst : instances) {
+            const BVHAccel& blas = *bvh_inst.get_bvh();
+            const TriangleStore& store = blas.get_store();
+            if (!store.has_geometry() && blas.get_triangle_count() > 0) {
+                std::cerr << "FootprintGrid: BLAS " << blas.get_blas_id() << " has no triangles to bin, it is compressed, paged out or a heightfield." << std::endl;
+                m_blas_ids.clear();
+                m_prim_ids.clear();
+                m_normals.clear();
+                return false;
+            }
+            const glm::mat4& transform = bvh_inst.get_transform();
+            // a mirroring transform turns the winding, the normal keeps the side the BLAS gives it
+            float det = glm::dot(glm::cross(glm::vec3{ transform[0] }, glm::vec3{ transform[1] }), glm::vec3{ transform[2] });
+            float normal_sign = det < 0.0f ? -1.0f : 1.0f;
+            world.reserve(world.size() + store.size());
+            for (uint32_t prim = 0; prim < store.size(); ++prim) {
+                glm::vec3 a{ transform_point(transform, store.a(prim)) };
+                glm::vec3 b{ transform_point(transform, store.b(prim)) };
+                glm::vec3 c{ transform_point(transform, store.c(prim)) };
+                uint32_t world_prim = world.add(a, b, c, store.get_mat_id(prim));
+                m_bounds.expand(world.bounding_box(world_prim));
+                m_blas_ids.push_back(blas.get_blas_id());
+                m_prim_ids.push_back(prim);
+                m_normals.push_back(normal_sign * world.get_normal(world_prim));
+            }
+        }
+        uint32_t triangle_count = static_cast<uint32_t>(world.size());
+        if (triangle_count == 0) {
+            return true;
+        }
+
+        /* ---- Cells ---- */
+        const glm::vec3& box_min = m_bounds.get_min();
+        glm::vec3 extent{ m_bounds.get_max() - box_min };
+        float area = std::max(extent.x, Constant::EPSILON) * std::max(extent.z, Constant::EPSILON);
+        if (cell_size <= 0.0f) {
+            cell_size = 2.0f * std::sqrt(area / triangle_count);
+        }
+        cell_size = std::max({ cell_size, std::sqrt(area / MAX_CELLS), Constant::EPSILON });
+        m_origin = box_min;
+        m_cell_size = cell_size;
+        m_inv_cell_size = 1.0f / cell_size;
+        m_cells_x = std::max(1u, static_cast<uint32_t>(std::ceil(extent.x * m_inv_cell_size)));
+        m_cells_z = std::max(1u, static_cast<uint32_t>(std::ceil(extent.z * m_inv_cell_size)));
+        m_cells.assign(static_cast<std::size_t>(m_cells_x) * m_cells_z, Cell{});
+
+        /* ---- Bin the footprints ---- */
+        // (cell, triangle) pairs, counting sorted by cell
+        std::vector<std::pair<uint32_t, uint32_t>> refs{};
+        refs.reserve(triangle_count * 2);
+        std::vector<uint32_t> cell_count(m_cells.size() + 1, 0);
+        float margin = 1e-4f * m_cell_size; // triangles on a cell border go to both cells
+        for (uint32_t prim = 0; prim < triangle_count; ++prim) {
+            glm::vec3 tri_min{ world.get_min(prim) };
+            glm::vec3 tri_max{ world.get_max(prim) };
+            glm::vec2 footprint[3]{ { world.a(prim).x, world.a(prim).z }, { world.b(prim).x, world.b(prim).z }, { world.c(prim).x, world.c(prim).z } };
+            uint32_t x0 = std::min(m_cells_x - 1, static_cast<uint32_t>(std::max(0.0f, (tri_min.x - margin - m_origin.x) * m_inv_cell_size)));
+            uint32_t x1 = std::min(m_cells_x - 1, static_cast<uint32_t>(std::max(0.0f, (tri_max.x + margin - m_origin.x) * m_inv_cell_size)));
+            uint32_t z0 = std::min(m_cells_z - 1, static_cast<uint32_t>(std::max(0.0f, (tri_min.z - margin - m_origin.z) * m_inv_cell_size)));
+            uint32_t z1 = std::min(m_cells_z - 1, static_cast<uint32_t>(std::max(0.0f, (tri_max.z + margin - m_origin.z) * m_inv_cell_size)));
+            for (uint32_t z = z0; z <= z1; ++z) {
+                for (uint32_t x = x0; x <= x1; ++x) {
+                    glm::vec2 rect_min{ m_origin.x + x * m_cell_size - margin, m_origin.z + z * m_cell_size - margin };
+                    glm::vec2 rect_max{ rect_min.x + m_cell_size + 2.0f * margin, rect_min.y + m_cell_size + 2.0f * margin };
+                    if (x0 != x1 && z0 != z1 && !overlaps_rect(footprint, rect_min, rect_max)) {
+                        continue;
+                    }
+                    uint32_t cell_idx = z * m_cells_x + x;
+                    refs.emplace_back(cell_idx, prim);
+                    ++cell_count[cell_idx + 1];
+                    Cell& cell = m_cells[cell_idx];
+                    cell.y_min = std::min(cell.y_min, tri_min.y);
+                    cell.y_max = std::max(cell.y_max, tri_max.y);
+                }
+            }
+        }
+        for (std::size_t i = 1; i < cell_count.size(); ++i) {
+            cell_count[i] += cell_count[i - 1];
+        }
+        std::vector<uint32_t> cell_prims(refs.size());
+        {
+            std::vector<uint32_t> next{ cell_count.begin(), cell_count.end() - 1 };
+            for (const auto& [cell_idx, prim] : refs) {
+                cell_prims[next[cell_idx]++] = prim;
+            }
+        }
+
+        /* ---- Pack the cells ---- */
+        m_blocks.reset(width);
+        for (uint32_t cell_idx = 0; cell_idx < m_cells.size(); ++cell_idx) {
+            uint32_t count = cell_count[cell_idx + 1] - cell_count[cell_idx];
+            if (count == 0) {
+                continue;
+            }
+            Cell& cell = m_cells[cell_idx];
+            cell.first_block = m_blocks.add_leaf(world, &cell_prims[cell_count[cell_idx]], count);
+            cell.block_count = m_blocks.get_block_count(count);
+            ++m_stats.filled_cells;
+        }
+
+        m_stats.cells_x = m_cells_x;
+        m_stats.cells_z = m_cells_z;
+        m_stats.cell_size = m_cell_size;
+        m_stats.triangle_count = triangle_count;
+        m_stats.reference_count = static_cast<uint32_t>(refs.size());
+        m_stats.build_time = timer.elapsed();
+        return true;
+    }
+
+    std::size_t FootprintGrid::memory_usage() const {
+        return m_cells.capacity() * sizeof(Cell) + m_blocks.memory_usage()
+            + (m_blas_ids.capacity() + m_prim_ids.capacity()) * sizeof(uint32_t) + m_normals.capacity() * sizeof(glm::vec3);
+    }
+
+    template <typename Visit>
+    void FootprintGrid::walk(const Ray& ray, const Interval& interval, Visit&& visit) const {
+        if (m_cells.empty()) {
+            return;
+        }
+        const glm::vec3& o = ray.get_origin();
+        const glm::vec3& d = ray.get_direction();
+        const glm::vec3& rd = ray.get_rdirection();
+
+        /* ---- Clip to the grid ---- */
+        float t_near = interval.min();
+        float t_far = interval.max();
+        for (int axis = 0; axis < 3; ++axis) {
+            if (d[axis] == 0.0f) {
+                if (o[axis] < m_bounds.get_min()[axis] || o[axis] > m_bounds.get_max()[axis]) {
+                    return;
+                }
+                continue;
+            }
+            float t0 = (m_bounds.get_min()[axis] - o[axis]) * rd[axis];
+            float t1 = (m_bounds.get_max()[axis] - o[axis]) * rd[axis];
+            if (t0 > t1) { std::swap(t0, t1); }
+            t_near = std::max(t_near, t0);
+            t_far = std::min(t_far, t1);
+        }
+        if (t_near > t_far) {
+            return;
+        }
+
+        /* ---- 2D DDA on x and z ---- */
+        glm::vec3 start{ ray.point_at(t_near) };
+        int x = std::clamp(static_cast<int>(std::floor((start.x - m_origin.x) * m_inv_cell_size)), 0, static_cast<int>(m_cells_x) - 1);
+        int z = std::clamp(static_cast<int>(std::floor((start.z - m_origin.z) * m_inv_cell_size)), 0, static_cast<int>(m_cells_z) - 1);
+        int step_x = d.x > 0.0f ? 1 : -1;
+        int step_z = d.z > 0.0f ? 1 : -1;
+        float t_next_x{ Constant::INF_POS };
+        float t_next_z{ Constant::INF_POS };
+        float t_delta_x{ Constant::INF_POS };
+        float t_delta_z{ Constant::INF_POS };
+        if (d.x != 0.0f) {
+            t_next_x = (m_origin.x + (x + (step_x > 0 ? 1 : 0)) * m_cell_size - o.x) * rd.x;
+            t_delta_x = m_cell_size * std::fabs(rd.x);
+        }
+        if (d.z != 0.0f) {
+            t_next_z = (m_origin.z + (z + (step_z > 0 ? 1 : 0)) * m_cell_size - o.z) * rd.z;
+            t_delta_z = m_cell_size * std::fabs(rd.z);
+        }
+
+        float t_enter = t_near;
+        while (true) {
+            float t_exit = std::min({ t_next_x, t_next_z, t_far });
+            if (visit(m_cells[static_cast<uint32_t>(z) * m_cells_x + x], t_enter, t_exit)) {
+                return;
+            }
+            if (t_exit >= t_far) {
+                return;
+            }
+            t_enter = t_exit;
+            if (t_next_x < t_next_z) {
+                x += step_x;
+                if (x < 0 || x >= static_cast<int>(m_cells_x)) { return; }
+                t_next_x += t_delta_x;
+            }
+            else {
+                z += step_z;
+                if (z < 0 || z >= static_cast<int>(m_cells_z)) { return; }
+                t_next_z += t_delta_z;
+            }
+        }
+    }
+
+    bool FootprintGrid::is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const {
+        const float o_y = ray.get_origin().y;
+        const float d_y = ray.get_direction().y;
+        float best_t = interval.max();
+        uint32_t best_prim{ Constant::INVALID_IDX };
+        walk(ray, interval, [&](const Cell& cell, float t_enter, float t_exit) {
+            if (t_enter > best_t) {
+                return true;
+            }
+            // the height range of the ray inside the cell against the triangles of the cell
+            float y_enter = o_y + t_enter * d_y;
+            float y_exit = o_y + t_exit * d_y;
+            if (cell.block_count == 0 || std::min(y_enter, y_exit) > cell.y_max + Constant::EPSILON
+                || std::max(y_enter, y_exit) < cell.y_min - Constant::EPSILON) {
+                return false;
+            }
+            float t{};
+            uint32_t prim{};
+            if (m_blocks.intersect(cell.first_block, cell.block_count, ray, Interval{ interval.min(), best_t }, t, prim)) {
+                best_t = t;
+                best_prim = prim;
+            }
+            // a hit beyond the cell may still be cut short by a triangle of a later cell
+            return best_prim != Constant::INVALID_IDX && best_t <= t_exit;
+        });
+        if (best_prim == Constant::INVALID_IDX) {
+            return false;
+        }
+        record.t = best_t;
+        record.point = ray.point_at(best_t);
+        record.normal = m_normals[best_prim];
+        record.blas_id = m_blas_ids[best_prim];
+        record.prim_id = m_prim_ids[best_prim];
+        return true;
+    }
+
+    bool FootprintGrid::is_occluded(const Ray& ray, const Interval& interval) const {
+        const float o_y = ray.get_origin().y;
+        const float d_y = ray.get_direction().y;
+        bool occluded{ false };
+        walk(ray, interval, [&](const Cell& cell, float t_enter, float t_exit) {
+            float y_enter = o_y + t_enter * d_y;
+            float y_exit = o_y + t_exit * d_y;
+            if (cell.block_count == 0 || std::min(y_enter, y_exit) > cell.y_max + Constant::EPSILON
+                || std::max(y_enter, y_exit) < cell.y_min - Constant::EPSILON) {
+                return false;
+            }
+            occluded = m_blocks.occluded(cell.first_block, cell.block_count, ray, interval);
+            return occluded;
+        });
+        return occluded;
+    }
+
+    uint32_t FootprintGrid::is_hit(const RayPacket& packet, const Interval& interval, IntersectRecord* records) const {
+        uint32_t hit_mask = 0;
+        for (uint32_t rays = packet.get_active(); rays; rays &= rays - 1) {
+            int i = std::countr_zero(rays);
+            Interval ray_interval{ interval.min(), std::min(interval.max(), records[i].t) };
+            hit_mask |= static_cast<uint32_t>(is_hit(packet[i], ray_interval, records[i])) << i;
+        }
+        return hit_mask;
+    }
+
+    bool FootprintGrid::is_segment_occluded(const glm::vec3& from, const glm::vec3& to) const {
+        glm::vec3 segment = to - from;
+        float length = glm::length(segment);
+        if (length <= Constant::EPSILON) {
+            return false;
+        }
+        // the end points usually lie on a surface, keep them out of the test
+        Ray ray{ from, segment / length };
+        return is_occluded(ray, Interval{ Constant::EPSILON, length - Constant::EPSILON });
+    }
+}
@@ -0,0 +1,397 @@
+#include "heightfield.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace SignalTracer {
+
+    namespace {
+        /// @brief Moller-Trumbore on three corners, culled like TriangleStore::is_hit.
+        bool hit_triangle(const Ray& ray, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float t_min, float t_max, float& t) {
+            glm::vec3 edge_ab{ b - a };
+            glm::vec3 edge_ac{ c - a };
+            glm::vec3 pvec = glm::cross(ray.get_direction(), edge_ac);
+            float det = glm::dot(edge_ab, pvec);
+#if defined(CULLING)
+            if (det < Constant::EPSILON) {
+                return false;
+            }
+#else
+            if (std::fabs(det) < Constant::EPSILON) {
+                return false;
+            }
+#endif
+            float inv_det = 1.0f / det;
+            glm::vec3 tvec = ray.get_origin() - a;
+            float u = glm::dot(tvec, pvec) * inv_det;
+            if (u < 0.0f || u > 1.0f) {
+                return false;
+            }
+            glm::vec3 qvec = glm::cross(tvec, edge_ab);
+            float v = glm::dot(ray.get_direction(), qvec) * inv_det;
+            if (v < 0.0f || u + v > 1.0f) {
+                return false;
+            }
+            float t_hit = glm::dot(edge_ac, qvec) * inv_det;
+            if (t_hit < t_min || t_hit > t_max) {
+                return false;
+            }
+            t = t_hit;
+            return true;
+        }
+
+        template <typename T>
+        T read_sample(const unsigned char* bytes, bool big_endian) {
+            unsigned char ordered[sizeof(T)];
+            for (std::size_t i = 0; i < sizeof(T); ++i) {
+                ordered[i] = big_endian ? bytes[sizeof(T) - 1 - i] : bytes[i];
+            }
+            T value{};
+            std::memcpy(&value, ordered, sizeof(T));
+            return value;
+        }
+
+        /// @brief Slabs of the four children of a block, lane k is child (k & 1, k >> 1).
+        struct QuadSlabs {
+            float near_x[4];
+            float far_x[4];
+            float near_z[4];
+            float far_z[4];
+        };
+
+        /// @brief Entry distances of the four children, lo and hi are their height ranges on the near and far side of the ray.
+        /// @return mask of the children entered within [t_min, t_max]
+        uint32_t enter_quad(const QuadSlabs& slabs, const float* near_y, const float* far_y, const glm::vec3& near_offset, const glm::vec3& far_offset,
+            const glm::vec3& rd, float t_min, float t_max, float* t_enter) {
+#if defined(SIGNAL_TRACER_X86)
+            // _mm_max_ps and _mm_min_ps return their second operand for NaN, so a zero direction leaves the running bounds alone
+            __m128 t0 = _mm_set1_ps(t_min);
+            __m128 t1 = _mm_set1_ps(t_max);
+            __m128 rd_x = _mm_set1_ps(rd.x);
+            __m128 rd_y = _mm_set1_ps(rd.y);
+            __m128 rd_z = _mm_set1_ps(rd.z);
+            t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.near_x), _mm_set1_ps(near_offset.x)), rd_x), t0);
+            t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.far_x), _mm_set1_ps(far_offset.x)), rd_x), t1);
+            t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.near_z), _mm_set1_ps(near_offset.z)), rd_z), t0);
+            t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.far_z), _mm_set1_ps(far_offset.z)), rd_z), t1);
+            t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_y), _mm_set1_ps(near_offset.y)), rd_y), t0);
+            t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_y), _mm_set1_ps(far_offset.y)), rd_y), t1);
+            _mm_storeu_ps(t_enter, t0);
+            return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t0, t1)));
+#else
+            uint32_t mask = 0;
+            for (int k = 0; k < 4; ++k) {
+                float t0 = t_min;
+                float t1 = t_max;
+                float near_t[3]{ (slabs.near_x[k] - near_offset.x) * rd.x, (near_y[k] - near_offset.y) * rd.y, (slabs.near_z[k] - near_offset.z) * rd.z };
+                float far_t[3]{ (slabs.far_x[k] - far_offset.x) * rd.x, (far_y[k] - far_offset.y) * rd.y, (slabs.far_z[k] - far_offset.z) * rd.z };
+                for (int axis = 0; axis < 3; ++axis) {
+                    t0 = near_t[axis] > t0 ? near_t[axis] : t0;
+                    t1 = far_t[axis] < t1 ? far_t[axis] : t1;
+                }
+                t_enter[k] = t0;
+                mask |= static_cast<uint32_t>(t0 <= t1) << k;
+            }
+            return mask;
+#endif
+        }
+    }
+
+    Heightfield::Heightfield(const HeightfieldDesc& desc, std::vector<float> heights)
+        : m_desc{ desc }
+        , m_heights{ std::move(heights) } {
+        if (m_desc.width < 2 || m_desc.depth < 2 || m_heights.size() != static_cast<std::size_t>(m_desc.width) * m_desc.depth) {
+            std::cerr << "Heightfield: " << m_heights.size() << " samples do not make a " << m_desc.width << " x " << m_desc.depth
+                << " raster of at least 2 x 2." << std::endl;
+            m_desc.width = 0;
+            m_desc.depth = 0;
+            m_heights.clear();
+            return;
+        }
+        build_levels();
+    }
+
+    std::shared_ptr<Heightfield> Heightfield::load_raw(const std::string& path, const HeightfieldDesc& desc) {
+        std::ifstream file{ path, std::ios::binary };
+        if (!file) {
+            std::cerr << "Heightfield: cannot open " << path << std::endl;
+            return nullptr;
+        }
+        std::size_t sample_size = desc.format == HeightFormat::Float32 ? 4 : 2;
+        std::size_t count = static_cast<std::size_t>(desc.width) * desc.depth;
+        std::vector<unsigned char> bytes(count * sample_size);
+        file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (static_cast<std::size_t>(file.gcount()) != bytes.size()) {
+            std::cerr << "Heightfield: " << path << " is shorter than a " << desc.width << " x " << desc.depth << " raster." << std::endl;
+            return nullptr;
+        }
+
+        std::vector<float> heights(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            const unsigned char* sample = &bytes[i * sample_size];
+            float value{};
+            switch (desc.format) {
+            case HeightFormat::Float32:
+                value = read_sample<float>(sample, desc.big_endian);
+                break;
+            case HeightFormat::Int16:
+                value = static_cast<float>(read_sample<int16_t>(sample, desc.big_endian));
+                break;
+            case HeightFormat::UInt16:
+                value = static_cast<float>(read_sample<uint16_t>(sample, desc.big_endian));
+                break;
+            }
+            heights[i] = desc.origin.y + desc.height_offset + desc.height_scale * value;
+        }
+        return std::make_shared<Heightfield>(desc, std::move(heights));
+    }
+
+    std::size_t Heightfield::get_triangle_count() const {
+        if (m_heights.empty()) {
+            return 0;
+        }
+        return 2 * static_cast<std::size_t>(m_desc.width - 1) * (m_desc.depth - 1);
+    }
+
+    void Heightfield::build_levels() {
+        // level sizes, halved up to a single block
+        m_levels.clear();
+        uint32_t width = m_desc.width - 1;
+        uint32_t depth = m_desc.depth - 1;
+        while (true) {
+            Level& level = m_levels.emplace_back();
+            level.width = width;
+            level.depth = depth;
+            if (width == 1 && depth == 1) { break; }
+            width = (width + 1) / 2;
+            depth = (depth + 1) / 2;
+        }
+        // blocks past the raster keep an empty range, no ray enters them
+        for (uint32_t l = 0; l < m_levels.size(); ++l) {
+            m_levels[l].quads.assign(static_cast<std::size_t>(parent_width(l)) * (l + 1 < m_levels.size() ? m_levels[l + 1].depth : 1), RangeQuad{});
+        }
+        auto set_range = [this](uint32_t l, uint32_t x, uint32_t z, float lo, float hi) {
+            RangeQuad& quad = m_levels[l].quads[static_cast<std::size_t>(z >> 1) * parent_width(l) + (x >> 1)];
+            uint32_t lane = ((z & 1u) << 1) | (x & 1u);
+            quad.lo[lane] = lo;
+            quad.hi[lane] = hi;
+        };
+
+        /* ---- Cells ---- */
+        for (uint32_t z = 0; z < m_levels[0].depth; ++z) {
+            for (uint32_t x = 0; x < m_levels[0].width; ++x) {
+                float h00 = get_height(x, z);
+                float h10 = get_height(x + 1, z);
+                float h01 = get_height(x, z + 1);
+                float h11 = get_height(x + 1, z + 1);
+                set_range(0, x, z, std::min({ h00, h10, h01, h11 }), std::max({ h00, h10, h01, h11 }));
+            }
+        }
+
+        /* ---- Blocks of 2 x 2 ---- */
+        for (uint32_t l = 1; l < m_levels.size(); ++l) {
+            for (uint32_t z = 0; z < m_levels[l].depth; ++z) {
+                for (uint32_t x = 0; x < m_levels[l].width; ++x) {
+                    const RangeQuad& children = m_levels[l - 1].quads[static_cast<std::size_t>(z) * m_levels[l].width + x];
+                    set_range(l, x, z, *std::min_element(children.lo, children.lo + 4), *std::max_element(children.hi, children.hi + 4));
+                }
+            }
+        }
+
+        const RangeQuad& top = m_levels.back().quads[0];
+        glm::vec3 far_corner{ m_desc.origin.x + (m_desc.width - 1) * m_desc.spacing.x, top.hi[0], m_desc.origin.z + (m_desc.depth - 1) * m_desc.spacing.y };
+        m_bounds = AABB{ glm::vec3{ m_desc.origin.x, top.lo[0], m_desc.origin.z }, far_corner };
+    }
+
+    void Heightfield::get_triangle(uint32_t prim_id, glm::vec3& a, glm::vec3& b, glm::vec3& c) const {
+        uint32_t cell = prim_id / 2;
+        uint32_t x = cell % (m_desc.width - 1);
+        uint32_t z = cell / (m_desc.width - 1);
+        float x0 = m_desc.origin.x + x * m_desc.spacing.x;
+        float z0 = m_desc.origin.z + z * m_desc.spacing.y;
+        float x1 = x0 + m_desc.spacing.x;
+        float z1 = z0 + m_desc.spacing.y;
+        // both triangles share the diagonal from (x, z) to (x + 1, z + 1)
+        a = glm::vec3{ x0, get_height(x, z), z0 };
+        if (prim_id % 2 == 0) {
+            b = glm::vec3{ x0, get_height(x, z + 1), z1 };
+            c = glm::vec3{ x1, get_height(x + 1, z + 1), z1 };
+        }
+        else {
+            b = glm::vec3{ x1, get_height(x + 1, z + 1), z1 };
+            c = glm::vec3{ x1, get_height(x + 1, z), z0 };
+        }
+    }
+
+    glm::vec3 Heightfield::get_normal(uint32_t prim_id) const {
+        glm::vec3 a{};
+        glm::vec3 b{};
+        glm::vec3 c{};
+        get_triangle(prim_id, a, b, c);
+        return glm::normalize(glm::cross(b - a, c - a));
+    }
+
+    std::size_t Heightfield::memory_usage() const {
+        std::size_t bytes = m_heights.capacity() * sizeof(float);
+        for (const auto& level : m_levels) {
+            bytes += level.quads.capacity() * sizeof(RangeQuad);
+        }
+        return bytes;
+    }
+
+    bool Heightfield::intersect_cell(uint32_t x, uint32_t z, const Ray& ray, float t_min, float t_max, float& t, uint32_t& prim_id) const {
+        // the corners of get_triangle, read once for both triangles
+        float x0 = m_desc.origin.x + x * m_desc.spacing.x;
+        float z0 = m_desc.origin.z + z * m_desc.spacing.y;
+        glm::vec3 p00{ x0, get_height(x, z), z0 };
+        glm::vec3 p11{ x0 + m_desc.spacing.x, get_height(x + 1, z + 1), z0 + m_desc.spacing.y };
+        glm::vec3 p01{ x0, get_height(x, z + 1), p11.z };
+        glm::vec3 p10{ p11.x, get_height(x + 1, z), z0 };
+        uint32_t first = 2 * (z * (m_desc.width - 1) + x);
+        bool hit_flag{ false };
+        float t_hit{};
+        if (hit_triangle(ray, p00, p01, p11, t_min, t_max, t_hit)) {
+            t_max = t_hit;
+            t = t_hit;
+            prim_id = first;
+            hit_flag = true;
+        }
+        if (hit_triangle(ray, p00, p11, p10, t_min, t_max, t_hit)) {
+            t = t_hit;
+            prim_id = first + 1;
+            hit_flag = true;
+        }
+        return hit_flag;
+    }
+
+    bool Heightfield::traverse(const Ray& ray, const Interval& interval, bool any_hit, float& t, uint32_t& prim_id) const {
+        if (m_levels.empty()) {
+            return false;
+        }
+        const glm::vec3& o = ray.get_origin();
+        const glm::vec3& rd = ray.get_rdirection();
+        const bool negative[3]{ rd.x < 0.0f, rd.y < 0.0f, rd.z < 0.0f };
+        // block faces are pushed out a little, so that a hit on a face is not lost to rounding
+        const glm::vec3 margin{ 1e-4f * m_desc.spacing.x, Constant::EPSILON, 1e-4f * m_desc.spacing.y };
+        const glm::vec3 near_pad{ negative[0] ? margin.x : -margin.x, negative[1] ? margin.y : -margin.y, negative[2] ? margin.z : -margin.z };
+        const glm::vec3 near_offset{ o - near_pad };
+        const glm::vec3 far_offset{ o + near_pad };
+
+        struct Entry {
+            uint32_t level;
+            uint32_t x;
+            uint32_t z;
+            float t_enter;
+        };
+        std::array<Entry, 4 * 32> stack; // at most 3 entries per level and the root, left uninitialized
+        int stack_size{ 0 };
+        float t_max = interval.max();
+        float t_hit{};
+        uint32_t prim_hit{};
+        bool hit_flag{ false };
+
+        /* ---- Root ---- */
+        {
+            const RangeQuad& top = m_levels.back().quads[0];
+            float lo[3]{ m_bounds.get_min().x, top.lo[0], m_bounds.get_min().z };
+            float hi[3]{ m_bounds.get_max().x, top.hi[0], m_bounds.get_max().z };
+            float t0 = interval.min();
+            float t1 = t_max;
+            for (int axis = 0; axis < 3; ++axis) {
+                float near_t = ((negative[axis] ? hi[axis] : lo[axis]) - near_offset[axis]) * rd[axis];
+                float far_t = ((negative[axis] ? lo[axis] : hi[axis]) - far_offset[axis]) * rd[axis];
+                t0 = near_t > t0 ? near_t : t0;
+                t1 = far_t < t1 ? far_t : t1;
+            }
+            if (t0 > t1) {
+                return false;
+            }
+            if (m_levels.size() == 1) {
+                // a single cell
+                if (!intersect_cell(0, 0, ray, interval.min(), t_max, t_hit, prim_hit)) {
+                    return false;
+                }
+                t = t_hit;
+                prim_id = prim_hit;
+                return true;
+            }
+            stack[stack_size++] = Entry{ static_cast<uint32_t>(m_levels.size() - 1), 0, 0, t0 };
+        }
+
+        while (stack_size > 0) {
+            Entry entry = stack[--stack_size];
+            if (entry.t_enter > t_max) {
+                continue;
+            }
+
+            // the two columns and two rows of children share their x and z faces
+            const uint32_t child_level = entry.level - 1;
+            const glm::vec2 child_size{ m_desc.spacing * static_cast<float>(1u << child_level) };
+            const float x0 = m_desc.origin.x + 2 * entry.x * child_size.x;
+            const float z0 = m_desc.origin.z + 2 * entry.z * child_size.y;
+            const float x_faces[3]{ x0, x0 + child_size.x, x0 + 2.0f * child_size.x };
+            const float z_faces[3]{ z0, z0 + child_size.y, z0 + 2.0f * child_size.y };
+            QuadSlabs slabs{};
+            for (uint32_t k = 0; k < 4; ++k) {
+                uint32_t i = k & 1u;
+                uint32_t j = k >> 1;
+                slabs.near_x[k] = x_faces[negative[0] ? i + 1 : i];
+                slabs.far_x[k] = x_faces[negative[0] ? i : i + 1];
+                slabs.near_z[k] = z_faces[negative[2] ? j + 1 : j];
+                slabs.far_z[k] = z_faces[negative[2] ? j : j + 1];
+            }
+            const RangeQuad& quad = m_levels[child_level].quads[static_cast<std::size_t>(entry.z) * m_levels[entry.level].width + entry.x];
+            float t_enter[4];
+            uint32_t mask = enter_quad(slabs, negative[1] ? quad.hi : quad.lo, negative[1] ? quad.lo : quad.hi, near_offset, far_offset,
+                rd, interval.min(), t_max, t_enter);
+
+            // children the ray enters, sorted near to far
+            Entry hits[4];
+            int hit_count{ 0 };
+            for (; mask; mask &= mask - 1) {
+                uint32_t k = static_cast<uint32_t>(std::countr_zero(mask));
+                int n = hit_count++;
+                for (; n > 0 && hits[n - 1].t_enter > t_enter[k]; --n) {
+                    hits[n] = hits[n - 1];
+                }
+                hits[n] = Entry{ child_level, 2 * entry.x + (k & 1u), 2 * entry.z + (k >> 1), t_enter[k] };
+            }
+
+            if (child_level > 0) {
+                // pushed far to near, so the nearest child is popped first
+                for (int n = hit_count - 1; n >= 0; --n) {
+                    stack[stack_size++] = hits[n];
+                }
+                continue;
+            }
+            for (int n = 0; n < hit_count && hits[n].t_enter <= t_max; ++n) {
+                if (intersect_cell(hits[n].x, hits[n].z, ray, interval.min(), t_max, t_hit, prim_hit)) {
+                    t_max = t_hit;
+                    t = t_hit;
+                    prim_id = prim_hit;
+                    hit_flag = true;
+                    if (any_hit) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return hit_flag;
+    }
+
+    bool Heightfield::intersect(const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id) const {
+        return traverse(ray, interval, false, t, prim_id);
+    }
+
+    bool Heightfield::occluded(const Ray& ray, const Interval& interval) const {
+        float t{};
+        uint32_t prim_id{};
+        return traverse(ray, interval, true, t, prim_id);
+    }
+}
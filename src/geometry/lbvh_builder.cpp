@@ -0,0 +1,381 @@
+#include "lbvh_builder.hpp"
+#include <bit>
+
+namespace SignalTracer {
+
+    namespace {
+        constexpr int MORTON_BITS{ 10 };   // per axis, 30-bit codes
+        constexpr int RADIX_BITS{ 10 };    // 3 passes over 30-bit codes
+
+        float box_area(const glm::vec3& bmin, const glm::vec3& bmax) {
+            glm::vec3 e = bmax - bmin;
+            return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+    }
+
+    LBVHBuilder::LBVHBuilder(const TriangleStore& store, const BVHBuildOptions& options, uint32_t leaf_size)
+        : m_store{ store }
+        , m_options{ options }
+        , m_leaf_size{ std::max(leaf_size, 1u) } {}
+
+    uint32_t LBVHBuilder::build(std::vector<BVHNode>& nodes, std::vector<uint>& prim_indices) {
+        const std::size_t prim_count = m_store.size();
+        if (nodes.size() < std::max<std::size_t>(2 * prim_count, 2)) {
+            nodes.resize(std::max<std::size_t>(2 * prim_count, 2));
+        }
+        prim_indices.resize(prim_count);
+        if (prim_count == 0) {
+            return 2;
+        }
+
+        // 1. Morton codes of the centroids, sorted
+        std::vector<uint32_t> codes(prim_count);
+        compute_morton_codes(codes, prim_indices);
+        radix_sort(codes, prim_indices);
+
+        // 2. split of every internal node, then the node array
+        std::vector<uint32_t> splits(prim_count - 1);
+        find_splits(codes, splits);
+        uint32_t nodes_used = emit(splits, nodes);
+        update_bounds(nodes, prim_indices, nodes_used);
+
+        // 3. optional SAH restructuring, a pass that pushes leaves below BVH_MAX_DEPTH is undone
+        std::vector<BVHNode> previous{};
+        for (uint pass = 0; pass < m_options.treelet_passes; ++pass) {
+            previous.assign(nodes.begin(), nodes.begin() + nodes_used);
+            optimize_treelets(nodes, nodes_used);
+            if (max_depth(nodes, nodes_used) > BVH_MAX_DEPTH) {
+                std::copy(previous.begin(), previous.end(), nodes.begin());
+                break;
+            }
+        }
+        return nodes_used;
+    }
+
+    void LBVHBuilder::compute_morton_codes(std::vector<uint32_t>& codes, std::vector<uint>& prim_indices) const {
+        const int prim_count = static_cast<int>(m_store.size());
+
+        std::vector<glm::vec3> centroids(prim_count);
+        glm::vec3 bmin{ Constant::INF_POS }, bmax{ Constant::INF_NEG };
+#pragma omp parallel
+        {
+            glm::vec3 local_min{ Constant::INF_POS }, local_max{ Constant::INF_NEG };
+#pragma omp for nowait
+            for (int i = 0; i < prim_count; ++i) {
+                centroids[i] = m_store.get_centroid(i);
+                local_min = glm::min(local_min, centroids[i]);
+                local_max = glm::max(local_max, centroids[i]);
+            }
+#pragma omp critical
+            {
+                bmin = glm::min(bmin, local_min);
+                bmax = glm::max(bmax, local_max);
+            }
+        }
+
+        glm::vec3 extent = bmax - bmin;
+        glm::vec3 inv_extent{
+            extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+            extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+            extent.z > 0.0f ? 1.0f / extent.z : 0.0f };
+#pragma omp parallel for
+        for (int i = 0; i < prim_count; ++i) {
+            codes[i] = Utils::morton_code((centroids[i] - bmin) * inv_extent);
+            prim_indices[i] = i;
+        }
+    }
+
+    void LBVHBuilder::radix_sort(std::vector<uint32_t>& codes, std::vector<uint>& prim_indices) const {
+        constexpr uint32_t BUCKETS{ 1u << RADIX_BITS };
+        const std::size_t count = codes.size();
+        std::vector<uint32_t> codes_tmp(count);
+        std::vector<uint> prim_indices_tmp(count);
+        std::vector<uint32_t> offsets(static_cast<std::size_t>(omp_get_max_threads()) * BUCKETS);
+
+        // stable LSD passes, each thread scatters its own contiguous chunk
+        for (int shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS) {
+            std::fill(offsets.begin(), offsets.end(), 0u);
+#pragma omp parallel
+            {
+                const std::size_t thread_id = omp_get_thread_num();
+                const std::size_t thread_count = omp_get_num_threads();
+                const std::size_t begin = count * thread_id / thread_count;
+                const std::size_t end = count * (thread_id + 1) / thread_count;
+                uint32_t* offset = &offsets[thread_id * BUCKETS];
+                for (std::size_t i = begin; i < end; ++i) {
+                    offset[(codes[i] >> shift) & (BUCKETS - 1)]++;
+                }
+#pragma omp barrier
+#pragma omp single
+                {
+                    uint32_t sum{ 0 };
+                    for (uint32_t b = 0; b < BUCKETS; ++b) {
+                        for (std::size_t t = 0; t < thread_count; ++t) {
+                            uint32_t n = offsets[t * BUCKETS + b];
+                            offsets[t * BUCKETS + b] = sum;
+                            sum += n;
+                        }
+                    }
+                }
+                for (std::size_t i = begin; i < end; ++i) {
+                    uint32_t dst = offset[(codes[i] >> shift) & (BUCKETS - 1)]++;
+                    codes_tmp[dst] = codes[i];
+                    prim_indices_tmp[dst] = prim_indices[i];
+                }
+            }
+            codes.swap(codes_tmp);
+            prim_indices.swap(prim_indices_tmp);
+        }
+    }
+
+    void LBVHBuilder::find_splits(const std::vector<uint32_t>& codes, std::vector<uint32_t>& splits) const {
+        const int last = static_cast<int>(codes.size()) - 1;
+
+        // length of the common prefix of two sorted keys, equal codes fall back to their positions
+        auto delta = [&](int i, int j) {
+            if (j < 0 || j > last) { return -1; }
+            if (codes[i] == codes[j]) { return 32 + std::countl_zero(static_cast<uint32_t>(i ^ j)); }
+            return std::countl_zero(codes[i] ^ codes[j]);
+        };
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < last; ++i) {
+            // direction of the range and its other end
+            int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+            int delta_min = delta(i, i - d);
+            int length_max = 2;
+            while (delta(i, i + length_max * d) > delta_min) { length_max *= 2; }
+            int length = 0;
+            for (int t = length_max / 2; t >= 1; t /= 2) {
+                if (delta(i, i + (length + t) * d) > delta_min) { length += t; }
+            }
+            int j = i + length * d;
+
+            // the split is where the prefix of the range ends
+            int delta_node = delta(i, j);
+            int s = 0;
+            int t = length;
+            do {
+                t = (t + 1) / 2;
+                if (delta(i, i + (s + t) * d) > delta_node) { s += t; }
+            } while (t > 1);
+            splits[i] = static_cast<uint32_t>(i + s * d + std::min(d, 0));
+        }
+    }
+
+    uint32_t LBVHBuilder::emit(const std::vector<uint32_t>& splits, std::vector<BVHNode>& nodes) const {
+        // internal node i covers [first, last] and splits after splits[i],
+        // its children are internal nodes splits[i] and splits[i] + 1 unless they are small enough for a leaf
+        struct Range {
+            uint32_t node_idx, internal, first, last, depth;
+        };
+        std::vector<Range> stack{};
+        stack.reserve(128);
+        stack.push_back(Range{ 0, 0, 0, static_cast<uint32_t>(m_store.size()) - 1, 0 });
+        uint32_t nodes_used{ 2 };
+        while (!stack.empty()) {
+            Range range = stack.back();
+            stack.pop_back();
+            BVHNode& node = nodes[range.node_idx];
+            if (range.last - range.first + 1 <= m_leaf_size || range.depth >= BVH_MAX_DEPTH) {
+                node.left_first = range.first;
+                node.tri_count = range.last - range.first + 1;
+                continue;
+            }
+            uint32_t split = splits[range.internal];
+            uint32_t left_child_idx = nodes_used;
+            nodes_used += 2;
+            node.left_first = left_child_idx;
+            node.tri_count = 0;
+            stack.push_back(Range{ left_child_idx + 1, split + 1, split + 1, range.last, range.depth + 1 });
+            stack.push_back(Range{ left_child_idx, split, range.first, split, range.depth + 1 });
+        }
+        return nodes_used;
+    }
+
+    void LBVHBuilder::update_bounds(std::vector<BVHNode>& nodes, const std::vector<uint>& prim_indices, uint32_t nodes_used) const {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < static_cast<int>(nodes_used); ++i) {
+            BVHNode& node = nodes[i];
+            if (i == 1 || node.tri_count == 0) { continue; }
+            node.aabb_min = glm::vec3{ Constant::INF_POS };
+            node.aabb_max = glm::vec3{ Constant::INF_NEG };
+            for (uint32_t k = node.left_first; k < node.left_first + node.tri_count; ++k) {
+                node.aabb_min = glm::min(node.aabb_min, m_store.get_min(prim_indices[k]));
+                node.aabb_max = glm::max(node.aabb_max, m_store.get_max(prim_indices[k]));
+            }
+        }
+        // children are always emitted after their parent
+        for (int i = static_cast<int>(nodes_used) - 1; i >= 0; --i) {
+            BVHNode& node = nodes[i];
+            if (i == 1 || node.tri_count > 0) { continue; }
+            node.aabb_min = glm::min(nodes[node.left_first].aabb_min, nodes[node.left_first + 1].aabb_min);
+            node.aabb_max = glm::max(nodes[node.left_first].aabb_max, nodes[node.left_first + 1].aabb_max);
+        }
+    }
+
+    uint32_t LBVHBuilder::max_depth(const std::vector<BVHNode>& nodes, uint32_t nodes_used) {
+        // children are always stored after their parent
+        std::vector<uint32_t> depths(nodes_used, 0);
+        uint32_t deepest{ 0 };
+        for (uint32_t i = 0; i < nodes_used; ++i) {
+            if (i == 1) { continue; }
+            deepest = std::max(deepest, depths[i]);
+            if (nodes[i].tri_count == 0) {
+                depths[nodes[i].left_first] = depths[nodes[i].left_first + 1] = depths[i] + 1;
+            }
+        }
+        return deepest;
+    }
+
+    void LBVHBuilder::optimize_treelets(std::vector<BVHNode>& nodes, uint32_t nodes_used) const {
+        // SAH cost of every subtree, same units as BVHAccel::calc_sah_cost
+        std::vector<float> costs(nodes_used, 0.0f);
+        std::vector<uint32_t> depths(nodes_used, 0);
+        uint32_t max_depth{ 0 };
+        for (int i = static_cast<int>(nodes_used) - 1; i >= 0; --i) {
+            const BVHNode& node = nodes[i];
+            if (i == 1) { continue; }
+            float area = box_area(node.aabb_min, node.aabb_max);
+            costs[i] = node.tri_count > 0 ? area * blocks(node.tri_count) : area + costs[node.left_first] + costs[node.left_first + 1];
+        }
+        for (uint32_t i = 0; i < nodes_used; ++i) {
+            const BVHNode& node = nodes[i];
+            if (i == 1 || node.tri_count > 0) { continue; }
+            depths[node.left_first] = depths[node.left_first + 1] = depths[i] + 1;
+            max_depth = std::max(max_depth, depths[i]);
+        }
+
+        // treelets rooted at the same depth do not overlap, so each level runs in parallel,
+        // deepest first so that every treelet sees optimized subtrees
+        std::vector<std::vector<uint32_t>> levels(max_depth + 1);
+        for (uint32_t i = 0; i < nodes_used; ++i) {
+            if (i != 1 && nodes[i].tri_count == 0) { levels[depths[i]].push_back(i); }
+        }
+        for (int depth = static_cast<int>(max_depth); depth >= 0; --depth) {
+            const std::vector<uint32_t>& level = levels[depth];
+#pragma omp parallel for schedule(dynamic, 64)
+            for (int k = 0; k < static_cast<int>(level.size()); ++k) {
+                restructure(nodes, costs, level[k]);
+            }
+        }
+
+        // restructuring shuffles child pairs, store the tree in depth-first order again
+        // so that children follow their parent (refit and the next pass rely on it)
+        std::vector<BVHNode> ordered(nodes_used);
+        std::vector<std::pair<uint32_t, uint32_t>> stack{ { 0, 0 } };
+        uint32_t next_idx{ 2 };
+        while (!stack.empty()) {
+            auto [old_idx, new_idx] = stack.back();
+            stack.pop_back();
+            const BVHNode& node = nodes[old_idx];
+            ordered[new_idx] = node;
+            if (node.tri_count > 0) { continue; }
+            ordered[new_idx].left_first = next_idx;
+            stack.emplace_back(node.left_first + 1, next_idx + 1);
+            stack.emplace_back(node.left_first, next_idx);
+            next_idx += 2;
+        }
+        std::copy(ordered.begin(), ordered.end(), nodes.begin());
+    }
+
+    bool LBVHBuilder::restructure(std::vector<BVHNode>& nodes, std::vector<float>& costs, uint32_t root) const {
+        // 1. grow the treelet by opening the largest internal leaf
+        uint32_t leaves[TREELET_SIZE];
+        uint32_t child_pairs[TREELET_SIZE - 1];
+        int leaf_count{ 0 };
+        int pair_count{ 0 };
+        child_pairs[pair_count++] = nodes[root].left_first;
+        leaves[leaf_count++] = nodes[root].left_first;
+        leaves[leaf_count++] = nodes[root].left_first + 1;
+        while (leaf_count < TREELET_SIZE) {
+            int best{ -1 };
+            float best_area{ -1.0f };
+            for (int k = 0; k < leaf_count; ++k) {
+                const BVHNode& node = nodes[leaves[k]];
+                float area = box_area(node.aabb_min, node.aabb_max);
+                if (node.tri_count == 0 && area > best_area) {
+                    best = k;
+                    best_area = area;
+                }
+            }
+            if (best < 0) { break; }
+            uint32_t left_child_idx = nodes[leaves[best]].left_first;
+            child_pairs[pair_count++] = left_child_idx;
+            leaves[best] = left_child_idx;
+            leaves[leaf_count++] = left_child_idx + 1;
+        }
+        if (leaf_count < 3) {
+            return false;
+        }
+
+        // 2. optimal topology over all subsets of the treelet leaves
+        constexpr int MAX_SUBSETS{ 1 << TREELET_SIZE };
+        const uint32_t full = (1u << leaf_count) - 1;
+        glm::vec3 subset_min[MAX_SUBSETS], subset_max[MAX_SUBSETS];
+        float subset_cost[MAX_SUBSETS];
+        uint32_t subset_split[MAX_SUBSETS];
+        for (int k = 0; k < leaf_count; ++k) {
+            subset_min[1u << k] = nodes[leaves[k]].aabb_min;
+            subset_max[1u << k] = nodes[leaves[k]].aabb_max;
+            subset_cost[1u << k] = costs[leaves[k]];
+        }
+        for (uint32_t s = 1; s <= full; ++s) {
+            if (std::popcount(s) < 2) { continue; }
+            uint32_t low_bit = s & (~s + 1);
+            subset_min[s] = glm::min(subset_min[low_bit], subset_min[s ^ low_bit]);
+            subset_max[s] = glm::max(subset_max[low_bit], subset_max[s ^ low_bit]);
+
+            // partitions are enumerated once, the side holding the lowest leaf comes first
+            float best_cost = Constant::INF_POS;
+            uint32_t best_split = low_bit;
+            for (uint32_t p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+                if (!(p & low_bit)) { continue; }
+                float cost = subset_cost[p] + subset_cost[s ^ p];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_split = p;
+                }
+            }
+            subset_cost[s] = box_area(subset_min[s], subset_max[s]) + best_cost;
+            subset_split[s] = best_split;
+        }
+        if (!(subset_cost[full] < costs[root] * (1.0f - 1e-5f))) {
+            return false;
+        }
+
+        // 3. rewrite the treelet, reusing its child pairs
+        BVHNode leaf_nodes[TREELET_SIZE];
+        float leaf_costs[TREELET_SIZE];
+        for (int k = 0; k < leaf_count; ++k) {
+            leaf_nodes[k] = nodes[leaves[k]];
+            leaf_costs[k] = costs[leaves[k]];
+        }
+        struct Item {
+            uint32_t node_idx, subset;
+        };
+        Item stack[2 * TREELET_SIZE];
+        int stack_size{ 0 };
+        int next_pair{ 0 };
+        stack[stack_size++] = Item{ root, full };
+        while (stack_size > 0) {
+            Item item = stack[--stack_size];
+            BVHNode& node = nodes[item.node_idx];
+            if (std::popcount(item.subset) == 1) {
+                int k = std::countr_zero(item.subset);
+                node = leaf_nodes[k];
+                costs[item.node_idx] = leaf_costs[k];
+                continue;
+            }
+            uint32_t left_child_idx = child_pairs[next_pair++];
+            node.left_first = left_child_idx;
+            node.tri_count = 0;
+            node.aabb_min = subset_min[item.subset];
+            node.aabb_max = subset_max[item.subset];
+            costs[item.node_idx] = subset_cost[item.subset];
+            stack[stack_size++] = Item{ left_child_idx + 1, item.subset ^ subset_split[item.subset] };
+            stack[stack_size++] = Item{ left_child_idx, subset_split[item.subset] };
+        }
+        return true;
+    }
+}
@@ -0,0 +1,116 @@
+#include "model_partition.hpp"
+
+namespace SignalTracer {
+
+    std::vector<std::vector<uint32_t>> partition_model(const Model& model, BLASPartition partition) {
+        const auto& meshes = model.get_meshes();
+        std::vector<std::vector<uint32_t>> groups{};
+        uint32_t first_face{ 0 };
+
+        switch (partition) {
+        case BLASPartition::Model:
+            for (const auto& mesh : meshes) {
+                first_face += static_cast<uint32_t>(mesh.get_indices().size() / 3);
+            }
+            groups.emplace_back(first_face);
+            for (uint32_t face = 0; face < first_face; ++face) {
+                groups[0][face] = face;
+            }
+            break;
+
+        case BLASPartition::Mesh:
+        case BLASPartition::Node: {
+            // meshes of a node are consecutive, depth-first order visits every node once
+            const auto& mesh_nodes = model.get_mesh_nodes();
+            bool by_node = partition == BLASPartition::Node && mesh_nodes.size() == meshes.size();
+            for (std::size_t i = 0; i < meshes.size(); ++i) {
+                if (i == 0 || !by_node || mesh_nodes[i] != mesh_nodes[i - 1]) {
+                    groups.emplace_back();
+                }
+                uint32_t face_count = static_cast<uint32_t>(meshes[i].get_indices().size() / 3);
+                for (uint32_t face = 0; face < face_count; ++face) {
+                    groups.back().emplace_back(first_face + face);
+                }
+                first_face += face_count;
+            }
+            break;
+        }
+
+        case BLASPartition::Component: {
+            std::vector<glm::vec3> positions{};
+            std::vector<uint32_t> labels{};
+            for (const auto& mesh : meshes) {
+                positions.clear();
+                for (const auto& vertex : mesh.get_vertices()) {
+                    positions.emplace_back(vertex.position);
+                }
+                std::size_t first_group = groups.size();
+                groups.resize(first_group + label_components(positions, mesh.get_indices(), labels));
+                for (uint32_t face = 0; face < labels.size(); ++face) {
+                    groups[first_group + labels[face]].emplace_back(first_face + face);
+                }
+                first_face += static_cast<uint32_t>(labels.size());
+            }
+            break;
+        }
+        }
+
+        std::erase_if(groups, [](const std::vector<uint32_t>& faces) { return faces.empty(); });
+        return groups;
+    }
+
+    uint32_t label_components(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, std::vector<uint32_t>& labels) {
+        // union-find over the vertices, with path halving
+        std::vector<uint32_t> parents(positions.size());
+        for (uint32_t i = 0; i < parents.size(); ++i) {
+            parents[i] = i;
+        }
+        auto find = [&](uint32_t v) {
+            while (parents[v] != v) {
+                parents[v] = parents[parents[v]];
+                v = parents[v];
+            }
+            return v;
+        };
+        auto unite = [&](uint32_t a, uint32_t b) {
+            a = find(a);
+            b = find(b);
+            if (a != b) { parents[std::max(a, b)] = std::min(a, b); }
+        };
+
+        // vertices at the same position, found as neighbours in sorted order
+        std::vector<uint32_t> order(positions.size());
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        auto less = [&](uint32_t a, uint32_t b) {
+            const glm::vec3& pa = positions[a];
+            const glm::vec3& pb = positions[b];
+            return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+        };
+        std::sort(order.begin(), order.end(), less);
+        for (std::size_t i = 1; i < order.size(); ++i) {
+            if (positions[order[i]] == positions[order[i - 1]]) {
+                unite(order[i], order[i - 1]);
+            }
+        }
+
+        const std::size_t face_count = indices.size() / 3;
+        for (std::size_t face = 0; face < face_count; ++face) {
+            unite(indices[3 * face], indices[3 * face + 1]);
+            unite(indices[3 * face], indices[3 * face + 2]);
+        }
+
+        std::vector<uint32_t> components(positions.size(), Constant::INVALID_IDX);
+        uint32_t component_count{ 0 };
+        labels.resize(face_count);
+        for (std::size_t face = 0; face < face_count; ++face) {
+            uint32_t root = find(indices[3 * face]);
+            if (components[root] == Constant::INVALID_IDX) {
+                components[root] = component_count++;
+            }
+            labels[face] = components[root];
+        }
+        return component_count;
+    }
+}
@@ -0,0 +1,409 @@
+#include "paged_bvh.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SignalTracer {
+
+    namespace {
+        constexpr char MAGIC[8]{ 'S', 'T', 'B', 'V', 'H', 'T', 'L', '\0' };
+        constexpr uint32_t VERSION{ 1 };
+        constexpr uint64_t FILE_PAGE{ 4096 };       // treelets start on a page of the file
+        constexpr std::size_t TREELET_BYTES{ 64 * 1024 };
+
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t width;
+            uint32_t treelet_count;
+            uint32_t node_size;     // sizeof of the node and block structs, a file is only read by the same build
+            uint32_t block_size;
+            uint32_t reserved;
+        };
+
+        uint64_t align_up(uint64_t value, uint64_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        /// @brief Hand the mapped pages of a byte range back to the kernel, they are read from the file again if needed.
+        void drop_pages(const unsigned char* begin, std::size_t length) {
+            static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+            uintptr_t first = reinterpret_cast<uintptr_t>(begin) / page * page;
+            uintptr_t last = align_up(reinterpret_cast<uintptr_t>(begin) + length, page);
+            madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+        }
+
+        /// @brief memcpy that skips empty ranges, the vector of a treelet without nodes or blocks has no data.
+        void copy_bytes(void* dst, const unsigned char* src, std::size_t length) {
+            if (length > 0) {
+                std::memcpy(dst, src, length);
+            }
+        }
+    }
+
+    /* ---- Writing ---- */
+
+    bool PagedBVH::write(const std::string& path, const WideBVH& wide, const TriangleBlocks& blocks, uint32_t treelet_nodes) {
+        if (wide.empty() || wide.get_width() != blocks.get_width()) {
+            std::cerr << "PagedBVH: nothing to write, the BLAS is empty or not collapsed." << std::endl;
+            return false;
+        }
+        std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+        if (!out) {
+            std::cerr << "PagedBVH: cannot open " << path << " for writing." << std::endl;
+            return false;
+        }
+        bool written = wide.get_width() == 8 ? write_treelets(out, wide.get_nodes8(), blocks.get_blocks8(), treelet_nodes)
+            : write_treelets(out, wide.get_nodes4(), blocks.get_blocks4(), treelet_nodes);
+        out.close();
+        if (!written || out.fail()) {
+            std::cerr << "PagedBVH: writing " << path << " failed." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    template <int W>
+    bool PagedBVH::write_treelets(std::ostream& out, const WideNodeArray<W>& nodes, const TransformBlockArray<W>& blocks, uint32_t treelet_nodes) {
+        if (treelet_nodes == 0) {
+            treelet_nodes = static_cast<uint32_t>(std::max<std::size_t>(TREELET_BYTES / sizeof(WideBVHNode<W>), 1));
+        }
+
+        // cut the tree into treelets, each filled breadth-first from its root
+        std::vector<uint32_t> treelet_of(nodes.size());
+        std::vector<uint32_t> local_of(nodes.size());
+        std::vector<std::vector<uint32_t>> members{};
+        std::vector<uint32_t> roots{ 0 };
+        while (!roots.empty()) {
+            uint32_t root = roots.back();
+            roots.pop_back();
+            uint32_t treelet_id = static_cast<uint32_t>(members.size());
+            std::vector<uint32_t>& member = members.emplace_back(1, root);
+            treelet_of[root] = treelet_id;
+            local_of[root] = 0;
+            for (std::size_t head = 0; head < member.size(); ++head) {
+                const WideBVHNode<W>& node = nodes[member[head]];
+                for (int lane = 0; lane < W; ++lane) {
+                    if (!(node.lane_mask >> lane & 1u) || node.count[lane] != 0) { continue; }
+                    uint32_t child = node.child[lane];
+                    if (member.size() < treelet_nodes) {
+                        treelet_of[child] = treelet_id;
+                        local_of[child] = static_cast<uint32_t>(member.size());
+                        member.push_back(child);
+                    }
+                    else {
+                        roots.push_back(child);
+                    }
+                }
+            }
+        }
+
+        // relink every treelet on its own: local node and block indices, links to the other treelets
+        std::vector<WideNodeArray<W>> treelet_nodes_out(members.size());
+        std::vector<TransformBlockArray<W>> treelet_blocks_out(members.size());
+        for (std::size_t id = 0; id < members.size(); ++id) {
+            WideNodeArray<W>& local_nodes = treelet_nodes_out[id];
+            TransformBlockArray<W>& local_blocks = treelet_blocks_out[id];
+            local_nodes.resize(members[id].size());
+            for (std::size_t k = 0; k < members[id].size(); ++k) {
+                WideBVHNode<W>& node = local_nodes[k];
+                node = nodes[members[id][k]];
+                for (int lane = 0; lane < W; ++lane) {
+                    if (!(node.lane_mask >> lane & 1u)) { continue; }
+                    uint32_t child = node.child[lane];
+                    if (node.count[lane] > 0) {
+                        node.child[lane] = static_cast<uint32_t>(local_blocks.size());
+                        local_blocks.insert(local_blocks.end(), blocks.begin() + child, blocks.begin() + child + node.count[lane]);
+                    }
+                    else if (treelet_of[child] == id) {
+                        node.child[lane] = local_of[child];
+                    }
+                    else {
+                        node.child[lane] = treelet_of[child];
+                        node.count[lane] = TREELET_LINK;
+                    }
+                }
+            }
+        }
+
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.width = W;
+        header.treelet_count = static_cast<uint32_t>(members.size());
+        header.node_size = sizeof(WideBVHNode<W>);
+        header.block_size = sizeof(TransformBlock<W>);
+
+        std::vector<TreeletEntry> table(members.size());
+        uint64_t offset = align_up(sizeof(FileHeader) + table.size() * sizeof(TreeletEntry), FILE_PAGE);
+        for (std::size_t id = 0; id < members.size(); ++id) {
+            table[id].offset = offset;
+            table[id].node_count = static_cast<uint32_t>(treelet_nodes_out[id].size());
+            table[id].block_count = static_cast<uint32_t>(treelet_blocks_out[id].size());
+            offset = align_up(offset + table[id].node_count * sizeof(WideBVHNode<W>) + table[id].block_count * sizeof(TransformBlock<W>), FILE_PAGE);
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(TreeletEntry)));
+        uint64_t position = sizeof(FileHeader) + table.size() * sizeof(TreeletEntry);
+        const std::vector<char> padding(FILE_PAGE, 0);
+        for (std::size_t id = 0; id < members.size(); ++id) {
+            out.write(padding.data(), static_cast<std::streamsize>(table[id].offset - position));
+            std::size_t node_bytes = treelet_nodes_out[id].size() * sizeof(WideBVHNode<W>);
+            std::size_t block_bytes = treelet_blocks_out[id].size() * sizeof(TransformBlock<W>);
+            out.write(reinterpret_cast<const char*>(treelet_nodes_out[id].data()), static_cast<std::streamsize>(node_bytes));
+            out.write(reinterpret_cast<const char*>(treelet_blocks_out[id].data()), static_cast<std::streamsize>(block_bytes));
+            position = table[id].offset + node_bytes + block_bytes;
+        }
+        return out.good();
+    }
+
+    /* ---- Mapping and residency ---- */
+
+    PagedBVH::PagedBVH(const std::string& path, std::size_t memory_budget)
+        : m_path{ path }
+        , m_memory_budget{ memory_budget } {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "PagedBVH: cannot open " << path << std::endl;
+            return;
+        }
+        struct stat file_stat {};
+        void* data = MAP_FAILED;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof(FileHeader))) {
+            data = mmap(nullptr, static_cast<std::size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cerr << "PagedBVH: cannot map " << path << std::endl;
+            return;
+        }
+        m_data = static_cast<const unsigned char*>(data);
+        m_size = static_cast<std::size_t>(file_stat.st_size);
+
+        FileHeader header{};
+        std::memcpy(&header, m_data, sizeof(header));
+        bool valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION && header.treelet_count > 0
+            && ((header.width == 4 && header.node_size == sizeof(WideBVHNode<4>) && header.block_size == sizeof(TransformBlock<4>))
+                || (header.width == 8 && header.node_size == sizeof(WideBVHNode<8>) && header.block_size == sizeof(TransformBlock<8>)))
+            && sizeof(FileHeader) + static_cast<uint64_t>(header.treelet_count) * sizeof(TreeletEntry) <= m_size;
+        if (valid) {
+            m_table.resize(header.treelet_count);
+            std::memcpy(m_table.data(), m_data + sizeof(FileHeader), m_table.size() * sizeof(TreeletEntry));
+            for (const TreeletEntry& entry : m_table) {
+                uint64_t end = entry.offset + static_cast<uint64_t>(entry.node_count) * header.node_size
+                    + static_cast<uint64_t>(entry.block_count) * header.block_size;
+                valid &= entry.offset % FILE_PAGE == 0 && entry.node_count > 0 && end <= m_size;
+            }
+        }
+        if (!valid) {
+            std::cerr << "PagedBVH: " << path << " is not a treelet file of this build." << std::endl;
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+            m_data = nullptr;
+            m_table.clear();
+            return;
+        }
+
+        m_width = static_cast<int>(header.width);
+        m_slots.resize(m_table.size());
+        m_stats.treelet_count = static_cast<uint32_t>(m_table.size());
+        m_top = load(0);
+    }
+
+    PagedBVH::~PagedBVH() {
+        if (m_data) {
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+        }
+    }
+
+    PagedBVHStats PagedBVH::get_stats() const {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_stats;
+    }
+
+    std::size_t PagedBVH::memory_usage() const {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_stats.resident_bytes + (m_top ? m_top->bytes : 0) + m_table.size() * (sizeof(TreeletEntry) + sizeof(Slot));
+    }
+
+    std::shared_ptr<const PagedBVH::Treelet> PagedBVH::load(uint32_t treelet_id) const {
+        const TreeletEntry& entry = m_table[treelet_id];
+        const unsigned char* src = m_data + entry.offset;
+        auto treelet = std::make_shared<Treelet>();
+        std::size_t node_bytes{ 0 };
+        std::size_t block_bytes{ 0 };
+        if (m_width == 8) {
+            treelet->nodes8.resize(entry.node_count);
+            treelet->blocks8.resize(entry.block_count);
+            node_bytes = entry.node_count * sizeof(WideBVHNode<8>);
+            block_bytes = entry.block_count * sizeof(TransformBlock<8>);
+            copy_bytes(treelet->nodes8.data(), src, node_bytes);
+            copy_bytes(treelet->blocks8.data(), src + node_bytes, block_bytes);
+        }
+        else {
+            treelet->nodes4.resize(entry.node_count);
+            treelet->blocks4.resize(entry.block_count);
+            node_bytes = entry.node_count * sizeof(WideBVHNode<4>);
+            block_bytes = entry.block_count * sizeof(TransformBlock<4>);
+            copy_bytes(treelet->nodes4.data(), src, node_bytes);
+            copy_bytes(treelet->blocks4.data(), src + node_bytes, block_bytes);
+        }
+        treelet->bytes = node_bytes + block_bytes;
+        // the copy is what stays resident, the mapped pages are not kept twice
+        drop_pages(src, node_bytes + block_bytes);
+        return treelet;
+    }
+
+    std::shared_ptr<const PagedBVH::Treelet> PagedBVH::acquire(uint32_t treelet_id) const {
+        if (treelet_id == 0) {
+            return m_top;
+        }
+        // misses load under the lock, threads needing the same treelet wait for one copy instead of making their own
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        Slot& slot = m_slots[treelet_id];
+        if (slot.treelet) {
+            m_stats.hits++;
+            m_lru.splice(m_lru.begin(), m_lru, slot.lru);
+            return slot.treelet;
+        }
+        m_stats.misses++;
+        slot.treelet = load(treelet_id);
+        m_lru.push_front(treelet_id);
+        slot.lru = m_lru.begin();
+        m_stats.resident_bytes += slot.treelet->bytes;
+        m_stats.resident_treelets++;
+        std::shared_ptr<const Treelet> treelet = slot.treelet;
+
+        // rays still inside an evicted treelet keep their reference until they leave it
+        while (m_stats.resident_bytes > m_memory_budget && m_lru.size() > 1) {
+            Slot& victim = m_slots[m_lru.back()];
+            m_lru.pop_back();
+            m_stats.resident_bytes -= victim.treelet->bytes;
+            m_stats.resident_treelets--;
+            m_stats.evictions++;
+            victim.treelet.reset();
+        }
+        return treelet;
+    }
+
+    /* ---- Traversal ---- */
+
+    template <int W>
+    bool PagedBVH::intersect_treelet(uint32_t treelet_id, const Ray& ray, Interval& interval, uint32_t& prim_id, glm::vec3& normal) const {
+        std::shared_ptr<const Treelet> treelet = acquire(treelet_id);
+        const WideNodeArray<W>* nodes{};
+        const TransformBlockArray<W>* blocks{};
+        if constexpr (W == 8) {
+            nodes = &treelet->nodes8;
+            blocks = &treelet->blocks8;
+        }
+        else {
+            nodes = &treelet->nodes4;
+            blocks = &treelet->blocks4;
+        }
+
+        auto leaf = [&](uint32_t first, uint32_t count, Interval& leaf_interval) {
+            if (count == TREELET_LINK) {
+                return intersect_treelet<W>(first, ray, leaf_interval, prim_id, normal);
+            }
+            bool hit = false;
+            for (uint32_t i = first; i < first + count; ++i) {
+                const TransformBlock<W>& block = (*blocks)[i];
+                float t{};
+                int lane = intersect_block<W>(block, ray.get_origin(), ray.get_direction(), leaf_interval.min(), leaf_interval.max(), t);
+                if (lane < 0) { continue; }
+                leaf_interval.max(t);
+                prim_id = block.prim_id[lane];
+                normal = block.get_normal(lane);
+                hit = true;
+            }
+            return hit;
+        };
+
+        if constexpr (W == 8) {
+#if defined(SIGNAL_TRACER_X86)
+            if (SIMD::has_avx2()) {
+                return traverse_wide_avx2(nodes->data(), ray, interval, leaf);
+            }
+#endif
+            ScalarSlab<8> slab{ ray.get_origin(), ray.get_rdirection() };
+            return traverse_wide<8>(nodes->data(), slab, interval, leaf);
+        }
+        else {
+#if defined(SIGNAL_TRACER_X86)
+            SSESlab slab{ ray.get_origin(), ray.get_rdirection() };
+#else
+            ScalarSlab<4> slab{ ray.get_origin(), ray.get_rdirection() };
+#endif
+            return traverse_wide<4>(nodes->data(), slab, interval, leaf);
+        }
+    }
+
+    template <int W>
+    bool PagedBVH::occluded_treelet(uint32_t treelet_id, const Ray& ray, const Interval& interval) const {
+        std::shared_ptr<const Treelet> treelet = acquire(treelet_id);
+        const WideNodeArray<W>* nodes{};
+        const TransformBlockArray<W>* blocks{};
+        if constexpr (W == 8) {
+            nodes = &treelet->nodes8;
+            blocks = &treelet->blocks8;
+        }
+        else {
+            nodes = &treelet->nodes4;
+            blocks = &treelet->blocks4;
+        }
+
+        auto leaf = [&](uint32_t first, uint32_t count, const Interval& leaf_interval) {
+            if (count == TREELET_LINK) {
+                return occluded_treelet<W>(first, ray, leaf_interval);
+            }
+            for (uint32_t i = first; i < first + count; ++i) {
+                float t{};
+                if (intersect_block<W>((*blocks)[i], ray.get_origin(), ray.get_direction(), leaf_interval.min(), leaf_interval.max(), t) >= 0) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        if constexpr (W == 8) {
+#if defined(SIGNAL_TRACER_X86)
+            if (SIMD::has_avx2()) {
+                return occluded_wide_avx2(nodes->data(), ray, interval, leaf);
+            }
+#endif
+            ScalarSlab<8> slab{ ray.get_origin(), ray.get_rdirection() };
+            return occluded_wide<8>(nodes->data(), slab, interval, leaf);
+        }
+        else {
+#if defined(SIGNAL_TRACER_X86)
+            SSESlab slab{ ray.get_origin(), ray.get_rdirection() };
+#else
+            ScalarSlab<4> slab{ ray.get_origin(), ray.get_rdirection() };
+#endif
+            return occluded_wide<4>(nodes->data(), slab, interval, leaf);
+        }
+    }
+
+    bool PagedBVH::intersect(const Ray& ray, const Interval& interval, float& t, uint32_t& prim_id, glm::vec3& normal) const {
+        if (!is_open()) { return false; }
+        Interval ray_interval{ interval };
+        bool hit = m_width == 8 ? intersect_treelet<8>(0, ray, ray_interval, prim_id, normal)
+            : intersect_treelet<4>(0, ray, ray_interval, prim_id, normal);
+        if (hit) {
+            t = ray_interval.max();
+        }
+        return hit;
+    }
+
+    bool PagedBVH::occluded(const Ray& ray, const Interval& interval) const {
+        if (!is_open()) { return false; }
+        return m_width == 8 ? occluded_treelet<8>(0, ray, interval) : occluded_treelet<4>(0, ray, interval);
+    }
+}
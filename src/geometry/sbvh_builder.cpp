@@ -0,0 +1,313 @@
+#include "sbvh_builder.hpp"
+
+namespace SignalTracer {
+
+    SBVHBuilder::SBVHBuilder(const TriangleStore& store, const BVHBuildOptions& options, uint32_t block_width)
+        : m_store{ store }
+        , m_options{ options }
+        , m_block_width{ std::max(block_width, 1u) } {}
+
+    uint32_t SBVHBuilder::build(std::vector<BVHNode>& nodes, std::vector<uint>& prim_indices) {
+        m_nodes = &nodes;
+        m_prim_indices = &prim_indices;
+
+        const std::size_t prim_count = m_store.size();
+        m_ref_count = prim_count;
+        m_max_refs = std::max(prim_count, static_cast<std::size_t>(prim_count * std::max(m_options.split_budget, 1.0f)));
+
+        std::vector<Reference> refs(prim_count);
+        Box root_box{};
+        for (std::size_t i = 0; i < prim_count; ++i) {
+            refs[i].box = Box{ m_store.get_min(i), m_store.get_max(i) };
+            refs[i].prim = static_cast<uint32_t>(i);
+            root_box.grow(refs[i].box);
+        }
+        m_min_overlap = root_box.area() * m_options.split_alpha;
+
+        // every leaf holds at least one reference, so 2 x references bounds the node count
+        nodes.assign(2 * m_max_refs + 2, BVHNode{});
+        prim_indices.clear();
+        prim_indices.reserve(m_max_refs);
+        m_nodes_used = 2;
+
+        if (prim_count > 0) {
+            subdivide(0, refs, 0);
+        }
+        return m_nodes_used;
+    }
+
+    void SBVHBuilder::subdivide(uint32_t node_idx, std::vector<Reference>& refs, uint32_t depth) {
+        Box bounds{};
+        for (const auto& ref : refs) {
+            bounds.grow(ref.box);
+        }
+        BVHNode& node = (*m_nodes)[node_idx];
+        node.aabb_min = bounds.min;
+        node.aabb_max = bounds.max;
+
+        const uint32_t count = static_cast<uint32_t>(refs.size());
+        if (count <= 2 || depth >= BVH_MAX_DEPTH) {
+            make_leaf(node_idx, refs);
+            return;
+        }
+
+        // 1. object split, then a spatial split if the object children overlap too much
+        Split split = find_object_split(refs);
+        bool is_spatial = false;
+        bool try_spatial = split.axis < 0 || split.left.intersect(split.right).area() > m_min_overlap;
+        if (try_spatial && m_ref_count < m_max_refs) {
+            Split spatial = find_spatial_split(refs, bounds);
+            std::size_t duplicates = spatial.left_count + spatial.right_count - count;
+            if (spatial.cost < split.cost && m_ref_count + duplicates <= m_max_refs) {
+                split = spatial;
+                is_spatial = true;
+            }
+        }
+
+        // an inner node costs one box test, the same unit as a triangle block (see BVHAccel::calc_sah_cost)
+        float leaf_cost = bounds.area() * blocks(count);
+        if (split.axis < 0 || leaf_cost <= bounds.area() + split.cost) {
+            make_leaf(node_idx, refs);
+            return;
+        }
+
+        // 2. partition the references
+        std::vector<Reference> left_refs{}, right_refs{};
+        if (is_spatial) { partition_spatial(refs, split, left_refs, right_refs); }
+        else { partition_object(refs, split, left_refs, right_refs); }
+        if (left_refs.empty() || right_refs.empty()) {
+            make_leaf(node_idx, refs);
+            return;
+        }
+        std::vector<Reference>().swap(refs);
+
+        // 3. children are allocated in pairs and recursively subdivided
+        uint32_t left_child_idx = m_nodes_used;
+        m_nodes_used += 2;
+        node.left_first = left_child_idx;
+        node.tri_count = 0;
+        subdivide(left_child_idx, left_refs, depth + 1);
+        subdivide(left_child_idx + 1, right_refs, depth + 1);
+    }
+
+    SBVHBuilder::Split SBVHBuilder::find_object_split(const std::vector<Reference>& refs) const {
+        const uint num_bins = std::clamp(m_options.num_bins, 2u, BVHAccel::MAX_BINS);
+        Split best{};
+
+        Box centroid_box{};
+        for (const auto& ref : refs) {
+            centroid_box.grow(ref.box.center());
+        }
+
+        for (int a = 0; a < 3; ++a) {
+            float extent = centroid_box.max[a] - centroid_box.min[a];
+            if (!(extent > 0.0f)) { continue; }
+
+            Box bins[BVHAccel::MAX_BINS]{};
+            uint32_t counts[BVHAccel::MAX_BINS]{};
+            float scale = static_cast<float>(num_bins) / extent;
+            for (const auto& ref : refs) {
+                uint bin_idx = std::min(num_bins - 1, static_cast<uint>((ref.box.center()[a] - centroid_box.min[a]) * scale));
+                bins[bin_idx].grow(ref.box);
+                counts[bin_idx]++;
+            }
+
+            Box right_boxes[BVHAccel::MAX_BINS - 1]{};
+            uint32_t right_counts[BVHAccel::MAX_BINS - 1]{};
+            Box right_box{};
+            uint32_t right_sum{ 0 };
+            for (uint i = num_bins - 1; i > 0; --i) {
+                right_box.grow(bins[i]);
+                right_sum += counts[i];
+                right_boxes[i - 1] = right_box;
+                right_counts[i - 1] = right_sum;
+            }
+
+            Box left_box{};
+            uint32_t left_sum{ 0 };
+            for (uint i = 0; i < num_bins - 1; ++i) {
+                left_box.grow(bins[i]);
+                left_sum += counts[i];
+                if (left_sum == 0 || right_counts[i] == 0) { continue; }
+                float cost = left_box.area() * blocks(left_sum) + right_boxes[i].area() * blocks(right_counts[i]);
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = a;
+                    best.pos = centroid_box.min[a] + extent / num_bins * (i + 1);
+                    best.left = left_box;
+                    best.right = right_boxes[i];
+                    best.left_count = left_sum;
+                    best.right_count = right_counts[i];
+                }
+            }
+        }
+        return best;
+    }
+
+    SBVHBuilder::Split SBVHBuilder::find_spatial_split(const std::vector<Reference>& refs, const Box& bounds) const {
+        const uint num_bins = std::clamp(m_options.num_bins, 2u, BVHAccel::MAX_BINS);
+        Split best{};
+
+        for (int a = 0; a < 3; ++a) {
+            float extent = bounds.max[a] - bounds.min[a];
+            if (!(extent > 0.0f)) { continue; }
+
+            // each reference is chopped into the bins it spans,
+            // it enters the bin of its minimum and exits the bin of its maximum
+            Box bins[BVHAccel::MAX_BINS]{};
+            uint32_t entries[BVHAccel::MAX_BINS]{};
+            uint32_t exits[BVHAccel::MAX_BINS]{};
+            float bin_size = extent / num_bins;
+            float inv_bin_size = 1.0f / bin_size;
+            for (const auto& ref : refs) {
+                int first = std::clamp(static_cast<int>((ref.box.min[a] - bounds.min[a]) * inv_bin_size), 0, static_cast<int>(num_bins) - 1);
+                int last = std::clamp(static_cast<int>((ref.box.max[a] - bounds.min[a]) * inv_bin_size), first, static_cast<int>(num_bins) - 1);
+                Reference cur = ref;
+                for (int b = first; b < last; ++b) {
+                    Reference left{}, right{};
+                    split_reference(cur, a, bounds.min[a] + bin_size * (b + 1), left, right);
+                    bins[b].grow(left.box);
+                    cur = right;
+                }
+                bins[last].grow(cur.box);
+                entries[first]++;
+                exits[last]++;
+            }
+
+            Box right_boxes[BVHAccel::MAX_BINS - 1]{};
+            uint32_t right_counts[BVHAccel::MAX_BINS - 1]{};
+            Box right_box{};
+            uint32_t right_sum{ 0 };
+            for (uint i = num_bins - 1; i > 0; --i) {
+                right_box.grow(bins[i]);
+                right_sum += exits[i];
+                right_boxes[i - 1] = right_box;
+                right_counts[i - 1] = right_sum;
+            }
+
+            Box left_box{};
+            uint32_t left_sum{ 0 };
+            for (uint i = 0; i < num_bins - 1; ++i) {
+                left_box.grow(bins[i]);
+                left_sum += entries[i];
+                if (left_sum == 0 || right_counts[i] == 0) { continue; }
+                float cost = left_box.area() * blocks(left_sum) + right_boxes[i].area() * blocks(right_counts[i]);
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = a;
+                    best.pos = bounds.min[a] + bin_size * (i + 1);
+                    best.left = left_box;
+                    best.right = right_boxes[i];
+                    best.left_count = left_sum;
+                    best.right_count = right_counts[i];
+                }
+            }
+        }
+        return best;
+    }
+
+    void SBVHBuilder::partition_object(const std::vector<Reference>& refs, const Split& split, std::vector<Reference>& left, std::vector<Reference>& right) const {
+        left.reserve(split.left_count);
+        right.reserve(split.right_count);
+        for (const auto& ref : refs) {
+            if (ref.box.center()[split.axis] < split.pos) { left.emplace_back(ref); }
+            else { right.emplace_back(ref); }
+        }
+    }
+
+    void SBVHBuilder::partition_spatial(const std::vector<Reference>& refs, const Split& split, std::vector<Reference>& left, std::vector<Reference>& right) {
+        const int a = split.axis;
+        left.reserve(split.left_count);
+        right.reserve(split.right_count);
+
+        // references entirely on one side first
+        Box left_box{}, right_box{};
+        std::vector<const Reference*> straddling{};
+        for (const auto& ref : refs) {
+            if (ref.box.max[a] <= split.pos) {
+                left.emplace_back(ref);
+                left_box.grow(ref.box);
+            }
+            else if (ref.box.min[a] >= split.pos) {
+                right.emplace_back(ref);
+                right_box.grow(ref.box);
+            }
+            else {
+                straddling.emplace_back(&ref);
+            }
+        }
+
+        // a straddling reference is split, unless moving it whole to one side is cheaper
+        for (const Reference* ref : straddling) {
+            Reference left_part{}, right_part{};
+            split_reference(*ref, a, split.pos, left_part, right_part);
+            float left_count = static_cast<float>(left.size());
+            float right_count = static_cast<float>(right.size());
+
+            Box left_whole = left_box, right_whole = right_box;
+            left_whole.grow(ref->box);
+            right_whole.grow(ref->box);
+            Box left_split = left_box, right_split = right_box;
+            left_split.grow(left_part.box);
+            right_split.grow(right_part.box);
+
+            float cost_split = left_split.area() * (left_count + 1) + right_split.area() * (right_count + 1);
+            float cost_left = left_whole.area() * (left_count + 1) + right_box.area() * right_count;
+            float cost_right = left_box.area() * left_count + right_whole.area() * (right_count + 1);
+
+            bool left_valid = left_part.box.valid();
+            bool right_valid = right_part.box.valid();
+            if (!right_valid || (left_valid && cost_left <= cost_split && cost_left <= cost_right)) {
+                left.emplace_back(*ref);
+                left_box = left_whole;
+            }
+            else if (!left_valid || (cost_right <= cost_split && cost_right < cost_left)) {
+                right.emplace_back(*ref);
+                right_box = right_whole;
+            }
+            else {
+                left.emplace_back(left_part);
+                right.emplace_back(right_part);
+                left_box = left_split;
+                right_box = right_split;
+                m_ref_count++;
+            }
+        }
+    }
+
+    void SBVHBuilder::split_reference(const Reference& ref, int axis, float pos, Reference& left, Reference& right) const {
+        left = Reference{ Box{}, ref.prim };
+        right = Reference{ Box{}, ref.prim };
+
+        // clip the triangle edges against the plane
+        const glm::vec3 verts[3] = { m_store.a(ref.prim), m_store.b(ref.prim), m_store.c(ref.prim) };
+        for (int i = 0; i < 3; ++i) {
+            const glm::vec3& v0 = verts[i];
+            const glm::vec3& v1 = verts[(i + 1) % 3];
+            float p0 = v0[axis];
+            float p1 = v1[axis];
+            if (p0 <= pos) { left.box.grow(v0); }
+            if (p0 >= pos) { right.box.grow(v0); }
+            if ((p0 < pos && pos < p1) || (p1 < pos && pos < p0)) {
+                glm::vec3 v = glm::mix(v0, v1, std::clamp((pos - p0) / (p1 - p0), 0.0f, 1.0f));
+                left.box.grow(v);
+                right.box.grow(v);
+            }
+        }
+        left.box.max[axis] = pos;
+        right.box.min[axis] = pos;
+
+        // the reference may already be clipped by an ancestor split
+        left.box = left.box.intersect(ref.box);
+        right.box = right.box.intersect(ref.box);
+    }
+
+    void SBVHBuilder::make_leaf(uint32_t node_idx, const std::vector<Reference>& refs) {
+        BVHNode& node = (*m_nodes)[node_idx];
+        node.left_first = static_cast<uint32_t>(m_prim_indices->size());
+        node.tri_count = static_cast<uint32_t>(refs.size());
+        for (const auto& ref : refs) {
+            m_prim_indices->emplace_back(ref.prim);
+        }
+    }
+}
@@ -32,6 +32,9 @@ namespace SignalTracer {
         m_b = rhs.m_b;
         m_c = rhs.m_c;
         m_box = rhs.m_box;
+        m_edge_ab = rhs.m_edge_ab;
+        m_edge_ac = rhs.m_edge_ac;
+        m_normal = rhs.m_normal;
         m_mat_ptr = rhs.m_mat_ptr;
         return *this;
     }
@@ -45,6 +48,9 @@ namespace SignalTracer {
         m_b = std::move(rhs.m_b);
         m_c = std::move(rhs.m_c);
         m_box = std::move(rhs.m_box);
+        m_edge_ab = std::move(rhs.m_edge_ab);
+        m_edge_ac = std::move(rhs.m_edge_ac);
+        m_normal = std::move(rhs.m_normal);
         m_mat_ptr = std::move(rhs.m_mat_ptr);
         return *this;
     }
@@ -89,10 +95,7 @@ namespace SignalTracer {
 
 
     glm::vec3 Triangle::get_normal() const {
-        glm::vec3 edge_ab = m_b - m_a;
-        glm::vec3 edge_ac = m_c - m_a;
-        glm::vec3 normal = glm::normalize(glm::cross(edge_ab, edge_ac));
-        return normal;
+        return m_normal;
     }
 
     glm::vec3 Triangle::get_centroid() const {
@@ -114,9 +117,9 @@ namespace SignalTracer {
     }
 
     bool Triangle::is_hit(const Ray& ray, const Interval& interval, IntersectRecord& record) const {
-        // Tomas Moller and Ben Trumbore Algorithm
-        glm::vec3 edge_ab = m_b - m_a;
-        glm::vec3 edge_ac = m_c - m_a;
+        // Tomas Moller and Ben Trumbore Algorithm on the edges cached by update()
+        const glm::vec3& edge_ab = m_edge_ab;
+        const glm::vec3& edge_ac = m_edge_ac;
         glm::vec3 pvec = glm::cross(ray.get_direction(), edge_ac);
         float det = glm::dot(edge_ab, pvec);
 #if defined(CULLING)
@@ -149,8 +152,7 @@ namespace SignalTracer {
         if (interval.contains(t)) {
             record.t = t;
             record.point = ray.point_at(t);
-            record.normal = get_normal();
-            record.tri_ptr = std::make_shared<Triangle>(*this);
+            record.normal = m_normal;
             return true;
         }
         return false;
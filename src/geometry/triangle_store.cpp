@@ -0,0 +1,68 @@
+#include "triangle_store.hpp"
+
+namespace SignalTracer {
+
+    void TriangleStore::reserve(std::size_t count) {
+        m_a.reserve(count);
+        m_edge_ab.reserve(count);
+        m_edge_ac.reserve(count);
+        m_normals.reserve(count);
+        m_mat_ids.reserve(count);
+    }
+
+    void TriangleStore::clear() {
+        m_a.clear();
+        m_edge_ab.clear();
+        m_edge_ac.clear();
+        m_normals.clear();
+        m_mat_ids.clear();
+    }
+
+    void TriangleStore::release_geometry() {
+        m_a = {};
+        m_edge_ab = {};
+        m_edge_ac = {};
+        m_normals = {};
+    }
+
+    uint32_t TriangleStore::add(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint16_t mat_id) {
+        uint32_t prim_id = static_cast<uint32_t>(m_mat_ids.size());
+        m_a.emplace_back();
+        m_edge_ab.emplace_back();
+        m_edge_ac.emplace_back();
+        m_normals.emplace_back();
+        m_mat_ids.emplace_back(mat_id);
+        set(prim_id, a, b, c);
+        return prim_id;
+    }
+
+    void TriangleStore::set(uint32_t prim_id, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        m_a[prim_id] = a;
+        m_edge_ab[prim_id] = b - a;
+        m_edge_ac[prim_id] = c - a;
+        glm::vec3 normal = glm::cross(m_edge_ab[prim_id], m_edge_ac[prim_id]);
+        float length = glm::length(normal);
+        m_normals[prim_id] = length > 0.0f ? normal / length : glm::vec3{ 0.0f };
+    }
+
+    glm::vec3 TriangleStore::get_centroid(uint32_t prim_id) const {
+        return m_a[prim_id] + (m_edge_ab[prim_id] + m_edge_ac[prim_id]) * 0.3333f;
+    }
+
+    glm::vec3 TriangleStore::get_min(uint32_t prim_id) const {
+        return glm::min(m_a[prim_id], glm::min(b(prim_id), c(prim_id)));
+    }
+
+    glm::vec3 TriangleStore::get_max(uint32_t prim_id) const {
+        return glm::max(m_a[prim_id], glm::max(b(prim_id), c(prim_id)));
+    }
+
+    AABB TriangleStore::bounding_box(uint32_t prim_id) const {
+        return AABB{ get_min(prim_id), get_max(prim_id) };
+    }
+
+    std::size_t TriangleStore::memory_usage() const {
+        return Utils::vector_sizeof(m_a) + Utils::vector_sizeof(m_edge_ab) + Utils::vector_sizeof(m_edge_ac)
+            + Utils::vector_sizeof(m_normals) + Utils::vector_sizeof(m_mat_ids);
+    }
+}
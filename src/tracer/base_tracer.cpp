@@ -1,35 +1,221 @@
 #include "base_tracer.hpp"
 
 namespace SignalTracer {
-    BaseTracer::BaseTracer(const std::vector<Model>& models) {
-        m_bvhs.reserve(models.size() * 16);
-        for (std::size_t i = 0; i < models.size(); ++i) {
-            std::shared_ptr<BVHAccel> bvh_ptr{ std::make_shared<BVHAccel>(models[i]) };
-
-            // Create intances
-            for (int j = 0; j < 1; ++j) {
-                glm::mat4 trans{ glm::mat4(1.0f) };
-                BVHInstance bvh_inst{ bvh_ptr, trans };
-                m_bvhs.emplace_back(bvh_inst);
-            }
+    BaseTracer::BaseTracer(const std::vector<Model>& models, const BVHBuildOptions& options) {
+        m_bvhs.reserve(models.size());
+        for (const auto& model : models) {
+            add_model(model, options);
         }
         m_tlas = TLAS{ m_bvhs, static_cast<uint>(m_bvhs.size()) };
         m_tlas.build();
+        init_scene_accel(options);
     }
 
-    BaseTracer::BaseTracer(const std::vector<std::reference_wrapper<Model>>& models) {
-        m_bvhs.reserve(models.size() * 16);
-        for (std::size_t i = 0; i < models.size(); ++i) {
-            std::shared_ptr<BVHAccel> bvh_ptr{ std::make_shared<BVHAccel>(models[i].get()) };
+    BaseTracer::BaseTracer(const std::vector<std::reference_wrapper<Model>>& models, const BVHBuildOptions& options) {
+        m_bvhs.reserve(models.size());
+        for (const auto& model : models) {
+            add_model(model.get(), options);
+        }
+        m_tlas = TLAS{ m_bvhs, static_cast<uint>(m_bvhs.size()) };
+        m_tlas.build();
+        init_scene_accel(options);
+    }
 
-            // Create intances, increase j to create more instances with transformation trans
-            for (int j = 0; j < 1; ++j) {
-                glm::mat4 trans{ glm::mat4(1.0f) };
-                BVHInstance bvh_inst{ bvh_ptr, trans };
-                m_bvhs.emplace_back(bvh_inst);
+    void BaseTracer::add_model(const Model& model, const BVHBuildOptions& model_options) {
+        // every BLAS is placed once as it was loaded, add_instance places more copies
+        // and all of them take their material ids from the palette of the tracer
+        if (model_options.palette && model_options.palette != m_palette) {
+            if (m_blases.empty()) {
+                m_palette = model_options.palette;
+            }
+            else {
+                std::cerr << "BaseTracer: the BLASes already use another palette, the new palette is ignored." << std::endl;
+            }
+        }
+        BVHBuildOptions options{ model_options };
+        options.palette = m_palette;
+        if (options.partition == BLASPartition::Model) {
+            std::shared_ptr<BVHAccel> bvh_ptr{ std::make_shared<BVHAccel>(model, static_cast<uint32_t>(m_blases.size()), options) };
+            m_blases.emplace_back(bvh_ptr);
+            m_bvhs.emplace_back(bvh_ptr);
+            if (bvh_ptr->is_built()) {
+                std::cout << "BLAS " << bvh_ptr->get_blas_id() << ": " << bvh_ptr->get_build_stats();
+            }
+            else {
+                std::cout << "BLAS " << bvh_ptr->get_blas_id() << ": lazy, " << bvh_ptr->get_triangle_count() << " triangles" << std::endl;
             }
+            return;
+        }
+
+        Utils::Timer timer{};
+        std::vector<std::vector<uint32_t>> objects{ partition_model(model, options.partition) };
+        std::size_t triangle_count{ 0 };
+        m_blases.reserve(m_blases.size() + objects.size());
+        m_bvhs.reserve(m_bvhs.size() + objects.size());
+        for (const auto& faces : objects) {
+            std::shared_ptr<BVHAccel> bvh_ptr{ std::make_shared<BVHAccel>(model, faces, static_cast<uint32_t>(m_blases.size()), options) };
+            triangle_count += bvh_ptr->get_triangle_count();
+            m_blases.emplace_back(bvh_ptr);
+            m_bvhs.emplace_back(bvh_ptr);
+        }
+        std::cout << "BLAS " << m_blases.size() - objects.size() << " - " << m_blases.size() << ": "
+            << objects.size() << " objects, " << triangle_count << " triangles, " << (options.lazy ? "bounds: " : "build: ")
+            << timer.elapsed() << " s" << std::endl;
+    }
+
+    void BaseTracer::copy_blases(const BaseTracer& other) {
+        m_blases.clear();
+        m_blases.reserve(other.m_blases.size());
+        for (const auto& blas : other.m_blases) {
+            m_blases.emplace_back(std::make_shared<BVHAccel>(*blas));
+        }
+        // instances of one BLAS share its copy, blas_id is the index in m_blases
+        m_bvhs.clear();
+        m_bvhs.reserve(other.m_bvhs.size());
+        for (const auto& bvh_inst : other.m_bvhs) {
+            m_bvhs.emplace_back(m_blases[bvh_inst.get_bvh()->get_blas_id()], bvh_inst.get_transform());
+        }
+        m_tlas = other.m_tlas;
+        m_tlas.set_instances(m_bvhs);
+    }
+
+    void BaseTracer::init_scene_accel(const BVHBuildOptions& options) {
+        m_grid_cell_size = options.grid_cell_size;
+        bool use_grid{ options.scene_accel == SceneAccel::FootprintGrid };
+        if (options.scene_accel == SceneAccel::Auto) {
+            use_grid = FootprintGrid::is_2_5d(m_bvhs);
+            std::cout << "Scene: " << (use_grid ? "2.5D, footprint grid" : "not 2.5D, TLAS") << std::endl;
+        }
+        if (use_grid) {
+            build_footprint_grid();
+        }
+    }
+
+    void BaseTracer::build_footprint_grid() {
+        // a new grid, copies of this tracer keep the one they share
+        std::shared_ptr<FootprintGrid> grid{ std::make_shared<FootprintGrid>() };
+        if (!grid->build(m_bvhs, m_grid_cell_size)) {
+            std::cerr << "Footprint grid could not be built, rays are traced through the TLAS." << std::endl;
+            m_grid.reset();
+            return;
+        }
+        std::cout << grid->get_stats();
+        m_grid = grid;
+    }
+
+    uint32_t BaseTracer::add_instance(uint32_t blas_id, const glm::mat4& transform) {
+        return add_instances(blas_id, std::vector<glm::mat4>{ transform });
+    }
+
+    uint32_t BaseTracer::add_instances(uint32_t blas_id, const std::vector<glm::mat4>& transforms) {
+        if (blas_id >= m_blases.size()) {
+            std::cerr << "BLAS " << blas_id << " does not exist." << std::endl;
+            return Constant::INVALID_IDX;
         }
+        uint32_t first = static_cast<uint32_t>(m_bvhs.size());
+        m_bvhs.reserve(m_bvhs.size() + transforms.size());
+        for (const auto& transform : transforms) {
+            m_bvhs.emplace_back(m_blases[blas_id], transform);
+        }
+
+        // the instances may have moved
         m_tlas = TLAS{ m_bvhs, static_cast<uint>(m_bvhs.size()) };
         m_tlas.build();
+        if (m_grid) {
+            build_footprint_grid();
+        }
+        return first;
+    }
+
+    uint32_t BaseTracer::add_terrain(const std::shared_ptr<const Heightfield>& heightfield, const glm::mat4& transform) {
+        if (!heightfield || heightfield->get_triangle_count() == 0) {
+            std::cerr << "Terrain has no samples." << std::endl;
+            return Constant::INVALID_IDX;
+        }
+        BVHBuildOptions options{};
+        options.palette = m_palette;
+        uint32_t blas_id = static_cast<uint32_t>(m_blases.size());
+        m_blases.emplace_back(std::make_shared<BVHAccel>(heightfield, blas_id, options));
+        std::cout << "BLAS " << blas_id << ": heightfield " << heightfield->get_width() << " x " << heightfield->get_depth()
+            << ", " << heightfield->get_level_count() << " mipmap levels, " << heightfield->memory_usage() / 1024.0 / 1024.0 << " MiB" << std::endl;
+        add_instance(blas_id, transform);
+        return blas_id;
+    }
+
+    uint32_t BaseTracer::add_triangles(const std::vector<std::shared_ptr<Triangle>>& triangles, const glm::mat4& transform) {
+        if (triangles.empty()) {
+            std::cerr << "No triangles to add." << std::endl;
+            return Constant::INVALID_IDX;
+        }
+        BVHBuildOptions options{};
+        options.palette = m_palette;
+        uint32_t blas_id = static_cast<uint32_t>(m_blases.size());
+        m_blases.emplace_back(std::make_shared<BVHAccel>(triangles, 0, triangles.size(), blas_id, options));
+        std::cout << "BLAS " << blas_id << ": " << triangles.size() << " triangles" << std::endl;
+        add_instance(blas_id, transform);
+        return blas_id;
+    }
+
+    AccelMemory BaseTracer::get_memory_usage() const {
+        AccelMemory memory{};
+        for (const auto& blas : m_blases) {
+            memory.blas_bytes += blas->memory_usage();
+            memory.stored_triangles += blas->get_triangle_count();
+        }
+        for (const auto& bvh_inst : m_bvhs) {
+            memory.instanced_triangles += bvh_inst.get_bvh()->get_triangle_count();
+        }
+        memory.instance_count = m_bvhs.size();
+        memory.instance_bytes = m_bvhs.capacity() * sizeof(BVHInstance);
+        memory.tlas_bytes = m_tlas.memory_usage();
+        memory.grid_bytes = m_grid ? m_grid->memory_usage() : 0;
+        return memory;
+    }
+
+    void BaseTracer::update_blas(uint32_t blas_id, const Model& model, BLASUpdate mode) {
+        if (blas_id >= m_blases.size()) {
+            std::cerr << "BLAS " << blas_id << " does not exist." << std::endl;
+            return;
+        }
+        BVHAccel& blas = *m_blases[blas_id];
+        std::size_t triangle_count = blas.get_triangle_count();
+        blas.set_geometry(model);
+
+        // a refit keeps the topology, so it needs the same triangles
+        if (blas.get_triangle_count() != triangle_count && (mode == BLASUpdate::Auto || mode == BLASUpdate::Refit)) {
+            mode = BLASUpdate::Linear;
+        }
+        // an unbuilt lazy BLAS only needs its new bounds, the first ray that reaches it builds it
+        if (!blas.is_built()) {
+            mode = BLASUpdate::Refit;
+        }
+        switch (mode) {
+        case BLASUpdate::Auto:
+            blas.refit();
+            if (blas.calc_sah_cost() > REFIT_SAH_LIMIT * blas.get_build_stats().sah_cost) {
+                blas.rebuild(BVHBuilder::Linear);
+            }
+            break;
+        case BLASUpdate::Refit:
+            blas.refit();
+            break;
+        case BLASUpdate::Linear:
+            blas.rebuild(BVHBuilder::Linear);
+            break;
+        case BLASUpdate::Full:
+            blas.build();
+            break;
+        }
+
+        // instance boxes are cached in world space
+        for (auto& bvh_inst : m_bvhs) {
+            if (bvh_inst.get_bvh() == m_blases[blas_id]) {
+                bvh_inst.set_transform(bvh_inst.get_transform());
+            }
+        }
+        m_tlas.build();
+        if (m_grid) {
+            build_footprint_grid();
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,48 @@
+#include "ray_sorter.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+namespace SignalTracer {
+
+    RaySorter::RaySorter(const AABB& scene_box)
+        : m_min{ scene_box.get_min() } {
+        glm::vec3 extent = scene_box.get_max() - scene_box.get_min();
+        m_inv_extent = 1.0f / glm::max(extent, glm::vec3{ Constant::EPSILON });
+    }
+
+    uint64_t RaySorter::calc_key(const Ray& ray) const {
+        uint64_t direction = Utils::octahedral_code(ray.get_direction(), DIRECTION_BITS);
+        uint64_t origin = Utils::morton_code((ray.get_origin() - m_min) * m_inv_extent);
+        return (direction << 30) | origin;
+    }
+
+    void RaySorter::sort(const std::vector<Ray>& rays, std::vector<int>& ray_ids) {
+        const int count = static_cast<int>(ray_ids.size());
+        m_keys.resize(count);
+        m_tmp_keys.resize(count);
+        m_tmp_ids.resize(count);
+
+#pragma omp parallel for
+        for (int i = 0; i < count; ++i) {
+            m_keys[i] = calc_key(rays[ray_ids[i]]);
+        }
+
+        constexpr int num_buckets = 1 << RADIX_BITS;
+        for (int shift = 0; shift < KEY_BITS; shift += RADIX_BITS) {
+            std::vector<int> offsets(num_buckets + 1, 0);
+            for (int i = 0; i < count; ++i) {
+                ++offsets[((m_keys[i] >> shift) & (num_buckets - 1)) + 1];
+            }
+            for (int b = 0; b < num_buckets; ++b) {
+                offsets[b + 1] += offsets[b];
+            }
+            for (int i = 0; i < count; ++i) {
+                int dst = offsets[(m_keys[i] >> shift) & (num_buckets - 1)]++;
+                m_tmp_keys[dst] = m_keys[i];
+                m_tmp_ids[dst] = ray_ids[i];
+            }
+            std::swap(m_keys, m_tmp_keys);
+            ray_ids.swap(m_tmp_ids);
+        }
+    }
+}
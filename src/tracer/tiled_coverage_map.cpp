@@ -0,0 +1,242 @@
+#include "tiled_coverage_map.hpp"
+#include "coverage_map.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace SignalTracer {
+
+    namespace {
+        /// @brief Hand the mapped pages of a tile back to the kernel, the file keeps the data.
+        void drop_pages(const float* begin, std::size_t length) {
+            madvise(const_cast<float*>(begin), length, MADV_DONTNEED);
+        }
+    }
+
+    TiledCoverageMap::TiledCoverageMap(const glm::vec3& origin, const glm::vec2& extent, float cell_size, std::size_t memory_budget, const std::string& backing_path)
+        : m_origin{ origin }
+        , m_cell_size{ cell_size }
+        , m_cells_x{ static_cast<uint32_t>(extent.x / cell_size) + 1 }
+        , m_cells_z{ static_cast<uint32_t>(extent.y / cell_size) + 1 }
+        , m_tiles_x{ (m_cells_x + TILE_SIZE - 1) / TILE_SIZE }
+        , m_tiles_z{ (m_cells_z + TILE_SIZE - 1) / TILE_SIZE }
+        , m_memory_budget{ memory_budget }
+        , m_path{ backing_path } {
+        m_slots.resize(static_cast<std::size_t>(m_tiles_x) * m_tiles_z);
+        m_stats.tile_count = static_cast<uint32_t>(m_slots.size());
+
+        // the file is sparse, only evicted tiles take disk space
+        int fd = ::open(backing_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            std::cerr << "TiledCoverageMap: cannot create " << backing_path << std::endl;
+            return;
+        }
+        std::size_t file_size = m_slots.size() * TILE_BYTES;
+        void* data = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(file_size)) == 0) {
+            data = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        // the mapping keeps the file alive, nothing is left behind when the map goes away
+        ::unlink(backing_path.c_str());
+        if (data == MAP_FAILED) {
+            std::cerr << "TiledCoverageMap: cannot map " << backing_path << std::endl;
+            return;
+        }
+        m_file = static_cast<float*>(data);
+        m_file_size = file_size;
+    }
+
+    TiledCoverageMap::~TiledCoverageMap() {
+        if (m_file) {
+            munmap(m_file, m_file_size);
+        }
+    }
+
+    TiledCoverageStats TiledCoverageMap::get_stats() const {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_stats;
+    }
+
+    bool TiledCoverageMap::locate(const glm::vec3& point, uint32_t& tile_id, uint32_t& cell) const {
+        // rows along z and columns along x, as in the CoverageMap of generate_par
+        int row{};
+        int col{};
+        if (!find_nearest_cell(point, m_origin, glm::vec3{ 0.0f, 0.0f, 1.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f }, m_cell_size,
+            static_cast<int>(m_cells_z), static_cast<int>(m_cells_x), row, col)) {
+            return false;
+        }
+        uint32_t x = static_cast<uint32_t>(col);
+        uint32_t z = static_cast<uint32_t>(row);
+        tile_id = (z / TILE_SIZE) * m_tiles_x + x / TILE_SIZE;
+        cell = (z % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+        return true;
+    }
+
+    /* ---- Residency ---- */
+
+    std::shared_ptr<float[]> TiledCoverageMap::acquire(uint32_t tile_id) {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        Slot& slot = m_slots[tile_id];
+        if (slot.strengths) {
+            m_stats.hits++;
+            m_lru.splice(m_lru.begin(), m_lru, slot.lru);
+        }
+        else {
+            slot.strengths = std::make_shared<float[]>(TILE_CELLS); // zeroed
+            if (slot.on_file) {
+                m_stats.loads++;
+                std::memcpy(slot.strengths.get(), file_tile(tile_id), TILE_BYTES);
+                drop_pages(file_tile(tile_id), TILE_BYTES);
+            }
+            else {
+                m_stats.allocations++;
+                m_stats.touched_tiles++;
+            }
+            m_lru.push_front(tile_id);
+            slot.lru = m_lru.begin();
+            m_stats.resident_bytes += TILE_BYTES;
+            m_stats.resident_tiles++;
+            m_stats.peak_bytes = std::max(m_stats.peak_bytes, m_stats.resident_bytes);
+        }
+        std::shared_ptr<float[]> strengths = slot.strengths;
+        evict();
+        return strengths;
+    }
+
+    void TiledCoverageMap::evict() {
+        // tiles pinned by a writer are passed over, they go on a later call once released
+        // without a backing file nothing can be evicted, the budget is exceeded instead
+        auto it = m_lru.end();
+        while (m_file && m_stats.resident_bytes > m_memory_budget && it != m_lru.begin()) {
+            --it;
+            Slot& victim = m_slots[*it];
+            if (victim.strengths.use_count() > 1) {
+                continue;
+            }
+            std::memcpy(file_tile(*it), victim.strengths.get(), TILE_BYTES);
+            drop_pages(file_tile(*it), TILE_BYTES);
+            victim.on_file = true;
+            victim.strengths.reset();
+            it = m_lru.erase(it);
+            m_stats.resident_bytes -= TILE_BYTES;
+            m_stats.resident_tiles--;
+            m_stats.evictions++;
+        }
+    }
+
+    /* ---- Adding ---- */
+
+    void TiledCoverageMap::Writer::add_strength(const glm::vec3& point, float strength) {
+        uint32_t tile_id{};
+        uint32_t cell{};
+        if (!m_map.locate(point, tile_id, cell)) {
+            return;
+        }
+        Entry& entry = m_cache[tile_id % CACHE_SIZE];
+        if (entry.tile_id != tile_id) {
+            entry.strengths = m_map.acquire(tile_id);
+            entry.tile_id = tile_id;
+        }
+        std::atomic_ref<float>{ entry.strengths[cell] }.fetch_add(strength, std::memory_order_relaxed);
+    }
+
+    void TiledCoverageMap::add_strength(const glm::vec3& point, float strength) {
+        uint32_t tile_id{};
+        uint32_t cell{};
+        if (!locate(point, tile_id, cell)) {
+            return;
+        }
+        std::shared_ptr<float[]> strengths = acquire(tile_id);
+        std::atomic_ref<float>{ strengths[cell] }.fetch_add(strength, std::memory_order_relaxed);
+    }
+
+    /* ---- Reading ---- */
+
+    float TiledCoverageMap::get_strength(const glm::vec3& point) const {
+        uint32_t tile_id{};
+        uint32_t cell{};
+        if (!locate(point, tile_id, cell)) {
+            return 0.0f;
+        }
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        const Slot& slot = m_slots[tile_id];
+        if (slot.strengths) {
+            return slot.strengths[cell];
+        }
+        return slot.on_file ? file_tile(tile_id)[cell] : 0.0f;
+    }
+
+    void TiledCoverageMap::for_each_tile(const std::function<void(const TileView&)>& visit) const {
+        // list the touched tiles and pin the resident ones, then visit without the lock
+        struct Touched {
+            uint32_t tile_id{ 0 };
+            std::shared_ptr<float[]> strengths{};   // empty if the tile is on file
+        };
+        std::vector<Touched> touched{};
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (uint32_t tile_id = 0; tile_id < m_slots.size(); ++tile_id) {
+                const Slot& slot = m_slots[tile_id];
+                if (slot.strengths || slot.on_file) {
+                    touched.push_back(Touched{ tile_id, slot.strengths });
+                }
+            }
+        }
+
+        for (Touched& tile : touched) {
+            TileView view{};
+            view.first_x = (tile.tile_id % m_tiles_x) * TILE_SIZE;
+            view.first_z = (tile.tile_id / m_tiles_x) * TILE_SIZE;
+            view.width = std::min(TILE_SIZE, m_cells_x - view.first_x);
+            view.depth = std::min(TILE_SIZE, m_cells_z - view.first_z);
+            view.strengths = tile.strengths ? tile.strengths.get() : file_tile(tile.tile_id);
+            visit(view);
+            if (tile.strengths) {
+                tile.strengths.reset();     // unpin, the tile may be evicted again
+            }
+            else {
+                drop_pages(file_tile(tile.tile_id), TILE_BYTES);
+            }
+        }
+    }
+
+    bool TiledCoverageMap::write_raw(const std::string& path, bool in_dB) const {
+        std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+        if (!out) {
+            std::cerr << "TiledCoverageMap: cannot open " << path << " for writing." << std::endl;
+            return false;
+        }
+        const float background{ in_dB ? -200.0f : 0.0f };
+
+        // untouched cells first, one row at a time, then every touched tile over them
+        std::vector<float> row(m_cells_x, background);
+        for (uint32_t z = 0; z < m_cells_z; ++z) {
+            out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+        }
+        for_each_tile([&](const TileView& view) {
+            for (uint32_t z = 0; z < view.depth; ++z) {
+                const float* strengths = view.strengths + static_cast<std::size_t>(z) * TILE_SIZE;
+                for (uint32_t x = 0; x < view.width; ++x) {
+                    float strength = strengths[x];
+                    row[x] = !in_dB ? strength : (strength == 0.0f ? -200.0f : 10.0f * std::log10(strength));
+                }
+                std::size_t offset = (static_cast<std::size_t>(view.first_z + z) * m_cells_x + view.first_x) * sizeof(float);
+                out.seekp(static_cast<std::streamoff>(offset));
+                out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(view.width * sizeof(float)));
+            }
+        });
+        out.close();
+        if (out.fail()) {
+            std::cerr << "TiledCoverageMap: writing " << path << " failed." << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,356 @@
+#pragma once
+
+#ifndef COVERAGE_MAP_TEST_HPP
+#define COVERAGE_MAP_TEST_HPP
+
+#include "coverage_layers.hpp"
+#include "coverage_map.hpp"
+#include "coverage_tracer.hpp"
+#include "coverage_volume.hpp"
+#include "sparse_coverage_map.hpp"
+#include "tiled_coverage_map.hpp"
+#include "transmitter.hpp"
+#include "triangle.hpp"
+#include "aabb.hpp"
+#include "constant.hpp"
+#include "ray.hpp"
+#include "quad.hpp"
+#include "glm/glm.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+/*
+    ----------------------------------------
+    Coverage Accumulator Tests
+    ----------------------------------------
+*/
+namespace {
+    // 11 x 11 cells of size 1, every cell gets one unit per thread iteration that lands on it
+    std::vector<float> accumulate_in_parallel(SignalTracer::CoverageAccumulation mode, std::size_t memory_budget, bool& is_private) {
+        SignalTracer::Quad quad{ glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 0.0f, 10.0f }, glm::vec3{ 10.0f, 0.0f, 0.0f } };
+        SignalTracer::CoverageMap cm{ quad, 1.0f };
+        SignalTracer::CoverageAccumulator accumulator{ cm, mode, memory_budget };
+        is_private = accumulator.is_private();
+        const int num_adds{ 200000 };
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < num_adds; ++i) {
+            // most adds go to the hot cell (0, 0), the rest spread over the map
+            glm::vec3 point{ i % 4 == 0 ? glm::vec3{ float(i % 11), 0.0f, float(i / 11 % 11) } : glm::vec3{ 0.0f } };
+            accumulator.add_strength(point, 1.0f);
+        }
+        accumulator.add_strength(glm::vec3{ 100.0f, 0.0f, 100.0f }, 1.0f);    // outside of the map, dropped
+        accumulator.reduce();
+
+        std::vector<float> strengths{};
+        for (const auto& cell : cm.get_cells()) {
+            strengths.push_back(cell.strength);
+        }
+        return strengths;
+    }
+}
+
+TEST(CoverageAccumulatorTest, PrivateAndAtomicMatchSequential) {
+    std::vector<float> expected(11 * 11, 0.0f);
+    for (int i = 0; i < 200000; ++i) {
+        int row{ i % 4 == 0 ? i / 11 % 11 : 0 };
+        int col{ i % 4 == 0 ? i % 11 : 0 };
+        expected[row * 11 + col] += 1.0f;
+    }
+
+    bool is_private{};
+    std::vector<float> private_strengths{ accumulate_in_parallel(SignalTracer::CoverageAccumulation::Private, 0, is_private) };
+    EXPECT_TRUE(is_private);
+    EXPECT_EQ(private_strengths, expected);
+
+    std::vector<float> atomic_strengths{ accumulate_in_parallel(SignalTracer::CoverageAccumulation::Atomic, 0, is_private) };
+    EXPECT_FALSE(is_private);
+    EXPECT_EQ(atomic_strengths, expected);
+
+    // the grids do not fit in one byte, Auto falls back to atomic adds
+    std::vector<float> auto_strengths{ accumulate_in_parallel(SignalTracer::CoverageAccumulation::Auto, 1, is_private) };
+    EXPECT_FALSE(is_private);
+    EXPECT_EQ(auto_strengths, expected);
+}
+
+/*
+    ----------------------------------------
+    Coverage Layers Tests
+    ----------------------------------------
+*/
+TEST(CoverageLayersTest, BestServerAndSinr) {
+    // 3 transmitters over 3 x 3 cells
+    SignalTracer::Quad quad{ glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 0.0f, 2.0f }, glm::vec3{ 2.0f, 0.0f, 0.0f } };
+    SignalTracer::CoverageLayers layers{ quad, 1.0f, 3 };
+    ASSERT_EQ(layers.get_num_cells(), 9u);
+    int cell{ layers.find_cell_index(glm::vec3{ 1.0f, 0.0f, 1.0f }) };
+    ASSERT_EQ(cell, 4);
+    EXPECT_EQ(layers.find_cell_index(glm::vec3{ 50.0f, 0.0f, 50.0f }), -1);
+
+    layers.get_layer(0)[cell] = 1.0f;
+    layers.get_layer(1)[cell] = 8.0f;
+    layers.get_layer(2)[cell] = 1.0f;
+    layers.add_strength_atomic(0, 0, 10.0f);
+    layers.derive(0.0f);
+
+    EXPECT_EQ(layers.get_best_server()[cell], 1);
+    EXPECT_NEAR(layers.get_best_rsrp()[cell], 10.0f * std::log10(8.0f), 1e-5f);
+    EXPECT_NEAR(layers.get_sinr()[cell], 10.0f * std::log10(4.0f), 1e-5f);
+
+    // a single server without noise, its SINR is unbounded
+    EXPECT_EQ(layers.get_best_server()[0], 0);
+    EXPECT_NEAR(layers.get_best_rsrp()[0], 10.0f, 1e-5f);
+    EXPECT_TRUE(std::isinf(layers.get_sinr()[0]));
+
+    // no transmitter reaches the other cells
+    EXPECT_EQ(layers.get_best_server()[8], -1);
+    EXPECT_EQ(layers.get_best_rsrp()[8], SignalTracer::CoverageLayers::NO_COVERAGE_DB);
+
+    std::vector<SignalTracer::Cell> cells{ layers.make_best_server_map().get_cells() };
+    EXPECT_EQ(cells[cell].strength, 8.0f);
+    EXPECT_EQ(cells[0].strength, 10.0f);
+}
+
+/*
+    ----------------------------------------
+    Coverage Volume Tests
+    ----------------------------------------
+*/
+TEST(CoverageVolumeTest, CrossingsInRayOrder) {
+    SignalTracer::AABB box{ glm::vec3{ 0.0f }, glm::vec3{ 20.0f, 30.0f, 20.0f } };
+    SignalTracer::CoverageVolume volume{ box, { 6.0f, 1.5f, 3.0f, 3.0f }, 1.0f };
+    ASSERT_EQ(volume.get_num_layers(), 3u);
+    EXPECT_EQ(volume.get_heights(), (std::vector<float>{ 1.5f, 3.0f, 6.0f }));
+
+    // down from y = 10, the layers come from the top
+    SignalTracer::Ray down{ glm::vec3{ 2.0f, 10.0f, 2.0f }, glm::vec3{ 1.0f, -1.0f, 1.0f } };
+    std::vector<std::size_t> layers{};
+    std::vector<glm::vec3> points{};
+    volume.for_each_crossing(down, 0.0f, Constant::INF_POS, [&](std::size_t layer, const glm::vec3& point) {
+        layers.push_back(layer);
+        points.push_back(point);
+    });
+    EXPECT_EQ(layers, (std::vector<std::size_t>{ 2, 1, 0 }));
+    ASSERT_EQ(points.size(), 3u);
+    EXPECT_NEAR(points[0].x, 6.0f, 1e-5f);
+    EXPECT_NEAR(points[0].y, 6.0f, 1e-5f);
+    EXPECT_NEAR(points[2].z, 10.5f, 1e-5f);
+
+    // a hit between 3 m and 1.5 m stops the segment, t is along the normalized direction
+    layers.clear();
+    volume.for_each_crossing(down, 0.0f, 13.0f, [&](std::size_t layer, const glm::vec3&) { layers.push_back(layer); });
+    EXPECT_EQ(layers, (std::vector<std::size_t>{ 2, 1 }));
+
+    // up from the pedestrian layer, the layer the ray starts on is not crossed
+    layers.clear();
+    SignalTracer::Ray up{ glm::vec3{ 5.0f, 1.5f, 5.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f } };
+    volume.for_each_crossing(up, Constant::EPSILON, Constant::INF_POS, [&](std::size_t layer, const glm::vec3&) { layers.push_back(layer); });
+    EXPECT_EQ(layers, (std::vector<std::size_t>{ 1, 2 }));
+
+    // level rays and crossings outside of the box deposit nothing
+    layers.clear();
+    SignalTracer::Ray level{ glm::vec3{ 5.0f, 2.0f, 5.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+    SignalTracer::Ray outside{ glm::vec3{ -50.0f, 10.0f, 5.0f }, glm::vec3{ 0.0f, -1.0f, 0.0f } };
+    volume.for_each_crossing(level, 0.0f, Constant::INF_POS, [&](std::size_t layer, const glm::vec3&) { layers.push_back(layer); });
+    volume.for_each_crossing(outside, 0.0f, Constant::INF_POS, [&](std::size_t layer, const glm::vec3&) { layers.push_back(layer); });
+    EXPECT_TRUE(layers.empty());
+}
+
+/*
+    ----------------------------------------
+    Tiled Coverage Map Tests
+    ----------------------------------------
+*/
+TEST(TiledCoverageMapTest, EvictAndStream) {
+    using SignalTracer::TiledCoverageMap;
+    std::string backing{ (std::filesystem::temp_directory_path() / "tiled_coverage_test.bin").string() };
+    // 3 x 2 tiles of 256 x 256 cells, the last column and row of tiles are partial, one tile kept on the heap
+    TiledCoverageMap map{ glm::vec3{ -100.0f, 3.0f, 50.0f }, glm::vec2{ 600.0f, 300.0f }, 1.0f, TiledCoverageMap::TILE_BYTES, backing };
+    ASSERT_TRUE(map.is_open());
+    EXPECT_EQ(map.get_cells_x(), 601u);
+    EXPECT_EQ(map.get_cells_z(), 301u);
+    EXPECT_FALSE(std::filesystem::exists(backing));
+
+    // cells in tiles (0, 0), (2, 0) and (1, 1), added from several threads, each through its writer
+    const glm::vec3 points[3]{ glm::vec3{ -99.7f, 3.0f, 50.2f }, glm::vec3{ 498.6f, 3.0f, 51.4f }, glm::vec3{ 200.3f, 3.0f, 348.8f } };
+#pragma omp parallel
+    {
+        TiledCoverageMap::Writer writer{ map };
+#pragma omp for
+        for (int i = 0; i < 3000; ++i) {
+            writer.add_strength(points[i % 3], 1.0f);
+            writer.add_strength(glm::vec3{ 1000.0f, 3.0f, 0.0f }, 1.0f);   // outside of the map, dropped
+        }
+    }
+    // evicted tiles come back from the file
+    for (int round = 0; round < 3; ++round) {
+        for (const auto& point : points) {
+            map.add_strength(point, 1.0f);
+        }
+    }
+    SignalTracer::TiledCoverageStats stats{ map.get_stats() };
+    EXPECT_EQ(stats.touched_tiles, 3u);
+    EXPECT_EQ(stats.tile_count, 6u);
+    EXPECT_GT(stats.evictions, 0u);
+    EXPECT_GT(stats.loads, 0u);
+    EXPECT_EQ(stats.resident_tiles, 1u);
+    for (const auto& point : points) {
+        EXPECT_EQ(map.get_strength(point), 1003.0f);
+    }
+    EXPECT_EQ(map.get_strength(glm::vec3{ 0.5f, 3.0f, 60.5f }), 0.0f);
+
+    int tiles{ 0 };
+    float total{ 0.0f };
+    map.for_each_tile([&](const TiledCoverageMap::TileView& view) {
+        ++tiles;
+        for (uint32_t z = 0; z < view.depth; ++z) {
+            for (uint32_t x = 0; x < view.width; ++x) {
+                total += view.strengths[z * TiledCoverageMap::TILE_SIZE + x];
+            }
+        }
+        if (view.first_x == 512) {
+            EXPECT_EQ(view.width, 89u);
+        }
+    });
+    EXPECT_EQ(tiles, 3);
+    EXPECT_EQ(total, 3009.0f);
+
+    std::string raster{ (std::filesystem::temp_directory_path() / "tiled_coverage_test.raw").string() };
+    ASSERT_TRUE(map.write_raw(raster, false));
+    EXPECT_EQ(std::filesystem::file_size(raster), 601u * 301u * sizeof(float));
+    std::ifstream in{ raster, std::ios::binary };
+    std::vector<float> cells(601 * 301);
+    in.read(reinterpret_cast<char*>(cells.data()), static_cast<std::streamsize>(cells.size() * sizeof(float)));
+    EXPECT_EQ(cells[1 * 601 + 599], 1003.0f);   // cell (599, 1)
+    EXPECT_EQ(cells[299 * 601 + 300], 1003.0f); // cell (300, 299)
+    EXPECT_EQ(cells[10], 0.0f);
+    std::filesystem::remove(raster);
+}
+
+TEST(TiledCoverageMapTest, MatchesDenseMap) {
+    using SignalTracer::TiledCoverageMap;
+    // the quad and the tiled map generate_par and generate_tiled make for a scene box, rows along z
+    const glm::vec3 box_min{ -37.3f, 0.0f, 12.9f };
+    const glm::vec3 box_max{ 481.6f, 40.0f, 355.2f };
+    const float cell_size{ 2.0f };
+    SignalTracer::Quad quad{ glm::vec3{ box_min.x, 3.0f, box_min.z }, glm::vec3{ 0.0f, 0.0f, box_max.z - box_min.z }, glm::vec3{ box_max.x - box_min.x, 0.0f, 0.0f } };
+    SignalTracer::CoverageMap dense{ quad, cell_size };
+    std::string backing{ (std::filesystem::temp_directory_path() / "tiled_coverage_match_test.bin").string() };
+    TiledCoverageMap tiled{ quad.get_corner_point(), glm::vec2{ box_max.x - box_min.x, box_max.z - box_min.z }, cell_size, TiledCoverageMap::TILE_BYTES, backing };
+    ASSERT_TRUE(tiled.is_open());
+    EXPECT_EQ(static_cast<int>(tiled.get_cells_x()), dense.get_num_col());
+    EXPECT_EQ(static_cast<int>(tiled.get_cells_z()), dense.get_num_row());
+
+    // points all over the quad and just outside of it, many near cell edges
+    std::vector<glm::vec3> points{};
+    for (long i = 0; i < 40000; ++i) {
+        float fx = float(i * 7919 % 10007) / 10007.0f * 1.02f - 0.01f;
+        float fz = float(i * 104729 % 10009) / 10009.0f * 1.02f - 0.01f;
+        points.emplace_back(box_min.x + fx * (box_max.x - box_min.x), 3.0f, box_min.z + fz * (box_max.z - box_min.z));
+        points.emplace_back(box_min.x + std::round(fx * 200.0f) * cell_size + cell_size * 0.5f, 3.0f, box_min.z + std::round(fz * 100.0f) * cell_size - cell_size * 0.5f);
+    }
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        float strength{ 1.0f + float(i % 13) };
+        dense.add_strength(points[i], strength);
+        tiled.add_strength(points[i], strength);
+    }
+
+    std::vector<SignalTracer::Cell> cells{ dense.get_cells() };
+    float dense_total{ 0.0f };
+    for (const auto& cell : cells) {
+        ASSERT_EQ(tiled.get_strength(cell.point), cell.strength);
+        dense_total += cell.strength;
+    }
+    float tiled_total{ 0.0f };
+    tiled.for_each_tile([&](const TiledCoverageMap::TileView& view) {
+        for (uint32_t z = 0; z < view.depth; ++z) {
+            for (uint32_t x = 0; x < view.width; ++x) {
+                float strength{ view.strengths[z * TiledCoverageMap::TILE_SIZE + x] };
+                tiled_total += strength;
+                // the visitor may read the map, the tile list is not locked
+                EXPECT_EQ(tiled.get_strength(cells[(view.first_z + z) * dense.get_num_col() + view.first_x + x].point), strength);
+            }
+        }
+    });
+    EXPECT_GT(dense_total, 0.0f);
+    EXPECT_EQ(tiled_total, dense_total);
+}
+
+/*
+    ----------------------------------------
+    Coverage Tracer Tests
+    ----------------------------------------
+*/
+TEST(CoverageTracerTest, BounceSyncRejectsSparseBackend) {
+    // a wall and a ground plane, 20 x 20 m
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(glm::vec3{ -10.0f, 0.0f, -10.0f }, glm::vec3{ 10.0f, 0.0f, 10.0f }, glm::vec3{ 10.0f, 0.0f, -10.0f }));
+    triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(glm::vec3{ -10.0f, 0.0f, -10.0f }, glm::vec3{ -10.0f, 0.0f, 10.0f }, glm::vec3{ 10.0f, 0.0f, 10.0f }));
+    triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(glm::vec3{ 5.0f, 0.0f, -10.0f }, glm::vec3{ 5.0f, 10.0f, -10.0f }, glm::vec3{ 5.0f, 10.0f, 10.0f }));
+    SignalTracer::CoverageTracer tracer{ 2, 2000 };
+    ASSERT_NE(tracer.add_triangles(triangles), Constant::INVALID_IDX);
+    const std::vector<SignalTracer::Transmitter> transmitters{ SignalTracer::Transmitter{ 0, glm::vec3{ 0.0f, 5.0f, 0.0f }, 2.4e9f, 20.0f } };
+
+    tracer.set_bounce_sync(true);
+    EXPECT_GT(tracer.generate(transmitters, 1.0f).get_num_cells(), 0u);
+    tracer.set_backend(SignalTracer::CoverageBackend::Sparse);
+    // the same configuration is rejected whatever the number of transmitters
+    EXPECT_EQ(tracer.generate(transmitters, 1.0f).get_num_cells(), 0u);
+    std::vector<SignalTracer::Transmitter> two_sites{ transmitters[0], SignalTracer::Transmitter{ 1, glm::vec3{ -5.0f, 5.0f, 5.0f }, 2.4e9f, 20.0f } };
+    EXPECT_EQ(tracer.generate(two_sites, 1.0f).get_num_cells(), 0u);
+    tracer.set_bounce_sync(false);
+    EXPECT_GT(tracer.generate(transmitters, 1.0f).get_num_cells(), 0u);
+}
+
+/*
+    ----------------------------------------
+    Sparse Coverage Map Tests
+    ----------------------------------------
+*/
+TEST(SparseCoverageMapTest, MatchesDenseMap) {
+    // 101 x 201 cells, rays reach a street along x and a few scattered cells
+    SignalTracer::Quad quad{ glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 0.0f, 100.0f }, glm::vec3{ 200.0f, 0.0f, 0.0f } };
+    SignalTracer::CoverageMap dense{ quad, 1.0f };
+    SignalTracer::SparseCoverageMap sparse{ quad, 1.0f };
+    EXPECT_EQ(sparse.get_num_row(), dense.get_num_row());
+    EXPECT_EQ(sparse.get_num_col(), dense.get_num_col());
+
+    std::vector<glm::vec3> points{};
+    for (int i = 0; i < 5000; ++i) {
+        points.emplace_back(float(i % 200) + 0.3f, 0.0f, 50.0f + float(i % 3));
+    }
+    points.emplace_back(7.0f, 0.0f, 93.6f);
+    points.emplace_back(199.9f, 0.0f, 0.1f);
+
+    SignalTracer::SparseCoverageAccumulator accumulator{ sparse };
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < static_cast<int>(points.size()); ++i) {
+        accumulator.add_strength(points[i], 0.5f);
+    }
+    accumulator.add_strength(glm::vec3{ -10.0f, 0.0f, 50.0f }, 1.0f);  // outside of the map, dropped
+    accumulator.reduce();
+    for (const auto& point : points) {
+        dense.add_strength(point, 0.5f);
+    }
+
+    EXPECT_EQ(sparse.get_num_occupied(), 602u);
+    EXPECT_EQ(sparse.get_strength(glm::vec3{ 10.0f, 0.0f, 51.0f }), dense.get_strength(glm::vec3{ 10.0f, 0.0f, 51.0f }));
+    EXPECT_EQ(sparse.get_strength(glm::vec3{ 10.0f, 0.0f, 20.0f }), 0.0f);
+    std::vector<SignalTracer::Cell> expected{ dense.get_cells() };
+    std::vector<SignalTracer::Cell> exported{ sparse.to_dense().get_cells() };
+    ASSERT_EQ(exported.size(), expected.size());
+    for (std::size_t c = 0; c < expected.size(); ++c) {
+        ASSERT_EQ(exported[c].strength, expected[c].strength) << "cell " << c;
+        ASSERT_EQ(exported[c].point, expected[c].point) << "cell " << c;
+    }
+
+    sparse.set_strength(glm::vec3{ 7.0f, 0.0f, 93.6f }, 100.0f);
+    sparse.convert_to_dB();
+    EXPECT_NEAR(sparse.get_strength(glm::vec3{ 7.0f, 0.0f, 93.6f }), 20.0f, 1e-5f);
+    EXPECT_EQ(sparse.get_strength(glm::vec3{ 10.0f, 0.0f, 20.0f }), -200.0f);
+}
+
+#endif // !COVERAGE_MAP_TEST_HPP
@@ -1,4 +1,5 @@
 #include "aabb_test.hpp"
+#include "coverage_map_test.hpp"
 #include "intersect_hittablelist_test.hpp"
 #include "intersection_test.hpp"
 #include "interval_test.hpp"
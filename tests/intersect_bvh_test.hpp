@@ -4,13 +4,21 @@
 #define INTERSECT_BVH_TEST_HPP
 
 #include "intersect_test_class.hpp"
+#include "model_partition.hpp"
+#include "footprint_grid.hpp"
+#include "heightfield.hpp"
 #include "intersect_record.hpp"
 #include "hittable_list.hpp"
 #include "ray.hpp"
 #include "glm/glm.hpp"
 #include <gtest/gtest.h>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <string>
 #include <vector>
 
 /*
@@ -64,6 +72,646 @@ TEST_F(IntersectionTest, RayBVHHittableList3) {
     EXPECT_EQ(record.point, hittablelist_record.point);
 }
 
+TEST_F(IntersectionTest, RayBVHPrimitive) {
+    bool hit1 = bvh->is_hit(ray1, interval, record);
+    EXPECT_TRUE(hit1);
+    EXPECT_TRUE(record.has_primitive());
+    EXPECT_EQ(record.blas_id, bvh->get_blas_id());
+    EXPECT_LT(record.prim_id, bvh->get_triangle_count());
+    EXPECT_EQ(bvh->get_material(record.prim_id), triangle1->get_mat_ptr());
+}
+
+TEST_F(IntersectionTest, RayBVHMaterialPalette) {
+    // equal materials share one id of the palette, .mtl names map to the ITU materials
+    using SignalTracer::MaterialPalette;
+    auto palette = std::make_shared<MaterialPalette>();
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{
+        std::make_shared<SignalTracer::Triangle>(p1, p2, p3),
+        std::make_shared<SignalTracer::Triangle>(p4, p2, p3, std::make_shared<SignalTracer::Brick>()),
+        std::make_shared<SignalTracer::Triangle>(p4, p1, p3, std::make_shared<SignalTracer::Brick>()),
+        std::make_shared<SignalTracer::Triangle>(p4, p1, p2, p_material),
+    };
+    EXPECT_EQ(triangles[0]->get_mat_ptr(), MaterialPalette::default_material());
+    SignalTracer::BVHBuildOptions options{};
+    options.palette = palette;
+    SignalTracer::BVHAccel material_bvh{ triangles, 0, triangles.size(), 0, options };
+    EXPECT_EQ(material_bvh.get_mat_id(0), MaterialPalette::CONCRETE);
+    EXPECT_EQ(material_bvh.get_mat_id(1), MaterialPalette::BRICK);
+    EXPECT_EQ(material_bvh.get_mat_id(2), MaterialPalette::BRICK);
+    EXPECT_EQ(material_bvh.get_material(3), p_material);
+    EXPECT_EQ(palette->size(), 14u);
+
+    EXPECT_EQ(palette->find_name("itu_very_dry_ground"), MaterialPalette::VERY_DRY_GROUND);
+    EXPECT_EQ(palette->find_name("Brick_Wall"), MaterialPalette::BRICK);
+    EXPECT_EQ(palette->find_name("window_pane"), MaterialPalette::GLASS);
+    EXPECT_EQ(palette->find_name("Air"), MaterialPalette::AIR);
+    EXPECT_EQ(palette->find_name("roof_tiles"), MaterialPalette::DEFAULT_ID);
+    palette->map_name("roof", MaterialPalette::METAL);
+    EXPECT_EQ(palette->find_name("roof_tiles"), MaterialPalette::METAL);
+
+    std::vector<float> permittivities{ palette->get_permittivities(5e9f) };
+    EXPECT_FLOAT_EQ(permittivities[MaterialPalette::BRICK], 3.75f);
+}
+
+TEST_F(IntersectionTest, RayBVHNoPrimitive) {
+    bool hit3 = bvh->is_hit(ray3, interval, record);
+    EXPECT_FALSE(hit3);
+    EXPECT_FALSE(record.has_primitive());
+}
+
+TEST_F(IntersectionTest, RayBVHSpatialSplit) {
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{ {triangle1, triangle2} };
+    SignalTracer::BVHBuildOptions options{};
+    options.builder = SignalTracer::BVHBuilder::SpatialSplit;
+    SignalTracer::BVHAccel sbvh{ triangles, 0, triangles.size(), 0, options };
+    EXPECT_GE(sbvh.get_build_stats().reference_count, triangles.size());
+
+    bool hit_bvh_1 = bvh->is_hit(ray1, interval, record);
+    SignalTracer::IntersectRecord sbvh_record{};
+    bool hit_sbvh_1 = sbvh.is_hit(ray1, interval, sbvh_record);
+    EXPECT_EQ(hit_bvh_1, hit_sbvh_1);
+    EXPECT_EQ(record.prim_id, sbvh_record.prim_id);
+    EXPECT_FALSE(sbvh.is_hit(ray3, interval, sbvh_record));
+}
+
+TEST_F(IntersectionTest, RayBVHLinearRebuild) {
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{ {triangle1, triangle2} };
+    SignalTracer::BVHAccel lbvh{ triangles, 0, triangles.size() };
+    lbvh.rebuild(SignalTracer::BVHBuilder::Linear);
+    EXPECT_EQ(lbvh.get_build_options().builder, SignalTracer::BVHBuilder::ParallelBinned);
+
+    bool hit_bvh_1 = bvh->is_hit(ray1, interval, record);
+    SignalTracer::IntersectRecord lbvh_record{};
+    bool hit_lbvh_1 = lbvh.is_hit(ray1, interval, lbvh_record);
+    EXPECT_EQ(hit_bvh_1, hit_lbvh_1);
+    EXPECT_EQ(record.prim_id, lbvh_record.prim_id);
+
+    // move the triangles out of the ray path and refit
+    for (auto& triangle : triangles) {
+        triangle = std::make_shared<SignalTracer::Triangle>(triangle->a() + 5.0f, triangle->b() + 5.0f, triangle->c() + 5.0f);
+    }
+    lbvh.set_geometry(triangles);
+    lbvh.refit();
+    SignalTracer::IntersectRecord refit_record{};
+    EXPECT_FALSE(lbvh.is_hit(ray1, interval, refit_record));
+}
+
+TEST_F(IntersectionTest, RayBVHLazyBuild) {
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{ {triangle1, triangle2} };
+    SignalTracer::BVHBuildOptions options{};
+    options.lazy = true;
+    auto lazy_bvh = std::make_shared<SignalTracer::BVHAccel>(triangles, 0, triangles.size(), 0, options);
+    EXPECT_FALSE(lazy_bvh->is_built());
+    EXPECT_EQ(lazy_bvh->bounding_box().get_min(), bvh->bounding_box().get_min());
+    EXPECT_EQ(lazy_bvh->bounding_box().get_max(), bvh->bounding_box().get_max());
+
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ lazy_bvh } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+
+    // ray3 misses the bounds, so the BLAS is not built
+    SignalTracer::IntersectRecord lazy_record{};
+    EXPECT_FALSE(tlas.is_hit(ray3, interval, lazy_record));
+    EXPECT_FALSE(lazy_bvh->is_built());
+
+    EXPECT_TRUE(tlas.is_hit(ray1, interval, lazy_record));
+    EXPECT_TRUE(lazy_bvh->is_built());
+    EXPECT_TRUE(bvh->is_hit(ray1, interval, record));
+    EXPECT_EQ(record.prim_id, lazy_record.prim_id);
+    EXPECT_FLOAT_EQ(record.t, lazy_record.t);
+}
+
+TEST_F(IntersectionTest, RayBVHLazyBuildInParallel) {
+    // the first rays of a parallel trace build a lazy task-parallel BLAS on one thread, without a nested team
+    std::mt19937 rng{ 5 };
+    std::uniform_real_distribution<float> position{ -50.0f, 50.0f };
+    std::uniform_real_distribution<float> offset{ -0.5f, 0.5f };
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    for (int i = 0; i < 4000; ++i) {
+        glm::vec3 a{ position(rng), position(rng), position(rng) };
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(a, a + glm::vec3{ offset(rng), offset(rng), offset(rng) }, a + glm::vec3{ offset(rng), offset(rng), offset(rng) }));
+    }
+    SignalTracer::BVHBuildOptions options{};
+    options.builder = SignalTracer::BVHBuilder::ParallelBinned;
+    SignalTracer::BVHAccel eager{ triangles, 0, triangles.size(), 0, options };
+    options.lazy = true;
+    SignalTracer::BVHAccel lazy{ triangles, 0, triangles.size(), 0, options };
+    EXPECT_FALSE(lazy.is_built());
+
+    std::vector<SignalTracer::Ray> rays{};
+    for (int i = 0; i < 256; ++i) {
+        rays.emplace_back(glm::vec3{ 0.0f }, glm::vec3{ position(rng), position(rng), position(rng) });
+    }
+    std::vector<float> lazy_t(rays.size(), -1.0f);
+    const int max_threads = omp_get_max_threads();
+#pragma omp parallel for
+    for (int i = 0; i < static_cast<int>(rays.size()); ++i) {
+        SignalTracer::IntersectRecord lazy_record{};
+        if (lazy.is_hit(rays[i], interval, lazy_record)) { lazy_t[i] = lazy_record.t; }
+    }
+    EXPECT_TRUE(lazy.is_built());
+    EXPECT_FLOAT_EQ(lazy.get_build_stats().sah_cost, eager.get_build_stats().sah_cost);
+    EXPECT_EQ(omp_get_max_threads(), max_threads);
+    for (std::size_t i = 0; i < rays.size(); ++i) {
+        SignalTracer::IntersectRecord eager_record{};
+        bool hit = eager.is_hit(rays[i], interval, eager_record);
+        EXPECT_EQ(hit, lazy_t[i] >= 0.0f);
+        if (hit) { EXPECT_FLOAT_EQ(eager_record.t, lazy_t[i]); }
+    }
+}
+
+TEST_F(IntersectionTest, RayBVHCompressed) {
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{ {triangle1, triangle2} };
+    SignalTracer::BVHBuildOptions options{};
+    options.compressed = true;
+    SignalTracer::BVHAccel compressed_bvh{ triangles, 0, triangles.size(), 0, options };
+    EXPECT_TRUE(compressed_bvh.is_compressed());
+    EXPECT_FALSE(compressed_bvh.get_store().has_geometry());
+    EXPECT_EQ(compressed_bvh.get_triangle_count(), triangles.size());
+    EXPECT_LT(compressed_bvh.memory_usage(), bvh->memory_usage());
+
+    // vertices move by up to half a grid step, so the ray aims inside triangle1 instead of at a vertex like ray1
+    SignalTracer::Ray ray{ glm::vec3{0.25f, 0.25f, 2.0f}, glm::vec3{0.0f, 0.0f, -1.0f} };
+    SignalTracer::IntersectRecord compressed_record{};
+    EXPECT_TRUE(bvh->is_hit(ray, interval, record));
+    EXPECT_TRUE(compressed_bvh.is_hit(ray, interval, compressed_record));
+    EXPECT_EQ(record.prim_id, compressed_record.prim_id);
+    EXPECT_NEAR(record.t, compressed_record.t, 1e-4f);
+    EXPECT_NEAR(glm::dot(record.normal, compressed_record.normal), 1.0f, 1e-4f);
+    EXPECT_FALSE(compressed_bvh.is_hit(ray3, interval, compressed_record));
+    EXPECT_TRUE(compressed_bvh.is_occluded(ray, interval));
+    EXPECT_FALSE(compressed_bvh.is_occluded(ray, SignalTracer::Interval{ 0.0f, 1.5f }));
+}
+
+TEST_F(IntersectionTest, RayBVHNodeLayouts) {
+    // enough triangles for several wide nodes, the layouts must not change any hit
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    for (int i = 0; i < 256; ++i) {
+        glm::vec3 offset{ static_cast<float>(i % 16), static_cast<float>(i / 16), 0.0f };
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(p1 + offset, p2 + offset, p3 + offset));
+    }
+    std::vector<SignalTracer::Ray> rays{};
+    for (int i = 0; i < 64; ++i) {
+        rays.emplace_back(glm::vec3{ 0.3f + 0.25f * i, 0.2f + 0.2f * i, 2.0f }, glm::vec3{ 0.0f, 0.0f, -1.0f });
+    }
+
+    SignalTracer::BVHBuildOptions options{};
+    options.layout = SignalTracer::NodeLayout::DepthFirst;
+    SignalTracer::BVHAccel reference{ triangles, 0, triangles.size(), 0, options };
+    for (auto layout : { SignalTracer::NodeLayout::Siblings, SignalTracer::NodeLayout::Treelet }) {
+        options.layout = layout;
+        SignalTracer::BVHAccel reordered{ triangles, 0, triangles.size(), 0, options };
+        EXPECT_EQ(reordered.get_wide().get_node_count(), reference.get_wide().get_node_count());
+        for (const auto& ray : rays) {
+            SignalTracer::IntersectRecord reference_record{};
+            SignalTracer::IntersectRecord reordered_record{};
+            bool reference_hit = reference.is_hit(ray, interval, reference_record);
+            EXPECT_EQ(reordered.is_hit(ray, interval, reordered_record), reference_hit);
+            EXPECT_EQ(reordered.is_occluded(ray, interval), reference_hit);
+            if (reference_hit) { EXPECT_EQ(reordered_record.prim_id, reference_record.prim_id); }
+        }
+    }
+}
+
+TEST_F(IntersectionTest, RayBVHPagedOut) {
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    for (int i = 0; i < 256; ++i) {
+        glm::vec3 offset{ static_cast<float>(i % 16), static_cast<float>(i / 16), 0.0f };
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(p1 + offset, p2 + offset, p3 + offset));
+    }
+    SignalTracer::BVHAccel reference{ triangles, 0, triangles.size() };
+    SignalTracer::BVHAccel paged{ triangles, 0, triangles.size() };
+    ASSERT_GT(paged.get_wide().get_node_count(), 1u);
+
+    // one node per treelet and no budget, every treelet change pages
+    std::string path = (std::filesystem::temp_directory_path() / "signal_tracer_paged_test.bvh").string();
+    ASSERT_TRUE(paged.page_out(path, 0, 1));
+    EXPECT_TRUE(paged.is_paged());
+    EXPECT_FALSE(paged.get_store().has_geometry());
+    EXPECT_EQ(paged.bounding_box().get_min(), reference.bounding_box().get_min());
+
+    for (int i = 0; i < 64; ++i) {
+        SignalTracer::Ray ray{ glm::vec3{ 0.3f + 0.25f * i, 0.2f + 0.2f * i, 2.0f }, glm::vec3{ 0.0f, 0.0f, -1.0f } };
+        SignalTracer::IntersectRecord reference_record{};
+        SignalTracer::IntersectRecord paged_record{};
+        bool reference_hit = reference.is_hit(ray, interval, reference_record);
+        EXPECT_EQ(paged.is_hit(ray, interval, paged_record), reference_hit);
+        EXPECT_EQ(paged.is_occluded(ray, interval), reference_hit);
+        if (reference_hit) {
+            EXPECT_EQ(paged_record.prim_id, reference_record.prim_id);
+            EXPECT_FLOAT_EQ(paged_record.t, reference_record.t);
+        }
+    }
+    SignalTracer::PagedBVHStats stats = paged.get_paged()->get_stats();
+    EXPECT_GT(stats.treelet_count, 1u);
+    EXPECT_GT(stats.misses, 0u);
+    EXPECT_LE(stats.resident_treelets, 1u);
+    std::filesystem::remove(path);
+}
+
+TEST_F(IntersectionTest, RayBVHPagedTreeletWithoutBlocks) {
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    for (int i = 0; i < 256; ++i) {
+        glm::vec3 offset{ static_cast<float>(i % 16), static_cast<float>(i / 16), 0.0f };
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(p1 + offset, p2 + offset, p3 + offset));
+    }
+    SignalTracer::BVHAccel reference{ triangles, 0, triangles.size() };
+    SignalTracer::BVHAccel paged{ triangles, 0, triangles.size() };
+
+    // with one node per treelet, the top treelet is the root, whose lanes all lead to inner nodes, so it has no blocks
+    const SignalTracer::WideBVH& wide = reference.get_wide();
+    uint32_t root_leaf_lanes{ 0 };
+    for (int lane = 0; lane < wide.get_width(); ++lane) {
+        root_leaf_lanes += wide.get_width() == 8 ? wide.get_nodes8()[0].count[lane] : wide.get_nodes4()[0].count[lane];
+    }
+    ASSERT_EQ(root_leaf_lanes, 0u);
+
+    std::string path = (std::filesystem::temp_directory_path() / "signal_tracer_paged_empty_test.bvh").string();
+    ASSERT_TRUE(paged.page_out(path, 0, 1));
+    // map the file again, the treelet without blocks is loaded once more
+    SignalTracer::PagedBVH reopened{ path, 0 };
+    ASSERT_TRUE(reopened.is_open());
+    for (int i = 0; i < 64; ++i) {
+        SignalTracer::Ray ray{ glm::vec3{ 0.3f + 0.25f * i, 0.2f + 0.2f * i, 2.0f }, glm::vec3{ 0.0f, 0.0f, -1.0f } };
+        SignalTracer::IntersectRecord reference_record{};
+        bool reference_hit = reference.is_hit(ray, interval, reference_record);
+        float t{};
+        uint32_t prim_id{};
+        glm::vec3 normal{};
+        EXPECT_EQ(reopened.intersect(ray, interval, t, prim_id, normal), reference_hit);
+        EXPECT_EQ(reopened.occluded(ray, interval), reference_hit);
+        if (reference_hit) {
+            EXPECT_EQ(prim_id, reference_record.prim_id);
+            EXPECT_FLOAT_EQ(t, reference_record.t);
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_F(IntersectionTest, RayBVHOccluded) {
+    EXPECT_TRUE(bvh->is_occluded(ray1, interval));
+    EXPECT_FALSE(bvh->is_occluded(ray3, interval));
+    // ray1 hits the triangles at t = 2, a shorter segment is not blocked
+    EXPECT_FALSE(bvh->is_occluded(ray1, SignalTracer::Interval{ 0.0f, 1.5f }));
+    EXPECT_EQ(bvh->is_occluded(ray2, interval), model1.is_occluded(ray2, interval));
+}
+
+TEST_F(IntersectionTest, TLASSegmentOccluded) {
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ bvh } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+    EXPECT_TRUE(tlas.is_occluded(ray1, interval));
+    EXPECT_TRUE(tlas.is_segment_occluded(glm::vec3{ 0.1f, 0.1f, 2.0f }, glm::vec3{ 0.1f, 0.1f, -2.0f }));
+    EXPECT_FALSE(tlas.is_segment_occluded(glm::vec3{ 0.1f, 0.1f, 2.0f }, glm::vec3{ 0.1f, 0.1f, 1.0f }));
+}
+
+TEST_F(IntersectionTest, TLASEmptyInstance) {
+    // an empty BLAS has inverted bounds, the TLAS leaves it out instead of binning a NaN centroid
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> no_triangles{};
+    auto empty_bvh = std::make_shared<SignalTracer::BVHAccel>(no_triangles, 0, no_triangles.size());
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ empty_bvh }, SignalTracer::BVHInstance{ bvh },
+        SignalTracer::BVHInstance{ empty_bvh } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+    SignalTracer::IntersectRecord tlas_record{};
+    SignalTracer::IntersectRecord bvh_record{};
+    EXPECT_TRUE(tlas.is_hit(ray1, interval, tlas_record));
+    EXPECT_TRUE(bvh->is_hit(ray1, interval, bvh_record));
+    EXPECT_EQ(tlas_record.prim_id, bvh_record.prim_id);
+    EXPECT_FLOAT_EQ(tlas_record.t, bvh_record.t);
+    EXPECT_FALSE(tlas.is_hit(ray3, interval, tlas_record));
+
+    // only empty instances leave an empty tree
+    std::vector<SignalTracer::BVHInstance> empty_instances{ SignalTracer::BVHInstance{ empty_bvh } };
+    SignalTracer::TLAS empty_tlas{ empty_instances, static_cast<uint>(empty_instances.size()) };
+    empty_tlas.build();
+    EXPECT_FALSE(empty_tlas.is_hit(ray1, interval, tlas_record));
+    EXPECT_FALSE(empty_tlas.is_occluded(ray1, interval));
+}
+
+TEST_F(IntersectionTest, TLASRayPacket) {
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ bvh } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+
+    // a narrow 4x4 fan of rays next to ray1
+    std::vector<SignalTracer::Ray> rays{};
+    for (int i = 0; i < SignalTracer::RayPacket::MAX_SIZE; ++i) {
+        glm::vec3 offset{ (i % 4) * 0.02f + 0.01f, (i / 4) * 0.02f + 0.01f, 0.0f };
+        rays.emplace_back(ray1.get_origin(), ray1.get_direction() + offset);
+    }
+    SignalTracer::RayPacket packet{ rays.data(), static_cast<int>(rays.size()) };
+    EXPECT_TRUE(packet.is_coherent());
+
+    SignalTracer::IntersectRecord records[SignalTracer::RayPacket::MAX_SIZE]{};
+    uint32_t hit_mask = tlas.is_hit(packet, interval, records);
+    for (int i = 0; i < packet.size(); ++i) {
+        SignalTracer::IntersectRecord single_record{};
+        bool hit = tlas.is_hit(rays[i], interval, single_record);
+        EXPECT_EQ(hit, ((hit_mask >> i) & 1u) != 0);
+        EXPECT_EQ(single_record.prim_id, records[i].prim_id);
+        EXPECT_FLOAT_EQ(single_record.t, records[i].t);
+    }
+    EXPECT_NE(hit_mask, 0u);
+}
+
+TEST_F(IntersectionTest, TLASTransformedInstance) {
+    // non-uniform scale and translation, against a BVH over the transformed triangles
+    glm::mat4 transform{ 1.0f };
+    transform[0][0] = 2.0f;
+    transform[1][1] = 3.0f;
+    transform[3] = glm::vec4{ 5.0f, 1.0f, 0.0f, 1.0f };
+    auto to_world = [&](const glm::vec3& p) { return glm::vec3(transform * glm::vec4(p, 1.0f)); };
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> world_triangles{
+        std::make_shared<SignalTracer::Triangle>(to_world(p1), to_world(p2), to_world(p3), p_material),
+        std::make_shared<SignalTracer::Triangle>(to_world(p4), to_world(p2), to_world(p3), p_material),
+    };
+    SignalTracer::BVHAccel world_bvh{ world_triangles, 0, world_triangles.size() };
+
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ bvh, transform } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+
+    glm::vec3 origin{ 6.0f, 2.0f, 8.0f };
+    std::vector<SignalTracer::Ray> rays{};
+    for (const auto& triangle : world_triangles) {
+        rays.emplace_back(origin, triangle->get_centroid() - origin);
+    }
+    rays.emplace_back(origin, glm::vec3{ 0.0f, 1.0f, 0.0f });
+    for (const auto& ray : rays) {
+        SignalTracer::IntersectRecord instance_record{};
+        SignalTracer::IntersectRecord world_record{};
+        bool hit = tlas.is_hit(ray, interval, instance_record);
+        EXPECT_EQ(hit, world_bvh.is_hit(ray, interval, world_record));
+        EXPECT_EQ(tlas.is_occluded(ray, interval), hit);
+        if (!hit) { continue; }
+        EXPECT_EQ(instance_record.prim_id, world_record.prim_id);
+        EXPECT_NEAR(instance_record.t, world_record.t, 1e-4f);
+        for (int axis = 0; axis < 3; ++axis) {
+            EXPECT_NEAR(instance_record.point[axis], world_record.point[axis], 1e-4f);
+            EXPECT_NEAR(instance_record.normal[axis], world_record.normal[axis], 1e-4f);
+        }
+    }
+
+    // the interval is in world distances, the first centroid is about 8 away
+    SignalTracer::IntersectRecord short_record{};
+    EXPECT_FALSE(tlas.is_hit(rays[0], SignalTracer::Interval{ 0.0f, 7.0f }, short_record));
+    EXPECT_TRUE(tlas.is_hit(rays[0], SignalTracer::Interval{ 0.0f, 9.0f }, short_record));
+}
+
+TEST_F(IntersectionTest, FootprintGridMatchesTLAS) {
+    // a ground quad and a row of box buildings placed twice, the second copy moved along x
+    auto quad = [&](std::vector<std::shared_ptr<SignalTracer::Triangle>>& tris, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d) {
+        tris.emplace_back(std::make_shared<SignalTracer::Triangle>(a, b, c, p_material));
+        tris.emplace_back(std::make_shared<SignalTracer::Triangle>(a, c, d, p_material));
+    };
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> ground{};
+    quad(ground, { -20.0f, 0.0f, -20.0f }, { -20.0f, 0.0f, 20.0f }, { 40.0f, 0.0f, 20.0f }, { 40.0f, 0.0f, -20.0f });
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> buildings{};
+    for (int i = 0; i < 4; ++i) {
+        glm::vec3 lo{ i * 5.0f - 10.0f, 0.0f, -2.0f + i };
+        glm::vec3 hi{ lo.x + 3.0f, 4.0f + 3.0f * i, lo.z + 3.0f };
+        quad(buildings, { lo.x, lo.y, lo.z }, { hi.x, lo.y, lo.z }, { hi.x, hi.y, lo.z }, { lo.x, hi.y, lo.z });
+        quad(buildings, { lo.x, lo.y, hi.z }, { lo.x, hi.y, hi.z }, { hi.x, hi.y, hi.z }, { hi.x, lo.y, hi.z });
+        quad(buildings, { lo.x, lo.y, lo.z }, { lo.x, hi.y, lo.z }, { lo.x, hi.y, hi.z }, { lo.x, lo.y, hi.z });
+        quad(buildings, { hi.x, lo.y, lo.z }, { hi.x, lo.y, hi.z }, { hi.x, hi.y, hi.z }, { hi.x, hi.y, lo.z });
+        quad(buildings, { lo.x, hi.y, lo.z }, { hi.x, hi.y, lo.z }, { hi.x, hi.y, hi.z }, { lo.x, hi.y, hi.z });
+    }
+    auto ground_bvh = std::make_shared<SignalTracer::BVHAccel>(ground, 0, ground.size(), 0);
+    auto building_bvh = std::make_shared<SignalTracer::BVHAccel>(buildings, 0, buildings.size(), 1);
+    glm::mat4 shift{ 1.0f };
+    shift[3] = glm::vec4{ 22.0f, 0.0f, 5.0f, 1.0f };
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ ground_bvh }, SignalTracer::BVHInstance{ building_bvh },
+        SignalTracer::BVHInstance{ building_bvh, shift } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+
+    EXPECT_TRUE(SignalTracer::FootprintGrid::is_2_5d(instances));
+    SignalTracer::FootprintGrid grid{};
+    ASSERT_TRUE(grid.build(instances, 2.5f));
+    EXPECT_TRUE(grid.is_built());
+    EXPECT_EQ(grid.get_stats().triangle_count, ground.size() + 2 * buildings.size());
+
+    // rays from street level and from above the roofs, in every direction
+    std::mt19937 rng{ 7 };
+    std::uniform_real_distribution<float> unit{ -1.0f, 1.0f };
+    for (int i = 0; i < 2000; ++i) {
+        glm::vec3 origin{ 10.0f + 25.0f * unit(rng), i % 2 == 0 ? 1.5f : 20.0f, 15.0f * unit(rng) };
+        SignalTracer::Ray ray{ origin, glm::normalize(glm::vec3{ unit(rng), unit(rng), unit(rng) }) };
+        SignalTracer::IntersectRecord tlas_record{};
+        SignalTracer::IntersectRecord grid_record{};
+        bool hit = tlas.is_hit(ray, interval, tlas_record);
+        ASSERT_EQ(grid.is_hit(ray, interval, grid_record), hit);
+        EXPECT_EQ(grid.is_occluded(ray, interval), hit);
+        if (!hit) { continue; }
+        EXPECT_NEAR(grid_record.t, tlas_record.t, 1e-3f);
+        EXPECT_EQ(grid_record.blas_id, tlas_record.blas_id);
+        EXPECT_NEAR(glm::dot(grid_record.normal, tlas_record.normal), 1.0f, 1e-4f);
+    }
+
+    // the line of sight over a building is open, through it is blocked
+    EXPECT_FALSE(grid.is_segment_occluded(glm::vec3{ -12.0f, 5.0f, -0.5f }, glm::vec3{ -5.0f, 5.0f, -0.5f }));
+    EXPECT_TRUE(grid.is_segment_occluded(glm::vec3{ -12.0f, 2.0f, -0.5f }, glm::vec3{ -5.0f, 2.0f, -0.5f }));
+}
+
+TEST_F(IntersectionTest, RayBVHHeightfield) {
+    // rolling terrain, stored as big-endian 16-bit samples of half a unit
+    SignalTracer::HeightfieldDesc desc{};
+    desc.width = 33;
+    desc.depth = 25;
+    desc.format = SignalTracer::HeightFormat::Int16;
+    desc.big_endian = true;
+    desc.origin = glm::vec3{ -5.0f, 1.0f, -4.0f };
+    desc.spacing = glm::vec2{ 1.0f, 1.5f };
+    desc.height_scale = 0.5f;
+    std::string path = (std::filesystem::temp_directory_path() / "signal_tracer_dem_test.raw").string();
+    {
+        std::ofstream out{ path, std::ios::binary };
+        for (uint32_t z = 0; z < desc.depth; ++z) {
+            for (uint32_t x = 0; x < desc.width; ++x) {
+                int16_t sample = static_cast<int16_t>(std::lround(6.0 * std::sin(x * 0.3) * std::cos(z * 0.4) + 0.2 * x));
+                char bytes[2]{ static_cast<char>((sample >> 8) & 0xff), static_cast<char>(sample & 0xff) };
+                out.write(bytes, 2);
+            }
+        }
+    }
+    std::shared_ptr<SignalTracer::Heightfield> heightfield{ SignalTracer::Heightfield::load_raw(path, desc) };
+    std::filesystem::remove(path);
+    ASSERT_NE(heightfield, nullptr);
+    EXPECT_FLOAT_EQ(heightfield->get_height(5, 0), 1.0f + 0.5f * std::lround(6.0 * std::sin(1.5) + 1.0));
+    EXPECT_EQ(heightfield->get_triangle_count(), 2u * 32u * 24u);
+    EXPECT_EQ(heightfield->get_level_count(), 6u);
+
+    // the same terrain as triangles
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    for (uint32_t prim = 0; prim < heightfield->get_triangle_count(); ++prim) {
+        glm::vec3 a{};
+        glm::vec3 b{};
+        glm::vec3 c{};
+        heightfield->get_triangle(prim, a, b, c);
+        EXPECT_GT(glm::cross(b - a, c - a).y, 0.0f);
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(a, b, c, p_material));
+    }
+    SignalTracer::BVHAccel mesh_bvh{ triangles, 0, triangles.size() };
+    auto terrain_bvh = std::make_shared<SignalTracer::BVHAccel>(heightfield, 3);
+    EXPECT_TRUE(terrain_bvh->is_heightfield());
+    EXPECT_EQ(terrain_bvh->get_triangle_count(), triangles.size());
+    EXPECT_LT(terrain_bvh->memory_usage(), mesh_bvh.memory_usage());
+    EXPECT_EQ(terrain_bvh->get_mat_id(0), SignalTracer::MaterialPalette::MEDIUM_DRY_GROUND);
+
+    // steep and grazing rays from above and from inside the valleys
+    std::mt19937 rng{ 11 };
+    std::uniform_real_distribution<float> unit{ -1.0f, 1.0f };
+    for (int i = 0; i < 2000; ++i) {
+        glm::vec3 origin{ 12.0f + 20.0f * unit(rng), i % 2 == 0 ? 12.0f : 2.0f, 14.0f + 20.0f * unit(rng) };
+        glm::vec3 direction{ unit(rng), i % 2 == 0 ? -std::fabs(unit(rng)) : 0.2f * unit(rng), unit(rng) };
+        SignalTracer::Ray ray{ origin, glm::normalize(direction) };
+        SignalTracer::IntersectRecord mesh_record{};
+        SignalTracer::IntersectRecord terrain_record{};
+        bool hit = mesh_bvh.is_hit(ray, interval, mesh_record);
+        ASSERT_EQ(terrain_bvh->is_hit(ray, interval, terrain_record), hit);
+        EXPECT_EQ(terrain_bvh->is_occluded(ray, interval), hit);
+        if (!hit) { continue; }
+        EXPECT_NEAR(terrain_record.t, mesh_record.t, 1e-3f);
+        EXPECT_EQ(terrain_record.blas_id, 3u);
+        EXPECT_NEAR(glm::dot(terrain_record.normal, mesh_record.normal), 1.0f, 1e-4f);
+    }
+
+    // a building on the terrain under one TLAS, the terrain moved by an instance transform
+    glm::mat4 shift{ 1.0f };
+    shift[3] = glm::vec4{ 100.0f, 0.0f, 0.0f, 1.0f };
+    std::vector<SignalTracer::BVHInstance> instances{ SignalTracer::BVHInstance{ terrain_bvh, shift }, SignalTracer::BVHInstance{ bvh } };
+    SignalTracer::TLAS tlas{ instances, static_cast<uint>(instances.size()) };
+    tlas.build();
+    SignalTracer::Ray down{ glm::vec3{ 110.25f, 50.0f, 5.25f }, glm::vec3{ 0.0f, -1.0f, 0.0f } };
+    SignalTracer::Ray down_local{ glm::vec3{ 10.25f, 50.0f, 5.25f }, glm::vec3{ 0.0f, -1.0f, 0.0f } };
+    SignalTracer::IntersectRecord world_record{};
+    SignalTracer::IntersectRecord local_record{};
+    ASSERT_TRUE(tlas.is_hit(down, interval, world_record));
+    ASSERT_TRUE(terrain_bvh->is_hit(down_local, interval, local_record));
+    EXPECT_EQ(world_record.blas_id, 3u);
+    EXPECT_EQ(world_record.prim_id, local_record.prim_id);
+    EXPECT_NEAR(world_record.point.x, 110.25f, 1e-4f);
+    EXPECT_NEAR(world_record.point.y, local_record.point.y, 1e-4f);
+    EXPECT_TRUE(tlas.is_hit(ray1, interval, world_record));
+    EXPECT_EQ(world_record.blas_id, bvh->get_blas_id());
+}
+
+TEST(ModelPartitionTest, ConnectedComponents) {
+    // two triangles sharing an edge by index, a quad whose corners are repeated vertices, a lone triangle
+    std::vector<glm::vec3> positions{
+        { 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 1.0f, 1.0f, 0.0f },
+        { 5.0f, 0.0f, 0.0f }, { 6.0f, 0.0f, 0.0f }, { 5.0f, 1.0f, 0.0f },
+        { 6.0f, 0.0f, 0.0f }, { 6.0f, 1.0f, 0.0f }, { 5.0f, 1.0f, 0.0f },
+        { 9.0f, 0.0f, 0.0f }, { 9.0f, 1.0f, 0.0f }, { 9.0f, 0.0f, 1.0f },
+    };
+    std::vector<unsigned int> indices{ 0, 1, 2, 1, 3, 2, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+    std::vector<uint32_t> labels{};
+    EXPECT_EQ(SignalTracer::label_components(positions, indices, labels), 3u);
+    EXPECT_EQ(labels, (std::vector<uint32_t>{ 0, 0, 1, 1, 2 }));
+}
+
+TEST_F(IntersectionTest, RayBVHDeepAxisParallel) {
+    // exponentially spaced walls, a SAH split peels off one wall per level
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    const int wall_count{ 120 };
+    for (int k = 0; k < wall_count; ++k) {
+        float x = std::ldexp(1.0f, k);
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(glm::vec3{ x, -1.0f, -1.0f }, glm::vec3{ x, 1.0f, -1.0f }, glm::vec3{ x, 0.0f, 1.0f }));
+    }
+    for (auto builder : { SignalTracer::BVHBuilder::Sequential, SignalTracer::BVHBuilder::ParallelBinned, SignalTracer::BVHBuilder::Linear }) {
+        SignalTracer::BVHBuildOptions options{};
+        options.builder = builder;
+        options.treelet_passes = 2;
+        SignalTracer::BVHAccel deep{ triangles, 0, triangles.size(), 0, options };
+        EXPECT_LE(deep.get_build_stats().max_depth, SignalTracer::BVH_MAX_DEPTH);
+
+        // rays along x are parallel to the y and z slabs
+        for (int k = 0; k < wall_count; k += 7) {
+            float x = std::ldexp(1.0f, k);
+            SignalTracer::Ray ray{ glm::vec3{ 0.75f * x, 0.0f, 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+            SignalTracer::Interval ray_interval{ 0.0f, Constant::INF_POS };
+            SignalTracer::IntersectRecord deep_record{};
+            ASSERT_TRUE(deep.is_hit(ray, ray_interval, deep_record)) << "wall " << k;
+            EXPECT_EQ(deep_record.prim_id, static_cast<uint32_t>(k));
+            EXPECT_FLOAT_EQ(deep_record.t, 0.25f * x);
+            EXPECT_TRUE(deep.is_occluded(ray, ray_interval));
+        }
+        SignalTracer::Ray miss{ glm::vec3{ 0.5f, 2.0f, 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+        SignalTracer::IntersectRecord miss_record{};
+        EXPECT_FALSE(deep.is_hit(miss, SignalTracer::Interval{ 0.0f, Constant::INF_POS }, miss_record));
+    }
+
+#if defined(SIGNAL_TRACER_X86)
+    // a box beside the ray on an axis it is parallel to is culled, not kept by a NaN slab
+    if (SIMD::has_avx2()) {
+        SignalTracer::WideBVHNode<8> node{};
+        node.set_lane(0, glm::vec3{ 0.0f, -1.0f, -1.0f }, glm::vec3{ 1.0f, 1.0f, 1.0f }, 0, 1);
+        node.set_lane(1, glm::vec3{ 0.0f, 1.5f, -1.0f }, glm::vec3{ 1.0f, 2.0f, 1.0f }, 0, 1);
+        node.set_lane(2, glm::vec3{ 0.0f, -1.0f, 3.0f }, glm::vec3{ 1.0f, 1.0f, 4.0f }, 0, 1);
+        SignalTracer::Ray ray{ glm::vec3{ -1.0f, 0.0f, 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+        SignalTracer::AVX2Slab slab{ ray.get_origin(), ray.get_rdirection() };
+        alignas(32) float dist[8];
+        EXPECT_EQ(slab.test(node, 0.0f, Constant::INF_POS, dist), 1u);
+        EXPECT_FLOAT_EQ(dist[0], 1.0f);
+    }
+#endif
+}
+
+TEST_F(IntersectionTest, RayBVHLeafFill) {
+    // small triangles scattered in a cube, the binned builders should fill their triangle blocks like SBVH does
+    std::mt19937 rng{ 3 };
+    std::uniform_real_distribution<float> position{ -50.0f, 50.0f };
+    std::uniform_real_distribution<float> offset{ -0.5f, 0.5f };
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{};
+    for (int i = 0; i < 8000; ++i) {
+        glm::vec3 a{ position(rng), position(rng), position(rng) };
+        triangles.emplace_back(std::make_shared<SignalTracer::Triangle>(a, a + glm::vec3{ offset(rng), offset(rng), offset(rng) }, a + glm::vec3{ offset(rng), offset(rng), offset(rng) }));
+    }
+    SignalTracer::BVHBuildOptions reference_options{};
+    reference_options.builder = SignalTracer::BVHBuilder::SpatialSplit;
+    SignalTracer::BVHAccel reference{ triangles, 0, triangles.size(), 0, reference_options };
+    for (auto builder : { SignalTracer::BVHBuilder::Sequential, SignalTracer::BVHBuilder::ParallelBinned }) {
+        SignalTracer::BVHBuildOptions options{};
+        options.builder = builder;
+        SignalTracer::BVHAccel binned{ triangles, 0, triangles.size(), 0, options };
+        const SignalTracer::BVHBuildStats& stats = binned.get_build_stats();
+        EXPECT_GT(stats.leaf_fill, 0.6f);
+        EXPECT_LE(stats.sah_cost, 1.1f * reference.get_build_stats().sah_cost);
+
+        for (int i = 0; i < 64; ++i) {
+            SignalTracer::Ray ray{ glm::vec3{ 0.0f }, glm::vec3{ position(rng), position(rng), position(rng) } };
+            SignalTracer::IntersectRecord binned_record{}, reference_record{};
+            bool binned_hit = binned.is_hit(ray, interval, binned_record);
+            EXPECT_EQ(binned_hit, reference.is_hit(ray, interval, reference_record));
+            if (binned_hit) { EXPECT_FLOAT_EQ(binned_record.t, reference_record.t); }
+        }
+    }
+}
+
+TEST_F(IntersectionTest, BVHCopyIsIndependent) {
+    // a copied tracer copies its BLASes, moving the geometry of the copy leaves the original in place
+    SignalTracer::BVHAccel copy{ *bvh };
+    SignalTracer::IntersectRecord copy_record{};
+    ASSERT_TRUE(copy.is_hit(ray1, interval, copy_record));
+    EXPECT_FLOAT_EQ(copy_record.t, 2.0f);
+
+    glm::vec3 shift{ 0.0f, 0.0f, -1.0f };
+    std::vector<std::shared_ptr<SignalTracer::Triangle>> moved{
+        std::make_shared<SignalTracer::Triangle>(p1 + shift, p2 + shift, p3 + shift, p_material),
+        std::make_shared<SignalTracer::Triangle>(p4 + shift, p2 + shift, p3 + shift, p_material),
+    };
+    copy.set_geometry(moved);
+    copy.refit();
+    copy_record = SignalTracer::IntersectRecord{};
+    ASSERT_TRUE(copy.is_hit(ray1, interval, copy_record));
+    EXPECT_FLOAT_EQ(copy_record.t, 3.0f);
+    SignalTracer::IntersectRecord original_record{};
+    ASSERT_TRUE(bvh->is_hit(ray1, interval, original_record));
+    EXPECT_FLOAT_EQ(original_record.t, 2.0f);
+    EXPECT_EQ(copy.get_palette(), bvh->get_palette());
+}
+
 TEST_F(IntersectionTest, EmptyBVH) {
     std::vector<std::shared_ptr<SignalTracer::Triangle>> triangles{  };
     std::shared_ptr<SignalTracer::BVHAccel> empty_bvh = std::make_shared<SignalTracer::BVHAccel>(triangles, 0, triangles.size());
@@ -5,6 +5,8 @@
 
 #include "intersect_test_class.hpp"
 #include "triangle.hpp"
+#include "triangle_block.hpp"
+#include "triangle_store.hpp"
 #include "glm/glm.hpp"
 #include "ray.hpp"
 #include <gtest/gtest.h>
@@ -99,4 +101,40 @@ TEST_F(IntersectionTest, RayTriangle3ShortInterval) {
     EXPECT_FALSE(hit18);
 }
 
+TEST_F(IntersectionTest, RayTransformBlock) {
+    // the precomputed leaf transforms agree with the Moller-Trumbore test of the triangles
+    SignalTracer::TriangleStore store{};
+    store.add(triangle1->a(), triangle1->b(), triangle1->c());
+    store.add(triangle2->a(), triangle2->b(), triangle2->c());
+    const uint32_t prims[2]{ 0, 1 };
+    std::vector<SignalTracer::Ray> rays{
+        SignalTracer::Ray{ glm::vec3{ 0.25f, 0.25f, 2.0f }, glm::vec3{ 0.0f, 0.0f, -1.0f } },
+        SignalTracer::Ray{ glm::vec3{ 0.25f, 0.25f, -2.0f }, glm::vec3{ 0.0f, 0.0f, 1.0f } },
+        SignalTracer::Ray{ glm::vec3{ 0.2f, 1.5f, -5.0f }, glm::normalize(glm::vec3{ 0.1f, 0.3f, 1.0f }) },
+        SignalTracer::Ray{ glm::vec3{ 5.0f, 5.0f, 5.0f }, glm::normalize(glm::vec3{ 0.2f, 0.3f, 0.0f } - glm::vec3{ 5.0f }) },
+        SignalTracer::Ray{ glm::vec3{ 2.0f, 2.0f, 1.0f }, glm::vec3{ 0.0f, 0.0f, -1.0f } },
+        ray3,
+    };
+    for (int width : { 4, 8 }) {
+        SignalTracer::TriangleBlocks blocks{};
+        blocks.reset(width);
+        uint32_t first = blocks.add_leaf(store, prims, 2);
+        for (const SignalTracer::Ray& ray : rays) {
+            SignalTracer::IntersectRecord record1{}, record2{};
+            bool hit1 = triangle1->is_hit(ray, interval, record1);
+            bool hit2 = triangle2->is_hit(ray, interval, record2);
+            float t{};
+            uint32_t prim_id{ Constant::INVALID_IDX };
+            bool hit = blocks.intersect(first, blocks.get_block_count(2), ray, interval, t, prim_id);
+            EXPECT_EQ(hit, hit1 || hit2);
+            EXPECT_EQ(blocks.occluded(first, blocks.get_block_count(2), ray, interval), hit);
+            if (hit) {
+                bool first_nearer = hit1 && (!hit2 || record1.t <= record2.t);
+                EXPECT_EQ(prim_id, first_nearer ? 0u : 1u);
+                EXPECT_NEAR(t, first_nearer ? record1.t : record2.t, 1e-4f);
+            }
+        }
+    }
+}
+
 #endif // !INTERSECTION_TRIANGLE_TEST_HPP
\ No newline at end of file
@@ -4,7 +4,9 @@
 #define RAY_TEST_HPP
 
 #include "ray.hpp"
+#include "ray_sorter.hpp"
 #include <gtest/gtest.h>
+#include <vector>
 
 /*
     ----------------------------------------
@@ -57,5 +59,27 @@ TEST(RayTest, RayMoveAssignmentOperator) {
     EXPECT_EQ(ray2.get_direction(), direction);
 }
 
+TEST(RayTest, RaySorterOrder) {
+    SignalTracer::AABB scene_box{ glm::vec3{ -10.0f }, glm::vec3{ 10.0f } };
+    SignalTracer::RaySorter sorter{ scene_box };
+    std::vector<SignalTracer::Ray> rays{};
+    std::vector<int> ray_ids{};
+    for (int i = 0; i < 100; ++i) {
+        float x = static_cast<float>((i * 37) % 100) * 0.2f - 10.0f;
+        rays.emplace_back(glm::vec3{ x, 0.0f, 0.0f }, glm::vec3{ i % 2 ? 1.0f : -1.0f, 0.5f, 0.0f });
+        ray_ids.emplace_back(i);
+    }
+    sorter.sort(rays, ray_ids);
+
+    ASSERT_EQ(ray_ids.size(), rays.size());
+    std::vector<bool> seen(rays.size(), false);
+    for (std::size_t k = 0; k < ray_ids.size(); ++k) {
+        EXPECT_FALSE(seen[ray_ids[k]]);
+        seen[ray_ids[k]] = true;
+        if (k > 0) {
+            EXPECT_LE(sorter.calc_key(rays[ray_ids[k - 1]]), sorter.calc_key(rays[ray_ids[k]]));
+        }
+    }
+}
 
 #endif // !RAY_TEST_HPP
\ No newline at end of file